@@ -0,0 +1,133 @@
+#include "Programs.h"
+
+namespace optimix {
+namespace bench {
+
+// Every program keeps its values small: the language has no modulo and
+// signed overflow must not happen in the interpreters.
+
+Program deepLoops(int scale) {
+  std::string n = std::to_string(20 * scale);
+  return {"deep_loops",
+          "int main() {\n"
+          "  int acc = 0;\n"
+          "  int i = 0;\n"
+          "  while (i < " + n + ") {\n"
+          "    int j = 0;\n"
+          "    while (j < " + n + ") {\n"
+          "      int k = 0;\n"
+          "      while (k < 20) {\n"
+          "        acc = acc + i - j + k * 2 - k;\n"
+          "        acc = acc - k;\n"
+          "        k = k + 1;\n"
+          "      }\n"
+          "      j = j + 1;\n"
+          "    }\n"
+          "    acc = acc - i * 20 + i * 20;\n"
+          "    i = i + 1;\n"
+          "  }\n"
+          "  return acc;\n"
+          "}\n"};
+}
+
+Program largeArrays(int scale) {
+  std::string n = std::to_string(10000 * scale);
+  return {"large_arrays",
+          "int main() {\n"
+          "  int data[" + n + "];\n"
+          "  int i = 0;\n"
+          "  while (i < " + n + ") {\n"
+          "    data[i] = i - i / 2 * 2;\n"
+          "    i = i + 1;\n"
+          "  }\n"
+          "  int total = 0;\n"
+          "  int pass = 0;\n"
+          "  while (pass < 8) {\n"
+          "    int j = 0;\n"
+          "    while (j < " + n + ") {\n"
+          "      total = total + data[j];\n"
+          "      data[j] = 1 - data[j];\n"
+          "      j = j + 1;\n"
+          "    }\n"
+          "    total = total - " + n + " / 2;\n"
+          "    pass = pass + 1;\n"
+          "  }\n"
+          "  return total;\n"
+          "}\n"};
+}
+
+Program matrixColumns(int scale) {
+  std::string rows = std::to_string(256 * scale);
+  return {"matrix_columns",
+          "int main() {\n"
+          "  int rows = " + rows + ";\n"
+          "  int cols = 512;\n"
+          "  int a[rows][cols];\n"
+          "  int b[cols][rows];\n"
+          "  int j = 0;\n"
+          "  while (j < cols) {\n"
+          "    int i = 0;\n"
+          "    while (i < rows) {\n"
+          "      a[i][j] = i - j;\n"
+          "      i = i + 1;\n"
+          "    }\n"
+          "    j = j + 1;\n"
+          "  }\n"
+          "  int c = 0;\n"
+          "  while (c < cols) {\n"
+          "    int r = 0;\n"
+          "    while (r < rows) {\n"
+          "      b[c][r] = a[r][c];\n"
+          "      r = r + 1;\n"
+          "    }\n"
+          "    c = c + 1;\n"
+          "  }\n"
+          "  int total = 0;\n"
+          "  int y = 0;\n"
+          "  while (y < rows) {\n"
+          "    int x = 0;\n"
+          "    while (x < cols) {\n"
+          "      total = total + b[x][y];\n"
+          "      x = x + 1;\n"
+          "    }\n"
+          "    y = y + 1;\n"
+          "  }\n"
+          "  return total;\n"
+          "}\n"};
+}
+
+Program manyFunctions(int scale) {
+  std::string source;
+  int count = 200 * scale;
+  for (int f = 0; f < count; ++f) {
+    std::string n = std::to_string(f % 97);
+    source += "int f" + std::to_string(f) +
+              "(int x) {\n"
+              "  int i = 0;\n"
+              "  int s = " + n + ";\n"
+              "  int buf[16];\n"
+              "  while (i < 16) {\n"
+              "    buf[i] = s + i * " + n + ";\n"
+              "    s = s + buf[i] - i * " + n + " - s / 2;\n"
+              "    i = i + 1;\n"
+              "  }\n"
+              "  return s;\n"
+              "}\n";
+  }
+  source += "int main() {\n"
+            "  int i = 0;\n"
+            "  while (i < 1000) {\n"
+            "    i = i + 1;\n"
+            "  }\n"
+            "  return i;\n"
+            "}\n";
+  return {"many_functions", source};
+}
+
+std::vector<Program> allPrograms(int scale) {
+  return {deepLoops(scale), largeArrays(scale), matrixColumns(scale),
+          manyFunctions(scale)};
+}
+
+} // namespace bench
+} // namespace optimix
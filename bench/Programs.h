@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace optimix {
+namespace bench {
+
+// A synthetic .optx program. 'scale' grows the amount of work linearly.
+struct Program {
+  std::string name;
+  std::string source;
+};
+
+// Three nested counting loops around an arithmetic body.
+Program deepLoops(int scale);
+// Fills a large array, then sums it over several passes.
+Program largeArrays(int scale);
+// Walks matrices along their columns and transposes one.
+Program matrixColumns(int scale);
+// Many small functions with loops; stresses the front end and pass manager.
+Program manyFunctions(int scale);
+
+std::vector<Program> allPrograms(int scale);
+
+} // namespace bench
+} // namespace optimix
@@ -0,0 +1,264 @@
+// Throughput benchmarks for each compiler stage, run over scaled-up
+// synthetic programs. Results go to stdout as a table and to a JSON file so
+// they can be compared across releases:
+//
+//   optimix_bench [--scale n] [--min-time seconds] [--filter substr]
+//                 [--out results.json] [--emit-programs dir]
+
+#include "Programs.h"
+#include "optimix/codegen/IRInterpreter.h"
+#include "optimix/ir/IRBuilder.h"
+#include "optimix/ir/SSA.h"
+#include "optimix/lexer/Lexer.h"
+#include "optimix/parser/Parser.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace optimix;
+
+namespace {
+
+struct Result {
+  std::string name;   // "<stage>/<program>"
+  std::string unit;   // What 'value' measures
+  double value;       // Higher is better unless the unit is a time
+  double seconds;     // Best time of one iteration
+  int iterations;
+};
+
+// Runs 'body' until 'minTime' has elapsed (at least three times) and returns
+// the fastest single iteration, which is the least noisy estimate.
+double timeBest(double minTime, int &iterations,
+                const std::function<void()> &body) {
+  using Clock = std::chrono::steady_clock;
+  double best = 1e30, total = 0;
+  iterations = 0;
+  while (iterations < 3 || total < minTime) {
+    auto begin = Clock::now();
+    body();
+    double s = std::chrono::duration<double>(Clock::now() - begin).count();
+    best = std::min(best, s);
+    total += s;
+    ++iterations;
+  }
+  return best;
+}
+
+size_t countNodes(const Expr *e) {
+  if (auto *b = dynamic_cast<const BinaryExpr *>(e))
+    return 1 + countNodes(b->left.get()) + countNodes(b->right.get());
+  if (auto *a = dynamic_cast<const ArrayAccessExpr *>(e)) {
+    size_t n = 1;
+    for (const auto &index : a->indices)
+      n += countNodes(index.get());
+    return n;
+  }
+  return e ? 1 : 0;
+}
+
+size_t countNodes(const Stmt *s) {
+  if (auto *v = dynamic_cast<const VarDecl *>(s))
+    return 1 + countNodes(v->init.get());
+  if (auto *a = dynamic_cast<const Assignment *>(s))
+    return 1 + countNodes(a->value.get());
+  if (auto *a = dynamic_cast<const ArrayAssignment *>(s)) {
+    size_t n = 1 + countNodes(a->value.get());
+    for (const auto &index : a->indices)
+      n += countNodes(index.get());
+    return n;
+  }
+  if (auto *r = dynamic_cast<const ReturnStmt *>(s))
+    return 1 + countNodes(r->value.get());
+  if (auto *p = dynamic_cast<const PrintStmt *>(s))
+    return 1 + countNodes(p->value.get());
+  if (auto *w = dynamic_cast<const WhileStmt *>(s)) {
+    size_t n = 1 + countNodes(w->condition.get());
+    for (const auto &b : w->body)
+      n += countNodes(b.get());
+    return n;
+  }
+  return 1;
+}
+
+size_t countNodes(const ProgramAST &program) {
+  size_t n = 1;
+  for (const auto &f : program.functions) {
+    ++n;
+    for (const auto &s : f->body)
+      n += countNodes(s.get());
+  }
+  return n;
+}
+
+size_t countInstructions(const ir::Module &module) {
+  size_t n = 0;
+  for (const auto &f : module.functions)
+    for (const auto &bb : f->blocks)
+      n += bb->instructions.size();
+  return n;
+}
+
+std::unique_ptr<ProgramAST> parse(const std::string &source) {
+  Lexer lexer(source);
+  Parser parser(lexer);
+  return parser.parseProgram();
+}
+
+void benchProgram(const bench::Program &program, double minTime,
+                  const std::string &filter, std::vector<Result> &results) {
+  auto wanted = [&](const std::string &name) {
+    return filter.empty() || name.find(filter) != std::string::npos;
+  };
+  auto record = [&](const std::string &stage, const std::string &unit,
+                    double value, double seconds, int iterations) {
+    results.push_back({stage + "/" + program.name, unit, value, seconds,
+                       iterations});
+  };
+  int iterations = 0;
+  const std::string &source = program.source;
+
+  if (wanted("lexer/" + program.name)) {
+    size_t tokens = 0;
+    double s = timeBest(minTime, iterations, [&] {
+      Lexer lexer(source);
+      tokens = 0;
+      while (lexer.nextToken().type != TokenType::END_OF_FILE)
+        ++tokens;
+    });
+    record("lexer", "MB/s", source.size() / s / 1e6, s, iterations);
+  }
+
+  auto ast = parse(source);
+  if (wanted("parser/" + program.name)) {
+    size_t nodes = countNodes(*ast);
+    double s = timeBest(minTime, iterations, [&] { parse(source); });
+    record("parser", "nodes/s", nodes / s, s, iterations);
+  }
+
+  size_t instructions = countInstructions(*IRBuilder().generate(*ast));
+  if (wanted("irbuilder/" + program.name)) {
+    double s = timeBest(minTime, iterations,
+                        [&] { IRBuilder().generate(*ast); });
+    record("irbuilder", "us/1k inst", s * 1e6 / instructions * 1000, s,
+           iterations);
+  }
+
+  if (wanted("ssa/" + program.name)) {
+    // SSA rewrites the module in place, so every iteration gets a fresh
+    // copy; only the pass itself is timed.
+    using Clock = std::chrono::steady_clock;
+    double best = 1e30, total = 0;
+    iterations = 0;
+    ir::SSAPass ssa;
+    while (iterations < 3 || total < minTime) {
+      auto module = IRBuilder().generate(*ast);
+      auto begin = Clock::now();
+      for (auto &f : module->functions)
+        ssa.run(*f);
+      double s = std::chrono::duration<double>(Clock::now() - begin).count();
+      best = std::min(best, s);
+      total += s;
+      ++iterations;
+    }
+    record("ssa", "us/1k inst", best * 1e6 / instructions * 1000, best,
+           iterations);
+  }
+
+  if (wanted("interpreter/" + program.name)) {
+    auto module = IRBuilder().generate(*ast);
+    ir::SSAPass ssa;
+    for (auto &f : module->functions)
+      ssa.run(*f);
+    const ir::Function *entry = module->getFunction("main");
+    IRInterpreter interpreter;
+    uint64_t executed = 0;
+    double s = timeBest(minTime, iterations, [&] {
+      ExecState state;
+      interpreter.execute(*entry, state);
+      executed = interpreter.executedCount();
+    });
+    record("interpreter", "inst/s", executed / s, s, iterations);
+  }
+}
+
+void writeJson(std::ostream &os, const std::vector<Result> &results,
+               int scale) {
+  os << "{\n  \"version\": \"" OPTIMIX_VERSION "\",\n"
+     << "  \"scale\": " << scale << ",\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    char line[256];
+    std::snprintf(line, sizeof(line),
+                  "    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.6g, "
+                  "\"seconds\": %.6g, \"iterations\": %d}",
+                  r.name.c_str(), r.unit.c_str(), r.value, r.seconds,
+                  r.iterations);
+    os << line << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  os << "  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int scale = 1;
+  double minTime = 0.2;
+  std::string filter, out = "bench_results.json", emitDir;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--scale" && i + 1 < argc) {
+      scale = std::stoi(argv[++i]);
+    } else if (arg == "--min-time" && i + 1 < argc) {
+      minTime = std::stod(argv[++i]);
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--out" && i + 1 < argc) {
+      out = argv[++i];
+    } else if (arg == "--emit-programs" && i + 1 < argc) {
+      emitDir = argv[++i];
+    } else {
+      std::cerr << "Usage: optimix_bench [--scale n] [--min-time s] "
+                   "[--filter substr] [--out file.json] "
+                   "[--emit-programs dir]\n";
+      return 1;
+    }
+  }
+
+  auto programs = bench::allPrograms(scale);
+  if (!emitDir.empty()) {
+    // Lets the same inputs be fed to `optimix compile` / `optimix run`.
+    for (const auto &p : programs)
+      std::ofstream(emitDir + "/" + p.name + ".optx") << p.source;
+  }
+
+  std::vector<Result> results;
+  try {
+    for (const auto &p : programs)
+      benchProgram(p, minTime, filter, results);
+  } catch (const std::exception &e) {
+    std::cerr << "Benchmark failed: " << e.what() << "\n";
+    return 1;
+  }
+
+  for (const auto &r : results) {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-32s %14.4g %-10s (%d iterations)",
+                  r.name.c_str(), r.value, r.unit.c_str(), r.iterations);
+    std::cout << line << "\n";
+  }
+
+  std::ofstream json(out);
+  if (!json) {
+    std::cerr << "Error: Cannot write " << out << "\n";
+    return 1;
+  }
+  writeJson(json, results, scale);
+  std::cout << "Wrote " << out << "\n";
+  return 0;
+}
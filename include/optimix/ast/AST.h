@@ -1,6 +1,6 @@
 #pragma once
 
-#include <iostream>
+#include <ostream>
 #include <memory>
 #include <string>
 #include <vector>
@@ -11,7 +11,7 @@ namespace optimix {
 class ASTNode {
 public:
   virtual ~ASTNode() = default;
-  virtual void print(int indent = 0) const = 0;
+  virtual void print(std::ostream &os, int indent = 0) const = 0;
 };
 
 // Expressions
@@ -21,8 +21,8 @@ class NumberExpr : public Expr {
 public:
   int value;
   NumberExpr(int v) : value(v) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "NumberExpr(" << value << ")\n";
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "NumberExpr(" << value << ")\n";
   }
 };
 
@@ -30,8 +30,8 @@ class VariableExpr : public Expr {
 public:
   std::string name;
   VariableExpr(std::string n) : name(std::move(n)) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "VariableExpr(" << name << ")\n";
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "VariableExpr(" << name << ")\n";
   }
 };
 
@@ -42,52 +42,83 @@ public:
   BinaryExpr(std::string o, std::unique_ptr<Expr> l, std::unique_ptr<Expr> r)
       : op(std::move(o)), left(std::move(l)), right(std::move(r)) {}
 
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "BinaryExpr(" << op << ")\n";
-    left->print(indent + 2);
-    right->print(indent + 2);
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "BinaryExpr(" << op << ")\n";
+    left->print(os, indent + 2);
+    right->print(os, indent + 2);
   }
 };
 
+// Arrays are stored row-major: m[i][j] of int m[R][C] is element i * C + j.
+// The extents after the first are kept, from the moment the declaration
+// runs, in hidden variables named by this function ("%m_dim1" holds C), so
+// every tier computes the same flat index. Only that flat index is checked.
+inline std::string arrayExtentName(const std::string &array, size_t dim) {
+  return "%" + array + "_dim" + std::to_string(dim);
+}
+
 class ArrayAccessExpr : public Expr {
 public:
   std::string name;
-  std::unique_ptr<Expr> index;
-  ArrayAccessExpr(std::string n, std::unique_ptr<Expr> i)
-      : name(std::move(n)), index(std::move(i)) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "ArrayAccess(" << name << ")\n";
-    index->print(indent + 2);
+  std::vector<std::unique_ptr<Expr>> indices; // One per dimension
+  ArrayAccessExpr(std::string n, std::vector<std::unique_ptr<Expr>> i)
+      : name(std::move(n)), indices(std::move(i)) {}
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "ArrayAccess(" << name << ")\n";
+    for (const auto &index : indices)
+      index->print(os, indent + 2);
+  }
+};
+
+// name(args...): calls the function of that name in the program; arguments
+// are passed by value.
+class CallExpr : public Expr {
+public:
+  std::string callee;
+  std::vector<std::unique_ptr<Expr>> args;
+  CallExpr(std::string c, std::vector<std::unique_ptr<Expr>> a)
+      : callee(std::move(c)), args(std::move(a)) {}
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "CallExpr(" << callee << ")\n";
+    for (const auto &arg : args)
+      arg->print(os, indent + 2);
   }
 };
 
 // Statements
-class Stmt : public ASTNode {};
+class Stmt : public ASTNode {
+public:
+  int line = 0; // Source line the statement starts on, 0 if unknown
+};
 
 class ArrayDecl : public Stmt {
 public:
   std::string name;
-  int size;
-  ArrayDecl(std::string n, int s) : name(std::move(n)), size(s) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "ArrayDecl(" << name << "[" << size
-              << "])\n";
+  // Extents, outermost first; evaluated each time the declaration runs
+  std::vector<std::unique_ptr<Expr>> dims;
+  ArrayDecl(std::string n, std::vector<std::unique_ptr<Expr>> d)
+      : name(std::move(n)), dims(std::move(d)) {}
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "ArrayDecl(" << name << ")\n";
+    for (const auto &dim : dims)
+      dim->print(os, indent + 2);
   }
 };
 
 class ArrayAssignment : public Stmt {
 public:
   std::string name;
-  std::unique_ptr<Expr> index;
+  std::vector<std::unique_ptr<Expr>> indices; // One per dimension
   std::unique_ptr<Expr> value;
-  ArrayAssignment(std::string n, std::unique_ptr<Expr> i,
+  ArrayAssignment(std::string n, std::vector<std::unique_ptr<Expr>> i,
                   std::unique_ptr<Expr> v)
-      : name(std::move(n)), index(std::move(i)), value(std::move(v)) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "ArrayAssignment(" << name
+      : name(std::move(n)), indices(std::move(i)), value(std::move(v)) {}
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "ArrayAssignment(" << name
               << ")\n";
-    index->print(indent + 2);
-    value->print(indent + 2);
+    for (const auto &index : indices)
+      index->print(os, indent + 2);
+    value->print(os, indent + 2);
   }
 };
 
@@ -95,10 +126,10 @@ class ReturnStmt : public Stmt {
 public:
   std::unique_ptr<Expr> value;
   ReturnStmt(std::unique_ptr<Expr> v) : value(std::move(v)) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "ReturnStmt\n";
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "ReturnStmt\n";
     if (value)
-      value->print(indent + 2);
+      value->print(os, indent + 2);
   }
 };
 
@@ -108,10 +139,10 @@ public:
   std::unique_ptr<Expr> init;
   VarDecl(std::string n, std::unique_ptr<Expr> i)
       : name(std::move(n)), init(std::move(i)) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "VarDecl(" << name << ")\n";
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "VarDecl(" << name << ")\n";
     if (init)
-      init->print(indent + 2);
+      init->print(os, indent + 2);
   }
 };
 
@@ -121,9 +152,9 @@ public:
   std::unique_ptr<Expr> value;
   Assignment(std::string n, std::unique_ptr<Expr> v)
       : name(std::move(n)), value(std::move(v)) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "Assignment(" << name << ")\n";
-    value->print(indent + 2);
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "Assignment(" << name << ")\n";
+    value->print(os, indent + 2);
   }
 };
 
@@ -131,9 +162,9 @@ class PrintStmt : public Stmt {
 public:
   std::unique_ptr<Expr> value;
   PrintStmt(std::unique_ptr<Expr> v) : value(std::move(v)) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "PrintStmt\n";
-    value->print(indent + 2);
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "PrintStmt\n";
+    value->print(os, indent + 2);
   }
 };
 
@@ -143,11 +174,45 @@ public:
   std::vector<std::unique_ptr<Stmt>> body;
   WhileStmt(std::unique_ptr<Expr> c, std::vector<std::unique_ptr<Stmt>> b)
       : condition(std::move(c)), body(std::move(b)) {}
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "WhileStmt\n";
-    condition->print(indent + 2);
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "WhileStmt\n";
+    condition->print(os, indent + 2);
     for (const auto &s : body)
-      s->print(indent + 2);
+      s->print(os, indent + 2);
+  }
+};
+
+// name(args...); for a call whose result is not used.
+class CallStmt : public Stmt {
+public:
+  std::unique_ptr<CallExpr> call;
+  CallStmt(std::unique_ptr<CallExpr> c) : call(std::move(c)) {}
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "CallStmt\n";
+    call->print(os, indent + 2);
+  }
+};
+
+// if (condition) { then } else { otherwise }; 'else if' nests another IfStmt
+// as the only statement of 'otherwise', which is empty without an else.
+class IfStmt : public Stmt {
+public:
+  std::unique_ptr<Expr> condition;
+  std::vector<std::unique_ptr<Stmt>> then;
+  std::vector<std::unique_ptr<Stmt>> otherwise;
+  IfStmt(std::unique_ptr<Expr> c, std::vector<std::unique_ptr<Stmt>> t,
+         std::vector<std::unique_ptr<Stmt>> e)
+      : condition(std::move(c)), then(std::move(t)), otherwise(std::move(e)) {}
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "IfStmt\n";
+    condition->print(os, indent + 2);
+    for (const auto &s : then)
+      s->print(os, indent + 2);
+    if (otherwise.empty())
+      return;
+    os << std::string(indent, ' ') << "Else\n";
+    for (const auto &s : otherwise)
+      s->print(os, indent + 2);
   }
 };
 
@@ -161,12 +226,30 @@ public:
               std::vector<std::unique_ptr<Stmt>> b)
       : name(std::move(n)), args(std::move(a)), body(std::move(b)) {}
 
-  void print(int indent) const override {
-    std::cout << std::string(indent, ' ') << "FunctionAST(" << name << ")\n";
+  void print(std::ostream &os, int indent) const override {
+    os << std::string(indent, ' ') << "FunctionAST(" << name << ")\n";
     for (const auto &stmt : body) {
-      stmt->print(indent + 2);
+      stmt->print(os, indent + 2);
     }
   }
 };
 
+// A translation unit: every function in the source file, in order.
+class ProgramAST : public ASTNode {
+public:
+  std::vector<std::unique_ptr<FunctionAST>> functions;
+
+  const FunctionAST *getFunction(const std::string &name) const {
+    for (const auto &f : functions)
+      if (f->name == name)
+        return f.get();
+    return nullptr;
+  }
+
+  void print(std::ostream &os, int indent) const override {
+    for (const auto &f : functions)
+      f->print(os, indent);
+  }
+};
+
 } // namespace optimix
@@ -1,33 +1,267 @@
 #pragma once
 
 #include "optimix/ir/IR.h"
-#include <map>
+#include "optimix/ir/Profile.h"
+#include "optimix/support/DeepStack.h"
+#include "optimix/support/OutputBuffer.h"
+#include "optimix/support/ThreadPool.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace optimix {
 
+// Named program state exchanged between execution tiers. The AST interpreter
+// hands its variables and arrays over when a hot loop is promoted (on-stack
+// replacement) and takes them back once the IR engine is done.
+struct ExecState {
+  std::unordered_map<std::string, int> variables;
+  std::unordered_map<std::string, std::vector<int>> arrays;
+  bool returned = false; // The function executed a RET
+};
+
 class IRInterpreter {
 public:
   int execute(const ir::Function &function);
+  // Runs 'function' with live-ins taken from 'state' and writes the final
+  // variables/arrays back. Runtime faults are thrown as std::runtime_error.
+  int execute(const ir::Function &function, ExecState &state);
+
+  // Instructions dispatched by the last execute() call.
+  uint64_t executedCount() const { return executed; }
+
+  // While set, every execute() adds its block, branch, opcode and source
+  // line counts to 'profile' (null turns profiling off). Counting uses a
+  // separate copy of the dispatch loop, so unprofiled runs are unaffected.
+  void setProfile(ir::Profile *p) { profile = p; }
+
+  // PRINT writes to 'out' (not flushed by execute()). When unset, each
+  // execute() buffers its output and writes it to std::cout at the end.
+  void setOutput(OutputBuffer *out) { output = out; }
+
+  // Loops marked by ParallelizePass split their iterations into chunks and
+  // run them on 'pool' (null runs them here). Not while profiling. execute()
+  // waits for the pool, so it must not be called from one of its tasks.
+  void setThreadPool(ThreadPool *p) { pool = p; }
+
+  // CALL runs the function of that name in 'module', which must outlive
+  // execute(); without one, a call fails. Each function called is decoded
+  // once per execute() and then runs every call on a fresh frame.
+  void setModule(const ir::Module *m) { module = m; }
+
+  // Nested calls beyond this depth fail instead of overflowing the stack.
+  static constexpr int kMaxCallDepth = 10000;
+  // Stack a call takes at most. Measured: 288 bytes optimized, 608 without
+  // optimization, 1024 with AddressSanitizer.
+  static constexpr size_t kCallStackBytes = 1024 * DeepStack::kFrameScale;
+  // A function that calls runs on a stack this large (see DeepStack), so
+  // kMaxCallDepth calls fit whatever the stack of the caller of execute().
+  static constexpr size_t kStackBytes =
+      kMaxCallDepth * kCallStackBytes + DeepStack::kReserve;
+
+  // execute() fails once it has dispatched more than 'limit' instructions,
+  // calls included (0 = no limit). Runs with a limit use a separate copy of
+  // the dispatch loop and stay sequential, so other runs are unaffected.
+  void setStepLimit(uint64_t limit) { stepLimit = limit; }
 
 private:
-  // Memory for variables (virtual registers)
-  // Since SSA variables are unique, we can just map name -> value
-  std::map<std::string, int> registers;
+  // The function is decoded once into a dense instruction array before it
+  // runs: operands become register slots (constants live in preinitialized
+  // slots), labels become instruction indices, arrays become small ids.
+  enum class Op : uint8_t {
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOV,
+    LT,
+    GT,
+    EQ,
+    NEQ,
+    JMP,
+    JMP_IF,
+    RET,
+    PRINT,
+    ALLOCA,
+    LOAD,
+    STORE,
+    LOAD_UNCHECKED,
+    STORE_UNCHECKED,
+    INBOUNDS,
+    LOAD_UNCHECKED_DYN, // Unchecked, array may move: base looked up by id
+    STORE_UNCHECKED_DYN,
+    SHL,
+    SHR,
+    MULH,
+    SELECT, // dst = a ? b : c
+    PARFOR, // Parallel loop dst of parLoops; its header follows
+    CALL,   // dst = call of callSites[a]
+    PAREND, // JMP out of a parallel loop; ends a chunk (not when profiling)
+    // Superinstructions, formed by fuse() from the sequences that dominate
+    // loops (see fuse()). Each still writes every register the original
+    // sequence wrote, except DIV_MAGIC and ADD_IF.
+    BR_LT, // dst = a < b; jump to pc 'target' if set, else to pc 'c'
+    BR_GT,
+    BR_EQ,
+    BR_NE,
+    ADDI,      // dst = a + b, b an immediate
+    ADDI_MOV,  // c = dst = a + b, b an immediate
+    ADD_MOV,   // c = dst = a + b
+    LOAD_ADD,  // dst = mem[c + a]; target = b + dst
+    LOAD_OFF,  // b = a + target; dst = mem[c + a] (c is base + target)
+    STORE_OFF, // c = a + target; mem[dst + a] = b (dst is base + target)
+    // dst = a / d for the constant d whose magic numbers are b (multiplier),
+    // c (shift) and target (+1/-1: add/subtract a after the multiply). Only
+    // formed when the sequence's temps are read nowhere else.
+    DIV_MAGIC,
+    // dst = a + b if c is nonzero (target 1) or zero (target 0), else a:
+    // ADD t, a, b; SELECT dst, c, t, a (or c, a, t). Only formed when the
+    // sum is read nowhere else.
+    ADD_IF,
+    HALT // Fell off the end of the function
+  };
+
+  // 32 bytes; a wider Inst measurably slows down dispatch, so INBOUNDS keeps
+  // its extra operands in the jump fields. Unchecked accesses hold the
+  // array's base offset where the others hold its id.
+  struct Inst {
+    Op op;
+    int dst = -1;    // Result slot (array id for ALLOCA/STORE)
+    int a = -1;      // First operand slot
+    int b = -1;      // Second operand slot
+    int c = -1;      // Third operand slot / array id for LOAD, INBOUNDS
+    int target = -1; // Destination block for jumps; lo slot for INBOUNDS
+    int block = -1;  // Owning block (predecessor for PHIs); hi for INBOUNDS
+  };
+
+  struct Phi {
+    int dst;
+    std::vector<std::pair<int, int>> incoming; // (pred block, value slot)
+  };
+
+  struct Block {
+    size_t entry = 0; // Index of the first instruction
+    std::vector<Phi> phis;
+  };
+
+  std::vector<Inst> code;
+  std::vector<Block> blocks;
+  std::vector<int> registers;
+  std::vector<std::string> slotNames; // Empty for constant slots
+  std::vector<bool> exported;         // Slot holds a source-level variable
+  std::vector<std::string> arrayNames;
+
+  // Arrays live in one linear region per execute() (the frame), laid out
+  // during decode from the constant ALLOCA sizes and the arrays handed over
+  // in ExecState. Unchecked accesses then decode to base + index. An ALLOCA
+  // of a variable size that does not fit moves its array to the end, so
+  // unchecked accesses to such arrays look the base up at run time.
+  struct Array {
+    int base = 0;
+    int size = 0;     // Elements in use; 0 until allocated
+    int capacity = 0; // Elements reserved at 'base'
+    bool allocated = false;
+    bool fixed = true; // No ALLOCA of a variable size
+  };
+  std::vector<Array> arrays;
+  std::vector<int> memory;
+  uint64_t executed = 0;
+  OutputBuffer *output = nullptr;
+
+  // PARFOR header, iv, end, sums...: the loop entered at block 'header'
+  // counts iv up to end.
+  struct ParLoop {
+    int header;
+    int iv, end;
+    std::vector<int> sums;
+  };
+  std::vector<ParLoop> parLoops;
+  ThreadPool *pool = nullptr;
+
+  // CALL dst, f, args...: the engine of f is looked up on the first call.
+  struct CallSite {
+    const ir::Function *function;
+    std::vector<int> args; // Slots
+    IRInterpreter *callee = nullptr;
+  };
+  std::vector<CallSite> callSites;
+  const ir::Module *module = nullptr;
+  uint64_t stepLimit = 0; // Of the root engine
+  // The engine execute() ran on owns one engine per function called, used
+  // by every caller, and counts the calls in progress.
+  IRInterpreter *root = this;
+  const ir::Function *rootFunction = nullptr;
+  std::unordered_map<const ir::Function *, std::unique_ptr<IRInterpreter>>
+      callees;
+  int callDepth = 0;
+
+  // A call starts from the registers as decoded, with the arguments in the
+  // parameter slots, and from the arrays as laid out, in a memory region of
+  // its own. Frames are kept for reuse, one per level of recursion.
+  std::vector<int> params;
+  std::vector<int> initialRegisters;
+  std::vector<Array> arrayLayout;
+  size_t frameMemory = 0;
+  std::vector<std::vector<int>> frames;
+  size_t activeFrames = 0;
 
-  // Memory for arrays
-  std::map<std::string, std::vector<int>> memory;
+  // MEMO n: a direct-mapped table of n (a power of two) entries, each the
+  // arguments followed by the result, indexed by a hash of the arguments.
+  // A new result replaces whatever its entry held.
+  std::vector<int> memoEntries;
+  std::vector<bool> memoValid;
 
-  // For recursion support, we would need a stack of frames.
-  // But since the current AST interpreter is also simple,
-  // we'll start with a single frame for the main function.
+  // Profiling state; counts are per decoded instruction.
+  ir::Profile *profile = nullptr;
+  std::string functionName;
+  std::vector<std::string> blockLabels;
+  std::vector<int> codeLines;
+  std::vector<uint64_t> counts; // Times each instruction was dispatched
+  std::vector<uint64_t> taken;  // Times each JMP_IF jumped
 
-  // Last visited block (needed for PHI nodes)
-  ir::BasicBlock *lastBlock = nullptr;
+  std::unordered_map<std::string, int> slotIndex;
+  std::unordered_map<int, int> constIndex;
+  std::unordered_map<std::string, int> arrayIndex;
 
-  int getVal(const ir::Operand &op);
-  void setVal(const std::string &name, int val);
+  // execute() on the stack it is called on.
+  int executeHere(const ir::Function &function, ExecState &state);
+  void decode(const ir::Function &function, const ExecState &state);
+  void layoutArrays(const ir::Function &function, const ExecState &state);
+  int slotFor(const ir::Operand &op);
+  int arrayFor(const std::string &name);
+  [[noreturn]] void arrayFault(int id) const;
+  // Replaces common instruction sequences with superinstructions. Jumps
+  // between them go straight to an instruction index, so it only fuses
+  // branches to blocks without PHIs.
+  void fuse(const std::vector<bool> &hasPhis);
+  void enterBlock(int target, int from, int *r);
+  // Dispatches from 'pc' on the registers 'r', adding to 'steps', until a
+  // RET or the end of the function. A Chunk run executes part of a parallel
+  // loop and stops where it leaves the loop instead. A Limited run checks
+  // the step limit.
+  template <bool Profiling, bool Chunk, bool Limited = false>
+  int run(size_t pc, int *r, uint64_t &steps, bool &returned,
+          OutputBuffer &out);
+  // run() from the start of a function or call, in the copy for profiling,
+  // for a step limit, or the plain one.
+  int runBody(size_t pc, int *r, uint64_t &steps, bool &returned,
+              OutputBuffer &out);
+  // Runs the rest of 'loop' in chunks on the pool and returns true, or
+  // returns false when that does not pay off; the loop then continues
+  // from whatever iteration it has reached.
+  bool runParallel(const ParLoop &loop, int *r, uint64_t &steps,
+                   OutputBuffer &out);
+  void recordProfile();
+  // The engine running calls to 'function', created on first use.
+  IRInterpreter &engineFor(const ir::Function &function);
+  // Runs one call with the arguments in 'args' of the caller's registers
+  // 'from', or returns the memoized result.
+  int call(const std::vector<int> &args, const int *from, uint64_t &steps,
+           OutputBuffer &out);
 };
 
 } // namespace optimix
@@ -1,6 +1,12 @@
 #pragma once
 
 #include "optimix/ast/AST.h"
+#include "optimix/codegen/IRInterpreter.h"
+#include "optimix/ir/IR.h"
+#include "optimix/support/DeepStack.h"
+#include "optimix/support/OutputBuffer.h"
+#include <cstddef>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -12,12 +18,64 @@ class Interpreter {
 public:
   int execute(const FunctionAST &function);
 
+  // Number of back-edges a while loop may take in the AST interpreter before
+  // it is compiled to IR and finished by the IR engine. 0 disables tier-up.
+  void setTierUpThreshold(int threshold) { tierUpThreshold = threshold; }
+  int tierUpCount() const { return tierUps; }
+
+  // PRINT writes to 'out', also from loops running in the IR engine. When
+  // unset, each execute() buffers its output and writes it to std::cout at
+  // the end.
+  void setOutput(OutputBuffer *out) { output = out; }
+
+  // Calls are resolved in 'program', which must outlive the interpreter.
+  // Without one, a call fails.
+  void setProgram(const ProgramAST *p) { program = p; }
+
+  // Nested calls beyond this depth fail instead of overflowing the stack.
+  static constexpr int kMaxCallDepth = 1000;
+  // Stack a call takes, which grows with the statements and expressions
+  // around it. Measured for a call inside a while and an if: 1.7 KB
+  // optimized, 3.4 KB without optimization, 6.2 KB with AddressSanitizer.
+  // Calls nested deeper than planned for fail early rather than crash.
+  static constexpr size_t kCallStackBytes = 8 * 1024 * DeepStack::kFrameScale;
+  // With a program, execute() runs on a stack this large (see DeepStack),
+  // which also holds the calls of loops finished by the IR engine.
+  static constexpr size_t kStackBytes =
+      kMaxCallDepth * kCallStackBytes + IRInterpreter::kStackBytes;
+
 private:
+  int executeHere(const FunctionAST &function);
+
+  // Of the running function; a call sets both aside until it returns.
   std::unordered_map<std::string, int> environment;
   std::unordered_map<std::string, std::vector<int>> memory;
 
+  int returnValue = 0;
+  const ProgramAST *program = nullptr;
+  int callDepth = 0;
+  // The program in IR, for calls from loops running in the IR engine.
+  std::unique_ptr<ir::Module> programIR;
+
+  OutputBuffer *output = nullptr;
+  OutputBuffer *out = nullptr; // Buffer of the running execute()
+
+  int tierUpThreshold = 0;
+  int tierUps = 0;
+  std::unordered_map<const WhileStmt *, int> backEdges;
+  std::unordered_map<const WhileStmt *, std::unique_ptr<ir::Function>>
+      compiledLoops;
+
   int evaluate(const Expr *expr);
-  void executeStmt(const Stmt *stmt);
+  // Row-major position of array[indices...]; see arrayExtentName.
+  int flatIndex(const std::string &array,
+                const std::vector<std::unique_ptr<Expr>> &indices);
+  // Returns true when the statement ran a 'return'; its value is then in
+  // returnValue.
+  bool executeStmt(const Stmt *stmt);
+  int call(const CallExpr &call);
+  // Finishes 'loop' in the IR engine; returns like executeStmt.
+  bool tierUp(const WhileStmt *loop);
 };
 
 } // namespace optimix
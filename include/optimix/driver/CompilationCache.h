@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace optimix {
+namespace driver {
+
+// On-disk, content-addressed store for compilation artifacts. Entries are
+// keyed by a hash of the source bytes, the compiler version and the flags
+// that affect the output, so a hit can skip the whole pipeline.
+//
+// Safe for concurrent writers (threads or processes): entries are written to
+// a private temporary file and renamed into place, so readers only ever see
+// complete entries. The total size is bounded; least recently used entries
+// are evicted first. Stores keep a running total, so the directory is only
+// scanned when it may have outgrown the bound.
+class CompilationCache {
+public:
+  explicit CompilationCache(std::string directory,
+                            uint64_t maxBytes = 256ull << 20);
+
+  // 128-bit hex key for (source, OPTIMIX_VERSION, flags).
+  static std::string makeKey(std::string_view source, std::string_view flags);
+
+  std::optional<std::string> lookup(const std::string &key) const;
+  // Failures to write are ignored: the cache is only an accelerator.
+  void store(const std::string &key, const std::string &artifact) const;
+
+private:
+  std::string directory;
+  uint64_t maxBytes;
+  // Size of the entries as of the last scan plus what this object stored
+  // since. Writers in other processes are only seen by the next scan.
+  mutable std::atomic<uint64_t> bytesStored{0};
+  mutable std::atomic<bool> measured{false};
+
+  std::string entryPath(const std::string &key) const;
+  void evict() const;
+};
+
+} // namespace driver
+} // namespace optimix
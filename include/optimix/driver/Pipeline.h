@@ -0,0 +1,60 @@
+#pragma once
+
+#include "optimix/ast/AST.h"
+#include "optimix/ir/IR.h"
+#include "optimix/ir/PassManager.h"
+#include "optimix/ir/Profile.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace optimix {
+namespace driver {
+
+// Reads a whole file. Throws std::runtime_error if it cannot be read.
+std::string readFile(const std::string &path);
+
+// The optimization pipeline every compile runs after IR generation. With a
+// profile from `optimix run --profile`, profile-guided passes run first; the
+// profile must outlive the returned pipeline. A nonzero 'evalSteps' ends it
+// with compile-time evaluation of input-free code, taking at most that many
+// steps in all.
+ir::PassManager defaultPipeline(const ir::Profile *profile = nullptr,
+                                uint64_t evalSteps = 0);
+
+struct CompileResult {
+  std::unique_ptr<ProgramAST> ast;
+  std::unique_ptr<ir::Module> module;
+};
+
+// Runs lex -> parse -> IR -> optimize on one source. Uses no shared mutable
+// state, so independent sources may be compiled concurrently. Functions are
+// optimized in parallel on 'pool' when given. Throws on errors.
+CompileResult compileSource(const std::string &source,
+                            ThreadPool *pool = nullptr);
+
+struct BatchOptions {
+  unsigned jobs = 0;     // Worker threads, 0 = one per hardware thread
+  std::string outputDir; // Write <outputDir>/<input>.oxir instead of stdout
+  std::string cacheDir;  // Compilation cache location, empty = no cache
+  uint64_t cacheMaxBytes = 256ull << 20;
+};
+
+struct BatchEntry {
+  std::string file;
+  std::string output; // Optimized IR text
+  std::string error;  // Empty on success
+  bool fromCache = false;
+};
+
+// Compiles every file as an independent task on a work-stealing pool.
+// Entries are returned in input order regardless of completion order.
+std::vector<BatchEntry> compileBatch(const std::vector<std::string> &files,
+                                     const BatchOptions &options);
+
+// Reads a manifest: one path per line, blank lines and '#' comments ignored.
+std::vector<std::string> readManifest(const std::string &path);
+
+} // namespace driver
+} // namespace optimix
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "optimix/ir/IR.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace optimix {
+namespace ir {
+
+// Versioned binary serialization of a Module (".oxb" files).
+//
+// Layout (host byte order, every section 4-byte aligned):
+//   header     magic "OXB\0", format version, byte-order mark, section counts
+//   functions  {name, firstParam, numParams, firstBlock, numBlocks}
+//   params     string index of each parameter name
+//   blocks     {label, firstInst, numInsts}
+//   insts      {opcode, firstOperand, numOperands, line}; first operand =
+//              result, line = source line (0 if unknown)
+//   operands   {kind, value, version}; value is a constant or string index
+//   strings    offset table followed by the characters (no terminators)
+//
+// All records have a fixed size, so loading is a bounds-checked walk over
+// dense arrays; nothing is tokenized or parsed.
+constexpr uint32_t kBinaryIRVersion = 7;
+
+std::string writeBinary(const Module &module);
+
+// Throws std::runtime_error on malformed or incompatible input. Unchecked
+// accesses are read as checked ones (see checkedForm) unless 'trusted',
+// for IR this compiler wrote itself, such as a compilation cache entry.
+std::unique_ptr<Module> readBinary(const char *data, size_t size,
+                                   bool trusted = false);
+
+// Memory-maps 'path' and reads it with readBinary, untrusted.
+std::unique_ptr<Module> loadBinaryFile(const std::string &path);
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// Removes array bounds checks that range analysis proves redundant. Needs
+// SSA form.
+//
+// Every SSA value gets an integer range: from constants and arithmetic, from
+// the branch conditions that dominate the point of use (inside the body of
+// "while (i < n)", i <= n - 1) and, for loop PHIs, from an induction
+// argument (a PHI that only grows starts at its smallest initial value).
+// A LOAD/STORE whose index range lies within the constant size of its array,
+// and that some ALLOCA of the array dominates, becomes LOAD_UNCHECKED or
+// STORE_UNCHECKED. The analysis has a work budget proportional to the size
+// of the function; accesses it has not proven by then keep their checks.
+//
+// An innermost loop "while (i < n)" whose accesses a[i + c] cannot be proven
+// is versioned instead: one INBOUNDS test per array before the loop picks
+// either an unchecked copy of the loop or the original, checked one.
+class BoundsCheckEliminationPass : public FunctionPass {
+public:
+  const char *name() const override { return "bce"; }
+  void run(Function &func) const override;
+};
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "optimix/ir/IR.h"
+#include <unordered_map>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+// Whether control never continues past 'op' to the next instruction.
+inline bool isTerminator(OpCode op) {
+  return op == OpCode::JMP || op == OpCode::RET;
+}
+
+// Fills preds/succs of every block from its jumps and from fallthrough into
+// the next block (a block that does not end in JMP or RET).
+void computeCFG(Function &func);
+
+// Dominator tree of the blocks reachable from the entry (Cooper, Harvey and
+// Kennedy, "A Simple, Fast Dominance Algorithm"), with dominance frontiers.
+// Computes the CFG first. Blocks that cannot be reached have no idom and
+// dominate nothing.
+class DominatorTree {
+public:
+  explicit DominatorTree(Function &func);
+
+  // Reachable blocks, each before its successors except along back edges.
+  const std::vector<BasicBlock *> &reversePostOrder() const { return rpo; }
+  bool isReachable(const BasicBlock *bb) const { return index.count(bb) > 0; }
+  // Null for the entry block and unreachable blocks.
+  BasicBlock *idom(const BasicBlock *bb) const;
+  // Reflexive: every reachable block dominates itself.
+  bool dominates(const BasicBlock *a, const BasicBlock *b) const;
+  // Whether instruction 'a' (in 'aBlock') runs before every execution of
+  // 'b' (in 'bBlock'). An instruction does not dominate itself.
+  bool dominates(const BasicBlock *aBlock, const Instruction *a,
+                 const BasicBlock *bBlock, const Instruction *b) const;
+  const std::vector<BasicBlock *> &children(const BasicBlock *bb) const;
+  const std::vector<BasicBlock *> &frontier(const BasicBlock *bb) const;
+
+private:
+  std::vector<BasicBlock *> rpo;
+  std::unordered_map<const BasicBlock *, int> index; // Position in rpo
+  std::vector<int> idoms;
+  std::vector<std::vector<BasicBlock *>> kids;
+  std::vector<std::vector<BasicBlock *>> frontiers;
+  std::vector<int> treeIn, treeOut; // Preorder/postorder on the tree
+};
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace optimix {
+namespace ir {
+
+// Compile-time evaluation (evaluate) of code that takes no input. A program
+// reads nothing but its arguments, so a function without parameters prints
+// the same values and returns the same result every time, and so does a
+// call whose arguments are all constants. Each is run on the IR engine,
+// calls first; when the run finishes, the call becomes
+//   PRINT v1; ...; PRINT vk; MOV dst, result
+// for the values v1..vk it printed, and the function's body the same PRINTs
+// followed by RET of the result. A run that faults, runs out of steps or
+// prints more than kMaxPrints values leaves the code alone, so errors and
+// long-running programs still happen at run time.
+//
+// All runs on a module share one step budget, failed runs included, so
+// however many calls there are the pass takes bounded time; once the
+// budget is used up it evaluates nothing more.
+//
+// Runs last, on the final IR: the engine then runs optimized code, and
+// recursive functions already carry their MEMO from memoize.
+class PartialEvaluationPass : public ModulePass {
+public:
+  static constexpr uint64_t kDefaultStepLimit = 1000000;
+  static constexpr size_t kMaxPrints = 4096;
+
+  // 'stepLimit' is the budget for the whole module, calls included.
+  explicit PartialEvaluationPass(uint64_t stepLimit = kDefaultStepLimit)
+      : stepLimit(stepLimit) {}
+
+  const char *name() const override { return "evaluate"; }
+  void run(Module &module) const override;
+
+private:
+  uint64_t stepLimit;
+};
+
+} // namespace ir
+} // namespace optimix
@@ -24,12 +24,40 @@ enum class OpCode {
   PHI,    // SSA Phi node
   RET,
   PRINT, // Print intrinsic
-  CALL,
+  CALL,  // CALL r, f, args...: r = f(args...), for function f of the module
   ALLOCA, // Stack allocation
   LOAD,   // Load from memory
-  STORE   // Store to memory
+  STORE,  // Store to memory
+  // LOAD/STORE whose index is known to be in bounds of an allocated array
+  // (see BoundsCheckEliminationPass); the engine does not check them.
+  LOAD_UNCHECKED,
+  STORE_UNCHECKED,
+  // INBOUNDS g, array, first, end, lo, hi: g = 1 when array[k + c] is valid
+  // for all first <= k < end and lo <= c <= hi (always when first >= end).
+  INBOUNDS,
+  // Formed by InstCombinePass; all wrap modulo 2^32. SHL/SHR shift by the
+  // low 5 bits of the second operand (SHR is arithmetic), MULH is the high
+  // half of the 64-bit signed product.
+  SHL,
+  SHR,
+  MULH,
+  // SELECT r, c, a, b: r = a if c != 0, else b (IfConversionPass)
+  SELECT,
+  // PARFOR header, iv, end, s...: the loop entered next, whose header is
+  // LT c, iv, end; JMP_IF body, c; JMP exit, may run its iterations as
+  // parallel chunks, each adding up its own part of the sums s...
+  // (ParallelizePass).
+  PARFOR,
+  // MEMO n, first in the entry block: the function is pure, so a call may
+  // return the result of an earlier call with the same arguments; the
+  // engine keeps up to n of them (MemoizePass).
+  MEMO
 };
 
+// Number of opcodes; keep in sync with the last enumerator above (and bump
+// kBinaryIRVersion when the list changes).
+constexpr int kNumOpCodes = static_cast<int>(OpCode::MEMO) + 1;
+
 struct Operand {
   enum Type { VARIABLE, CONSTANT, LABEL } type;
   std::string value; // Var name or int value
@@ -40,7 +68,8 @@ struct Operand {
       return value;
     if (type == LABEL)
       return value;
-    return value + (version > 0 ? "_" + std::to_string(version) : "");
+    // '.' cannot appear in source identifiers, so "x.2" is unambiguous.
+    return value + (version > 0 ? "." + std::to_string(version) : "");
   }
 
   static Operand makeVar(std::string name) { return {VARIABLE, name}; }
@@ -48,10 +77,21 @@ struct Operand {
   static Operand makeLabel(std::string label) { return {LABEL, label}; }
 };
 
+const char *opcodeName(OpCode op);
+// Whether the opcode defines 'result' (void ops carry a placeholder).
+bool hasResult(OpCode op);
+// Whether operand 'index' of 'op' names an array rather than a scalar.
+bool isArrayOperand(OpCode op, size_t index);
+// LOAD/STORE for LOAD_UNCHECKED/STORE_UNCHECKED, any other opcode as is.
+// Loaders apply it to IR from elsewhere: nothing proves its accesses in
+// bounds, and the engine would not check them.
+OpCode checkedForm(OpCode op);
+
 struct Instruction {
   OpCode op;
   Operand result;
   std::vector<Operand> operands;
+  int line = 0; // Source line it was generated from, 0 if unknown
 
   Instruction(OpCode o, Operand res) : op(o), result(res) {}
   Instruction(OpCode o, Operand res, Operand op1)
@@ -79,6 +119,12 @@ struct Instruction {
   }
 
   std::string toString() const;
+  // For a PHI: the value it takes when entered from block 'label', or null
+  // if it does not list that block.
+  const Operand *incoming(const std::string &label) const;
+  // Operand count and kinds match the opcode. Checked when IR is loaded from
+  // a file, since the engine relies on it.
+  bool isWellFormed() const;
 };
 
 class BasicBlock {
@@ -96,6 +142,8 @@ public:
 class Function {
 public:
   std::string name;
+  // Variables that hold the arguments on entry, in order.
+  std::vector<std::string> params;
   std::list<std::unique_ptr<BasicBlock>> blocks;
 
   Function(std::string n) : name(n) {}
@@ -106,6 +154,26 @@ public:
   }
 
   void print() const;
+  void print(std::ostream &os) const;
+};
+
+// All functions of one translation unit.
+class Module {
+public:
+  std::vector<std::unique_ptr<Function>> functions;
+
+  Function *getFunction(const std::string &name) const {
+    for (const auto &f : functions)
+      if (f->name == name)
+        return f.get();
+    return nullptr;
+  }
+
+  void print() const { print(std::cout); }
+  void print(std::ostream &os) const {
+    for (const auto &f : functions)
+      f->print(os);
+  }
 };
 
 } // namespace ir
@@ -9,20 +9,30 @@ namespace optimix {
 class IRBuilder {
 public:
   std::unique_ptr<ir::Function> generate(const FunctionAST &ast);
+  std::unique_ptr<ir::Module> generate(const ProgramAST &program);
+  // Lowers a single loop into a standalone function for tier-up. Variables
+  // read before being written are live-ins supplied by the caller.
+  std::unique_ptr<ir::Function> generateLoop(const WhileStmt &loop,
+                                             const std::string &name);
 
 private:
   ir::Function *currentFunc = nullptr;
   ir::BasicBlock *currentBB = nullptr;
   int tempCounter = 0;
   int labelCounter = 0;
+  int currentLine = 0; // Source line of the statement being lowered
 
   ir::Operand genExpr(const Expr *expr);
+  // Row-major position of array[indices...]; see arrayExtentName.
+  ir::Operand genIndex(const std::string &array,
+                       const std::vector<std::unique_ptr<Expr>> &indices);
   void genStmt(const Stmt *stmt);
 
   std::string newTemp() { return "t" + std::to_string(tempCounter++); }
   std::string newLabel() { return "L" + std::to_string(labelCounter++); }
 
   void emit(ir::Instruction inst) {
+    inst.line = currentLine;
     if (currentBB)
       currentBB->addInst(inst);
   }
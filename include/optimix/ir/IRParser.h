@@ -0,0 +1,26 @@
+#pragma once
+
+#include "optimix/ir/IR.h"
+#include <memory>
+#include <string_view>
+
+namespace optimix {
+namespace ir {
+
+// Reads the text produced by Function::print / Module::print (".oxir"):
+//
+//   Function main:
+//   entry:
+//     MOV i, 0
+//     JMP loop_L0
+//
+// A function with parameters lists them: "Function fib(n):".
+// Integers are constants, "name.N" is SSA version N of 'name', and the
+// label positions of JMP/JMP_IF/PHI/CALL are labels. ';' starts a comment
+// that runs to the end of the line. LOAD_UNCHECKED and STORE_UNCHECKED are
+// read as LOAD and STORE (see checkedForm). Throws
+// std::runtime_error("line N: ...") on bad input.
+std::unique_ptr<Module> parseIR(std::string_view text);
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// If-conversion (ifconvert): a branch on c whose arms are small, run only
+// from it and rejoin at the same block is replaced by straight-line code.
+// Both arms run unconditionally and each PHI where they meet becomes
+// SELECT c, thenValue, elseValue, so the engine no longer jumps on a
+// data-dependent condition. Handles diamonds (if/else) and triangles (if
+// without else); the join is merged into the branching block, so nested
+// ifs collapse from the inside out.
+//
+// An arm may hold at most kMaxArmSize instructions, all of which must be
+// arithmetic that cannot fault or have side effects (no DIV, LOAD, STORE,
+// PRINT or CALL). Needs SSA form: the arms' definitions get fresh names
+// ("%if0_x") so that running them early does not clobber a value the
+// other path still needs.
+class IfConversionPass : public FunctionPass {
+public:
+  static constexpr int kMaxArmSize = 4;
+
+  const char *name() const override { return "ifconvert"; }
+  void run(Function &func) const override;
+};
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// Peephole simplification of arithmetic, one instruction at a time:
+//  - constants are folded, and variables defined (in SSA) as a constant
+//    through MOVs are replaced by it;
+//  - identities: x + 0, x * 1, x - x, x * 0, x / 1, x < x, ...;
+//  - canonical forms: constants go second in ADD/MUL/EQ/NEQ, SUB x, C
+//    becomes ADD x, -C, and MUL x, 2^k becomes SHL x, k;
+//  - constant chains in a block are reassociated: (x + 1) + 2 becomes
+//    x + 3, and likewise for MUL/SHL;
+//  - DIV by a constant becomes MULH/SHR/SUB (see signedDivisionMagic()),
+//    truncating toward zero like DIV.
+// Instructions left without a use are then removed (except MOV, whose
+// destination is a source variable). Works with or without SSA; all
+// arithmetic wraps modulo 2^32, as in the engine.
+class InstCombinePass : public FunctionPass {
+public:
+  const char *name() const override { return "instcombine"; }
+  void run(Function &func) const override;
+};
+
+// For 2 <= |divisor|: x / divisor == q + (q < 0), where
+// q = MULH(x, multiplier) [+ x if divisor > 0 and multiplier < 0]
+// [- x if divisor < 0 and multiplier > 0], then SHR by 'shift'
+// (Hacker's Delight, 10-1).
+struct DivisionMagic {
+  int multiplier;
+  int shift;
+};
+DivisionMagic signedDivisionMagic(int divisor);
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// Loop fusion (loop-fusion): two adjacent loops
+//   while (i < n) { A; i = i + 1; }  ...  while (j < n) { B; j = j + 1; }
+// that run the same iterations (same start, bound and unit step) become
+// one loop whose body is A followed by B. The code between them may only
+// set up the second loop (arithmetic that reads nothing the first one
+// computes); it moves in front of the first. Each iteration then pays for
+// one compare and branch instead of two, and an element the first body
+// writes is still in cache when the second reads it.
+//
+// Fusing is legal when no iteration of B needs to come after a later
+// iteration of A. For an array that either loop writes, every access in
+// both must be iv + c, and an access a[j + b] in B may only meet a[i + a]
+// in A with b <= a: B then reads (or overwrites) only elements A has
+// already finished with. Neither loop may touch a scalar the other
+// defines, and at most one of them may PRINT or have an access that could
+// fail its bounds check, so output and errors come in the original order.
+//
+// Both bodies must be single blocks. Needs SSA form; run it before bce so
+// the fused loop gets its checks removed or versioned as one.
+class LoopFusionPass : public FunctionPass {
+public:
+  const char *name() const override { return "loop-fusion"; }
+  void run(Function &func) const override;
+};
+
+} // namespace ir
+} // namespace optimix
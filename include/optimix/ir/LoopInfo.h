@@ -0,0 +1,43 @@
+#pragma once
+
+#include "optimix/ir/Dominators.h"
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+// A natural loop: the header plus every block that reaches a back edge
+// (latch -> header, where the header dominates the latch) without passing
+// through the header.
+struct Loop {
+  BasicBlock *header = nullptr;
+  std::vector<BasicBlock *> latches;
+  std::set<const BasicBlock *> blocks; // Includes the header
+  Loop *parent = nullptr;              // Innermost enclosing loop
+  std::vector<Loop *> subLoops;
+
+  bool contains(const BasicBlock *bb) const { return blocks.count(bb) > 0; }
+  // The single block outside the loop that enters it, when it has no other
+  // successor; null otherwise.
+  BasicBlock *preheader() const;
+};
+
+// All natural loops of a function. Back edges to the same header form one
+// loop. Only meaningful while the CFG the tree was built from is unchanged.
+class LoopInfo {
+public:
+  explicit LoopInfo(const DominatorTree &domTree);
+
+  // Outermost loops first, each before the loops nested in it.
+  const std::vector<std::unique_ptr<Loop>> &loops() const { return all; }
+  // Innermost loop containing 'bb', or null.
+  Loop *loopFor(const BasicBlock *bb) const;
+
+private:
+  std::vector<std::unique_ptr<Loop>> all;
+};
+
+} // namespace ir
+} // namespace optimix
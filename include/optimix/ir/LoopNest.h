@@ -0,0 +1,41 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// Loop nest optimization (loop-nest) for perfect nests of two loops
+//   while (i < n) { j = j0; while (j < m) { B; j = j + 1; } i = i + 1; }
+// whose bounds and j0 do not change inside the nest. The array indices in
+// B are written as polynomials in i, j and names the nest does not assign,
+// which gives every access a stride per loop (m[i][j] of int m[R][C] moves
+// by C when i does and by 1 when j does).
+//
+// When more accesses have a large stride (symbolic, or at least 16
+// elements) in the inner loop than in the outer one, the loops are
+// interchanged, so that a column-major walk over a matrix becomes a walk
+// along its rows. When an access with a large inner stride remains and has
+// a small outer one, as in a transpose, the inner loop is strip-mined into
+// strips of kTileSize iterations and the loop over strips becomes the
+// outermost: each strip then touches kTileSize rows of that array while it
+// works its way along them, and those rows stay in cache.
+//
+// Both orders run the same iterations, so the transformation is legal when
+// no two iterations whose order it reverses (one has the larger i, the
+// other the larger j) touch the same element of an array the nest writes.
+// All accesses to such an array must use the same index, and its strides
+// must rule the collision out. Other scalars the nest assigns must be
+// recomputed in each iteration before they are read and be dead after it,
+// or be sums (x = x + e, read nowhere else); i and j must be dead too. The
+// nest may not PRINT, call or allocate.
+//
+// Runs on the IR as IRBuilder emits it, before SSA.
+class LoopNestPass : public FunctionPass {
+public:
+  const char *name() const override { return "loop-nest"; }
+  void run(Function &func) const override;
+};
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "optimix/ir/Dominators.h"
+#include "optimix/ir/IR.h"
+#include "optimix/ir/Polynomial.h"
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+// Helpers shared by the loop passes that run out of SSA form (loop-nest,
+// parallelize), where a name may be assigned in several places.
+
+// Calls fn(name) for each scalar 'inst' reads.
+template <typename Fn> void forEachRead(const Instruction &inst, Fn fn) {
+  for (size_t i = 0; i < inst.operands.size(); ++i) {
+    const Operand &op = inst.operands[i];
+    if (op.type == Operand::VARIABLE && !isArrayOperand(inst.op, i))
+      fn(op.value);
+  }
+}
+
+bool definesScalar(const Instruction &inst);
+bool isVar(const Operand &op, const std::string &name);
+
+// header: LT c, iv, bound; JMP_IF in, c; JMP out
+bool matchHeader(const BasicBlock *header, std::string &iv, Operand &bound,
+                 std::string &in, std::string &out);
+
+// Whether 'name' may be read after control reaches 'from', before it is
+// assigned again.
+bool liveAt(const BasicBlock *from, const std::string &name);
+
+// The assignments to each scalar of a function. Only meaningful while the
+// function is unchanged.
+class ScalarDefs {
+public:
+  using Site = std::pair<BasicBlock *, const Instruction *>;
+
+  ScalarDefs() = default;
+  explicit ScalarDefs(const Function &func);
+
+  // The assignments to 'name', empty if there are none.
+  const std::vector<Site> &of(const std::string &name) const;
+
+  // The value 'v' has at 'at' if it is a constant or a name that is never
+  // assigned, looking through MOVs that are the only definition of their
+  // name and run before it.
+  std::optional<Poly> fixedValue(const DominatorTree &domTree,
+                                 const Operand &v, const BasicBlock *atBlock,
+                                 const Instruction *at, int depth = 0) const;
+
+private:
+  std::unordered_map<std::string, std::vector<Site>> sites;
+};
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// Automatic memoization (memoize) of pure recursive functions. A function
+// is pure when it does not PRINT and calls only pure functions: arrays and
+// variables are local to a call and arguments are passed by value, so its
+// result then depends on nothing but its arguments. Calls within a cycle of
+// the call graph are assumed pure until something in the cycle is not.
+//
+// Every pure function that can call itself, directly or through others,
+// gets MEMO n as its first instruction. The IR engine then keeps up to n
+// results per function in a table keyed on the arguments, so the naive
+// fib(n), whose calls mostly repeat earlier ones, runs in linear instead
+// of exponential time. A call that faults stores no result, so faults
+// still happen where they did; only a call deep enough to fail for lack of
+// stack may now find its result in the table and succeed.
+class MemoizePass : public ModulePass {
+public:
+  const char *name() const override { return "memoize"; }
+  void run(Module &module) const override;
+};
+
+} // namespace ir
+} // namespace optimix
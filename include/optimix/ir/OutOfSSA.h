@@ -0,0 +1,33 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// SSA destruction (out-of-ssa). Each PHI becomes a copy on every incoming
+// edge: at the end of the predecessor if it has only that successor, at the
+// start of the block if it has only that predecessor, or in a new block
+// ("loop_L0_from_body_L1") that splits the critical edge. The copies of one
+// edge act in parallel, so they are ordered such that no copy overwrites a
+// value a later one reads, and a cycle (a swap) goes through a temporary.
+// Copies between versions of one variable are dropped: passes keep those
+// versions from being live at the same time (see SSAPass). Versions are
+// then removed.
+//
+// Finally copies are coalesced: MOV x, y is removed by renaming y to x
+// (or x to y) when the two are never live at the same time with different
+// values, so "ADD t, x, 1; MOV x, t" becomes "ADD x, x, 1". Variables live
+// on entry keep their names, but other source variables may be merged, so
+// the engine's final values are only meaningful for those.
+//
+// The result has no PHIs, so it can go to any backend that does not know
+// SSA. Run it last.
+class OutOfSSAPass : public FunctionPass {
+public:
+  const char *name() const override { return "out-of-ssa"; }
+  void run(Function &func) const override;
+};
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// Automatic parallelization (parallelize) of counting loops
+//   header: LT c, i, n; JMP_IF body, c; JMP exit
+// that leave only through their header, step i by one in their single
+// latch and do not change n, when no iteration depends on another (DOALL).
+// The loop gets
+//   MOV %header_end, n; PARFOR header, i, %header_end, s...
+// at the end of its preheader (a new block header_par if the block before
+// it also leads elsewhere) and its test reads %header_end, so that the IR
+// engine can hand the iterations from i to n out to its thread pool in
+// chunks: every chunk gets its own copy of the scalars with i and
+// %header_end set to its range, and stops where the header leaves the
+// loop.
+//
+// Iterations are independent when
+// - the loop does not PRINT, call, return or allocate;
+// - every scalar it assigns, other than i and the sums, is assigned in an
+//   iteration before that iteration reads it, and is dead after the loop
+//   or assigned in every iteration (the last chunk then leaves the value
+//   the last iteration left);
+// - the sums s... are only updated as s = s + e, s = s - e, or
+//   s = c ? s + e : s after if-conversion, and read nowhere else. Each
+//   chunk adds up its own part starting from 0; the parts are added to s
+//   in the end. Integer addition wraps, so the order does not matter;
+// - every access to an array the loop stores to uses the same index
+//   a * i + b * j + r, for the counter j of at most one inner loop and
+//   an r the loop does not assign, with a a nonzero constant, or larger
+//   than b times the iterations of that inner loop (as in m[i][j] over
+//   the columns of int m[R][C], where a = C), so no two iterations touch
+//   the same element.
+//
+// Loops inside a loop that gets parallelized are left alone. Runs on the
+// final IR after out-of-ssa; only module passes (memoize, evaluate) follow,
+// and the function passes do not know PARFOR.
+class ParallelizePass : public FunctionPass {
+public:
+  const char *name() const override { return "parallelize"; }
+  void run(Function &func) const override;
+};
+
+} // namespace ir
+} // namespace optimix
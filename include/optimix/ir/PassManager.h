@@ -0,0 +1,64 @@
+#pragma once
+
+#include "optimix/ir/IR.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace optimix {
+
+class ThreadPool;
+class TimeReport;
+
+namespace ir {
+
+// A transformation applied to one function at a time. The pass manager may
+// run the same pass object on several functions concurrently, so run() must
+// keep all of its working state local to the invocation.
+class FunctionPass {
+public:
+  virtual ~FunctionPass() = default;
+  virtual const char *name() const = 0;
+  virtual void run(Function &func) const = 0;
+};
+
+// A transformation that needs to see the whole module (e.g. call-graph
+// based analyses). Module passes run alone, between function-pass stages.
+class ModulePass {
+public:
+  virtual ~ModulePass() = default;
+  virtual const char *name() const = 0;
+  virtual void run(Module &module) const = 0;
+};
+
+class PassManager {
+public:
+  void addPass(std::unique_ptr<FunctionPass> pass);
+  void addPass(std::unique_ptr<ModulePass> pass);
+
+  // Runs the pipeline in order. Each maximal run of consecutive function
+  // passes forms a stage: every function goes through the whole stage as one
+  // task on 'pool' (inline when null). Module passes are synchronization
+  // points that wait for the previous stage to finish on all functions.
+  void run(Module &module, ThreadPool *pool = nullptr) const;
+
+  // Comma-separated pass names in pipeline order, e.g. "ssa".
+  std::string pipelineText() const;
+
+  // Records every pass invocation in 'report' (null turns this off).
+  void setTimeReport(TimeReport *report) { timeReport = report; }
+
+private:
+  struct Entry {
+    std::unique_ptr<FunctionPass> functionPass;
+    std::unique_ptr<ModulePass> modulePass;
+  };
+  std::vector<Entry> pipeline;
+  TimeReport *timeReport = nullptr;
+
+  void runStage(Module &module, size_t begin, size_t end,
+                ThreadPool *pool) const;
+};
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+// Creates the function pass registered under 'name', or nullptr.
+std::unique_ptr<FunctionPass> createPass(const std::string &name);
+
+// Names accepted by createPass, in registration order.
+std::vector<std::string> registeredPasses();
+
+// Builds a pipeline from a comma-separated list such as "ssa". Throws
+// std::runtime_error for unknown pass names.
+PassManager parsePipeline(const std::string &text);
+
+} // namespace ir
+} // namespace optimix
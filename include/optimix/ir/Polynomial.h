@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+// A polynomial with integer coefficients over variable names, as the loop
+// passes use for array indices: each monomial (its names, sorted) maps to
+// a nonzero coefficient.
+using Poly = std::map<std::vector<std::string>, int64_t>;
+
+Poly constant(int64_t c);
+Poly symbol(const std::string &name);
+// p += sign * q
+void addTo(Poly &p, const Poly &q, int64_t sign);
+// Nothing if a coefficient is too large for the product to be exact.
+std::optional<Poly> multiply(const Poly &p, const Poly &q);
+// The value of 'p' if it has no names.
+std::optional<int64_t> constantValue(const Poly &p);
+
+} // namespace ir
+} // namespace optimix
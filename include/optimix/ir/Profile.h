@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+// Execution counts collected by the IR engine (`optimix run --profile`) and
+// read back by profile-guided passes (`optimix compile --profile-use`).
+// Blocks and edges are keyed by label, which IRBuilder derives
+// deterministically from the source, so a profile applies to any later
+// compile of the same program.
+
+struct BlockCount {
+  std::string label;
+  uint64_t count = 0;        // Times the block was entered
+  uint64_t instructions = 0; // Instructions executed inside it
+  int line = 0;              // First source line in the block, 0 if unknown
+};
+
+struct EdgeCount {
+  std::string from, to;
+  uint64_t count = 0;
+};
+
+struct BranchCount {
+  std::string block, target; // JMP_IF in 'block' jumping to 'target'
+  uint64_t taken = 0, notTaken = 0;
+  int line = 0;
+};
+
+struct FunctionProfile {
+  std::string name;
+  std::vector<BlockCount> blocks; // In IR order
+  std::vector<EdgeCount> edges;
+  std::vector<BranchCount> branches;
+  std::map<int, uint64_t> lines; // Source line -> instructions executed
+
+  const BlockCount *getBlock(const std::string &label) const;
+  uint64_t edgeCount(const std::string &from, const std::string &to) const;
+};
+
+class Profile {
+public:
+  std::vector<FunctionProfile> functions;
+  std::map<std::string, uint64_t> opcodes; // Instructions executed per op
+
+  const FunctionProfile *getFunction(const std::string &name) const;
+  // Adds the counts of 'fp' to the entry for the same function, so repeated
+  // runs accumulate.
+  void merge(const FunctionProfile &fp);
+
+  // Line-oriented text format ("optimix-profile 1"). read() throws
+  // std::runtime_error("profile line N: ...") on malformed input.
+  void write(std::ostream &os) const;
+  static Profile read(std::istream &is);
+
+  // Hottest blocks, source lines and branches, plus the opcode mix. When
+  // 'source' is given, hot lines are shown with their text.
+  void printReport(std::ostream &os, const std::string *source = nullptr,
+                   size_t top = 10) const;
+};
+
+} // namespace ir
+} // namespace optimix
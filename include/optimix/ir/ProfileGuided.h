@@ -0,0 +1,53 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+#include "optimix/ir/Profile.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace optimix {
+namespace ir {
+
+// Thresholds for the profile-guided passes.
+struct PGOOptions {
+  // A loop is hot when it executes at least this share of all profiled
+  // instructions.
+  double hotFraction = 0.01;
+  // Average iterations per loop entry needed before unrolling pays off.
+  uint64_t minTripCount = 4;
+  unsigned maxUnrollFactor = 4;
+  // Upper bound on the instructions of an unrolled loop.
+  size_t maxUnrolledSize = 96;
+};
+
+// Unrolls hot innermost loops whose profiled trip count is high enough. Each
+// copy of the body re-tests the loop condition, so no trip count needs to be
+// known; the gain is one back-edge jump per unrolled iteration. Runs before
+// SSA construction. Functions without a (matching) profile are left alone.
+class LoopUnrollPass : public FunctionPass {
+public:
+  LoopUnrollPass(const Profile &profile, PGOOptions options = {})
+      : profile(profile), options(options) {}
+  const char *name() const override { return "pgo-unroll"; }
+  void run(Function &func) const override;
+
+private:
+  const Profile &profile;
+  PGOOptions options;
+};
+
+// Orders blocks so that the hottest successor of each block follows it, then
+// drops jumps to the block that now comes next. The IR engine falls through
+// instead of dispatching those jumps.
+class BlockLayoutPass : public FunctionPass {
+public:
+  explicit BlockLayoutPass(const Profile &profile) : profile(profile) {}
+  const char *name() const override { return "pgo-layout"; }
+  void run(Function &func) const override;
+
+private:
+  const Profile &profile;
+};
+
+} // namespace ir
+} // namespace optimix
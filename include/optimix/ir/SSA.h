@@ -1,31 +1,30 @@
 #pragma once
 
 #include "optimix/ir/IR.h"
-#include <map>
-#include <set>
-#include <string>
-#include <vector>
+#include "optimix/ir/PassManager.h"
 
 namespace optimix {
 namespace ir {
 
-class SSAPass {
+// Builds SSA form (Cytron et al.): PHIs go on the iterated dominance
+// frontier of each variable's definitions, restricted to variables that are
+// live into some block (semi-pruned SSA), and a walk of the dominator tree
+// gives every definition its own version. Versions start at 1; version 0
+// stands for the value a variable has on entry (a live-in, or undefined).
+//
+// Existing PHIs and versions are discarded first, so the pass can rebuild
+// SSA after a transformation as long as the versions of one variable were
+// never live at the same time. The pass itself keeps that property, which
+// is what lets the IR engine give all versions of a variable one register
+// and skip PHIs entirely.
+class SSAPass : public FunctionPass {
 public:
-  void run(Function &func);
-
-private:
-  std::map<std::string, int> counter;
-  std::map<std::string, std::vector<int>> stack;
-
-  // Simple dominance-based converter
-  void computeDominance(Function &func);
-  void insertPhiNodes(Function &func);
-  void renameVariables(Function &func, BasicBlock *bb);
-
-  std::string newName(std::string name);
-
-  std::set<BasicBlock *> visited;
+  const char *name() const override { return "ssa"; }
+  void run(Function &func) const override;
 };
 
+// Drops PHIs and resets versions to 0, undoing SSAPass.
+void discardSSA(Function &func);
+
 } // namespace ir
 } // namespace optimix
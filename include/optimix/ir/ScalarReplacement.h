@@ -0,0 +1,30 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// Scalar replacement of small arrays (mem2reg for arrays). An array whose
+// ALLOCAs all have the same constant size of at most kMaxElements, and whose
+// every access uses a constant index within it after an ALLOCA, is split
+// into one variable per element ("%arr[2]"): ALLOCA zeroes them with MOVs,
+// LOAD and STORE become MOVs. SSA is rebuilt afterwards, so the elements
+// get versions and PHIs like any other variable. Element MOVs whose values
+// are never read are then dropped, so only elements that may be read before
+// they are written keep their zeroing. An array whose elements still take
+// more instructions than its ALLOCAs and accesses did is left in memory.
+//
+// Needs SSA form: an index may be a variable defined as a constant through
+// MOVs. Arrays do not outlive the function, except in loops compiled by
+// tier-up, which hand them back to the AST interpreter; do not run it there.
+class ScalarReplacementPass : public FunctionPass {
+public:
+  static constexpr int kMaxElements = 16;
+
+  const char *name() const override { return "sroa"; }
+  void run(Function &func) const override;
+};
+
+} // namespace ir
+} // namespace optimix
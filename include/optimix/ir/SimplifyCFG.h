@@ -0,0 +1,34 @@
+#pragma once
+
+#include "optimix/ir/PassManager.h"
+
+namespace optimix {
+namespace ir {
+
+// Control-flow cleanup (simplifycfg), repeated until nothing changes:
+//  - a JMP_IF on a constant (or an SSA value that is a MOV of one) becomes
+//    a JMP or disappears; blocks no longer reachable are removed;
+//  - a block holding only a JMP is bypassed by its predecessors;
+//  - jump threading: a block that only branches on one of its PHIs is
+//    bypassed by each predecessor for which that PHI is a constant;
+//  - a block is merged into its only predecessor when it is that block's
+//    only successor (single-entry PHIs become MOVs).
+// Then, unless disabled, blocks are reordered so that each one is followed
+// by its likely successor (the one staying in the loop, else the JMP
+// target), and jumps to the next block are dropped. PHIs are kept up to
+// date, so it runs with or without SSA.
+class SimplifyCFGPass : public FunctionPass {
+public:
+  // With a profile, BlockLayoutPass has already ordered the blocks by
+  // measured heat; pass reorder = false to keep that order.
+  explicit SimplifyCFGPass(bool reorder = true) : reorder(reorder) {}
+
+  const char *name() const override { return "simplifycfg"; }
+  void run(Function &func) const override;
+
+private:
+  bool reorder;
+};
+
+} // namespace ir
+} // namespace optimix
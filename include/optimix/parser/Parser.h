@@ -2,7 +2,9 @@
 
 #include "optimix/ast/AST.h"
 #include "optimix/lexer/Lexer.h"
+#include <map>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace optimix {
@@ -11,14 +13,19 @@ class Parser {
 public:
   Parser(Lexer &lexer);
   std::unique_ptr<FunctionAST> parseTopLevel();
+  // Parses every function up to the end of the input.
+  std::unique_ptr<ProgramAST> parseProgram();
 
 private:
   Lexer &lexer;
   Token currentToken;
+  std::map<std::string, size_t> arrayRanks; // Of the current function
 
   void eat(TokenType type);
 
   std::unique_ptr<Expr> parsePrimary();
+  // "(a, b...)" after the name of the function being called.
+  std::unique_ptr<CallExpr> parseCall(const std::string &callee);
   std::unique_ptr<Expr> parseMultiplicative();
   std::unique_ptr<Expr> parseAdditive();
   std::unique_ptr<Expr> parseRelational();
@@ -26,6 +33,10 @@ private:
   parseExpression(); // Ensures public API remains consistent
   // parseExpression will just call parseRelational (lowest precedence)
 
+  // "[e]" one or more times after an array name; checks the count against
+  // the array's earlier declarations.
+  std::vector<std::unique_ptr<Expr>> parseSubscripts(const std::string &array,
+                                                     bool declaration);
   std::unique_ptr<Stmt> parseStatement();
   std::vector<std::unique_ptr<Stmt>> parseBlock();
 };
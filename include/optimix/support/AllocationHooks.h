@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+// Replaces the global allocation functions with ones that report to
+// TimeReport, so that --time-report can count heap allocations. A program
+// opts in by including this header in exactly one of its own translation
+// units; the library never replaces the allocator itself, so programs that
+// link it keep theirs (or jemalloc, tcmalloc, ...).
+
+namespace optimix {
+namespace detail {
+
+// malloc/free, counting each allocation. Defined in TimeReport.cpp: were
+// they inlined here, GCC would see operator new's memory reach free() and
+// warn (-Wmismatched-new-delete).
+void *countedAlloc(std::size_t size);
+void countedFree(void *p) noexcept;
+
+} // namespace detail
+} // namespace optimix
+
+void *operator new(std::size_t size) {
+  if (void *p = optimix::detail::countedAlloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) { return operator new(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return optimix::detail::countedAlloc(size);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return optimix::detail::countedAlloc(size);
+}
+void operator delete(void *p) noexcept { optimix::detail::countedFree(p); }
+void operator delete[](void *p) noexcept {
+  optimix::detail::countedFree(p);
+}
+void operator delete(void *p, std::size_t) noexcept {
+  optimix::detail::countedFree(p);
+}
+void operator delete[](void *p, std::size_t) noexcept {
+  optimix::detail::countedFree(p);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace optimix {
+
+// Recycles the int buffers behind program arrays. Buffers are kept in
+// power-of-two size classes, so an array declared in a loop body, or a
+// frame set up on every call, reuses the buffer its previous instance
+// released instead of going back to the heap. Not thread-safe; use one pool
+// per thread (local()).
+class BufferPool {
+public:
+  // Buffers smaller than this are not worth pooling.
+  static constexpr size_t kMinCapacity = 16;
+  // Nor are buffers of kMinCapacity << kNumClasses elements or more.
+  static constexpr size_t kNumClasses = 22;
+  // Released buffers kept per class; further ones are freed.
+  static constexpr size_t kMaxPerClass = 8;
+
+  // The calling thread's pool.
+  static BufferPool &local();
+
+  // A buffer of 'size' zeroed elements.
+  std::vector<int> acquire(size_t size);
+  // Takes back a buffer; its contents are discarded.
+  void release(std::vector<int> &&buffer);
+
+  // Buffers handed out by acquire() that did not need a new allocation.
+  size_t reused() const { return reuseCount; }
+
+private:
+  std::array<std::vector<std::vector<int>>, kNumClasses> free;
+  size_t reuseCount = 0;
+};
+
+} // namespace optimix
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define OPTIMIX_SANITIZED_STACK 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define OPTIMIX_SANITIZED_STACK 1
+#endif
+#endif
+
+namespace optimix {
+
+// Stack for deep native recursion. The interpreters run each call of the
+// program as a call of their own, so the depth they allow needs a stack of
+// known size: the calling thread's may hold as little as 1 MB (Windows) and
+// is not theirs to choose. They run on a thread started with the stack
+// they need, and before each call check that it still has room, so frames
+// larger than planned for end in an error rather than a crash.
+class DeepStack {
+public:
+#ifdef OPTIMIX_SANITIZED_STACK
+  // AddressSanitizer makes frames 2-4 times larger.
+  static constexpr size_t kFrameScale = 4;
+#else
+  static constexpr size_t kFrameScale = 1;
+#endif
+  // Stack kept free below the last call: what one level of execution may
+  // use besides its frames (throwing, decoding a callee, ...).
+  static constexpr size_t kReserve = 64 * 1024 * kFrameScale;
+
+  // Runs 'fn' with at least 'bytes' of stack: right here if this thread was
+  // started by run() and has that much left, otherwise on a new thread with
+  // a stack of that size, which run() waits for. Rethrows what 'fn' throws.
+  static void run(size_t bytes, const std::function<void()> &fn);
+
+  // Whether this thread was started by run() and has less than kReserve
+  // bytes of stack left. False on other threads, whose size is unknown.
+  static bool exhausted();
+};
+
+} // namespace optimix
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Messages above this level are compiled out of OPTIMIX_LOG entirely
+// (0 = errors only ... 3 = debug). Release builds drop debug messages.
+#ifndef OPTIMIX_MAX_LOG_LEVEL
+#ifdef NDEBUG
+#define OPTIMIX_MAX_LOG_LEVEL 2
+#else
+#define OPTIMIX_MAX_LOG_LEVEL 3
+#endif
+#endif
+
+namespace optimix {
+
+// Ordered from most to least severe.
+enum class LogLevel { ERROR, WARNING, INFO, DEBUG };
+
+const char *logLevelName(LogLevel level);
+
+// Receives every message that passes the level checks. Must be safe to call
+// from several threads.
+class DiagnosticSink {
+public:
+  virtual ~DiagnosticSink() = default;
+  virtual void emit(LogLevel level, const std::string &message) = 0;
+  virtual void flush() {}
+};
+
+// Formats messages as "[WARN] text" lines into a buffer that is written to
+// the stream in one piece when it fills up, when an error or warning
+// arrives, or on flush(). Concurrent messages never interleave.
+class StreamSink : public DiagnosticSink {
+public:
+  explicit StreamSink(std::ostream &os) : os(os) {}
+  ~StreamSink() override { flush(); }
+  void emit(LogLevel level, const std::string &message) override;
+  void flush() override;
+
+private:
+  std::ostream &os;
+  std::mutex lock;
+  std::string buffer;
+};
+
+// Keeps messages in memory; for tests and for callers that report them
+// later.
+class CollectingSink : public DiagnosticSink {
+public:
+  struct Message {
+    LogLevel level;
+    std::string text;
+  };
+  void emit(LogLevel level, const std::string &message) override;
+  std::vector<Message> messages() const;
+
+private:
+  mutable std::mutex lock;
+  std::vector<Message> collected;
+};
+
+namespace detail {
+extern std::atomic<int> runtimeLogLevel;
+} // namespace detail
+
+// The runtime threshold; the default is WARNING, so only problems are
+// reported unless a tool asks for more (e.g. --verbose).
+void setLogLevel(LogLevel level);
+LogLevel logLevel();
+
+// Cheap enough for hot paths: a constant compare and one relaxed load.
+inline bool logEnabled(LogLevel level) {
+  return static_cast<int>(level) <= OPTIMIX_MAX_LOG_LEVEL &&
+         static_cast<int>(level) <=
+             detail::runtimeLogLevel.load(std::memory_order_relaxed);
+}
+
+// Routes messages to 'sink' (null restores the stderr sink) and returns the
+// previous one. The caller keeps ownership.
+DiagnosticSink *setDiagnosticSink(DiagnosticSink *sink);
+// Writes out anything the current sink has buffered.
+void flushDiagnostics();
+
+// Sends 'message' to the current sink if 'level' is enabled. Prefer
+// OPTIMIX_LOG, which skips building the message when it is not.
+void log(LogLevel level, const std::string &message);
+
+} // namespace optimix
+
+#define OPTIMIX_LOG(level, message)                                            \
+  do {                                                                         \
+    if (::optimix::logEnabled(::optimix::LogLevel::level))                     \
+      ::optimix::log(::optimix::LogLevel::level, (message));                   \
+  } while (0)
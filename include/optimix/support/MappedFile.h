@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace optimix {
+
+// Read-only memory mapping of a whole file. Throws std::runtime_error if the
+// file cannot be opened or mapped.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data() const { return base; }
+  size_t size() const { return length; }
+
+private:
+  const char *base = nullptr;
+  size_t length = 0;
+#ifdef _WIN32
+  void *file = nullptr;
+  void *mapping = nullptr;
+#endif
+};
+
+} // namespace optimix
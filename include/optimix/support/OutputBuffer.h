@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+namespace optimix {
+
+// Collects program output (PRINT) and hands it to the stream in large
+// writes instead of one formatted insertion per value. Output reaches the
+// stream when the buffer fills, on flush() and on destruction, so anything
+// written to the same stream by other code must be preceded by a flush().
+class OutputBuffer {
+public:
+  explicit OutputBuffer(std::ostream &os, size_t capacity = 64 * 1024);
+  ~OutputBuffer() { flush(); }
+
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  // Writes 'value' in decimal followed by a newline.
+  void writeLine(int value);
+  void write(const std::string &text);
+  void flush();
+
+private:
+  std::ostream &os;
+  size_t capacity;
+  std::string buffer;
+};
+
+} // namespace optimix
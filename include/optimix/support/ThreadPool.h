@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace optimix {
+
+// Work-stealing thread pool. Each worker owns a deque: it pops its own work
+// from the back and steals from the front of other workers' deques when idle.
+// Tasks submitted from a worker go to that worker's deque; tasks submitted
+// from outside are spread round-robin.
+class ThreadPool {
+public:
+  // 0 threads means one per hardware thread.
+  explicit ThreadPool(unsigned threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task);
+
+  // Blocks until every submitted task has finished. Rethrows the first
+  // exception thrown by a task. Must not be called from inside a task.
+  void wait();
+
+  unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex stateLock;
+  std::condition_variable wake; // Work arrived or shutting down
+  std::condition_variable idle; // pending dropped to zero
+  size_t queued = 0;            // Tasks sitting in some deque
+  size_t pending = 0;           // Tasks submitted but not finished
+  bool stopping = false;
+  std::exception_ptr firstError;
+
+  std::atomic<unsigned> nextQueue{0};
+
+  bool tryTake(unsigned self, std::function<void()> &task);
+  void workerLoop(unsigned self);
+};
+
+} // namespace optimix
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace optimix {
+
+// Collects wall time, CPU time, heap allocation count and peak RSS for the
+// phases of a compile and for each optimization pass (--time-report), and
+// can export them as Chrome trace events (chrome://tracing, Perfetto).
+// Safe to record into from several threads.
+class TimeReport {
+public:
+  enum class Kind {
+    Phase, // Driver stage; CPU time and allocations of the whole process
+    Pass   // One pass on one function; measured on the calling thread
+  };
+
+  TimeReport();
+
+  // Measures the enclosing scope. A null report makes it a no-op, so call
+  // sites do not need to check whether reporting is enabled.
+  class Region {
+  public:
+    Region(TimeReport *report, std::string name, Kind kind = Kind::Phase);
+    ~Region();
+
+    Region(const Region &) = delete;
+    Region &operator=(const Region &) = delete;
+
+  private:
+    TimeReport *report;
+    std::string name;
+    Kind kind;
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart = 0;
+    uint64_t allocStart = 0;
+  };
+
+  // One line per phase, then one per pass (summed over functions).
+  void print(std::ostream &os) const;
+  // Chrome trace-event JSON; every region becomes a complete ("X") event.
+  void writeTrace(std::ostream &os) const;
+
+  // Heap allocations (operator new) made so far by the process / thread.
+  // Only counted in programs that include AllocationHooks.h; 0 otherwise.
+  static uint64_t allocationCount();
+  static uint64_t threadAllocationCount();
+  // Counts one allocation while a TimeReport exists. Called by the
+  // allocation functions of AllocationHooks.h.
+  static void noteAllocation();
+  // Peak resident set size in KB, 0 where unsupported.
+  static long peakRssKB();
+
+private:
+  struct Event {
+    std::string name;
+    Kind kind;
+    double start; // Seconds since the report was created
+    double wall;
+    double cpu;
+    uint64_t allocations;
+    long peakRss;
+    unsigned thread;
+  };
+
+  std::chrono::steady_clock::time_point origin;
+  mutable std::mutex lock;
+  std::vector<Event> events;
+
+  void record(Event event);
+};
+
+} // namespace optimix
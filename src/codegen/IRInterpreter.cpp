@@ -1,224 +1,1138 @@
 #include "optimix/codegen/IRInterpreter.h"
+#include "optimix/support/BufferPool.h"
+#include <algorithm>
+#include <climits>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <unordered_set>
 
 namespace optimix {
 
 int IRInterpreter::execute(const ir::Function &function) {
-  registers.clear();
-  memory.clear();
-  lastBlock = nullptr;
+  ExecState state;
+  try {
+    return execute(function, state);
+  } catch (const std::runtime_error &e) {
+    std::cerr << "Runtime Error: " << e.what() << ".\n";
+    return -1;
+  }
+}
+
+int IRInterpreter::execute(const ir::Function &function, ExecState &state) {
+  bool calls = false;
+  for (const auto &bb : function.blocks)
+    for (const auto &inst : bb->instructions)
+      calls |= inst.op == ir::OpCode::CALL;
+  if (!calls)
+    return executeHere(function, state);
+  int result = 0;
+  DeepStack::run(kStackBytes, [&] { result = executeHere(function, state); });
+  return result;
+}
 
-  if (function.blocks.empty())
+int IRInterpreter::executeHere(const ir::Function &function,
+                               ExecState &state) {
+  root = this;
+  rootFunction = &function;
+  callees.clear();
+  callDepth = 0;
+  decode(function, state);
+  state.returned = false;
+  executed = 0;
+  if (blocks.empty())
     return 0;
 
-  ir::BasicBlock *currentBlock = function.blocks.front().get();
-
-  while (currentBlock) {
-    // PHI Node Handling:
-    // We must process PHI nodes *before* executing other instructions in the
-    // block, but based on where we came from (lastBlock). However, in this
-    // simple IR, PHI nodes are just instructions at the start. Real CPU/VMs
-    // execute them in parallel. We'll do a lookahead or just standard execution
-    // if the PHI instruction correctly grabs values based on 'lastBlock'.
-    // Let's rely on the instruction execution loop to handle PHI.
-
-    // Save current block as 'prev' for the next transition,
-    // BUT we need to update 'lastBlock' only after we *leave* this block.
-    // So we'll use a temp variable.
-    ir::BasicBlock *nextBlock = nullptr;
-    ir::BasicBlock *prevBlockForPhi = lastBlock;
-
-    // Execute instructions
-    for (const auto &inst : currentBlock->instructions) {
-      if (inst.op == ir::OpCode::PHI) {
-        // PHI args are (value, label), (value, label)...
-        // We find the label passing the match
-        std::string labelNeeded = prevBlockForPhi ? prevBlockForPhi->label : "";
-
-        // Find the operand corresponding to the predecessor label
-        bool found = false;
-        // The operands in PHI are pairs: [Value, Label, Value, Label...]
-        // Wait, looking at IRBuilder/SSA, how are PHI nodes constructed?
-        // Usually PHIs have a list of (Value, Block).
-        // Let's assume operands are stored as: [Val1, Label1, Val2, Label2...]
-        // We need to check IR definition.
-        // Based on typical SSA, we look for the value coming from
-        // 'labelNeeded'.
-
-        // IR.h: Instruction has std::vector<Operand> operands.
-        // We need to verify how we emit PHI in SSA.cpp.
-        // Assuming standard (Val, Label) pairs.
-
-        for (size_t i = 0; i < inst.operands.size(); i += 2) {
-          if (i + 1 < inst.operands.size()) {
-            std::string valLabel = inst.operands[i + 1].value;
-            if (valLabel == labelNeeded) {
-              int val = getVal(inst.operands[i]);
-              setVal(inst.result.value, val);
-              found = true;
-              break;
-            }
-          }
-        }
+  // Seed live-ins from the caller's state.
+  for (const auto &var : state.variables) {
+    auto it = slotIndex.find(var.first);
+    if (it != slotIndex.end()) {
+      registers[it->second] = var.second;
+      exported[it->second] = true;
+    }
+  }
+  for (const auto &arr : state.arrays) {
+    auto it = arrayIndex.find(arr.first);
+    if (it != arrayIndex.end()) {
+      Array &a = arrays[it->second];
+      std::copy(arr.second.begin(), arr.second.end(),
+                memory.begin() + a.base);
+      a.size = arr.second.size();
+      a.allocated = true;
+    }
+  }
 
-        // If not found (e.g. entry block or missing path), maybe default to 0
-        // or error? In valid SSA, it should be found.
-        if (!found && !prevBlockForPhi) {
-          // Entry block PHI? Should not happen usually unless loops back to
-          // entry.
-        }
+  std::unique_ptr<OutputBuffer> ownOutput;
+  if (!output)
+    ownOutput = std::make_unique<OutputBuffer>(std::cout);
+  OutputBuffer &out = output ? *output : *ownOutput;
+
+  if (profile) {
+    counts.assign(code.size(), 0);
+    taken.assign(code.size(), 0);
+  }
+  int *r = registers.data();
+  enterBlock(0, -1, r);
+  size_t entry = blocks[0].entry;
+  uint64_t steps = 0;
+  int result;
+  try {
+    result = runBody(entry, r, steps, state.returned, out);
+  } catch (...) {
+    executed = steps;
+    if (profile) {
+      recordProfile(); // Keep what ran before the fault
+      for (auto &callee : callees)
+        callee.second->recordProfile();
+    }
+    BufferPool::local().release(std::move(memory));
+    throw;
+  }
+  executed = steps;
+  if (profile) {
+    recordProfile();
+    for (auto &callee : callees)
+      callee.second->recordProfile();
+  }
+
+  // Hand the final values back.
+  for (size_t i = 0; i < registers.size(); ++i) {
+    if (exported[i])
+      state.variables[slotNames[i]] = registers[i];
+  }
+  for (size_t i = 0; i < arrays.size(); ++i) {
+    const Array &a = arrays[i];
+    if (a.allocated)
+      state.arrays[arrayNames[i]].assign(memory.begin() + a.base,
+                                         memory.begin() + a.base + a.size);
+  }
+  BufferPool::local().release(std::move(memory));
+  return result;
+}
+
+int IRInterpreter::slotFor(const ir::Operand &op) {
+  if (op.type == ir::Operand::CONSTANT) {
+    int val = std::stoi(op.value);
+    auto it = constIndex.find(val);
+    if (it != constIndex.end())
+      return it->second;
+    int slot = registers.size();
+    registers.push_back(val);
+    slotNames.emplace_back();
+    exported.push_back(false);
+    constIndex[val] = slot;
+    return slot;
+  }
+
+  auto it = slotIndex.find(op.value);
+  if (it != slotIndex.end())
+    return it->second;
+  int slot = registers.size();
+  registers.push_back(0);
+  slotNames.push_back(op.value);
+  exported.push_back(false);
+  slotIndex[op.value] = slot;
+  return slot;
+}
+
+int IRInterpreter::arrayFor(const std::string &name) {
+  auto it = arrayIndex.find(name);
+  if (it != arrayIndex.end())
+    return it->second;
+  int id = arrays.size();
+  arrays.emplace_back();
+  arrayNames.push_back(name);
+  arrayIndex[name] = id;
+  return id;
+}
+
+void IRInterpreter::layoutArrays(const ir::Function &function,
+                                 const ExecState &state) {
+  for (const auto &bb : function.blocks)
+    for (const auto &inst : bb->instructions) {
+      if (inst.operands.empty() || !ir::isArrayOperand(inst.op, 0))
         continue;
-      }
+      Array &a = arrays[arrayFor(inst.operands[0].value)];
+      if (inst.op != ir::OpCode::ALLOCA)
+        continue;
+      const ir::Operand &size = inst.operands[1];
+      if (size.type == ir::Operand::CONSTANT)
+        a.capacity = std::max(a.capacity, std::stoi(size.value));
+      else
+        a.fixed = false;
+    }
+  for (const auto &arr : state.arrays) {
+    auto it = arrayIndex.find(arr.first);
+    if (it != arrayIndex.end()) {
+      Array &a = arrays[it->second];
+      a.capacity = std::max<int>(a.capacity, arr.second.size());
+    }
+  }
 
-      // Arithmetic
-      if (inst.op == ir::OpCode::ADD) {
-        setVal(inst.result.value,
-               getVal(inst.operands[0]) + getVal(inst.operands[1]));
-      } else if (inst.op == ir::OpCode::SUB) {
-        setVal(inst.result.value,
-               getVal(inst.operands[0]) - getVal(inst.operands[1]));
-      } else if (inst.op == ir::OpCode::MUL) {
-        setVal(inst.result.value,
-               getVal(inst.operands[0]) * getVal(inst.operands[1]));
-      } else if (inst.op == ir::OpCode::DIV) {
-        int r = getVal(inst.operands[1]);
-        setVal(inst.result.value, r != 0 ? getVal(inst.operands[0]) / r : 0);
-      }
-      // Moves / Copy
-      else if (inst.op == ir::OpCode::MOV) {
-        setVal(inst.result.value, getVal(inst.operands[0]));
-      }
-      // I/O
-      else if (inst.op == ir::OpCode::PRINT) {
-        std::cout << getVal(inst.operands[0]) << "\n";
-      }
-      // Control Flow
-      else if (inst.op == ir::OpCode::JMP) {
-        // Unconditional jump
-        // Target is in operands[0] (Label)
-        std::string targetLabel = inst.operands[0].value;
-        // Find block
-        for (auto &b : function.blocks) {
-          if (b->label == targetLabel) {
-            nextBlock = b.get();
-            break;
-          }
-        }
-        break; // Stop executing instructions in this block
-      } else if (inst.op == ir::OpCode::JMP_IF) {
-        // Condition is op[1], Target is op[0]
-        // Wait, usually JMP_IF target, cond.
-        // Let's check IR.h: createCondBranch(OpCode o, Operand target, Operand
-        // cond) so operands[0] = target, operands[1] = cond.
-
-        // Actually JMP_IF usually implies "Jump if False" or "Jump if True"?
-        // Let's assume Jump if True (Non-zero).
-        // But usually we have a fallthrough.
-        // Blocks end with specific terminators.
-
-        int cond = getVal(inst.operands[1]);
-        if (cond) {
-          std::string targetLabel = inst.operands[0].value;
-          for (auto &b : function.blocks) {
-            if (b->label == targetLabel) {
-              nextBlock = b.get();
-              break;
-            }
-          }
-          break; // Taken branch
-        }
-        // Fallthrough if not taken?
-        // In strict BasicBlock structure, we might fallthrough to the strictly
-        // next block if the JMP_IF doesn't have an 'else'. But usually blocks
-        // end with JMP_IF ... then JMP ... Or simply fall through to the
-        // textually next block. We need to implement finding the next block in
-        // the list if we don't jump.
-      } else if (inst.op == ir::OpCode::RET) {
-        int val = inst.operands.empty() ? 0 : getVal(inst.operands[0]);
-        return val;
-      }
-      // Comparisons
-      else if (inst.op == ir::OpCode::LT) {
-        setVal(inst.result.value,
-               getVal(inst.operands[0]) < getVal(inst.operands[1]));
-      } else if (inst.op == ir::OpCode::GT) {
-        setVal(inst.result.value,
-               getVal(inst.operands[0]) > getVal(inst.operands[1]));
-      } else if (inst.op == ir::OpCode::EQ) {
-        setVal(inst.result.value,
-               getVal(inst.operands[0]) == getVal(inst.operands[1]));
-      } else if (inst.op == ir::OpCode::NEQ) {
-        setVal(inst.result.value,
-               getVal(inst.operands[0]) != getVal(inst.operands[1]));
-      }
-      // Memory / Arrays
-      else if (inst.op == ir::OpCode::ALLOCA) {
+  size_t top = 0;
+  for (Array &a : arrays) {
+    a.base = top;
+    top += a.capacity;
+  }
+  BufferPool &pool = BufferPool::local();
+  pool.release(std::move(memory));
+  memory = pool.acquire(top);
+}
+
+void IRInterpreter::arrayFault(int id) const {
+  if (!arrays[id].allocated)
+    throw std::runtime_error("Array " + arrayNames[id] + " not found");
+  throw std::runtime_error("Index out of bounds");
+}
+
+void IRInterpreter::decode(const ir::Function &function,
+                           const ExecState &state) {
+  code.clear();
+  blocks.clear();
+  parLoops.clear();
+  callSites.clear();
+  memoEntries.clear();
+  memoValid.clear();
+  registers.clear();
+  slotNames.clear();
+  exported.clear();
+  arrayNames.clear();
+  arrays.clear();
+  slotIndex.clear();
+  constIndex.clear();
+  arrayIndex.clear();
+  layoutArrays(function, state);
+  arrayLayout = arrays;
+  frameMemory = memory.size();
+  functionName = function.name;
+  blockLabels.clear();
+  codeLines.clear();
+
+  // Registers are per variable, not per SSA version (SSAPass never keeps
+  // two versions of a variable live at once), so a PHI that only merges
+  // versions of its own variable is a no-op and is dropped.
+  auto isNoOp = [](const ir::Instruction &phi) {
+    for (size_t i = 0; i < phi.operands.size(); i += 2)
+      if (phi.operands[i].type != ir::Operand::VARIABLE ||
+          phi.operands[i].value != phi.result.value)
+        return false;
+    return true;
+  };
+
+  // The jump that leaves a parallel loop's header also ends a chunk.
+  std::unordered_set<std::string> parHeaders;
+  for (const auto &bb : function.blocks)
+    for (const auto &inst : bb->instructions)
+      if (inst.op == ir::OpCode::PARFOR && !profile)
+        parHeaders.insert(inst.operands[0].value);
+
+  std::unordered_map<std::string, int> blockIndex;
+  std::vector<bool> hasPhis;
+  int numBlocks = 0;
+  for (const auto &bb : function.blocks) {
+    blockIndex[bb->label] = numBlocks++;
+    blockLabels.push_back(bb->label);
+    bool phis = false;
+    for (const auto &inst : bb->instructions)
+      if (inst.op == ir::OpCode::PHI && !isNoOp(inst))
+        phis = true;
+    hasPhis.push_back(phis);
+  }
+  blocks.resize(function.blocks.size());
+
+  // Code is laid out in block order, so a jump to the next block can be
+  // dropped and execution runs straight into it, unless PHIs there need to
+  // know the predecessor. Profiling keeps every jump so edges are counted.
+  auto fallsThrough = [&](int from, int to) {
+    return !profile && to == from + 1 && to < numBlocks && !hasPhis[to];
+  };
+
+  auto targetOf = [&](const ir::Operand &label) {
+    auto it = blockIndex.find(label.value);
+    if (it == blockIndex.end())
+      throw std::runtime_error("Unknown label " + label.value);
+    return it->second;
+  };
+
+  int bi = 0;
+  for (const auto &bb : function.blocks) {
+    blocks[bi].entry = code.size();
+    bool terminated = false;
+
+    for (const auto &inst : bb->instructions) {
+      Inst d;
+      d.block = bi;
+      switch (inst.op) {
+      case ir::OpCode::ADD:
+      case ir::OpCode::SUB:
+      case ir::OpCode::MUL:
+      case ir::OpCode::DIV:
+      case ir::OpCode::LT:
+      case ir::OpCode::GT:
+      case ir::OpCode::EQ:
+      case ir::OpCode::NEQ:
+      case ir::OpCode::SHL:
+      case ir::OpCode::SHR:
+      case ir::OpCode::MULH: {
+        static const Op binOps[] = {Op::ADD, Op::SUB, Op::MUL, Op::DIV, Op::MOV,
+                                    Op::LT,  Op::GT,  Op::EQ,  Op::NEQ};
+        static const Op shiftOps[] = {Op::SHL, Op::SHR, Op::MULH};
+        int op = static_cast<int>(inst.op);
+        int shl = static_cast<int>(ir::OpCode::SHL);
+        d.op = op < shl ? binOps[op] : shiftOps[op - shl];
+        d.dst = slotFor(inst.result);
+        d.a = slotFor(inst.operands[0]);
+        d.b = slotFor(inst.operands[1]);
+        break;
+      }
+      case ir::OpCode::MOV:
+        d.op = Op::MOV;
+        d.dst = slotFor(inst.result);
+        d.a = slotFor(inst.operands[0]);
+        exported[d.dst] = true;
+        break;
+      case ir::OpCode::JMP:
+        d.op = parHeaders.count(bb->label) ? Op::PAREND : Op::JMP;
+        d.target = targetOf(inst.operands[0]);
+        terminated = true;
+        break;
+      case ir::OpCode::JMP_IF:
+        d.op = Op::JMP_IF;
+        d.target = targetOf(inst.operands[0]);
+        d.a = slotFor(inst.operands[1]);
+        break;
+      case ir::OpCode::RET:
+        d.op = Op::RET;
+        d.a = slotFor(inst.operands.empty() ? ir::Operand::makeConst(0)
+                                            : inst.operands[0]);
+        terminated = true;
+        break;
+      case ir::OpCode::PRINT:
+        d.op = Op::PRINT;
+        d.a = slotFor(inst.operands[0]);
+        break;
+      case ir::OpCode::ALLOCA:
         // ALLOCA name, size
-        std::string name = inst.operands[0].value;
-        int size = getVal(inst.operands[1]);
-        memory[name] = std::vector<int>(size, 0);
-      } else if (inst.op == ir::OpCode::STORE) {
-        // STORE name, idx, val
-        std::string name = inst.operands[0].value;
-        int idx = getVal(inst.operands[1]);
-        int val = getVal(inst.operands[2]);
-        if (memory.find(name) == memory.end()) {
-          // Runtime error: Array not found
-          std::cerr << "Runtime Error: Array " << name << " not found.\n";
-          return -1;
-        }
-        if (idx < 0 || idx >= memory[name].size()) {
-          std::cerr << "Runtime Error: Index out of bounds.\n";
-          return -1;
-        }
-        memory[name][idx] = val;
-      } else if (inst.op == ir::OpCode::LOAD) {
+        d.op = Op::ALLOCA;
+        d.dst = arrayFor(inst.operands[0].value);
+        d.a = slotFor(inst.operands[1]);
+        break;
+      case ir::OpCode::LOAD:
+      case ir::OpCode::LOAD_UNCHECKED: {
         // LOAD dest, name, idx
-        std::string name = inst.operands[0].value;
-        int idx = getVal(inst.operands[1]);
-        if (memory.find(name) == memory.end()) {
-          std::cerr << "Runtime Error: Array " << name << " not found.\n";
-          return -1;
-        }
-        if (idx < 0 || idx >= memory[name].size()) {
-          std::cerr << "Runtime Error: Index out of bounds.\n";
-          return -1;
-        }
-        setVal(inst.result.value, memory[name][idx]);
+        int id = arrayFor(inst.operands[0].value);
+        bool fixed = arrays[id].fixed;
+        d.op = inst.op == ir::OpCode::LOAD ? Op::LOAD
+               : fixed                     ? Op::LOAD_UNCHECKED
+                                           : Op::LOAD_UNCHECKED_DYN;
+        d.dst = slotFor(inst.result);
+        d.c = d.op == Op::LOAD_UNCHECKED ? arrays[id].base : id;
+        d.a = slotFor(inst.operands[1]);
+        break;
+      }
+      case ir::OpCode::STORE:
+      case ir::OpCode::STORE_UNCHECKED: {
+        // STORE name, idx, val
+        int id = arrayFor(inst.operands[0].value);
+        bool fixed = arrays[id].fixed;
+        d.op = inst.op == ir::OpCode::STORE ? Op::STORE
+               : fixed                      ? Op::STORE_UNCHECKED
+                                            : Op::STORE_UNCHECKED_DYN;
+        d.dst = d.op == Op::STORE_UNCHECKED ? arrays[id].base : id;
+        d.a = slotFor(inst.operands[1]);
+        d.b = slotFor(inst.operands[2]);
+        break;
+      }
+      case ir::OpCode::SELECT:
+        d.op = Op::SELECT;
+        d.dst = slotFor(inst.result);
+        d.a = slotFor(inst.operands[0]);
+        d.b = slotFor(inst.operands[1]);
+        d.c = slotFor(inst.operands[2]);
+        break;
+      case ir::OpCode::INBOUNDS:
+        // INBOUNDS g, name, first, end, lo, hi
+        d.op = Op::INBOUNDS;
+        d.dst = slotFor(inst.result);
+        d.c = arrayFor(inst.operands[0].value);
+        d.a = slotFor(inst.operands[1]);
+        d.b = slotFor(inst.operands[2]);
+        d.target = slotFor(inst.operands[3]);
+        d.block = slotFor(inst.operands[4]);
+        break;
+      case ir::OpCode::PARFOR: {
+        // PARFOR header, iv, end, sums...
+        ParLoop loop;
+        loop.header = targetOf(inst.operands[0]);
+        loop.iv = slotFor(inst.operands[1]);
+        loop.end = slotFor(inst.operands[2]);
+        for (size_t i = 3; i < inst.operands.size(); ++i)
+          loop.sums.push_back(slotFor(inst.operands[i]));
+        d.op = Op::PARFOR;
+        d.dst = parLoops.size();
+        parLoops.push_back(std::move(loop));
+        break;
+      }
+      case ir::OpCode::CALL: {
+        // CALL dst, callee, args...
+        const std::string &name = inst.operands[0].value;
+        CallSite site;
+        site.function = module ? module->getFunction(name) : nullptr;
+        if (!site.function)
+          throw std::runtime_error("Call to undefined function " + name);
+        if (inst.operands.size() - 1 != site.function->params.size())
+          throw std::runtime_error("Wrong number of arguments to " + name);
+        for (size_t i = 1; i < inst.operands.size(); ++i)
+          site.args.push_back(slotFor(inst.operands[i]));
+        d.op = Op::CALL;
+        d.dst = slotFor(inst.result);
+        d.a = callSites.size();
+        callSites.push_back(std::move(site));
+        break;
+      }
+      case ir::OpCode::MEMO: {
+        // Rounded down to a power of two, so the hash can be masked.
+        int size = std::max(std::stoi(inst.operands[0].value), 1);
+        while (size & (size - 1))
+          size &= size - 1;
+        memoValid.assign(size, false);
+        memoEntries.assign(size * (function.params.size() + 1), 0);
+        continue;
+      }
+      case ir::OpCode::PHI: {
+        // PHI operands are (value, label) pairs; they are resolved when the
+        // block is entered, based on the predecessor we came from.
+        if (isNoOp(inst))
+          continue;
+        Phi phi;
+        phi.dst = slotFor(inst.result);
+        for (size_t i = 0; i + 1 < inst.operands.size(); i += 2)
+          phi.incoming.emplace_back(targetOf(inst.operands[i + 1]),
+                                    slotFor(inst.operands[i]));
+        blocks[bi].phis.push_back(std::move(phi));
+        continue;
       }
+      default:
+        continue; // No runtime semantics (e.g. CALL)
+      }
+      if (d.op != Op::JMP || !fallsThrough(bi, d.target)) {
+        code.push_back(d);
+        codeLines.push_back(inst.line);
+      }
+      if (terminated)
+        break; // Anything after a terminator is unreachable
     }
 
-    lastBlock = currentBlock;
+    if (!terminated && !fallsThrough(bi, bi + 1)) {
+      // Make the fallthrough explicit so execution never searches for it.
+      Inst d;
+      d.block = bi;
+      if (bi + 1 < static_cast<int>(blocks.size())) {
+        d.op = Op::JMP;
+        d.target = bi + 1;
+      } else {
+        d.op = Op::HALT;
+      }
+      code.push_back(d);
+      codeLines.push_back(0);
+    }
+    ++bi;
+  }
+  params.clear();
+  for (const auto &param : function.params)
+    params.push_back(slotFor(ir::Operand::makeVar(param)));
+  if (!profile)
+    fuse(hasPhis);
+  initialRegisters = registers;
+}
 
-    if (nextBlock) {
-      currentBlock = nextBlock;
-    } else {
-      // Fallthrough logic: Find the next block in the list
-      bool foundCurrent = false;
-      ir::BasicBlock *fallthrough = nullptr;
-      for (auto &b : function.blocks) {
-        if (foundCurrent) {
-          fallthrough = b.get();
-          break;
+void IRInterpreter::fuse(const std::vector<bool> &hasPhis) {
+  std::vector<bool> isEntry(code.size() + 1, false);
+  for (const Block &b : blocks)
+    isEntry[b.entry] = true;
+  // The constant a slot holds, for the immediate forms.
+  auto constant = [&](int slot, int &value) {
+    if (slot < 0 || !slotNames[slot].empty())
+      return false;
+    value = registers[slot];
+    return true;
+  };
+  auto isCompare = [](Op op) {
+    return op == Op::LT || op == Op::GT || op == Op::EQ || op == Op::NEQ;
+  };
+  // Times each slot is read; a fused sequence may skip writing a temp only
+  // if nothing else reads it.
+  std::vector<int> reads(registers.size(), 0);
+  for (const Inst &in : code) {
+    switch (in.op) {
+    case Op::JMP:
+    case Op::HALT:
+    case Op::PARFOR:
+    case Op::PAREND:
+    case Op::CALL:
+      break;
+    case Op::SELECT:
+      ++reads[in.a];
+      ++reads[in.b];
+      ++reads[in.c];
+      break;
+    case Op::INBOUNDS:
+      ++reads[in.target];
+      ++reads[in.block];
+      [[fallthrough]];
+    case Op::ADD:
+    case Op::SUB:
+    case Op::MUL:
+    case Op::DIV:
+    case Op::LT:
+    case Op::GT:
+    case Op::EQ:
+    case Op::NEQ:
+    case Op::STORE:
+    case Op::STORE_UNCHECKED:
+    case Op::STORE_UNCHECKED_DYN:
+    case Op::SHL:
+    case Op::SHR:
+    case Op::MULH:
+      ++reads[in.b];
+      [[fallthrough]];
+    default:
+      ++reads[in.a];
+      break;
+    }
+  }
+  for (const Block &b : blocks)
+    for (const Phi &phi : b.phis)
+      for (const auto &in : phi.incoming)
+        ++reads[in.second];
+  for (const CallSite &site : callSites)
+    for (int arg : site.args)
+      ++reads[arg];
+  for (const ParLoop &loop : parLoops) {
+    ++reads[loop.iv];
+    ++reads[loop.end];
+    for (int s : loop.sums)
+      ++reads[s];
+  }
+  auto isShift = [&](const Inst *in, int from, int amount) {
+    int value;
+    return in && in->op == Op::SHR && in->a == from &&
+           constant(in->b, value) && (value == amount || amount < 0);
+  };
+
+  std::vector<Inst> out;
+  std::vector<int> lines;
+  std::vector<int> newPc(code.size() + 1);
+  for (size_t pc = 0; pc < code.size();) {
+    newPc[pc] = out.size();
+    const Inst &in = code[pc];
+    // The instruction 'k' after this one, if nothing can jump between them.
+    auto next = [&](size_t k) -> const Inst * {
+      size_t p = pc + k;
+      if (p >= code.size() || isEntry[p] || code[p].block != in.block)
+        return nullptr;
+      return &code[p];
+    };
+    const Inst *n1 = next(1), *n2 = n1 ? next(2) : nullptr;
+    Inst f = in;
+    int magic = 0;
+    size_t used = 1;
+
+    int imm = 0;
+    bool immediate = false;
+    if (in.op == Op::ADD) {
+      if (constant(in.b, imm)) {
+        immediate = true;
+      } else if (constant(in.a, imm)) {
+        immediate = true;
+        f.a = in.b;
+      }
+    } else if (in.op == Op::SUB && constant(in.b, imm) && imm != INT_MIN) {
+      immediate = true;
+      imm = -imm;
+    }
+
+    // The SELECT operand that is not this instruction's result.
+    int kept = -1;
+    if (n1 && n1->op == Op::SELECT)
+      kept = n1->b == in.dst ? n1->c : n1->b;
+
+    if (in.op == Op::MULH && constant(in.b, magic) && in.dst != in.a) {
+      // InstCombine's division by a constant:
+      //   MULH h, x, M [; ADD/SUB h', h, x] [; SHR q, h', s];
+      //   SHR sign, q, 31; SUB r, q, sign
+      std::vector<const Inst *> seq = {&in};
+      int variant = 0, shift = 0;
+      const Inst *n = n1;
+      if (n && (n->op == Op::ADD || n->op == Op::SUB) && n->a == in.dst &&
+          n->b == in.a) {
+        variant = n->op == Op::ADD ? 1 : -1;
+        seq.push_back(n);
+        n = next(seq.size());
+      }
+      const Inst *after = n ? next(seq.size() + 1) : nullptr;
+      if (isShift(n, seq.back()->dst, -1) &&
+          isShift(after, n->dst, 31)) {
+        constant(n->b, shift);
+        seq.push_back(n);
+        n = after;
+      }
+      const Inst *sub = n ? next(seq.size() + 1) : nullptr;
+      bool matched = isShift(n, seq.back()->dst, 31) && sub &&
+                     sub->op == Op::SUB && sub->a == seq.back()->dst &&
+                     sub->b == n->dst;
+      if (matched) {
+        seq.push_back(n);
+        // Every temp must be read only by the next step of the sequence
+        // (q twice), must not be a variable, and must not be x.
+        for (size_t k = 0; k < seq.size(); ++k) {
+          int t = seq[k]->dst;
+          int expected = k + 2 == seq.size() ? 2 : 1;
+          matched = matched && t != in.a && !exported[t] &&
+                    reads[t] == expected;
         }
-        if (b.get() == currentBlock)
-          foundCurrent = true;
       }
-      currentBlock = fallthrough;
+      if (matched) {
+        f.op = Op::DIV_MAGIC;
+        f.dst = sub->dst;
+        f.b = magic;
+        f.c = shift;
+        f.target = variant;
+        used = seq.size() + 1;
+      }
+    }
+    if (used > 1) {
+      // Fused above
+    } else if (isCompare(in.op) && n1 && n1->op == Op::JMP_IF &&
+        n1->a == in.dst && !hasPhis[n1->target]) {
+      // LT t, a, b; JMP_IF x, t [; JMP y]
+      static const Op branch[] = {Op::BR_LT, Op::BR_GT, Op::BR_EQ, Op::BR_NE};
+      f.op = branch[static_cast<int>(in.op) - static_cast<int>(Op::LT)];
+      f.target = n1->target;
+      f.c = -1; // Falls through to the next instruction
+      used = 2;
+      if (n2 && n2->op == Op::JMP && !hasPhis[n2->target]) {
+        f.c = n2->target;
+        used = 3;
+      }
+    } else if (immediate && n1 && n1->op == Op::LOAD_UNCHECKED &&
+               n1->a == in.dst) {
+      // ADD t, i, C; LOAD_UNCHECKED x, arr, t
+      f.op = Op::LOAD_OFF;
+      f.dst = n1->dst;
+      f.b = in.dst;
+      f.c = n1->c + imm;
+      f.target = imm;
+      used = 2;
+    } else if (immediate && n1 && n1->op == Op::STORE_UNCHECKED &&
+               n1->a == in.dst) {
+      // ADD t, i, C; STORE_UNCHECKED arr, t, v
+      f.op = Op::STORE_OFF;
+      f.dst = n1->dst + imm;
+      f.b = n1->b;
+      f.c = in.dst;
+      f.target = imm;
+      used = 2;
+    } else if (in.op == Op::ADD && n1 && n1->op == Op::SELECT &&
+               n1->a != in.dst && (n1->b == in.dst) != (n1->c == in.dst) &&
+               reads[in.dst] == 1 && !exported[in.dst] &&
+               (kept == in.a || kept == in.b)) {
+      // ADD t, x, y; SELECT z, c, t, x (or c, x, t)
+      f.op = Op::ADD_IF;
+      f.dst = n1->dst;
+      f.a = kept;
+      f.b = kept == in.a ? in.b : in.a;
+      f.c = n1->a;
+      f.target = n1->b == in.dst;
+      used = 2;
+    } else if ((immediate || in.op == Op::ADD) && n1 && n1->op == Op::MOV &&
+               n1->a == in.dst) {
+      // ADD t, x, y; MOV z, t
+      f.op = immediate ? Op::ADDI_MOV : Op::ADD_MOV;
+      f.c = n1->dst;
+      if (immediate)
+        f.b = imm;
+      used = 2;
+    } else if (immediate) {
+      f.op = Op::ADDI;
+      f.b = imm;
+    } else if (in.op == Op::LOAD_UNCHECKED && n1 && n1->op == Op::ADD &&
+               (n1->a == in.dst || n1->b == in.dst)) {
+      // LOAD_UNCHECKED t, arr, i; ADD x, y, t
+      f.op = Op::LOAD_ADD;
+      f.b = n1->a == in.dst ? n1->b : n1->a;
+      f.target = n1->dst;
+      used = 2;
     }
+
+    out.push_back(f);
+    lines.push_back(codeLines[pc]);
+    for (size_t k = 1; k < used; ++k)
+      newPc[pc + k] = out.size() - 1;
+    pc += used;
   }
-  return 0;
+  newPc[code.size()] = out.size();
+
+  for (Block &b : blocks)
+    b.entry = newPc[b.entry];
+  for (size_t pc = 0; pc < out.size(); ++pc) {
+    Inst &f = out[pc];
+    if (f.op >= Op::BR_LT && f.op <= Op::BR_NE) {
+      f.target = blocks[f.target].entry;
+      f.c = f.c < 0 ? pc + 1 : blocks[f.c].entry;
+    }
+  }
+  code = std::move(out);
+  codeLines = std::move(lines);
 }
 
-int IRInterpreter::getVal(const ir::Operand &op) {
-  if (op.type == ir::Operand::CONSTANT) {
-    return std::stoi(op.value);
+void IRInterpreter::enterBlock(int target, int from, int *r) {
+  auto &phis = blocks[target].phis;
+  if (phis.empty())
+    return;
+  // PHIs of a block execute in parallel: read every incoming value first.
+  std::vector<std::pair<int, int>> moves;
+  for (const auto &phi : phis) {
+    for (const auto &in : phi.incoming) {
+      if (in.first == from) {
+        moves.emplace_back(phi.dst, r[in.second]);
+        break;
+      }
+    }
+  }
+  for (const auto &m : moves)
+    r[m.first] = m.second;
+}
+
+namespace {
+
+// Work (dispatched instructions) the rest of a parallel loop must be
+// expected to take before it is split up; below that, handing out chunks
+// and merging their registers costs more than it saves.
+const uint64_t kMinParallelSteps = 1 << 16;
+// Chunks per pool thread, so that threads that finish early can steal.
+const int kChunksPerThread = 4;
+
+[[noreturn]] void chunkFault() {
+  throw std::runtime_error(
+      "Parallel loop may not print, call, allocate or return");
+}
+
+} // namespace
+
+bool IRInterpreter::runParallel(const ParLoop &loop, int *r, uint64_t &steps,
+                                OutputBuffer &out) {
+  int64_t first = r[loop.iv], end = r[loop.end];
+  unsigned threads = pool->size();
+  if (threads < 2 || end - first < 2)
+    return false;
+
+  // Run the first iteration here and see what one costs.
+  size_t entry = blocks[loop.header].entry;
+  uint64_t before = steps;
+  bool returned;
+  r[loop.end] = first + 1;
+  run<false, true>(entry, r, steps, returned, out);
+  r[loop.end] = end;
+  int64_t trip = end - ++first;
+  if ((steps - before) * trip < kMinParallelSteps)
+    return false;
+
+  // Each chunk starts from a copy of the registers with its own range and
+  // its sums at 0.
+  int chunks = std::min<int64_t>(trip, int64_t(threads) * kChunksPerThread);
+  std::vector<std::vector<int>> frames(chunks);
+  std::vector<uint64_t> chunkSteps(chunks, 0);
+  std::vector<std::exception_ptr> faults(chunks);
+  for (int c = 0; c < chunks; ++c)
+    pool->submit([&, c] {
+      try {
+        std::vector<int> &frame = frames[c];
+        frame.assign(r, r + registers.size());
+        frame[loop.iv] = first + trip * c / chunks;
+        frame[loop.end] = first + trip * (c + 1) / chunks;
+        for (int s : loop.sums)
+          frame[s] = 0;
+        bool ignored;
+        run<false, true>(entry, frame.data(), chunkSteps[c], ignored, out);
+      } catch (...) {
+        faults[c] = std::current_exception();
+      }
+    });
+  pool->wait();
+  for (uint64_t n : chunkSteps)
+    steps += n;
+  // A chunk stops at its first fault, so the first chunk with one has the
+  // fault a sequential run would have hit.
+  for (const auto &fault : faults)
+    if (fault)
+      std::rethrow_exception(fault);
+
+  // The last chunk ran the last iteration, so its registers are what the
+  // loop leaves behind, except for the sums.
+  std::vector<uint32_t> totals;
+  for (int s : loop.sums) {
+    uint32_t total = r[s];
+    for (const auto &frame : frames)
+      total += static_cast<uint32_t>(frame[s]);
+    totals.push_back(total);
+  }
+  std::copy(frames.back().begin(), frames.back().end(), r);
+  for (size_t i = 0; i < loop.sums.size(); ++i)
+    r[loop.sums[i]] = static_cast<int>(totals[i]);
+  return true;
+}
+
+int IRInterpreter::runBody(size_t pc, int *r, uint64_t &steps,
+                           bool &returned, OutputBuffer &out) {
+  if (profile)
+    return run<true, false>(pc, r, steps, returned, out);
+  if (root->stepLimit)
+    return run<false, false, true>(pc, r, steps, returned, out);
+  return run<false, false>(pc, r, steps, returned, out);
+}
+
+template <bool Profiling, bool Chunk, bool Limited>
+int IRInterpreter::run(size_t pc, int *r, uint64_t &steps, bool &returned,
+                       OutputBuffer &out) {
+  int *mem = memory.data(); // Moves only when a variable-size ALLOCA runs
+
+  // Index of element 'idx' of array 'id' in 'mem', after the checks that
+  // unchecked accesses skip.
+  auto element = [&](int id, int idx) {
+    const Array &a = arrays[id];
+    if (static_cast<unsigned>(idx) >= static_cast<unsigned>(a.size))
+      arrayFault(id);
+    return a.base + idx;
+  };
+
+  while (true) {
+    if (Profiling)
+      ++counts[pc];
+    const Inst &in = code[pc++];
+    ++steps;
+    // Profiled runs are slow anyway and check the limit as well.
+    if ((Limited || Profiling) && root->stepLimit && steps > root->stepLimit)
+      throw std::runtime_error("Step limit exceeded");
+    switch (in.op) {
+    case Op::ADD:
+      r[in.dst] = r[in.a] + r[in.b];
+      break;
+    case Op::SUB:
+      r[in.dst] = r[in.a] - r[in.b];
+      break;
+    case Op::MUL:
+      r[in.dst] = r[in.a] * r[in.b];
+      break;
+    case Op::DIV: {
+      int d = r[in.b];
+      r[in.dst] = d != 0 ? r[in.a] / d : 0;
+      break;
+    }
+    case Op::MOV:
+      r[in.dst] = r[in.a];
+      break;
+    case Op::LT:
+      r[in.dst] = r[in.a] < r[in.b];
+      break;
+    case Op::GT:
+      r[in.dst] = r[in.a] > r[in.b];
+      break;
+    case Op::EQ:
+      r[in.dst] = r[in.a] == r[in.b];
+      break;
+    case Op::NEQ:
+      r[in.dst] = r[in.a] != r[in.b];
+      break;
+    case Op::JMP:
+      enterBlock(in.target, in.block, r);
+      pc = blocks[in.target].entry;
+      break;
+    case Op::JMP_IF:
+      if (r[in.a]) {
+        if (Profiling)
+          ++taken[pc - 1];
+        enterBlock(in.target, in.block, r);
+        pc = blocks[in.target].entry;
+      }
+      break;
+    case Op::RET:
+      if (Chunk)
+        chunkFault();
+      returned = true;
+      return r[in.a];
+    case Op::PRINT:
+      if (Chunk)
+        chunkFault();
+      out.writeLine(r[in.a]);
+      break;
+    case Op::ALLOCA: {
+      if (Chunk)
+        chunkFault();
+      int size = r[in.a];
+      if (size < 0)
+        throw std::runtime_error("Negative array size");
+      Array &a = arrays[in.dst];
+      if (size > a.capacity) {
+        // Only arrays without a fixed region can outgrow it. Doubling keeps
+        // a loop of growing ALLOCAs from moving the array every time.
+        a.base = memory.size();
+        a.capacity = std::max(size, 2 * a.capacity);
+        memory.resize(memory.size() + a.capacity);
+        mem = memory.data();
+      }
+      std::fill(mem + a.base, mem + a.base + size, 0);
+      a.size = size;
+      a.allocated = true;
+      break;
+    }
+    case Op::LOAD:
+      r[in.dst] = mem[element(in.c, r[in.a])];
+      break;
+    case Op::STORE:
+      mem[element(in.dst, r[in.a])] = r[in.b];
+      break;
+    case Op::LOAD_UNCHECKED:
+      r[in.dst] = mem[in.c + r[in.a]];
+      break;
+    case Op::STORE_UNCHECKED:
+      mem[in.dst + r[in.a]] = r[in.b];
+      break;
+    case Op::LOAD_UNCHECKED_DYN:
+      r[in.dst] = mem[arrays[in.c].base + r[in.a]];
+      break;
+    case Op::STORE_UNCHECKED_DYN:
+      mem[arrays[in.dst].base + r[in.a]] = r[in.b];
+      break;
+    case Op::SHL:
+      r[in.dst] = static_cast<uint32_t>(r[in.a]) << (r[in.b] & 31);
+      break;
+    case Op::SHR:
+      r[in.dst] = r[in.a] >> (r[in.b] & 31);
+      break;
+    case Op::MULH:
+      r[in.dst] = (int64_t(r[in.a]) * r[in.b]) >> 32;
+      break;
+    case Op::SELECT:
+      r[in.dst] = r[in.a] ? r[in.b] : r[in.c];
+      break;
+    case Op::INBOUNDS: {
+      // Computed in 64 bits so that no bound can wrap around.
+      int64_t first = r[in.a], end = r[in.b];
+      int64_t size = arrays[in.c].allocated ? arrays[in.c].size : -1;
+      r[in.dst] = first >= end || (first + r[in.target] >= 0 &&
+                                   end - 1 + r[in.block] < size);
+      break;
+    }
+    case Op::BR_LT:
+      pc = (r[in.dst] = r[in.a] < r[in.b]) ? in.target : in.c;
+      break;
+    case Op::BR_GT:
+      pc = (r[in.dst] = r[in.a] > r[in.b]) ? in.target : in.c;
+      break;
+    case Op::BR_EQ:
+      pc = (r[in.dst] = r[in.a] == r[in.b]) ? in.target : in.c;
+      break;
+    case Op::BR_NE:
+      pc = (r[in.dst] = r[in.a] != r[in.b]) ? in.target : in.c;
+      break;
+    case Op::ADDI:
+      r[in.dst] = r[in.a] + in.b;
+      break;
+    case Op::ADDI_MOV:
+      r[in.c] = r[in.dst] = r[in.a] + in.b;
+      break;
+    case Op::ADD_MOV:
+      r[in.c] = r[in.dst] = r[in.a] + r[in.b];
+      break;
+    case Op::LOAD_ADD:
+      r[in.dst] = mem[in.c + r[in.a]];
+      r[in.target] = r[in.b] + r[in.dst];
+      break;
+    case Op::LOAD_OFF: {
+      int i = r[in.a]; // The temp may be the index itself
+      r[in.b] = i + in.target;
+      r[in.dst] = mem[in.c + i];
+      break;
+    }
+    case Op::STORE_OFF: {
+      int i = r[in.a];
+      r[in.c] = i + in.target;
+      mem[in.dst + i] = r[in.b];
+      break;
+    }
+    case Op::DIV_MAGIC: {
+      int x = r[in.a];
+      uint32_t hi = (int64_t(x) * in.b) >> 32;
+      int q = static_cast<int>(hi + uint32_t(in.target * int64_t(x))) >>
+              in.c;
+      r[in.dst] = q - (q >> 31);
+      break;
+    }
+    case Op::ADD_IF: {
+      bool add = (r[in.c] != 0) == (in.target != 0);
+      r[in.dst] = r[in.a] + (add ? r[in.b] : 0);
+      break;
+    }
+    case Op::PARFOR:
+      // Afterwards i is at the end, so the header leaves the loop.
+      if (!Profiling && !Chunk && !Limited && pool &&
+          runParallel(parLoops[in.dst], r, steps, out))
+        pc = blocks[parLoops[in.dst].header].entry;
+      break;
+    case Op::CALL: {
+      if (Chunk)
+        chunkFault();
+      CallSite &site = callSites[in.a];
+      if (!site.callee)
+        site.callee = &root->engineFor(*site.function);
+      r[in.dst] = site.callee->call(site.args, r, steps, out);
+      break;
+    }
+    case Op::PAREND:
+      if (Chunk)
+        return 0;
+      enterBlock(in.target, in.block, r);
+      pc = blocks[in.target].entry;
+      break;
+    case Op::HALT:
+      if (Chunk)
+        chunkFault();
+      returned = false;
+      return 0;
+    }
+  }
+}
+
+IRInterpreter &IRInterpreter::engineFor(const ir::Function &function) {
+  if (&function == rootFunction)
+    return *this;
+  auto &engine = callees[&function];
+  if (!engine) {
+    engine = std::make_unique<IRInterpreter>();
+    engine->root = this;
+    engine->module = module;
+    engine->profile = profile;
+    engine->pool = pool;
+    engine->decode(function, ExecState());
+    if (profile) {
+      engine->counts.assign(engine->code.size(), 0);
+      engine->taken.assign(engine->code.size(), 0);
+    }
   }
-  return registers[op.value];
+  return *engine;
 }
 
-void IRInterpreter::setVal(const std::string &name, int val) {
-  registers[name] = val;
+int IRInterpreter::call(const std::vector<int> &args, const int *from,
+                        uint64_t &steps, OutputBuffer &out) {
+  // Cheap to compute and good enough to spread small argument values.
+  size_t entry = 0, width = args.size() + 1;
+  if (!memoValid.empty()) {
+    uint32_t hash = 0;
+    for (int arg : args)
+      hash = (hash ^ static_cast<uint32_t>(from[arg])) * 0x9E3779B1u;
+    entry = (hash ^ (hash >> 16)) & (memoValid.size() - 1);
+    const int *key = &memoEntries[entry * width];
+    bool hit = memoValid[entry];
+    for (size_t i = 0; hit && i < args.size(); ++i)
+      hit = key[i] == from[args[i]];
+    if (hit)
+      return key[args.size()];
+  }
+  if (root->callDepth == kMaxCallDepth || DeepStack::exhausted())
+    throw std::runtime_error("Call stack overflow");
+  if (blocks.empty())
+    return 0;
+
+  if (activeFrames == frames.size())
+    frames.emplace_back();
+  std::vector<int> &frame = frames[activeFrames++];
+  frame.assign(initialRegisters.begin(), initialRegisters.end());
+  for (size_t i = 0; i < args.size(); ++i)
+    frame[params[i]] = from[args[i]];
+  // The caller may be a frame of this function; its arrays are set aside.
+  // A fault ends the program, so nothing is restored then.
+  std::vector<int> callerMemory;
+  std::vector<Array> callerArrays;
+  if (!arrayLayout.empty()) {
+    callerMemory = std::move(memory);
+    callerArrays = std::move(arrays);
+    memory = BufferPool::local().acquire(frameMemory);
+    arrays = arrayLayout;
+  }
+
+  int *r = frame.data();
+  enterBlock(0, -1, r);
+  size_t pc = blocks[0].entry;
+  bool returned;
+  ++root->callDepth;
+  int result = runBody(pc, r, steps, returned, out);
+  --root->callDepth;
+  --activeFrames;
+  if (!arrayLayout.empty()) {
+    BufferPool::local().release(std::move(memory));
+    memory = std::move(callerMemory);
+    arrays = std::move(callerArrays);
+  }
+
+  if (!memoValid.empty()) {
+    int *key = &memoEntries[entry * width];
+    for (size_t i = 0; i < args.size(); ++i)
+      key[i] = from[args[i]];
+    key[args.size()] = result;
+    memoValid[entry] = true;
+  }
+  return result;
+}
+
+void IRInterpreter::recordProfile() {
+  static const char *const opNames[] = {
+      "ADD", "SUB",   "MUL", "DIV",   "MOV",    "LT",   "GT",    "EQ",
+      "NEQ", "JMP", "JMP_IF", "RET", "PRINT", "ALLOCA", "LOAD", "STORE",
+      "LOAD_UNCHECKED", "STORE_UNCHECKED", "INBOUNDS", "LOAD_UNCHECKED",
+      "STORE_UNCHECKED", "SHL", "SHR", "MULH", "SELECT", "PARFOR",
+      "CALL"};
+  // PAREND and fused ops only run without profiling, so the table stops
+  // here.
+
+  ir::FunctionProfile fp;
+  fp.name = functionName;
+  for (size_t b = 0; b < blocks.size(); ++b) {
+    size_t end = b + 1 < blocks.size() ? blocks[b + 1].entry : code.size();
+    ir::BlockCount block;
+    block.label = blockLabels[b];
+    block.count = counts[blocks[b].entry];
+    for (size_t pc = blocks[b].entry; pc < end; ++pc) {
+      block.instructions += counts[pc];
+      if (!block.line)
+        block.line = codeLines[pc];
+    }
+    fp.blocks.push_back(block);
+  }
+
+  std::map<std::pair<int, int>, uint64_t> edges;
+  for (size_t pc = 0; pc < code.size(); ++pc) {
+    const Inst &in = code[pc];
+    if (codeLines[pc] && counts[pc])
+      fp.lines[codeLines[pc]] += counts[pc];
+    if (in.op != Op::HALT && counts[pc])
+      profile->opcodes[opNames[static_cast<int>(in.op)]] += counts[pc];
+
+    if (in.op == Op::JMP && counts[pc]) {
+      edges[{in.block, in.target}] += counts[pc];
+    } else if (in.op == Op::JMP_IF) {
+      if (taken[pc])
+        edges[{in.block, in.target}] += taken[pc];
+      fp.branches.push_back({blockLabels[in.block], blockLabels[in.target],
+                             taken[pc], counts[pc] - taken[pc],
+                             codeLines[pc]});
+    }
+  }
+  for (const auto &e : edges)
+    fp.edges.push_back(
+        {blockLabels[e.first.first], blockLabels[e.first.second], e.second});
+  profile->merge(fp);
 }
 
 } // namespace optimix
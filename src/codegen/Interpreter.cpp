@@ -1,17 +1,36 @@
 #include "optimix/codegen/Interpreter.h"
+#include "optimix/codegen/IRInterpreter.h"
+#include "optimix/ir/BoundsCheck.h"
+#include "optimix/ir/IRBuilder.h"
+#include "optimix/ir/SSA.h"
+#include "optimix/support/BufferPool.h"
 #include <iostream>
 
 namespace optimix {
 
 int Interpreter::execute(const FunctionAST &function) {
+  if (!program)
+    return executeHere(function);
+  int result = 0;
+  DeepStack::run(kStackBytes, [&] { result = executeHere(function); });
+  return result;
+}
+
+int Interpreter::executeHere(const FunctionAST &function) {
   environment.clear();
+  for (auto &array : memory)
+    BufferPool::local().release(std::move(array.second));
   memory.clear();
-  try {
-    for (const auto &stmt : function.body) {
-      executeStmt(stmt.get());
-    }
-  } catch (int returnValue) {
-    return returnValue;
+  backEdges.clear();
+  tierUps = 0;
+  callDepth = 0;
+  std::unique_ptr<OutputBuffer> ownOutput;
+  if (!output)
+    ownOutput = std::make_unique<OutputBuffer>(std::cout);
+  out = output ? output : ownOutput.get();
+  for (const auto &stmt : function.body) {
+    if (executeStmt(stmt.get()))
+      return returnValue;
   }
   return 0; // Default return
 }
@@ -30,11 +49,16 @@ int Interpreter::evaluate(const Expr *expr) {
     if (memory.find(arrAcc->name) == memory.end())
       throw std::runtime_error("Segfault: Array " + arrAcc->name +
                                " not declared");
-    int idx = evaluate(arrAcc->index.get());
-    if (idx < 0 || idx >= memory[arrAcc->name].size())
+    int idx = flatIndex(arrAcc->name, arrAcc->indices);
+    // Looked up after the indices: a call among them moves 'memory' away
+    // for the callee's arrays and back.
+    const std::vector<int> &array = memory[arrAcc->name];
+    if (idx < 0 || idx >= array.size())
       throw std::runtime_error("Segfault: Out of bounds");
-    return memory[arrAcc->name][idx];
+    return array[idx];
   }
+  if (auto *callExpr = dynamic_cast<const CallExpr *>(expr))
+    return call(*callExpr);
   if (auto *bin = dynamic_cast<const BinaryExpr *>(expr)) {
     int l = evaluate(bin->left.get());
     int r = evaluate(bin->right.get());
@@ -58,12 +82,19 @@ int Interpreter::evaluate(const Expr *expr) {
   throw std::runtime_error("Unknown expression type");
 }
 
-void Interpreter::executeStmt(const Stmt *stmt) {
+int Interpreter::flatIndex(const std::string &array,
+                           const std::vector<std::unique_ptr<Expr>> &indices) {
+  int idx = evaluate(indices[0].get());
+  for (size_t d = 1; d < indices.size(); ++d)
+    idx = idx * environment[arrayExtentName(array, d)] +
+          evaluate(indices[d].get());
+  return idx;
+}
+
+bool Interpreter::executeStmt(const Stmt *stmt) {
   if (auto *ret = dynamic_cast<const ReturnStmt *>(stmt)) {
-    int val = ret->value ? evaluate(ret->value.get()) : 0;
-    throw val; // Throw return value to unwind stack (simple trick)
-               // Note: For a real recursive compiler, we'd execute properly,
-               // but for a single-function flat interpreter this works well.
+    returnValue = ret->value ? evaluate(ret->value.get()) : 0;
+    return true;
   }
   if (auto *decl = dynamic_cast<const VarDecl *>(stmt)) {
     int val = decl->init ? evaluate(decl->init.get()) : 0;
@@ -76,29 +107,136 @@ void Interpreter::executeStmt(const Stmt *stmt) {
     }
     environment[assign->name] = evaluate(assign->value.get());
   }
+  if (auto *callStmt = dynamic_cast<const CallStmt *>(stmt))
+    call(*callStmt->call);
   if (auto *print = dynamic_cast<const PrintStmt *>(stmt)) {
-    std::cout << evaluate(print->value.get()) << "\n";
+    out->writeLine(evaluate(print->value.get()));
   }
   if (auto *loop = dynamic_cast<const WhileStmt *>(stmt)) {
+    int &count = backEdges[loop];
     while (evaluate(loop->condition.get())) {
       for (const auto &s : loop->body) {
-        executeStmt(s.get());
+        if (executeStmt(s.get()))
+          return true;
       }
+      if (tierUpThreshold > 0 && ++count >= tierUpThreshold)
+        return tierUp(loop); // Runs the remaining iterations
     }
   }
+  if (auto *branch = dynamic_cast<const IfStmt *>(stmt)) {
+    const auto &body =
+        evaluate(branch->condition.get()) ? branch->then : branch->otherwise;
+    for (const auto &s : body)
+      if (executeStmt(s.get()))
+        return true;
+  }
   if (auto *arrDecl = dynamic_cast<const ArrayDecl *>(stmt)) {
-    memory[arrDecl->name] = std::vector<int>(arrDecl->size, 0);
+    int size = 1;
+    for (size_t d = 0; d < arrDecl->dims.size(); ++d) {
+      int extent = evaluate(arrDecl->dims[d].get());
+      if (extent < 0)
+        throw std::runtime_error("Negative array size");
+      if (d > 0)
+        environment[arrayExtentName(arrDecl->name, d)] = extent;
+      size *= extent;
+    }
+    if (size < 0)
+      throw std::runtime_error("Negative array size");
+    // Redeclaring (e.g. in a loop body) hands the old buffer back first,
+    // so it is normally the one that comes back.
+    BufferPool &pool = BufferPool::local();
+    std::vector<int> &array = memory[arrDecl->name];
+    pool.release(std::move(array));
+    array = pool.acquire(size);
   }
   if (auto *arrAssign = dynamic_cast<const ArrayAssignment *>(stmt)) {
     if (memory.find(arrAssign->name) == memory.end())
       throw std::runtime_error("Segfault: Array " + arrAssign->name +
                                " not declared");
-    int idx = evaluate(arrAssign->index.get());
+    int idx = flatIndex(arrAssign->name, arrAssign->indices);
     int val = evaluate(arrAssign->value.get());
-    if (idx < 0 || idx >= memory[arrAssign->name].size())
+    // Looked up after the index and value, as for reads.
+    std::vector<int> &array = memory[arrAssign->name];
+    if (idx < 0 || idx >= array.size())
       throw std::runtime_error("Segfault: Out of bounds");
-    memory[arrAssign->name][idx] = val;
+    array[idx] = val;
   }
+  return false;
+}
+
+int Interpreter::call(const CallExpr &call) {
+  const FunctionAST *callee =
+      program ? program->getFunction(call.callee) : nullptr;
+  if (!callee)
+    throw std::runtime_error("Call to undefined function " + call.callee);
+  if (call.args.size() != callee->args.size())
+    throw std::runtime_error("Function " + call.callee + " takes " +
+                             std::to_string(callee->args.size()) +
+                             " arguments, not " +
+                             std::to_string(call.args.size()));
+  std::vector<int> args;
+  for (const auto &arg : call.args)
+    args.push_back(evaluate(arg.get()));
+  if (callDepth == kMaxCallDepth || DeepStack::exhausted())
+    throw std::runtime_error("Call stack overflow");
+
+  // The callee starts with only its parameters; the caller's variables and
+  // arrays are set aside until it returns. A fault ends the program, so
+  // they need not come back then.
+  auto callerVariables = std::move(environment);
+  auto callerArrays = std::move(memory);
+  environment.clear();
+  memory.clear();
+  for (size_t i = 0; i < args.size(); ++i)
+    environment[callee->args[i]] = args[i];
+  ++callDepth;
+  int result = 0;
+  for (const auto &stmt : callee->body)
+    if (executeStmt(stmt.get())) {
+      result = returnValue;
+      break;
+    }
+  --callDepth;
+  for (auto &array : memory)
+    BufferPool::local().release(std::move(array.second));
+  environment = std::move(callerVariables);
+  memory = std::move(callerArrays);
+  return result;
+}
+
+bool Interpreter::tierUp(const WhileStmt *loop) {
+  auto &compiled = compiledLoops[loop];
+  if (!compiled) {
+    IRBuilder builder;
+    compiled = builder.generateLoop(
+        *loop, "osr" + std::to_string(compiledLoops.size() - 1));
+    ir::SSAPass().run(*compiled);
+    // Bounds here come from the interpreter's variables, so this is where
+    // versioning loops on an INBOUNDS test pays off.
+    ir::BoundsCheckEliminationPass().run(*compiled);
+  }
+  ++tierUps;
+  if (program && !programIR) {
+    for (const auto &bb : compiled->blocks)
+      for (const auto &inst : bb->instructions)
+        if (inst.op == ir::OpCode::CALL && !programIR)
+          programIR = IRBuilder().generate(*program);
+  }
+
+  // On-stack replacement: the IR engine picks up the loop with the current
+  // variables and arrays, and hands them back when the loop exits.
+  ExecState state;
+  state.variables = std::move(environment);
+  state.arrays = std::move(memory);
+  IRInterpreter engine;
+  engine.setOutput(out);
+  engine.setModule(programIR.get());
+  int result = engine.execute(*compiled, state);
+  environment = std::move(state.variables);
+  memory = std::move(state.arrays);
+
+  returnValue = result; // If the loop ran a 'return'
+  return state.returned;
 }
 
 } // namespace optimix
@@ -0,0 +1,186 @@
+#include "optimix/driver/CompilationCache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace optimix {
+namespace driver {
+
+namespace {
+
+// Written at the start of every entry; a mismatch is treated as a miss.
+const char *const kMagic = "OPTIMIX-CACHE 1\n";
+
+uint64_t fnv1a(std::string_view data, uint64_t hash) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Second, independent 64-bit hash (multiply-xorshift mixing) so keys are
+// 128 bits wide.
+uint64_t mix64(std::string_view data, uint64_t hash) {
+  for (unsigned char c : data) {
+    hash = (hash ^ c) * 0xff51afd7ed558ccdull;
+    hash ^= hash >> 32;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+std::string toHex(uint64_t v) {
+  static const char digits[] = "0123456789abcdef";
+  std::string s(16, '0');
+  for (int i = 15; i >= 0; --i, v >>= 4)
+    s[i] = digits[v & 0xf];
+  return s;
+}
+
+// Unique per process and thread, so concurrent writers never share a file.
+std::string tempSuffix() {
+  static std::atomic<uint64_t> counter{0};
+  static const uint64_t processNonce = std::random_device{}();
+  uint64_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+  return ".tmp-" + toHex(processNonce ^ thread) + "-" +
+         std::to_string(counter.fetch_add(1));
+}
+
+} // namespace
+
+CompilationCache::CompilationCache(std::string dir, uint64_t limit)
+    : directory(std::move(dir)), maxBytes(limit) {}
+
+std::string CompilationCache::makeKey(std::string_view source,
+                                      std::string_view flags) {
+  // Length prefixes keep ("ab", "c") and ("a", "bc") apart.
+  std::string header = std::string(OPTIMIX_VERSION) + "\n" +
+                       std::to_string(source.size()) + "\n" +
+                       std::to_string(flags.size()) + "\n";
+  uint64_t h1 = fnv1a(header, 0xcbf29ce484222325ull);
+  h1 = fnv1a(flags, fnv1a(source, h1));
+  uint64_t h2 = mix64(header, 0x9e3779b97f4a7c15ull);
+  h2 = mix64(flags, mix64(source, h2));
+  return toHex(h1) + toHex(h2);
+}
+
+std::string CompilationCache::entryPath(const std::string &key) const {
+  return (fs::path(directory) / (key + ".entry")).string();
+}
+
+std::optional<std::string> CompilationCache::lookup(
+    const std::string &key) const {
+  std::ifstream in(entryPath(key), std::ios::binary);
+  if (!in)
+    return std::nullopt;
+  std::ostringstream data;
+  data << in.rdbuf();
+  std::string content = data.str();
+
+  std::string_view magic(kMagic);
+  if (content.compare(0, magic.size(), magic) != 0)
+    return std::nullopt;
+
+  // Refresh the timestamp so eviction sees this entry as recently used.
+  std::error_code ec;
+  fs::last_write_time(entryPath(key), fs::file_time_type::clock::now(), ec);
+  return content.substr(magic.size());
+}
+
+void CompilationCache::store(const std::string &key,
+                             const std::string &artifact) const {
+  std::error_code ec;
+  fs::create_directories(directory, ec);
+
+  std::string finalPath = entryPath(key);
+  std::string tempPath = finalPath + tempSuffix();
+  {
+    std::ofstream out(tempPath, std::ios::binary);
+    out << kMagic << artifact;
+    if (!out) {
+      out.close();
+      fs::remove(tempPath, ec);
+      return;
+    }
+  }
+  // Atomic replace: a concurrent writer of the same key produces identical
+  // bytes, so whichever rename lands last is fine.
+  fs::rename(tempPath, finalPath, ec);
+  if (ec) {
+    fs::remove(tempPath, ec);
+    return;
+  }
+  // The directory is scanned on the first store and then only once the
+  // running total says it has outgrown the bound.
+  uint64_t total = bytesStored +=
+                   std::string_view(kMagic).size() + artifact.size();
+  if (!measured.exchange(true) || total > maxBytes)
+    evict();
+}
+
+void CompilationCache::evict() const {
+  struct Entry {
+    fs::path path;
+    uint64_t size;
+    fs::file_time_type time;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  auto now = fs::file_time_type::clock::now();
+
+  std::error_code ec;
+  for (fs::directory_iterator it(directory, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    std::error_code fileEc;
+    std::string name = it->path().filename().string();
+    auto time = it->last_write_time(fileEc);
+    if (fileEc)
+      continue;
+    if (name.find(".tmp-") != std::string::npos) {
+      // Left behind by a writer that died; in-flight ones are much younger.
+      if (now - time > std::chrono::hours(1))
+        fs::remove(it->path(), fileEc);
+      continue;
+    }
+    if (it->path().extension() != ".entry")
+      continue;
+    uint64_t size = it->file_size(fileEc);
+    if (fileEc)
+      continue;
+    entries.push_back({it->path(), size, time});
+    total += size;
+  }
+  if (total <= maxBytes) {
+    bytesStored = total;
+    return;
+  }
+
+  // Least recently used first; trim to 3/4 of the limit so that the stores
+  // that follow do not trigger another scan right away.
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.time < b.time; });
+  uint64_t target = maxBytes / 4 * 3;
+  for (const auto &e : entries) {
+    if (total <= target)
+      break;
+    std::error_code removeEc;
+    if (fs::remove(e.path, removeEc))
+      total -= e.size;
+  }
+  bytesStored = total;
+}
+
+} // namespace driver
+} // namespace optimix
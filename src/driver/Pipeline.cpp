@@ -0,0 +1,186 @@
+#include "optimix/driver/Pipeline.h"
+#include "optimix/driver/CompilationCache.h"
+#include "optimix/ir/BoundsCheck.h"
+#include "optimix/ir/Evaluate.h"
+#include "optimix/ir/IRBuilder.h"
+#include "optimix/ir/IfConversion.h"
+#include "optimix/ir/InstCombine.h"
+#include "optimix/ir/LoopFusion.h"
+#include "optimix/ir/LoopNest.h"
+#include "optimix/ir/Memoize.h"
+#include "optimix/ir/OutOfSSA.h"
+#include "optimix/ir/Parallelize.h"
+#include "optimix/ir/ProfileGuided.h"
+#include "optimix/ir/SSA.h"
+#include "optimix/ir/ScalarReplacement.h"
+#include "optimix/ir/SimplifyCFG.h"
+#include "optimix/lexer/Lexer.h"
+#include "optimix/parser/Parser.h"
+#include "optimix/support/ThreadPool.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace optimix {
+namespace driver {
+
+std::string readFile(const std::string &path) {
+  std::FILE *fp = std::fopen(path.c_str(), "rb");
+  if (!fp)
+    throw std::runtime_error("Could not open file " + path);
+  std::fseek(fp, 0, SEEK_END);
+  size_t size = std::ftell(fp);
+  std::string content(size, '\0');
+  std::rewind(fp);
+  bool ok = std::fread(&content[0], 1, size, fp) == size;
+  std::fclose(fp);
+  if (!ok)
+    throw std::runtime_error("Could not read entire file " + path);
+  return content;
+}
+
+ir::PassManager defaultPipeline(const ir::Profile *profile,
+                                uint64_t evalSteps) {
+  ir::PassManager pm;
+  // Before unrolling, which would hide the nest's shape.
+  pm.addPass(std::make_unique<ir::LoopNestPass>());
+  if (profile) {
+    // Unroll first: layout keeps the new copies next to their loop.
+    pm.addPass(std::make_unique<ir::LoopUnrollPass>(*profile));
+    pm.addPass(std::make_unique<ir::BlockLayoutPass>(*profile));
+  }
+  pm.addPass(std::make_unique<ir::SSAPass>());
+  pm.addPass(std::make_unique<ir::ScalarReplacementPass>());
+  pm.addPass(std::make_unique<ir::LoopFusionPass>());
+  pm.addPass(std::make_unique<ir::BoundsCheckEliminationPass>());
+  pm.addPass(std::make_unique<ir::InstCombinePass>());
+  pm.addPass(std::make_unique<ir::IfConversionPass>());
+  // A profile-guided layout is already in place; keep it.
+  pm.addPass(std::make_unique<ir::SimplifyCFGPass>(!profile));
+  pm.addPass(std::make_unique<ir::OutOfSSAPass>());
+  // Matches the final shape of loops, and no pass knows PARFOR.
+  pm.addPass(std::make_unique<ir::ParallelizePass>());
+  // Sees the whole call graph; like PARFOR, no earlier pass knows MEMO.
+  pm.addPass(std::make_unique<ir::MemoizePass>());
+  // Runs the final code, memoized calls included.
+  if (evalSteps)
+    pm.addPass(std::make_unique<ir::PartialEvaluationPass>(evalSteps));
+  return pm;
+}
+
+CompileResult compileSource(const std::string &source, ThreadPool *pool) {
+  CompileResult result;
+  Lexer lexer(source);
+  Parser parser(lexer);
+  result.ast = parser.parseProgram();
+
+  IRBuilder builder;
+  result.module = builder.generate(*result.ast);
+
+  defaultPipeline().run(*result.module, pool);
+  return result;
+}
+
+std::vector<BatchEntry> compileBatch(const std::vector<std::string> &files,
+                                     const BatchOptions &options) {
+  // Each task writes only its own slot, so results need no locking and come
+  // out in input order.
+  std::vector<BatchEntry> entries(files.size());
+  ThreadPool pool(options.jobs);
+
+  std::unique_ptr<CompilationCache> cache;
+  if (!options.cacheDir.empty())
+    cache = std::make_unique<CompilationCache>(options.cacheDir,
+                                               options.cacheMaxBytes);
+  // Everything besides the source that changes the output.
+  const std::string flags = "batch-ir;" + defaultPipeline().pipelineText();
+
+  // Each input is written below outputDir at its own path, normalized and
+  // without '..' so that it cannot leave the directory. Inputs that would
+  // share an output file (a.optx and a.txt) fail instead of racing on it.
+  namespace fs = std::filesystem;
+  std::vector<fs::path> outputs(files.size());
+  if (!options.outputDir.empty()) {
+    std::map<fs::path, size_t> owner;
+    for (size_t i = 0; i < files.size(); ++i) {
+      fs::path relative;
+      for (const auto &part :
+           fs::path(files[i]).relative_path().lexically_normal())
+        if (part != ".." && part != ".")
+          relative /= part;
+      outputs[i] = fs::path(options.outputDir) / relative;
+      outputs[i].replace_extension(".oxir");
+      auto inserted = owner.emplace(outputs[i], i);
+      if (!inserted.second) {
+        entries[i].file = files[i];
+        entries[i].error = "output " + outputs[i].string() +
+                           " is also written for " +
+                           files[inserted.first->second];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!entries[i].error.empty())
+      continue;
+    pool.submit([&, i] {
+      BatchEntry &entry = entries[i];
+      entry.file = files[i];
+      try {
+        std::string source = readFile(files[i]);
+        std::string key;
+        if (cache) {
+          key = CompilationCache::makeKey(source, flags);
+          if (auto hit = cache->lookup(key)) {
+            entry.output = std::move(*hit);
+            entry.fromCache = true;
+          }
+        }
+
+        if (!entry.fromCache) {
+          // Files are the unit of parallelism here; functions within a file
+          // are optimized inline on this worker.
+          auto result = compileSource(source);
+          std::ostringstream text;
+          result.module->print(text);
+          entry.output = text.str();
+          if (cache)
+            cache->store(key, entry.output);
+        }
+
+        if (!options.outputDir.empty()) {
+          const fs::path &out = outputs[i];
+          fs::create_directories(out.parent_path());
+          std::ofstream os(out, std::ios::binary);
+          os << entry.output;
+          if (!os)
+            throw std::runtime_error("Could not write " + out.string());
+        }
+      } catch (const std::exception &e) {
+        entry.error = e.what();
+      }
+    });
+  }
+  pool.wait();
+  return entries;
+}
+
+std::vector<std::string> readManifest(const std::string &path) {
+  std::istringstream in(readFile(path));
+  std::vector<std::string> files;
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string::npos || line[begin] == '#')
+      continue;
+    size_t end = line.find_last_not_of(" \t\r");
+    files.push_back(line.substr(begin, end - begin + 1));
+  }
+  return files;
+}
+
+} // namespace driver
+} // namespace optimix
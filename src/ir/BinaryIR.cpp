@@ -0,0 +1,310 @@
+#include "optimix/ir/BinaryIR.h"
+#include "optimix/support/MappedFile.h"
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+const char kMagic[4] = {'O', 'X', 'B', '\0'};
+const uint32_t kByteOrderMark = 0x01020304;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t numFunctions;
+  uint32_t numBlocks;
+  uint32_t numInsts;
+  uint32_t numOperands;
+  uint32_t numStrings;
+  uint32_t stringBytes;
+  uint32_t numParams;
+};
+
+struct FunctionRecord {
+  uint32_t name;
+  uint32_t firstParam;
+  uint32_t numParams;
+  uint32_t firstBlock;
+  uint32_t numBlocks;
+};
+
+struct BlockRecord {
+  uint32_t label;
+  uint32_t firstInst;
+  uint32_t numInsts;
+};
+
+struct InstRecord {
+  uint32_t op;
+  uint32_t firstOperand;
+  uint32_t numOperands;
+  uint32_t line;
+};
+
+enum OperandKind : uint32_t {
+  KIND_VARIABLE,
+  KIND_CONSTANT,
+  KIND_LABEL,
+  KIND_NONE
+};
+
+struct OperandRecord {
+  uint32_t kind;
+  int32_t value;
+  uint32_t version;
+};
+
+class StringTable {
+public:
+  uint32_t intern(const std::string &s) {
+    auto it = index.find(s);
+    if (it != index.end())
+      return it->second;
+    uint32_t id = offsets.size();
+    offsets.push_back(chars.size());
+    chars += s;
+    index[s] = id;
+    return id;
+  }
+  std::vector<uint32_t> offsets;
+  std::string chars;
+
+private:
+  std::unordered_map<std::string, uint32_t> index;
+};
+
+template <typename T> void append(std::string &out, const T &record) {
+  out.append(reinterpret_cast<const char *>(&record), sizeof(T));
+}
+
+template <typename T>
+void appendArray(std::string &out, const std::vector<T> &records) {
+  if (!records.empty())
+    out.append(reinterpret_cast<const char *>(records.data()),
+               records.size() * sizeof(T));
+}
+
+OperandRecord encode(const Operand &op, StringTable &strings) {
+  OperandRecord r{};
+  r.version = op.version;
+  switch (op.type) {
+  case Operand::VARIABLE:
+    r.kind = KIND_VARIABLE;
+    r.value = strings.intern(op.value);
+    break;
+  case Operand::LABEL:
+    r.kind = KIND_LABEL;
+    r.value = strings.intern(op.value);
+    break;
+  case Operand::CONSTANT:
+    if (op.value.empty()) {
+      r.kind = KIND_NONE; // Placeholder result of a void instruction
+    } else {
+      r.kind = KIND_CONSTANT;
+      r.value = std::stoi(op.value);
+    }
+    break;
+  }
+  return r;
+}
+
+// Bounds-checked view of one section of the input.
+template <typename T> class Section {
+public:
+  Section(const char *data, size_t size, size_t &offset, uint32_t count) {
+    if (count > (size - offset) / sizeof(T))
+      throw std::runtime_error("Truncated binary IR");
+    base = data + offset;
+    length = count;
+    offset += count * sizeof(T);
+  }
+  T operator[](size_t i) const {
+    if (i >= length)
+      throw std::runtime_error("Corrupt binary IR: index out of range");
+    T record;
+    std::memcpy(&record, base + i * sizeof(T), sizeof(T));
+    return record;
+  }
+  size_t size() const { return length; }
+  // Checks a range of records before anything is sized from its count.
+  void checkRange(uint32_t first, uint32_t count) const {
+    if (uint64_t(first) + count > length)
+      throw std::runtime_error("Corrupt binary IR: index out of range");
+  }
+
+private:
+  const char *base;
+  size_t length;
+};
+
+} // namespace
+
+std::string writeBinary(const Module &module) {
+  StringTable strings;
+  std::vector<FunctionRecord> functions;
+  std::vector<uint32_t> params;
+  std::vector<BlockRecord> blocks;
+  std::vector<InstRecord> insts;
+  std::vector<OperandRecord> operands;
+
+  for (const auto &func : module.functions) {
+    FunctionRecord f{strings.intern(func->name),
+                     static_cast<uint32_t>(params.size()),
+                     static_cast<uint32_t>(func->params.size()),
+                     static_cast<uint32_t>(blocks.size()),
+                     static_cast<uint32_t>(func->blocks.size())};
+    functions.push_back(f);
+    for (const auto &param : func->params)
+      params.push_back(strings.intern(param));
+    for (const auto &bb : func->blocks) {
+      BlockRecord b{strings.intern(bb->label),
+                    static_cast<uint32_t>(insts.size()),
+                    static_cast<uint32_t>(bb->instructions.size())};
+      blocks.push_back(b);
+      for (const auto &inst : bb->instructions) {
+        InstRecord i{static_cast<uint32_t>(inst.op),
+                     static_cast<uint32_t>(operands.size()),
+                     static_cast<uint32_t>(inst.operands.size() + 1),
+                     static_cast<uint32_t>(inst.line)};
+        insts.push_back(i);
+        operands.push_back(encode(inst.result, strings));
+        for (const auto &op : inst.operands)
+          operands.push_back(encode(op, strings));
+      }
+    }
+  }
+  strings.offsets.push_back(strings.chars.size());
+
+  Header h{};
+  std::memcpy(h.magic, kMagic, sizeof(kMagic));
+  h.version = kBinaryIRVersion;
+  h.byteOrder = kByteOrderMark;
+  h.numFunctions = functions.size();
+  h.numParams = params.size();
+  h.numBlocks = blocks.size();
+  h.numInsts = insts.size();
+  h.numOperands = operands.size();
+  h.numStrings = strings.offsets.size() - 1;
+  h.stringBytes = strings.chars.size();
+
+  std::string out;
+  append(out, h);
+  appendArray(out, functions);
+  appendArray(out, params);
+  appendArray(out, blocks);
+  appendArray(out, insts);
+  appendArray(out, operands);
+  appendArray(out, strings.offsets);
+  out += strings.chars;
+  return out;
+}
+
+std::unique_ptr<Module> readBinary(const char *data, size_t size,
+                                   bool trusted) {
+  Header h;
+  if (size < sizeof(h))
+    throw std::runtime_error("Truncated binary IR");
+  std::memcpy(&h, data, sizeof(h));
+  if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0)
+    throw std::runtime_error("Not an Optimix binary IR file");
+  if (h.byteOrder != kByteOrderMark)
+    throw std::runtime_error("Binary IR was written with another byte order");
+  if (h.version != kBinaryIRVersion)
+    throw std::runtime_error("Unsupported binary IR version " +
+                             std::to_string(h.version));
+
+  size_t offset = sizeof(h);
+  Section<FunctionRecord> functions(data, size, offset, h.numFunctions);
+  Section<uint32_t> params(data, size, offset, h.numParams);
+  Section<BlockRecord> blocks(data, size, offset, h.numBlocks);
+  Section<InstRecord> insts(data, size, offset, h.numInsts);
+  Section<OperandRecord> operands(data, size, offset, h.numOperands);
+  Section<uint32_t> stringOffsets(data, size, offset, h.numStrings + 1);
+  if (h.stringBytes > size - offset)
+    throw std::runtime_error("Truncated binary IR");
+  const char *chars = data + offset;
+
+  std::vector<std::string> strings(h.numStrings);
+  for (uint32_t i = 0; i < h.numStrings; ++i) {
+    uint32_t begin = stringOffsets[i], end = stringOffsets[i + 1];
+    if (begin > end || end > h.stringBytes)
+      throw std::runtime_error("Corrupt binary IR: bad string table");
+    strings[i].assign(chars + begin, end - begin);
+  }
+  auto stringAt = [&](int32_t id) -> const std::string & {
+    if (id < 0 || static_cast<uint32_t>(id) >= strings.size())
+      throw std::runtime_error("Corrupt binary IR: bad string index");
+    return strings[id];
+  };
+
+  auto decode = [&](const OperandRecord &r) {
+    Operand op{Operand::CONSTANT, ""};
+    switch (r.kind) {
+    case KIND_VARIABLE:
+      op = Operand::makeVar(stringAt(r.value));
+      break;
+    case KIND_LABEL:
+      op = Operand::makeLabel(stringAt(r.value));
+      break;
+    case KIND_CONSTANT:
+      op = Operand::makeConst(r.value);
+      break;
+    case KIND_NONE:
+      break;
+    default:
+      throw std::runtime_error("Corrupt binary IR: bad operand kind");
+    }
+    op.version = r.version;
+    return op;
+  };
+
+  auto module = std::make_unique<Module>();
+  for (size_t fi = 0; fi < functions.size(); ++fi) {
+    FunctionRecord f = functions[fi];
+    auto func = std::make_unique<Function>(stringAt(f.name));
+    params.checkRange(f.firstParam, f.numParams);
+    blocks.checkRange(f.firstBlock, f.numBlocks);
+    for (uint32_t p = 0; p < f.numParams; ++p)
+      func->params.push_back(stringAt(params[size_t(f.firstParam) + p]));
+    for (uint32_t b = 0; b < f.numBlocks; ++b) {
+      BlockRecord br = blocks[size_t(f.firstBlock) + b];
+      BasicBlock *bb = func->createBlock(stringAt(br.label));
+      insts.checkRange(br.firstInst, br.numInsts);
+      for (uint32_t i = 0; i < br.numInsts; ++i) {
+        InstRecord ir = insts[size_t(br.firstInst) + i];
+        if (ir.op >= uint32_t(kNumOpCodes) || ir.numOperands == 0)
+          throw std::runtime_error("Corrupt binary IR: bad instruction");
+        operands.checkRange(ir.firstOperand, ir.numOperands);
+        Instruction inst(static_cast<OpCode>(ir.op),
+                         decode(operands[ir.firstOperand]));
+        inst.line = static_cast<int>(ir.line);
+        inst.operands.reserve(ir.numOperands - 1);
+        for (uint32_t o = 1; o < ir.numOperands; ++o)
+          inst.operands.push_back(
+              decode(operands[size_t(ir.firstOperand) + o]));
+        if (!inst.isWellFormed())
+          throw std::runtime_error("Corrupt binary IR: malformed " +
+                                   inst.toString());
+        if (!trusted)
+          inst.op = checkedForm(inst.op);
+        bb->instructions.push_back(std::move(inst));
+      }
+    }
+    module->functions.push_back(std::move(func));
+  }
+  return module;
+}
+
+std::unique_ptr<Module> loadBinaryFile(const std::string &path) {
+  MappedFile file(path);
+  return readBinary(file.data(), file.size());
+}
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,765 @@
+#include "optimix/ir/BoundsCheck.h"
+#include "optimix/ir/Dominators.h"
+#include "optimix/ir/LoopInfo.h"
+#include "optimix/ir/SSA.h"
+#include "optimix/support/Diagnostics.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+constexpr int64_t kMin = INT_MIN, kMax = INT_MAX;
+
+struct Range {
+  int64_t lo = kMin, hi = kMax;
+};
+
+// A result outside 32 bits may have wrapped at run time, so nothing is
+// known about it.
+Range fit(int64_t lo, int64_t hi) {
+  if (lo < kMin || hi > kMax)
+    return {};
+  return {lo, hi};
+}
+
+bool sameValue(const Operand &a, const Operand &b) {
+  return a.type == Operand::VARIABLE && b.type == Operand::VARIABLE &&
+         a.value == b.value && a.version == b.version;
+}
+
+std::string keyOf(const Operand &v) {
+  return v.value + "." + std::to_string(v.version);
+}
+
+// Integer ranges of SSA values at a given block; see BoundsCheck.h.
+class RangeAnalysis {
+public:
+  RangeAnalysis(Function &func, const DominatorTree &domTree,
+                const LoopInfo &loops)
+      : domTree(domTree), loops(loops) {
+    BasicBlock *prev = nullptr;
+    for (auto &bb : func.blocks) {
+      byLabel[bb->label] = bb.get();
+      if (prev)
+        layoutNext[prev] = bb.get();
+      prev = bb.get();
+      for (const auto &inst : bb->instructions)
+        if (hasResult(inst.op) && inst.result.type == Operand::VARIABLE &&
+            inst.result.version > 0)
+          defs[keyOf(inst.result)] = {&inst, bb.get()};
+    }
+    for (const BasicBlock *bb : domTree.reversePostOrder())
+      addGuard(bb);
+    layers.emplace_back();
+    budget = kWorkPerValue * (defs.size() + 1);
+  }
+
+  struct Def {
+    const Instruction *inst = nullptr;
+    BasicBlock *block = nullptr;
+  };
+
+  const Def *defOf(const Operand &v) const {
+    if (v.type != Operand::VARIABLE || v.version == 0)
+      return nullptr;
+    auto it = defs.find(keyOf(v));
+    return it == defs.end() ? nullptr : &it->second;
+  }
+
+  // The range of 'v' wherever 'bb' executes.
+  Range at(const Operand &v, const BasicBlock *bb) {
+    if (v.type == Operand::CONSTANT) {
+      int64_t c = std::stoll(v.value);
+      return {c, c};
+    }
+    if (depth > kMaxDepth)
+      return {};
+    return cached(keyOf(v) + "@" + bb->label, [&] {
+      ++depth;
+      Range r = constrain(v, bb, base(v));
+      --depth;
+      return r;
+    });
+  }
+
+  BasicBlock *block(const std::string &label) const {
+    auto it = byLabel.find(label);
+    return it == byLabel.end() ? nullptr : it->second;
+  }
+
+  BasicBlock *next(const BasicBlock *bb) const {
+    auto it = layoutNext.find(bb);
+    return it == layoutNext.end() ? nullptr : it->second;
+  }
+
+  // For a block with a single predecessor, the condition that holds on the
+  // edge into it: (t, true) when the JMP_IF on t was taken, (t, false) when
+  // it was not.
+  std::optional<std::pair<Operand, bool>> edgeCondition(const BasicBlock *pred,
+                                                        const BasicBlock *bb) {
+    const Instruction *branch = nullptr;
+    const BasicBlock *otherwise = next(pred);
+    for (const auto &inst : pred->instructions) {
+      if (inst.op == OpCode::JMP_IF) {
+        if (branch)
+          return std::nullopt;
+        branch = &inst;
+      } else if (inst.op == OpCode::JMP) {
+        otherwise = block(inst.operands[0].value);
+        break;
+      } else if (inst.op == OpCode::RET) {
+        otherwise = nullptr;
+        break;
+      }
+    }
+    if (!branch)
+      return std::nullopt;
+    const BasicBlock *taken = block(branch->operands[0].value);
+    if (taken == bb && otherwise != bb)
+      return std::make_pair(branch->operands[1], true);
+    if (otherwise == bb && taken != bb)
+      return std::make_pair(branch->operands[1], false);
+    return std::nullopt;
+  }
+
+private:
+  static constexpr int kMaxDepth = 48;
+  // Work (ranges computed, guards looked at) allowed per SSA value of the
+  // function, so that analysis time stays linear in its size. Past that,
+  // every range not yet known is unknown and the checks stay.
+  static constexpr size_t kWorkPerValue = 256;
+
+  // A comparison known to hold in 'block' and the blocks it dominates:
+  // a < b (op LT) or a == b (op EQ), or their negation if not 'taken'.
+  struct Guard {
+    const BasicBlock *block, *pred;
+    OpCode op;
+    Operand a, b;
+    bool taken;
+  };
+
+  const DominatorTree &domTree;
+  const LoopInfo &loops;
+  std::unordered_map<std::string, BasicBlock *> byLabel;
+  std::unordered_map<const BasicBlock *, BasicBlock *> layoutNext;
+  std::unordered_map<std::string, Def> defs;
+  // By each value they compare, so that narrowing a value does not walk
+  // every dominating block.
+  std::unordered_map<std::string, std::vector<Guard>> guards;
+
+  // Ranges assumed for loop PHIs while their induction step is checked,
+  // each with the layer it opened. Layer 0 caches results that hold
+  // regardless of assumptions; layer k those that read the k-th assumption
+  // (and maybe earlier ones), and is dropped with it. 'need' is the highest
+  // layer the value being evaluated has read so far.
+  std::unordered_map<std::string, std::pair<Range, size_t>> assumed;
+  std::vector<std::unordered_map<std::string, Range>> layers;
+  size_t need = 0;
+  int depth = 0;
+  size_t work = 0, budget = 0;
+
+  Range base(const Operand &v) {
+    const Def *d = defOf(v);
+    if (!d)
+      return {};
+    std::string key = keyOf(v);
+    auto a = assumed.find(key);
+    if (a != assumed.end()) {
+      need = std::max(need, a->second.second);
+      return a->second.first;
+    }
+    return cached(key, [&] { return evaluate(*d); });
+  }
+
+  // The range cached under 'key', or else what 'compute' returns, cached in
+  // the highest layer it read. Costs one unit of work unless cached.
+  template <typename Fn> Range cached(const std::string &key, Fn compute) {
+    for (size_t layer = layers.size(); layer-- > 0;) {
+      auto c = layers[layer].find(key);
+      if (c != layers[layer].end()) {
+        need = std::max(need, layer);
+        return c->second;
+      }
+    }
+    if (++work > budget)
+      return {};
+    size_t outer = need;
+    need = 0;
+    Range r = compute();
+    layers[need][key] = r;
+    need = std::max(outer, need);
+    return r;
+  }
+
+  Range evaluate(const Def &d) {
+    const Instruction &inst = *d.inst;
+    auto operand = [&](size_t i) { return at(inst.operands[i], d.block); };
+    switch (inst.op) {
+    case OpCode::MOV:
+      return operand(0);
+    case OpCode::ADD: {
+      Range a = operand(0), b = operand(1);
+      return fit(a.lo + b.lo, a.hi + b.hi);
+    }
+    case OpCode::SUB: {
+      Range a = operand(0), b = operand(1);
+      return fit(a.lo - b.hi, a.hi - b.lo);
+    }
+    case OpCode::MUL:
+    case OpCode::DIV: {
+      Range a = operand(0), b = operand(1);
+      bool mul = inst.op == OpCode::MUL;
+      // An empty range (from a branch that cannot be taken) has no corners
+      // to try. Division by zero yields 0; a divisor range that spans zero
+      // is not worth modelling.
+      if (a.lo > a.hi || b.lo > b.hi || (!mul && b.lo <= 0 && b.hi >= 0))
+        return {};
+      int64_t corners[] = {a.lo, a.hi};
+      int64_t divisors[] = {b.lo, b.hi};
+      int64_t lo = INT64_MAX, hi = INT64_MIN;
+      for (int64_t x : corners)
+        for (int64_t y : divisors) {
+          int64_t value = mul ? x * y : x / y;
+          lo = std::min(lo, value);
+          hi = std::max(hi, value);
+        }
+      return fit(lo, hi);
+    }
+    case OpCode::SHL:
+    case OpCode::SHR:
+    case OpCode::MULH: {
+      // Monotone in the first operand for a constant shift; the product of
+      // MULH is extreme at the corners, and taking its high half keeps that.
+      Range a = operand(0), b = operand(1);
+      if (inst.op != OpCode::MULH && (b.lo != b.hi || b.lo < 0 || b.lo > 31))
+        return {};
+      int64_t lo = INT64_MAX, hi = INT64_MIN;
+      for (int64_t x : {a.lo, a.hi})
+        for (int64_t y : {b.lo, b.hi}) {
+          int64_t value = inst.op == OpCode::SHL   ? x * (int64_t(1) << y)
+                          : inst.op == OpCode::SHR ? x >> y
+                                                   : (x * y) >> 32;
+          lo = std::min(lo, value);
+          hi = std::max(hi, value);
+        }
+      return fit(lo, hi);
+    }
+    case OpCode::SELECT: {
+      Range a = operand(1), b = operand(2);
+      return {std::min(a.lo, b.lo), std::max(a.hi, b.hi)};
+    }
+    case OpCode::LT:
+    case OpCode::GT:
+    case OpCode::EQ:
+    case OpCode::NEQ:
+    case OpCode::INBOUNDS:
+      return {0, 1};
+    case OpCode::PHI:
+      return phi(d);
+    default:
+      return {};
+    }
+  }
+
+  Range phi(const Def &d) {
+    const Instruction &inst = *d.inst;
+    Loop *loop = loops.loopFor(d.block);
+    bool header = loop && loop->header == d.block;
+
+    Range entry{INT64_MAX, INT64_MIN};
+    std::vector<std::pair<Operand, BasicBlock *>> backEdge;
+    for (size_t i = 0; i + 1 < inst.operands.size(); i += 2) {
+      BasicBlock *pred = block(inst.operands[i + 1].value);
+      if (!pred || !domTree.isReachable(pred))
+        continue;
+      if (header && loop->contains(pred)) {
+        backEdge.push_back({inst.operands[i], pred});
+        continue;
+      }
+      Range r = at(inst.operands[i], pred);
+      entry = {std::min(entry.lo, r.lo), std::max(entry.hi, r.hi)};
+    }
+    if (entry.lo > entry.hi)
+      return {};
+    if (!header)
+      return entry;
+
+    // Induction: if the PHI never drops below its smallest initial value
+    // on the way round the loop, that value is a lower bound (and likewise
+    // for upper bounds). Each side is checked under its own assumption.
+    auto holds = [&](Range assumption, bool lower) {
+      std::string key = keyOf(inst.result);
+      layers.emplace_back();
+      size_t layer = layers.size() - 1;
+      assumed[key] = {assumption, layer};
+      bool ok = true;
+      for (const auto &in : backEdge) {
+        Range r = at(in.first, in.second);
+        ok = ok && (lower ? r.lo >= assumption.lo : r.hi <= assumption.hi);
+      }
+      layers.pop_back();
+      assumed.erase(key);
+      // The outcome no longer depends on the assumption it made.
+      need = std::min(need, layer - 1);
+      return ok;
+    };
+    Range r;
+    if (entry.lo > kMin && holds({entry.lo, kMax}, true))
+      r.lo = entry.lo;
+    if (entry.hi < kMax && holds({kMin, entry.hi}, false))
+      r.hi = entry.hi;
+    return r;
+  }
+
+  // Records the condition on the edge into 'bb', if it compares values.
+  void addGuard(const BasicBlock *bb) {
+    if (bb->preds.size() != 1)
+      return;
+    const BasicBlock *pred = bb->preds.front();
+    auto cond = edgeCondition(pred, bb);
+    if (!cond)
+      return;
+    const Def *test = defOf(cond->first);
+    if (!test)
+      return;
+    const Instruction &cmp = *test->inst;
+    OpCode op = cmp.op;
+    if (op != OpCode::LT && op != OpCode::GT && op != OpCode::EQ &&
+        op != OpCode::NEQ)
+      return;
+    Guard g{bb, pred, op, cmp.operands[0], cmp.operands[1], cond->second};
+    if (op == OpCode::GT) {
+      std::swap(g.a, g.b); // a > b is b < a
+      g.op = OpCode::LT;
+    } else if (op == OpCode::NEQ) {
+      g.op = OpCode::EQ;
+      g.taken = !g.taken;
+    }
+    for (const Operand *x : {&g.a, &g.b})
+      if (x->type == Operand::VARIABLE && !(x == &g.b && sameValue(g.a, g.b)))
+        guards[keyOf(*x)].push_back(g);
+  }
+
+  // Narrows 'r' by the branch conditions on the way to 'bb', nearest first.
+  // Each guard looked at counts as work; without budget left 'r' stays as
+  // wide as it is.
+  Range constrain(const Operand &v, const BasicBlock *bb, Range r) {
+    auto it = guards.find(keyOf(v));
+    if (it == guards.end())
+      return r;
+    // Recorded in reverse post-order, so a dominating guard comes before
+    // those it dominates.
+    for (auto g = it->second.rbegin(); g != it->second.rend(); ++g) {
+      if (++work > budget)
+        break;
+      if (!domTree.dominates(g->block, bb))
+        continue;
+      if (g->op == OpCode::LT) {
+        // Taken: a < b. Not taken: a >= b.
+        if (sameValue(g->a, v)) {
+          Range other = at(g->b, g->pred);
+          if (g->taken)
+            r.hi = std::min(r.hi, other.hi - 1);
+          else
+            r.lo = std::max(r.lo, other.lo);
+        } else if (sameValue(g->b, v)) {
+          Range other = at(g->a, g->pred);
+          if (g->taken)
+            r.lo = std::max(r.lo, other.lo + 1);
+          else
+            r.hi = std::min(r.hi, other.hi);
+        }
+      } else if (g->taken) {
+        // v == other
+        const Operand &other = sameValue(g->a, v) ? g->b : g->a;
+        Range o = at(other, g->pred);
+        r.lo = std::max(r.lo, o.lo);
+        r.hi = std::min(r.hi, o.hi);
+      }
+    }
+    return r;
+  }
+};
+
+// Index = iv + offset through MOV and ADD/SUB of constants. 'low'/'high'
+// bound the offsets of the intermediate values too, so that a guard on
+// them rules out wrap-around anywhere along the chain.
+struct Offset {
+  int64_t value = 0, low = 0, high = 0;
+};
+
+std::optional<Offset> offsetFrom(RangeAnalysis &ranges, const Operand &v,
+                                 const Operand &iv, int depth = 0) {
+  if (sameValue(v, iv))
+    return Offset{};
+  const RangeAnalysis::Def *d = ranges.defOf(v);
+  if (!d || depth > 16)
+    return std::nullopt;
+  const Instruction &inst = *d->inst;
+  if (inst.op == OpCode::MOV)
+    return offsetFrom(ranges, inst.operands[0], iv, depth + 1);
+  if (inst.op != OpCode::ADD && inst.op != OpCode::SUB)
+    return std::nullopt;
+
+  const Operand &a = inst.operands[0], &b = inst.operands[1];
+  std::optional<Offset> o;
+  int64_t c;
+  if (b.type == Operand::CONSTANT) {
+    o = offsetFrom(ranges, a, iv, depth + 1);
+    c = std::stoll(b.value);
+    if (inst.op == OpCode::SUB)
+      c = -c;
+  } else if (a.type == Operand::CONSTANT && inst.op == OpCode::ADD) {
+    o = offsetFrom(ranges, b, iv, depth + 1);
+    c = std::stoll(a.value);
+  } else {
+    return std::nullopt;
+  }
+  if (!o)
+    return std::nullopt;
+  o->value += c;
+  o->low = std::min(o->low, o->value);
+  o->high = std::max(o->high, o->value);
+  return o;
+}
+
+// Whether 'v' is 'iv' plus non-negative steps that cannot overflow.
+bool growsFrom(RangeAnalysis &ranges, const Operand &v, const Operand &iv,
+               int depth = 0) {
+  if (sameValue(v, iv))
+    return true;
+  const RangeAnalysis::Def *d = ranges.defOf(v);
+  if (!d || depth > 16)
+    return false;
+  const Instruction &inst = *d->inst;
+  if (inst.op == OpCode::MOV)
+    return growsFrom(ranges, inst.operands[0], iv, depth + 1);
+  if (inst.op != OpCode::ADD)
+    return false;
+  for (int i = 0; i < 2; ++i) {
+    const Operand &step = inst.operands[1 - i], &from = inst.operands[i];
+    if (step.type != Operand::CONSTANT)
+      continue;
+    int64_t c = std::stoll(step.value);
+    return c >= 0 && ranges.at(from, d->block).hi + c <= kMax &&
+           growsFrom(ranges, from, iv, depth + 1);
+  }
+  return false;
+}
+
+struct ArrayInfo {
+  bool constantSize = true;
+  int64_t size = kMax; // Smallest constant size
+  std::vector<std::pair<const BasicBlock *, const Instruction *>> allocas;
+};
+
+// A loop to duplicate with unchecked accesses behind INBOUNDS tests.
+struct VersionPlan {
+  std::set<const BasicBlock *> blocks;
+  BasicBlock *preheader;
+  BasicBlock *header;
+  Operand first, end; // The IV runs over [first, end)
+  std::map<std::string, std::pair<int64_t, int64_t>> offsets; // Per array
+  std::set<const Instruction *> accesses;
+};
+
+bool isLoad(OpCode op) { return op == OpCode::LOAD; }
+bool isAccess(OpCode op) { return op == OpCode::LOAD || op == OpCode::STORE; }
+
+OpCode unchecked(OpCode op) {
+  return isLoad(op) ? OpCode::LOAD_UNCHECKED : OpCode::STORE_UNCHECKED;
+}
+
+bool endsWithTerminator(const BasicBlock &bb) {
+  return !bb.instructions.empty() && isTerminator(bb.instructions.back().op);
+}
+
+// Plans versioning for an innermost loop of the form
+//   header: PHIs; ...; t = LT iv, n; JMP_IF body, t; JMP exit
+// with iv increasing and n invariant. Accesses with a provable offset from
+// iv in blocks under 'body' are the ones the unchecked copy will skip.
+std::optional<VersionPlan>
+planVersioning(RangeAnalysis &ranges, const DominatorTree &domTree,
+               const Loop &loop,
+               const std::map<std::string, ArrayInfo> &arrays) {
+  BasicBlock *header = loop.header;
+  BasicBlock *pre = loop.preheader();
+  if (!loop.subLoops.empty() || !pre)
+    return std::nullopt;
+  for (const auto &inst : pre->instructions)
+    if (inst.op == OpCode::JMP_IF)
+      return std::nullopt;
+
+  const Instruction *branch = nullptr;
+  for (const auto &inst : header->instructions) {
+    if (inst.op == OpCode::JMP_IF) {
+      if (branch)
+        return std::nullopt;
+      branch = &inst;
+    }
+    if (isTerminator(inst.op))
+      break;
+  }
+  if (!branch)
+    return std::nullopt;
+  BasicBlock *body = ranges.block(branch->operands[0].value);
+  if (!body || !loop.contains(body) || body->preds.size() != 1 ||
+      !ranges.edgeCondition(header, body))
+    return std::nullopt;
+
+  const RangeAnalysis::Def *test = ranges.defOf(branch->operands[1]);
+  if (!test || test->block != header)
+    return std::nullopt;
+  const Instruction &cmp = *test->inst;
+  Operand iv, bound;
+  if (cmp.op == OpCode::LT) {
+    iv = cmp.operands[0];
+    bound = cmp.operands[1];
+  } else if (cmp.op == OpCode::GT) {
+    iv = cmp.operands[1];
+    bound = cmp.operands[0];
+  } else {
+    return std::nullopt;
+  }
+  const RangeAnalysis::Def *ivDef = ranges.defOf(iv);
+  if (!ivDef || ivDef->block != header || ivDef->inst->op != OpCode::PHI)
+    return std::nullopt;
+  const RangeAnalysis::Def *boundDef = ranges.defOf(bound);
+  if (boundDef && loop.contains(boundDef->block))
+    return std::nullopt;
+
+  VersionPlan plan;
+  plan.blocks = loop.blocks;
+  plan.preheader = pre;
+  plan.header = header;
+  plan.end = bound;
+  bool haveFirst = false;
+  const auto &phi = ivDef->inst->operands;
+  for (size_t i = 0; i + 1 < phi.size(); i += 2) {
+    BasicBlock *pred = ranges.block(phi[i + 1].value);
+    if (pred == pre) {
+      plan.first = phi[i];
+      haveFirst = true;
+    } else if (!pred || !loop.contains(pred) ||
+               !growsFrom(ranges, phi[i], iv)) {
+      return std::nullopt;
+    }
+  }
+  if (!haveFirst)
+    return std::nullopt;
+
+  for (const BasicBlock *bb : loop.blocks) {
+    if (!domTree.dominates(body, bb))
+      continue;
+    for (const auto &inst : bb->instructions) {
+      if (!isAccess(inst.op))
+        continue;
+      const std::string &array = inst.operands[0].value;
+      auto info = arrays.find(array);
+      bool allocatedInLoop = false;
+      if (info != arrays.end())
+        for (const auto &a : info->second.allocas)
+          allocatedInLoop = allocatedInLoop || loop.contains(a.first);
+      if (allocatedInLoop)
+        continue;
+      auto offset = offsetFrom(ranges, inst.operands[1], iv);
+      if (!offset)
+        continue;
+      auto it = plan.offsets.find(array);
+      if (it == plan.offsets.end())
+        plan.offsets[array] = {offset->low, offset->high};
+      else
+        it->second = {std::min(it->second.first, offset->low),
+                      std::max(it->second.second, offset->high)};
+      plan.accesses.insert(&inst);
+    }
+  }
+  if (plan.accesses.empty())
+    return std::nullopt;
+  // With constant bounds and sizes the test could only fail: the range
+  // analysis has already removed every check it would cover.
+  bool constant = plan.first.type == Operand::CONSTANT &&
+                  plan.end.type == Operand::CONSTANT;
+  for (const auto &array : plan.offsets) {
+    auto info = arrays.find(array.first);
+    constant = constant && info != arrays.end() && info->second.constantSize;
+  }
+  if (constant)
+    return std::nullopt;
+  return plan;
+}
+
+// Clones the loop after its last block, marks the planned accesses in the
+// copy unchecked and makes the preheader choose between the two. Works on
+// IR without SSA (versions and PHIs gone), so the copy needs no renaming.
+void applyVersioning(Function &func, const VersionPlan &plan, int id) {
+  auto &blocks = func.blocks;
+  auto inLoop = [&](const BasicBlock *bb) { return plan.blocks.count(bb); };
+  std::unordered_map<std::string, std::string> cloneLabel;
+  auto last = blocks.end();
+  for (auto it = blocks.begin(); it != blocks.end(); ++it)
+    if (inLoop(it->get())) {
+      cloneLabel[(*it)->label] = (*it)->label + "_unchecked";
+      last = it;
+    }
+
+  // The copies go right after the last loop block, so that block can no
+  // longer fall through into whatever followed it.
+  if (!endsWithTerminator(**last))
+    (*last)->addInst(Instruction::createBranch(
+        OpCode::JMP, Operand::makeLabel((*std::next(last))->label)));
+
+  std::vector<std::unique_ptr<BasicBlock>> copies;
+  for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+    if (!inLoop(it->get()))
+      continue;
+    auto copy = std::make_unique<BasicBlock>(cloneLabel[(*it)->label]);
+    for (const auto &inst : (*it)->instructions) {
+      Instruction c = inst;
+      if (plan.accesses.count(&inst))
+        c.op = unchecked(c.op);
+      if ((c.op == OpCode::JMP || c.op == OpCode::JMP_IF) &&
+          cloneLabel.count(c.operands[0].value))
+        c.operands[0].value = cloneLabel[c.operands[0].value];
+      copy->addInst(c);
+    }
+    if (!endsWithTerminator(*copy)) {
+      const std::string &next = (*std::next(it))->label;
+      auto target = cloneLabel.find(next);
+      copy->addInst(Instruction::createBranch(
+          OpCode::JMP, Operand::makeLabel(target == cloneLabel.end()
+                                              ? next
+                                              : target->second)));
+    }
+    copies.push_back(std::move(copy));
+  }
+  auto pos = std::next(last);
+  for (auto &copy : copies)
+    pos = std::next(blocks.insert(pos, std::move(copy)));
+
+  // Preheader: one INBOUNDS per array, all must pass.
+  auto &pre = plan.preheader->instructions;
+  int line = pre.empty() ? 0 : pre.back().line;
+  if (!pre.empty() && pre.back().op == OpCode::JMP)
+    pre.pop_back();
+  auto strip = [](Operand op) {
+    op.version = 0;
+    return op;
+  };
+  std::string prefix = "%inbounds" + std::to_string(id);
+  Operand all;
+  int k = 0;
+  for (const auto &array : plan.offsets) {
+    Operand g = Operand::makeVar(prefix + "_" + std::to_string(k++));
+    Instruction test(OpCode::INBOUNDS, g);
+    test.operands = {Operand::makeVar(array.first), strip(plan.first),
+                     strip(plan.end),
+                     Operand::makeConst(array.second.first),
+                     Operand::makeConst(array.second.second)};
+    test.line = line;
+    pre.push_back(test);
+    if (k == 1) {
+      all = g;
+    } else {
+      Operand both = Operand::makeVar(prefix + "_and" + std::to_string(k));
+      Instruction combine(OpCode::MUL, both, all, g);
+      combine.line = line;
+      pre.push_back(combine);
+      all = both;
+    }
+  }
+  auto go = Instruction::createCondBranch(
+      OpCode::JMP_IF, Operand::makeLabel(cloneLabel[plan.header->label]), all);
+  go.line = line;
+  pre.push_back(go);
+  auto stay = Instruction::createBranch(
+      OpCode::JMP, Operand::makeLabel(plan.header->label));
+  stay.line = line;
+  pre.push_back(stay);
+}
+
+} // namespace
+
+void BoundsCheckEliminationPass::run(Function &func) const {
+  if (func.blocks.empty())
+    return;
+  DominatorTree domTree(func);
+  LoopInfo loops(domTree);
+  RangeAnalysis ranges(func, domTree, loops);
+
+  std::map<std::string, ArrayInfo> arrays;
+  for (BasicBlock *bb : domTree.reversePostOrder())
+    for (const auto &inst : bb->instructions) {
+      if (inst.op != OpCode::ALLOCA)
+        continue;
+      ArrayInfo &info = arrays[inst.operands[0].value];
+      info.allocas.push_back({bb, &inst});
+      if (inst.operands[1].type == Operand::CONSTANT)
+        info.size = std::min<int64_t>(info.size,
+                                      std::stoll(inst.operands[1].value));
+      else
+        info.constantSize = false;
+    }
+
+  // Some ALLOCA of the array runs before every execution of 'access'.
+  auto allocatedBefore = [&](const ArrayInfo &info, const BasicBlock *bb,
+                             const Instruction *access) {
+    for (const auto &a : info.allocas)
+      if (domTree.dominates(a.first, a.second, bb, access))
+        return true;
+    return false;
+  };
+
+  int proven = 0;
+  for (BasicBlock *bb : domTree.reversePostOrder()) {
+    for (auto &inst : bb->instructions) {
+      if (!isAccess(inst.op))
+        continue;
+      auto info = arrays.find(inst.operands[0].value);
+      if (info == arrays.end() || !info->second.constantSize ||
+          !allocatedBefore(info->second, bb, &inst))
+        continue;
+      Range r = ranges.at(inst.operands[1], bb);
+      if (r.lo >= 0 && r.hi < info->second.size) {
+        inst.op = unchecked(inst.op);
+        ++proven;
+      }
+    }
+  }
+
+  std::vector<VersionPlan> plans;
+  for (const auto &loop : loops.loops())
+    if (auto plan = planVersioning(ranges, domTree, *loop, arrays))
+      plans.push_back(std::move(*plan));
+  // The last loop block must be able to jump to the block after it.
+  plans.erase(std::remove_if(plans.begin(), plans.end(),
+                             [&](const VersionPlan &plan) {
+                               return plan.blocks.count(
+                                          func.blocks.back().get()) &&
+                                      !endsWithTerminator(*func.blocks.back());
+                             }),
+              plans.end());
+
+  OPTIMIX_LOG(DEBUG, "bce: " + func.name + ": " + std::to_string(proven) +
+                         " accesses proven, " + std::to_string(plans.size()) +
+                         " loops versioned");
+  if (plans.empty())
+    return;
+  discardSSA(func);
+  for (size_t i = 0; i < plans.size(); ++i)
+    applyVersioning(func, plans[i], i);
+  SSAPass().run(func);
+}
+
+} // namespace ir
+} // namespace optimix
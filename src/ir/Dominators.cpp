@@ -0,0 +1,195 @@
+#include "optimix/ir/Dominators.h"
+#include <algorithm>
+#include <iterator>
+
+namespace optimix {
+namespace ir {
+
+void computeCFG(Function &func) {
+  std::unordered_map<std::string, BasicBlock *> byLabel;
+  for (auto &bb : func.blocks) {
+    bb->preds.clear();
+    bb->succs.clear();
+    byLabel[bb->label] = bb.get();
+  }
+  auto link = [](BasicBlock *from, BasicBlock *to) {
+    if (std::find(from->succs.begin(), from->succs.end(), to) !=
+        from->succs.end())
+      return;
+    from->succs.push_back(to);
+    to->preds.push_back(from);
+  };
+
+  for (auto it = func.blocks.begin(); it != func.blocks.end(); ++it) {
+    BasicBlock *bb = it->get();
+    bool terminated = false;
+    for (const auto &inst : bb->instructions) {
+      if (inst.op == OpCode::JMP || inst.op == OpCode::JMP_IF) {
+        auto target = byLabel.find(inst.operands[0].value);
+        if (target != byLabel.end())
+          link(bb, target->second);
+      }
+      if (isTerminator(inst.op)) {
+        terminated = true;
+        break; // Anything after it never runs
+      }
+    }
+    if (!terminated && std::next(it) != func.blocks.end())
+      link(bb, std::next(it)->get());
+  }
+}
+
+DominatorTree::DominatorTree(Function &func) {
+  computeCFG(func);
+  if (func.blocks.empty())
+    return;
+
+  // Depth-first postorder from the entry, reversed.
+  std::vector<BasicBlock *> post;
+  std::unordered_map<const BasicBlock *, bool> seen;
+  std::vector<std::pair<BasicBlock *, size_t>> stack;
+  BasicBlock *entry = func.blocks.front().get();
+  stack.push_back({entry, 0});
+  seen[entry] = true;
+  while (!stack.empty()) {
+    auto &top = stack.back();
+    if (top.second < top.first->succs.size()) {
+      BasicBlock *succ = top.first->succs[top.second++];
+      if (!seen[succ]) {
+        seen[succ] = true;
+        stack.push_back({succ, 0});
+      }
+    } else {
+      post.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+  rpo.assign(post.rbegin(), post.rend());
+  for (size_t i = 0; i < rpo.size(); ++i)
+    index[rpo[i]] = i;
+
+  // Iterate to a fixed point; in reverse postorder this takes very few
+  // rounds for the reducible graphs the front end produces.
+  const int undefined = -1;
+  idoms.assign(rpo.size(), undefined);
+  idoms[0] = 0;
+  auto intersect = [this](int a, int b) {
+    while (a != b) {
+      while (a > b)
+        a = idoms[a];
+      while (b > a)
+        b = idoms[b];
+    }
+    return a;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 1; i < rpo.size(); ++i) {
+      int newIdom = undefined;
+      for (BasicBlock *pred : rpo[i]->preds) {
+        auto p = index.find(pred);
+        if (p == index.end() || idoms[p->second] == undefined)
+          continue;
+        newIdom = newIdom == undefined ? p->second
+                                       : intersect(p->second, newIdom);
+      }
+      if (idoms[i] != newIdom) {
+        idoms[i] = newIdom;
+        changed = true;
+      }
+    }
+  }
+
+  kids.assign(rpo.size(), {});
+  for (size_t i = 1; i < rpo.size(); ++i)
+    kids[idoms[i]].push_back(rpo[i]);
+
+  // Preorder/postorder numbers on the tree make dominates() O(1).
+  treeIn.assign(rpo.size(), 0);
+  treeOut.assign(rpo.size(), 0);
+  int clock = 0;
+  std::vector<std::pair<int, size_t>> walk = {{0, 0}};
+  treeIn[0] = clock++;
+  while (!walk.empty()) {
+    auto &top = walk.back();
+    if (top.second < kids[top.first].size()) {
+      int child = index[kids[top.first][top.second++]];
+      treeIn[child] = clock++;
+      walk.push_back({child, 0});
+    } else {
+      treeOut[top.first] = clock++;
+      walk.pop_back();
+    }
+  }
+
+  // A join point is in the frontier of every block on the way from each of
+  // its predecessors up to (not including) its idom.
+  frontiers.assign(rpo.size(), {});
+  for (size_t i = 0; i < rpo.size(); ++i) {
+    if (rpo[i]->preds.size() < 2)
+      continue;
+    for (BasicBlock *pred : rpo[i]->preds) {
+      auto p = index.find(pred);
+      if (p == index.end())
+        continue;
+      int runner = p->second;
+      while (runner != idoms[i]) {
+        auto &df = frontiers[runner];
+        if (df.empty() || df.back() != rpo[i])
+          df.push_back(rpo[i]);
+        if (runner == 0)
+          break;
+        runner = idoms[runner];
+      }
+    }
+  }
+}
+
+BasicBlock *DominatorTree::idom(const BasicBlock *bb) const {
+  auto it = index.find(bb);
+  if (it == index.end() || it->second == 0)
+    return nullptr;
+  return rpo[idoms[it->second]];
+}
+
+bool DominatorTree::dominates(const BasicBlock *a, const BasicBlock *b) const {
+  auto ia = index.find(a), ib = index.find(b);
+  if (ia == index.end() || ib == index.end())
+    return false;
+  return treeIn[ia->second] <= treeIn[ib->second] &&
+         treeOut[ib->second] <= treeOut[ia->second];
+}
+
+bool DominatorTree::dominates(const BasicBlock *aBlock, const Instruction *a,
+                              const BasicBlock *bBlock,
+                              const Instruction *b) const {
+  if (aBlock != bBlock)
+    return dominates(aBlock, bBlock);
+  if (!isReachable(aBlock))
+    return false;
+  for (const auto &inst : aBlock->instructions) {
+    if (&inst == b)
+      return false;
+    if (&inst == a)
+      return true;
+  }
+  return false;
+}
+
+const std::vector<BasicBlock *> &
+DominatorTree::children(const BasicBlock *bb) const {
+  static const std::vector<BasicBlock *> none;
+  auto it = index.find(bb);
+  return it == index.end() ? none : kids[it->second];
+}
+
+const std::vector<BasicBlock *> &
+DominatorTree::frontier(const BasicBlock *bb) const {
+  static const std::vector<BasicBlock *> none;
+  auto it = index.find(bb);
+  return it == index.end() ? none : frontiers[it->second];
+}
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,157 @@
+#include "optimix/ir/Evaluate.h"
+#include "optimix/codegen/IRInterpreter.h"
+#include "optimix/support/Diagnostics.h"
+#include "optimix/support/OutputBuffer.h"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+// What a run printed and returned.
+struct Outcome {
+  std::vector<int> prints;
+  int result = 0;
+};
+
+// Runs 'func' on 'args' in at most 'budget' steps (nonzero) and takes the
+// steps it used off 'budget', whether or not the run succeeds. Returns false
+// if the run faults, runs out of steps or prints more than the pass folds.
+bool evaluate(const Module &module, const Function &func,
+              const std::vector<int> &args, uint64_t &budget,
+              Outcome &outcome) {
+  ExecState state;
+  for (size_t i = 0; i < args.size(); ++i)
+    state.variables[func.params[i]] = args[i];
+  std::ostringstream text;
+  IRInterpreter engine;
+  engine.setModule(&module);
+  engine.setStepLimit(budget);
+  bool finished = true;
+  try {
+    OutputBuffer out(text);
+    engine.setOutput(&out);
+    outcome.result = engine.execute(func, state);
+    out.flush();
+  } catch (const std::exception &) {
+    finished = false;
+  }
+  budget -= std::min(budget, engine.executedCount());
+  if (!finished)
+    return false;
+
+  std::istringstream in(text.str());
+  int value;
+  while (in >> value) {
+    if (outcome.prints.size() == PartialEvaluationPass::kMaxPrints)
+      return false;
+    outcome.prints.push_back(value);
+  }
+  return true;
+}
+
+// A function that returns callee(args): a call evaluated through it counts
+// toward the call depth as it does at run time.
+std::unique_ptr<Function> makeCaller(const std::string &callee,
+                                     const std::vector<int> &args) {
+  auto caller = std::make_unique<Function>("%evaluate");
+  BasicBlock *entry = caller->createBlock("entry");
+  Instruction call(OpCode::CALL, Operand::makeVar("%result"),
+                   Operand::makeLabel(callee));
+  for (int arg : args)
+    call.operands.push_back(Operand::makeConst(arg));
+  entry->addInst(call);
+  entry->addInst(Instruction::createRet(Operand::makeVar("%result")));
+  return caller;
+}
+
+Instruction makePrint(int value) {
+  Instruction inst(OpCode::PRINT, {Operand::CONSTANT, ""});
+  inst.operands = {Operand::makeConst(value)};
+  return inst;
+}
+
+} // namespace
+
+void PartialEvaluationPass::run(Module &module) const {
+  uint64_t left = stepLimit;
+
+  // Calls with constant arguments first, so that a long-running main does
+  // not use up the budget before them (and then runs without them).
+  // Repeated calls are run once; a run that failed is not tried again.
+  std::map<std::pair<std::string, std::vector<int>>, std::pair<bool, Outcome>>
+      runs;
+  int calls = 0;
+  for (auto &func : module.functions)
+    for (auto &bb : func->blocks)
+      for (auto it = bb->instructions.begin(); it != bb->instructions.end();
+           ++it) {
+        if (it->op != OpCode::CALL)
+          continue;
+        const Function *callee = module.getFunction(it->operands[0].value);
+        std::vector<int> args;
+        for (size_t i = 1; i < it->operands.size(); ++i)
+          if (it->operands[i].type == Operand::CONSTANT)
+            args.push_back(std::stoi(it->operands[i].value));
+        if (!callee || args.size() + 1 != it->operands.size() ||
+            args.size() != callee->params.size())
+          continue;
+
+        auto key = std::make_pair(callee->name, args);
+        auto found = runs.find(key);
+        if (found == runs.end()) {
+          if (!left)
+            continue;
+          Outcome outcome;
+          bool ok = evaluate(module, *makeCaller(callee->name, args), {},
+                             left, outcome);
+          found = runs.emplace(key, std::make_pair(ok, outcome)).first;
+        }
+        if (!found->second.first)
+          continue;
+        const Outcome &outcome = found->second.second;
+        for (int value : outcome.prints) {
+          Instruction print = makePrint(value);
+          print.line = it->line;
+          bb->instructions.insert(it, print);
+        }
+        Instruction mov(OpCode::MOV, it->result,
+                        Operand::makeConst(outcome.result));
+        mov.line = it->line;
+        *it = mov;
+        ++calls;
+      }
+
+  // Then a function without parameters becomes its output and result.
+  int functions = 0;
+  for (auto &func : module.functions) {
+    Outcome outcome;
+    if (!left || !func->params.empty() || func->blocks.empty() ||
+        !evaluate(module, *func, {}, left, outcome))
+      continue;
+    BasicBlock *entry = func->blocks.front().get();
+    func->blocks.erase(std::next(func->blocks.begin()), func->blocks.end());
+    entry->instructions.clear();
+    entry->preds.clear();
+    entry->succs.clear();
+    for (int value : outcome.prints)
+      entry->addInst(makePrint(value));
+    entry->addInst(
+        Instruction::createRet(Operand::makeConst(outcome.result)));
+    ++functions;
+  }
+  OPTIMIX_LOG(DEBUG, "evaluate: " + std::to_string(functions) +
+                         " functions and " + std::to_string(calls) +
+                         " calls folded");
+}
+
+} // namespace ir
+} // namespace optimix
@@ -3,69 +3,219 @@
 namespace optimix {
 namespace ir {
 
-std::string Instruction::toString() const {
-  std::string s;
+const char *opcodeName(OpCode op) {
   switch (op) {
   case OpCode::ADD:
-    s = "ADD";
-    break;
+    return "ADD";
   case OpCode::SUB:
-    s = "SUB";
-    break;
+    return "SUB";
   case OpCode::MUL:
-    s = "MUL";
-    break;
+    return "MUL";
   case OpCode::DIV:
-    s = "DIV";
-    break;
+    return "DIV";
   case OpCode::MOV:
-    s = "MOV";
-    break;
+    return "MOV";
   case OpCode::LT:
-    s = "LT";
-    break;
+    return "LT";
   case OpCode::GT:
-    s = "GT";
-    break;
+    return "GT";
   case OpCode::EQ:
-    s = "EQ";
-    break;
+    return "EQ";
   case OpCode::NEQ:
-    s = "NEQ";
-    break;
+    return "NEQ";
   case OpCode::JMP:
-    return "JMP " + operands[0].toString();
+    return "JMP";
   case OpCode::JMP_IF:
-    return "JMP_IF " + operands[0].toString() + ", " + operands[1].toString();
+    return "JMP_IF";
+  case OpCode::PHI:
+    return "PHI";
   case OpCode::RET:
-    return "RET " + operands[0].toString();
+    return "RET";
   case OpCode::PRINT:
-    return "PRINT " + operands[0].toString();
-  case OpCode::PHI:
-    s = "PHI";
-    break;
+    return "PRINT";
+  case OpCode::CALL:
+    return "CALL";
+  case OpCode::ALLOCA:
+    return "ALLOCA";
+  case OpCode::LOAD:
+    return "LOAD";
+  case OpCode::STORE:
+    return "STORE";
+  case OpCode::LOAD_UNCHECKED:
+    return "LOAD_UNCHECKED";
+  case OpCode::STORE_UNCHECKED:
+    return "STORE_UNCHECKED";
+  case OpCode::INBOUNDS:
+    return "INBOUNDS";
+  case OpCode::SHL:
+    return "SHL";
+  case OpCode::SHR:
+    return "SHR";
+  case OpCode::MULH:
+    return "MULH";
+  case OpCode::SELECT:
+    return "SELECT";
+  case OpCode::PARFOR:
+    return "PARFOR";
+  case OpCode::MEMO:
+    return "MEMO";
+  }
+  return "OP";
+}
+
+bool hasResult(OpCode op) {
+  switch (op) {
+  case OpCode::JMP:
+  case OpCode::JMP_IF:
+  case OpCode::RET:
+  case OpCode::PRINT:
+  case OpCode::ALLOCA:
+  case OpCode::STORE:
+  case OpCode::STORE_UNCHECKED:
+  case OpCode::PARFOR:
+  case OpCode::MEMO:
+    return false;
   default:
-    s = "OP";
+    return true;
   }
+}
 
-  s += " " + result.toString();
-  if (!operands.empty()) {
-    s += ", ";
-    for (size_t i = 0; i < operands.size(); ++i) {
-      s += operands[i].toString();
-      if (i < operands.size() - 1)
-        s += ", ";
-    }
+bool isArrayOperand(OpCode op, size_t index) {
+  switch (op) {
+  case OpCode::ALLOCA:
+  case OpCode::LOAD:
+  case OpCode::STORE:
+  case OpCode::LOAD_UNCHECKED:
+  case OpCode::STORE_UNCHECKED:
+  case OpCode::INBOUNDS:
+    return index == 0;
+  default:
+    return false;
   }
+}
+
+OpCode checkedForm(OpCode op) {
+  switch (op) {
+  case OpCode::LOAD_UNCHECKED:
+    return OpCode::LOAD;
+  case OpCode::STORE_UNCHECKED:
+    return OpCode::STORE;
+  default:
+    return op;
+  }
+}
+
+std::string Instruction::toString() const {
+  // OPCODE [result, ] operand, operand...
+  std::string s = opcodeName(op);
+  bool first = true;
+  auto add = [&](const Operand &o) {
+    s += first ? " " : ", ";
+    s += o.toString();
+    first = false;
+  };
+  if (hasResult(op))
+    add(result);
+  for (const auto &o : operands)
+    add(o);
   return s;
 }
 
-void Function::print() const {
-  std::cout << "Function " << name << ":\n";
+const Operand *Instruction::incoming(const std::string &label) const {
+  for (size_t i = 0; i + 1 < operands.size(); i += 2)
+    if (operands[i + 1].value == label)
+      return &operands[i];
+  return nullptr;
+}
+
+bool Instruction::isWellFormed() const {
+  auto count = [this](size_t n) { return operands.size() == n; };
+  auto isLabel = [this](size_t i) {
+    return operands[i].type == Operand::LABEL;
+  };
+  auto isVar = [this](size_t i) {
+    return operands[i].type == Operand::VARIABLE;
+  };
+  bool hasResult = result.type == Operand::VARIABLE;
+
+  switch (op) {
+  case OpCode::ADD:
+  case OpCode::SUB:
+  case OpCode::MUL:
+  case OpCode::DIV:
+  case OpCode::LT:
+  case OpCode::GT:
+  case OpCode::EQ:
+  case OpCode::NEQ:
+  case OpCode::SHL:
+  case OpCode::SHR:
+  case OpCode::MULH:
+    return hasResult && count(2);
+  case OpCode::MOV:
+    return hasResult && count(1);
+  case OpCode::SELECT:
+    return hasResult && count(3);
+  case OpCode::JMP:
+    return count(1) && isLabel(0);
+  case OpCode::JMP_IF:
+    return count(2) && isLabel(0);
+  case OpCode::PHI:
+    if (!hasResult || operands.size() % 2 != 0)
+      return false;
+    for (size_t i = 1; i < operands.size(); i += 2)
+      if (!isLabel(i))
+        return false;
+    return true;
+  case OpCode::RET:
+    return operands.size() <= 1;
+  case OpCode::PRINT:
+    return count(1);
+  case OpCode::CALL:
+    if (!hasResult || operands.empty() || !isLabel(0))
+      return false;
+    for (size_t i = 1; i < operands.size(); ++i)
+      if (isLabel(i))
+        return false;
+    return true;
+  case OpCode::ALLOCA:
+    return count(2) && isVar(0);
+  case OpCode::LOAD:
+  case OpCode::LOAD_UNCHECKED:
+    return hasResult && count(2) && isVar(0);
+  case OpCode::STORE:
+  case OpCode::STORE_UNCHECKED:
+    return count(3) && isVar(0);
+  case OpCode::INBOUNDS:
+    return hasResult && count(5) && isVar(0);
+  case OpCode::PARFOR:
+    if (operands.size() < 3 || !isLabel(0))
+      return false;
+    for (size_t i = 1; i < operands.size(); ++i)
+      if (!isVar(i))
+        return false;
+    return true;
+  case OpCode::MEMO:
+    return count(1) && operands[0].type == Operand::CONSTANT;
+  }
+  return false;
+}
+
+void Function::print() const { print(std::cout); }
+
+void Function::print(std::ostream &os) const {
+  // Function fib(n): names the variables that receive the arguments.
+  os << "Function " << name;
+  if (!params.empty()) {
+    os << "(";
+    for (size_t i = 0; i < params.size(); ++i)
+      os << (i ? ", " : "") << params[i];
+    os << ")";
+  }
+  os << ":\n";
   for (const auto &bb : blocks) {
-    std::cout << bb->label << ":\n";
+    os << bb->label << ":\n";
     for (const auto &inst : bb->instructions) {
-      std::cout << "  " << inst.toString() << "\n";
+      os << "  " << inst.toString() << "\n";
     }
   }
 }
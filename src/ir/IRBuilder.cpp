@@ -1,9 +1,11 @@
 #include "optimix/ir/IRBuilder.h"
+#include <stdexcept>
 
 namespace optimix {
 
 std::unique_ptr<ir::Function> IRBuilder::generate(const FunctionAST &ast) {
   auto func = std::make_unique<ir::Function>(ast.name);
+  func->params = ast.args;
   currentFunc = func.get();
   currentBB = currentFunc->createBlock("entry");
 
@@ -14,6 +16,51 @@ std::unique_ptr<ir::Function> IRBuilder::generate(const FunctionAST &ast) {
   return func;
 }
 
+std::unique_ptr<ir::Module> IRBuilder::generate(const ProgramAST &program) {
+  auto module = std::make_unique<ir::Module>();
+  for (const auto &f : program.functions) {
+    // Temps and labels are numbered per function, so a function's IR does
+    // not depend on what precedes it in the file.
+    tempCounter = 0;
+    labelCounter = 0;
+    module->functions.push_back(generate(*f));
+  }
+
+  // Callees may be defined after their callers, so calls are checked once
+  // every function is known.
+  for (const auto &func : module->functions)
+    for (const auto &bb : func->blocks)
+      for (const auto &inst : bb->instructions) {
+        if (inst.op != ir::OpCode::CALL)
+          continue;
+        const std::string &name = inst.operands[0].value;
+        const ir::Function *callee = module->getFunction(name);
+        if (!callee)
+          throw std::runtime_error("Call to undefined function " + name);
+        size_t count = inst.operands.size() - 1;
+        if (count != callee->params.size())
+          throw std::runtime_error(
+              "Function " + name + " takes " +
+              std::to_string(callee->params.size()) + " arguments, not " +
+              std::to_string(count));
+      }
+  return module;
+}
+
+std::unique_ptr<ir::Function> IRBuilder::generateLoop(const WhileStmt &loop,
+                                                      const std::string &name) {
+  auto func = std::make_unique<ir::Function>(name);
+  currentFunc = func.get();
+  currentBB = currentFunc->createBlock("entry");
+
+  // Live-ins are not defined here: the caller seeds them from its own state.
+  // The loop exit block is created last, so leaving the loop falls off the
+  // end of the function.
+  genStmt(&loop);
+
+  return func;
+}
+
 ir::Operand IRBuilder::genExpr(const Expr *expr) {
   if (auto *num = dynamic_cast<const NumberExpr *>(expr)) {
     return ir::Operand::makeConst(num->value);
@@ -51,7 +98,7 @@ ir::Operand IRBuilder::genExpr(const Expr *expr) {
   }
 
   if (auto *arrAcc = dynamic_cast<const ArrayAccessExpr *>(expr)) {
-    auto index = genExpr(arrAcc->index.get());
+    auto index = genIndex(arrAcc->name, arrAcc->indices);
     auto dest = ir::Operand::makeVar(newTemp());
     // LOAD dest, arrName, index
     ir::Instruction inst(ir::OpCode::LOAD, dest);
@@ -60,10 +107,39 @@ ir::Operand IRBuilder::genExpr(const Expr *expr) {
     return dest;
   }
 
+  if (auto *call = dynamic_cast<const CallExpr *>(expr)) {
+    // CALL dest, callee, args...
+    auto dest = ir::Operand::makeVar(newTemp());
+    ir::Instruction inst(ir::OpCode::CALL, dest);
+    inst.operands.push_back(ir::Operand::makeLabel(call->callee));
+    for (const auto &arg : call->args)
+      inst.operands.push_back(genExpr(arg.get()));
+    emit(inst);
+    return dest;
+  }
+
   return ir::Operand::makeConst(0);
 }
 
+ir::Operand
+IRBuilder::genIndex(const std::string &array,
+                    const std::vector<std::unique_ptr<Expr>> &indices) {
+  auto index = genExpr(indices[0].get());
+  for (size_t d = 1; d < indices.size(); ++d) {
+    auto row = ir::Operand::makeVar(newTemp());
+    emit(ir::Instruction(ir::OpCode::MUL, row, index,
+                         ir::Operand::makeVar(arrayExtentName(array, d))));
+    auto column = genExpr(indices[d].get());
+    index = ir::Operand::makeVar(newTemp());
+    emit(ir::Instruction(ir::OpCode::ADD, index, row, column));
+  }
+  return index;
+}
+
 void IRBuilder::genStmt(const Stmt *stmt) {
+  int outerLine = currentLine;
+  currentLine = stmt->line;
+
   if (auto *ret = dynamic_cast<const ReturnStmt *>(stmt)) {
     auto val =
         ret->value ? genExpr(ret->value.get()) : ir::Operand::makeConst(0);
@@ -73,7 +149,7 @@ void IRBuilder::genStmt(const Stmt *stmt) {
     emit(ir::Instruction(ir::OpCode::MOV, ir::Operand::makeVar(assign->name),
                          val));
   } else if (auto *arrAssign = dynamic_cast<const ArrayAssignment *>(stmt)) {
-    auto idx = genExpr(arrAssign->index.get());
+    auto idx = genIndex(arrAssign->name, arrAssign->indices);
     auto val = genExpr(arrAssign->value.get());
     // STORE arrName, idx, val
     ir::Instruction inst(ir::OpCode::STORE, {ir::Operand::CONSTANT, ""});
@@ -86,15 +162,49 @@ void IRBuilder::genStmt(const Stmt *stmt) {
                            val));
     }
   } else if (auto *arrDecl = dynamic_cast<const ArrayDecl *>(stmt)) {
-    // ALLOCA arrName, size
+    // ALLOCA arrName, size, where size is the product of the extents; all
+    // but the first are also kept in their hidden variables.
+    std::vector<ir::Operand> extents;
+    for (const auto &dim : arrDecl->dims)
+      extents.push_back(genExpr(dim.get()));
+    auto size = extents[0];
+    for (size_t d = 1; d < extents.size(); ++d) {
+      emit(ir::Instruction(
+          ir::OpCode::MOV,
+          ir::Operand::makeVar(arrayExtentName(arrDecl->name, d)),
+          extents[d]));
+      auto product = ir::Operand::makeVar(newTemp());
+      emit(ir::Instruction(ir::OpCode::MUL, product, size, extents[d]));
+      size = product;
+    }
+    // A negative extent becomes the size, so that ALLOCA rejects it even
+    // when the product is not negative.
+    for (const auto &extent : extents) {
+      if (extents.size() == 1)
+        break;
+      if (extent.type == ir::Operand::CONSTANT) {
+        if (std::stoi(extent.value) < 0)
+          size = extent;
+        continue;
+      }
+      auto negative = ir::Operand::makeVar(newTemp());
+      emit(ir::Instruction(ir::OpCode::LT, negative, extent,
+                           ir::Operand::makeConst(0)));
+      auto checked = ir::Operand::makeVar(newTemp());
+      ir::Instruction select(ir::OpCode::SELECT, checked, negative, extent);
+      select.operands.push_back(size);
+      emit(select);
+      size = checked;
+    }
     ir::Instruction inst(ir::OpCode::ALLOCA, {ir::Operand::CONSTANT, ""});
-    inst.operands = {ir::Operand::makeVar(arrDecl->name),
-                     ir::Operand::makeConst(arrDecl->size)};
+    inst.operands = {ir::Operand::makeVar(arrDecl->name), size};
     emit(inst);
   } else if (auto *loop = dynamic_cast<const WhileStmt *>(stmt)) {
     auto loopInfo = currentFunc->createBlock("loop_" + newLabel());
     auto bodyBB = currentFunc->createBlock("loop_body_" + newLabel());
-    auto exitBB = currentFunc->createBlock("loop_exit_" + newLabel());
+    // The exit block is created after the body so that nested loops do not
+    // end up between it and the code that follows the loop.
+    std::string exitLabel = "loop_exit_" + newLabel();
 
     // Jump to loop condition check
     emit(ir::Instruction::createBranch(
@@ -107,7 +217,7 @@ void IRBuilder::genStmt(const Stmt *stmt) {
         ir::OpCode::JMP_IF, ir::Operand::makeLabel(bodyBB->label),
         cond)); // If true, body
     emit(ir::Instruction::createBranch(
-        ir::OpCode::JMP, ir::Operand::makeLabel(exitBB->label))); // Else exit
+        ir::OpCode::JMP, ir::Operand::makeLabel(exitLabel))); // Else exit
 
     // Loop Body
     currentBB = bodyBB;
@@ -115,11 +225,46 @@ void IRBuilder::genStmt(const Stmt *stmt) {
       genStmt(s.get());
     }
     // Jump back to condition
+    currentLine = loop->line;
     emit(ir::Instruction::createBranch(
         ir::OpCode::JMP, ir::Operand::makeLabel(loopInfo->label)));
 
     // Exit
-    currentBB = exitBB;
+    currentBB = currentFunc->createBlock(exitLabel);
+  } else if (auto *branch = dynamic_cast<const IfStmt *>(stmt)) {
+    auto cond = genExpr(branch->condition.get());
+    auto thenBB = currentFunc->createBlock("if_then_" + newLabel());
+    // As for loops, the later blocks are created once the code before them
+    // has been generated, which keeps nested blocks in source order.
+    std::string elseLabel =
+        branch->otherwise.empty() ? "" : "if_else_" + newLabel();
+    std::string endLabel = "if_end_" + newLabel();
+
+    emit(ir::Instruction::createCondBranch(
+        ir::OpCode::JMP_IF, ir::Operand::makeLabel(thenBB->label), cond));
+    emit(ir::Instruction::createBranch(
+        ir::OpCode::JMP,
+        ir::Operand::makeLabel(elseLabel.empty() ? endLabel : elseLabel)));
+
+    currentBB = thenBB;
+    for (const auto &s : branch->then)
+      genStmt(s.get());
+    currentLine = branch->line;
+    emit(ir::Instruction::createBranch(ir::OpCode::JMP,
+                                       ir::Operand::makeLabel(endLabel)));
+
+    if (!elseLabel.empty()) {
+      currentBB = currentFunc->createBlock(elseLabel);
+      for (const auto &s : branch->otherwise)
+        genStmt(s.get());
+      currentLine = branch->line;
+      emit(ir::Instruction::createBranch(ir::OpCode::JMP,
+                                         ir::Operand::makeLabel(endLabel)));
+    }
+
+    currentBB = currentFunc->createBlock(endLabel);
+  } else if (auto *call = dynamic_cast<const CallStmt *>(stmt)) {
+    genExpr(call->call.get());
   } else if (auto *print = dynamic_cast<const PrintStmt *>(stmt)) {
     auto val = genExpr(print->value.get());
     // Instruction(OpCode o, Operand res) where res is unused for void
@@ -129,6 +274,8 @@ void IRBuilder::genStmt(const Stmt *stmt) {
     inst.operands = {val};
     emit(inst);
   }
+
+  currentLine = outerLine;
 }
 
 } // namespace optimix
@@ -0,0 +1,203 @@
+#include "optimix/ir/IRParser.h"
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+  size_t begin = 0, end = s.size();
+  while (begin < end && std::isspace(static_cast<unsigned char>(s[begin])))
+    ++begin;
+  while (end > begin && std::isspace(static_cast<unsigned char>(s[end - 1])))
+    --end;
+  return s.substr(begin, end - begin);
+}
+
+bool isInteger(std::string_view s) {
+  size_t i = (!s.empty() && s[0] == '-') ? 1 : 0;
+  if (i == s.size())
+    return false;
+  for (; i < s.size(); ++i)
+    if (!std::isdigit(static_cast<unsigned char>(s[i])))
+      return false;
+  return true;
+}
+
+// Whether operand 'index' (not counting the result) names a block/function.
+bool isLabelPosition(OpCode op, size_t index) {
+  switch (op) {
+  case OpCode::JMP:
+  case OpCode::JMP_IF:
+  case OpCode::CALL:
+  case OpCode::PARFOR:
+    return index == 0;
+  case OpCode::PHI:
+    return index % 2 == 1;
+  default:
+    return false;
+  }
+}
+
+class IRTextParser {
+public:
+  explicit IRTextParser(std::string_view t) : text(t) {
+    for (int op = 0; op < kNumOpCodes; ++op)
+      opcodes[opcodeName(static_cast<OpCode>(op))] = static_cast<OpCode>(op);
+  }
+
+  std::unique_ptr<Module> parse() {
+    auto module = std::make_unique<Module>();
+    Function *func = nullptr;
+    BasicBlock *block = nullptr;
+
+    size_t pos = 0;
+    while (pos <= text.size()) {
+      size_t eol = text.find('\n', pos);
+      if (eol == std::string_view::npos)
+        eol = text.size();
+      std::string_view raw = text.substr(pos, eol - pos);
+      pos = eol + 1;
+      ++line;
+
+      std::string_view content = trim(raw.substr(0, raw.find(';')));
+      if (content.empty())
+        continue;
+
+      if (content.back() == ':' && !std::isspace((unsigned char)raw[0])) {
+        std::string_view name = content.substr(0, content.size() - 1);
+        if (name.substr(0, 9) == "Function ") {
+          func = parseFunctionHeader(*module, trim(name.substr(9)));
+          block = nullptr;
+        } else {
+          if (!func)
+            fail("block outside of a function");
+          block = func->createBlock(std::string(name));
+        }
+        continue;
+      }
+
+      if (!block)
+        fail("instruction outside of a block");
+      block->addInst(parseInstruction(content));
+    }
+    return module;
+  }
+
+private:
+  std::string_view text;
+  int line = 0;
+  std::unordered_map<std::string, OpCode> opcodes;
+
+  [[noreturn]] void fail(const std::string &message) const {
+    throw std::runtime_error("line " + std::to_string(line) + ": " + message);
+  }
+
+  // "fib(n, k)" or "main" after "Function ".
+  Function *parseFunctionHeader(Module &module, std::string_view header) {
+    size_t open = header.find('(');
+    auto func =
+        std::make_unique<Function>(std::string(trim(header.substr(0, open))));
+    if (open != std::string_view::npos) {
+      if (header.back() != ')')
+        fail("expected ')' after the parameters of " + func->name);
+      std::string_view list = header.substr(open + 1, header.size() - open - 2);
+      size_t start = 0;
+      while (true) {
+        size_t comma = list.find(',', start);
+        Operand param = parseOperand(trim(list.substr(start, comma - start)),
+                                     false);
+        if (param.type != Operand::VARIABLE || param.version != 0)
+          fail("bad parameter of " + func->name);
+        func->params.push_back(param.value);
+        if (comma == std::string_view::npos)
+          break;
+        start = comma + 1;
+      }
+    }
+    module.functions.push_back(std::move(func));
+    return module.functions.back().get();
+  }
+
+  Operand parseOperand(std::string_view token, bool label) const {
+    if (token.empty())
+      fail("missing operand");
+    for (char c : token)
+      if (std::isspace(static_cast<unsigned char>(c)))
+        fail("expected ',' in " + std::string(token));
+    if (label)
+      return Operand::makeLabel(std::string(token));
+    if (isInteger(token)) {
+      try {
+        return Operand::makeConst(std::stoi(std::string(token)));
+      } catch (const std::out_of_range &) {
+        fail("constant out of range: " + std::string(token));
+      }
+    }
+    Operand op = Operand::makeVar(std::string(token));
+    size_t dot = token.rfind('.');
+    if (dot != std::string_view::npos) {
+      std::string_view version = token.substr(dot + 1);
+      if (!isInteger(version) || version[0] == '-')
+        fail("bad SSA version in " + std::string(token));
+      op.value = std::string(token.substr(0, dot));
+      op.version = std::stoi(std::string(version));
+    }
+    return op;
+  }
+
+  Instruction parseInstruction(std::string_view content) const {
+    size_t space = content.find(' ');
+    std::string name(content.substr(0, space));
+    auto it = opcodes.find(name);
+    if (it == opcodes.end())
+      fail("unknown opcode " + name);
+    OpCode op = it->second;
+
+    std::vector<std::string_view> tokens;
+    if (space != std::string_view::npos) {
+      std::string_view rest = content.substr(space + 1);
+      size_t start = 0;
+      while (true) {
+        size_t comma = rest.find(',', start);
+        tokens.push_back(trim(rest.substr(start, comma - start)));
+        if (comma == std::string_view::npos)
+          break;
+        start = comma + 1;
+      }
+    }
+
+    Instruction inst(op, {Operand::CONSTANT, ""});
+    size_t first = 0;
+    if (hasResult(op)) {
+      if (tokens.empty())
+        fail(name + " needs a result");
+      inst.result = parseOperand(tokens[0], false);
+      if (inst.result.type != Operand::VARIABLE)
+        fail(name + " result must be a variable");
+      first = 1;
+    }
+    for (size_t i = first; i < tokens.size(); ++i)
+      inst.operands.push_back(
+          parseOperand(tokens[i], isLabelPosition(op, i - first)));
+
+    if (!inst.isWellFormed())
+      fail("malformed instruction: " + std::string(content));
+    inst.op = checkedForm(op);
+    return inst;
+  }
+};
+
+} // namespace
+
+std::unique_ptr<Module> parseIR(std::string_view text) {
+  return IRTextParser(text).parse();
+}
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,278 @@
+#include "optimix/ir/IfConversion.h"
+#include "optimix/ir/Dominators.h"
+#include "optimix/support/Diagnostics.h"
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <unordered_map>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+// Safe to run on a path that would not have run it.
+bool isSpeculatable(OpCode op) {
+  switch (op) {
+  case OpCode::ADD:
+  case OpCode::SUB:
+  case OpCode::MUL:
+  case OpCode::MOV:
+  case OpCode::LT:
+  case OpCode::GT:
+  case OpCode::EQ:
+  case OpCode::NEQ:
+  case OpCode::SHL:
+  case OpCode::SHR:
+  case OpCode::MULH:
+  case OpCode::SELECT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::string keyOf(const Operand &v) {
+  return v.value + "." + std::to_string(v.version);
+}
+
+class Converter {
+public:
+  explicit Converter(Function &func) : func(func) {}
+
+  void run() {
+    if (func.blocks.empty())
+      return;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      computeCFG(func);
+      for (auto &bb : func.blocks)
+        if (convert(*bb)) {
+          changed = true;
+          break;
+        }
+    }
+    OPTIMIX_LOG(DEBUG, "ifconvert: " + func.name + ": " +
+                           std::to_string(converted) + " branches, " +
+                           std::to_string(selects) + " selects");
+  }
+
+private:
+  Function &func;
+  int converted = 0, selects = 0;
+
+  // Whether 'arm' is entered only from 'head', leaves only to 'join', and
+  // may run unconditionally.
+  bool isArm(const BasicBlock &arm, const BasicBlock &head,
+             const BasicBlock &join) const {
+    if (&arm == func.blocks.front().get() || &arm == &head ||
+        arm.preds.size() != 1 || arm.preds[0] != &head ||
+        arm.succs.size() != 1 || arm.succs[0] != &join)
+      return false;
+    int size = 0;
+    for (const auto &inst : arm.instructions) {
+      if (isTerminator(inst.op))
+        break;
+      if (!isSpeculatable(inst.op) ||
+          inst.result.type != Operand::VARIABLE || inst.result.version == 0 ||
+          ++size > IfConversionPass::kMaxArmSize)
+        return false;
+    }
+    return true;
+  }
+
+  bool convert(BasicBlock &head) {
+    auto &insts = head.instructions;
+    if (insts.empty() || head.succs.size() != 2)
+      return false;
+    auto branch = std::prev(insts.end());
+    if (branch->op == OpCode::JMP && branch != insts.begin())
+      --branch;
+    if (branch->op != OpCode::JMP_IF)
+      return false;
+    Operand cond = branch->operands[1];
+    // A constant condition is simplifycfg's to fold.
+    if (cond.type != Operand::VARIABLE ||
+        head.succs[0]->label != branch->operands[0].value)
+      return false;
+
+    BasicBlock *taken = head.succs[0], *notTaken = head.succs[1];
+    BasicBlock *thenArm = nullptr, *elseArm = nullptr, *join = nullptr;
+    if (isArm(*taken, head, *notTaken)) {
+      thenArm = taken;
+      join = notTaken;
+    } else if (isArm(*notTaken, head, *taken)) {
+      elseArm = notTaken;
+      join = taken;
+    } else if (taken->succs.size() == 1 &&
+               isArm(*taken, head, *taken->succs[0]) &&
+               isArm(*notTaken, head, *taken->succs[0])) {
+      thenArm = taken;
+      elseArm = notTaken;
+      join = taken->succs[0];
+    } else {
+      return false;
+    }
+    if (join == &head || join == func.blocks.front().get() ||
+        join->preds.size() != 2)
+      return false;
+    auto joinPos = func.blocks.begin();
+    while (joinPos->get() != join)
+      ++joinPos;
+    auto &joinInsts = join->instructions;
+    bool joinFallsThrough =
+        joinInsts.empty() || !isTerminator(joinInsts.back().op);
+    if (joinFallsThrough && std::next(joinPos) == func.blocks.end())
+      return false;
+
+    // Fresh names for everything the arms define.
+    std::string prefix = "%if" + std::to_string(converted) + "_";
+    std::unordered_map<std::string, std::string> renamed;
+    for (BasicBlock *arm : {thenArm, elseArm})
+      if (arm)
+        for (const auto &inst : arm->instructions)
+          if (!isTerminator(inst.op))
+            renamed[keyOf(inst.result)] = prefix + inst.result.value;
+    auto rename = [&](Operand &op) {
+      if (op.type != Operand::VARIABLE)
+        return;
+      auto it = renamed.find(keyOf(op));
+      if (it != renamed.end())
+        op.value = it->second;
+    };
+    // Arm copies ("x = t" at the end of a branch) are forwarded into the
+    // SELECTs: between the arms and the SELECTs only renamed values and
+    // earlier SELECTs are written, and the latter are checked below.
+    std::unordered_map<std::string, Operand> copies; // By renamed key
+    for (BasicBlock *arm : {thenArm, elseArm})
+      if (arm)
+        for (const auto &inst : arm->instructions)
+          if (inst.op == OpCode::MOV) {
+            Operand result = inst.result, source = inst.operands[0];
+            rename(result);
+            rename(source);
+            auto it = copies.find(keyOf(source));
+            copies[keyOf(result)] = it != copies.end() ? it->second : source;
+          }
+
+    // Each PHI of the join becomes a SELECT. PHIs read their operands all
+    // at once but SELECTs run in turn, so none may read a variable that an
+    // earlier one writes.
+    const std::string &thenFrom = thenArm ? thenArm->label : head.label;
+    const std::string &elseFrom = elseArm ? elseArm->label : head.label;
+    std::list<Instruction> selected;
+    std::set<std::string> written;
+    auto firstOther = joinInsts.begin();
+    for (; firstOther != joinInsts.end() && firstOther->op == OpCode::PHI;
+         ++firstOther) {
+      const Operand *a = firstOther->incoming(thenFrom);
+      const Operand *b = firstOther->incoming(elseFrom);
+      if (!a || !b)
+        return false;
+      Instruction select(OpCode::SELECT, firstOther->result, cond, *a);
+      select.operands.push_back(*b);
+      select.line = firstOther->line;
+      for (size_t i = 1; i < select.operands.size(); ++i) {
+        Operand &op = select.operands[i];
+        rename(op);
+        auto copy = copies.find(keyOf(op));
+        if (copy != copies.end())
+          op = copy->second;
+        if (op.type == Operand::VARIABLE && written.count(op.value))
+          return false;
+      }
+      written.insert(select.result.value);
+      selected.push_back(std::move(select));
+    }
+    if (written.count(cond.value))
+      return false;
+
+    // Rewrite: head runs both arms, the SELECTs and the rest of the join.
+    int line = branch->line;
+    insts.erase(branch, insts.end());
+    std::list<Instruction> hoisted;
+    for (BasicBlock *arm : {thenArm, elseArm}) {
+      if (!arm)
+        continue;
+      for (auto &inst : arm->instructions) {
+        if (isTerminator(inst.op))
+          break;
+        rename(inst.result);
+        for (auto &op : inst.operands)
+          rename(op);
+        hoisted.push_back(std::move(inst));
+      }
+    }
+    std::unordered_map<std::string, int> reads;
+    for (const auto *list : {&hoisted, &selected})
+      for (const auto &inst : *list)
+        for (const auto &op : inst.operands)
+          if (op.type == Operand::VARIABLE)
+            ++reads[keyOf(op)];
+    // Drop the copies nothing reads any more.
+    hoisted.remove_if([&](const Instruction &inst) {
+      if (inst.op != OpCode::MOV || !copies.count(keyOf(inst.result)) ||
+          reads[keyOf(inst.result)])
+        return false;
+      if (inst.operands[0].type == Operand::VARIABLE)
+        --reads[keyOf(inst.operands[0])];
+      return true;
+    });
+    // A value only its SELECT reads is computed right before it, so that
+    // the engine can fuse the pair (see ADD_IF), unless it reads a variable
+    // that an earlier SELECT overwrote.
+    selects += static_cast<int>(selected.size());
+    std::set<std::string> overwritten;
+    for (auto it = selected.begin(); it != selected.end(); ++it) {
+      for (size_t i = 1; i < it->operands.size(); ++i) {
+        std::string key = keyOf(it->operands[i]);
+        auto def = std::find_if(
+            hoisted.begin(), hoisted.end(),
+            [&](const Instruction &inst) { return keyOf(inst.result) == key; });
+        if (def == hoisted.end() || reads[key] != 1 ||
+            std::any_of(def->operands.begin(), def->operands.end(),
+                        [&](const Operand &op) {
+                          return op.type == Operand::VARIABLE &&
+                                 overwritten.count(op.value);
+                        }))
+          continue;
+        selected.splice(it, hoisted, def);
+        break;
+      }
+      overwritten.insert(it->result.value);
+    }
+    insts.splice(insts.end(), hoisted);
+    insts.splice(insts.end(), selected);
+    insts.splice(insts.end(), joinInsts, firstOther, joinInsts.end());
+    if (joinFallsThrough) {
+      Instruction jump = Instruction::createBranch(
+          OpCode::JMP, Operand::makeLabel((*std::next(joinPos))->label));
+      jump.line = line;
+      insts.push_back(jump);
+    }
+
+    // Whatever the join led to is now entered from head.
+    std::string joinLabel = join->label;
+    for (auto &bb : func.blocks)
+      for (auto &inst : bb->instructions) {
+        if (inst.op != OpCode::PHI)
+          break;
+        for (size_t i = 1; i < inst.operands.size(); i += 2)
+          if (inst.operands[i].value == joinLabel)
+            inst.operands[i].value = head.label;
+      }
+    func.blocks.remove_if([&](const std::unique_ptr<BasicBlock> &bb) {
+      return bb.get() == thenArm || bb.get() == elseArm || bb.get() == join;
+    });
+    ++converted;
+    return true;
+  }
+};
+
+} // namespace
+
+void IfConversionPass::run(Function &func) const { Converter(func).run(); }
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,484 @@
+#include "optimix/ir/InstCombine.h"
+#include "optimix/support/Diagnostics.h"
+#include <climits>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+namespace optimix {
+namespace ir {
+
+DivisionMagic signedDivisionMagic(int divisor) {
+  // Smallest p >= 32 with 2^p > anc * (ad - 2^p mod ad), where anc is the
+  // largest dividend magnitude whose remainder is ad - 1; then
+  // multiplier = (2^p + ad - 2^p mod ad) / ad. Unsigned arithmetic
+  // throughout, so that |INT_MIN| is representable.
+  const uint32_t two31 = 0x80000000u;
+  uint32_t ad = divisor < 0 ? 0u - static_cast<uint32_t>(divisor)
+                            : static_cast<uint32_t>(divisor);
+  uint32_t t = two31 + (static_cast<uint32_t>(divisor) >> 31);
+  uint32_t anc = t - 1 - t % ad;
+  int p = 31;
+  uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+  uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+  uint32_t delta;
+  do {
+    ++p;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      ++q1;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      ++q2;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  uint32_t m = q2 + 1;
+  if (divisor < 0)
+    m = 0u - m;
+  return {static_cast<int>(m), p - 32};
+}
+
+namespace {
+
+int wrap(int64_t value) {
+  return static_cast<int32_t>(static_cast<uint32_t>(value));
+}
+
+std::optional<int> constant(const Operand &op) {
+  if (op.type != Operand::CONSTANT)
+    return std::nullopt;
+  return std::stoi(op.value);
+}
+
+bool sameValue(const Operand &a, const Operand &b) {
+  return a.type == b.type && a.value == b.value && a.version == b.version;
+}
+
+// The engine's semantics; nullopt where it would fault.
+std::optional<int> fold(OpCode op, int a, int b) {
+  switch (op) {
+  case OpCode::ADD:
+    return wrap(int64_t(a) + b);
+  case OpCode::SUB:
+    return wrap(int64_t(a) - b);
+  case OpCode::MUL:
+    return wrap(int64_t(a) * b);
+  case OpCode::DIV:
+    if (b == 0)
+      return 0;
+    if (a == INT_MIN && b == -1)
+      return std::nullopt;
+    return a / b;
+  case OpCode::LT:
+    return a < b;
+  case OpCode::GT:
+    return a > b;
+  case OpCode::EQ:
+    return a == b;
+  case OpCode::NEQ:
+    return a != b;
+  case OpCode::SHL:
+    return wrap(static_cast<uint32_t>(a) << (b & 31));
+  case OpCode::SHR:
+    return a >> (b & 31);
+  case OpCode::MULH:
+    return static_cast<int>((int64_t(a) * b) >> 32);
+  default:
+    return std::nullopt;
+  }
+}
+
+bool isArithmetic(OpCode op) {
+  switch (op) {
+  case OpCode::ADD:
+  case OpCode::SUB:
+  case OpCode::MUL:
+  case OpCode::DIV:
+  case OpCode::LT:
+  case OpCode::GT:
+  case OpCode::EQ:
+  case OpCode::NEQ:
+  case OpCode::SHL:
+  case OpCode::SHR:
+  case OpCode::MULH:
+  case OpCode::SELECT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Arithmetic that cannot fault, so an unused result can go.
+bool isRemovable(OpCode op) { return isArithmetic(op) && op != OpCode::DIV; }
+
+// Returns k if value == 2^k for some k >= 1 (INT_MIN counts as 2^31).
+std::optional<int> log2Of(int value) {
+  uint32_t v = static_cast<uint32_t>(value);
+  if (v < 2 || (v & (v - 1)) != 0)
+    return std::nullopt;
+  int k = 0;
+  while (v >>= 1)
+    ++k;
+  return k;
+}
+
+class Combiner {
+public:
+  explicit Combiner(Function &func) : func(func) {}
+
+  void run() {
+    collectConstants();
+    for (auto &bb : func.blocks) {
+      sums.clear();
+      products.clear();
+      dependents.clear();
+      auto &insts = bb->instructions;
+      for (auto it = insts.begin(); it != insts.end(); ++it) {
+        if (isArithmetic(it->op)) {
+          for (auto &op : it->operands)
+            op = lookThrough(op);
+          for (int round = 0; round < kMaxRounds && simplify(*it); ++round)
+            ++simplified;
+          if (it->op == OpCode::DIV)
+            expandDivision(insts, it);
+        }
+        record(*it);
+      }
+    }
+    removeDead();
+    OPTIMIX_LOG(DEBUG, "instcombine: " + func.name + ": " +
+                           std::to_string(simplified) + " simplified, " +
+                           std::to_string(divisions) + " divisions, " +
+                           std::to_string(removed) + " removed");
+  }
+
+private:
+  // A value defined in the current block as base + constant (sums) or
+  // base * constant (products).
+  struct Linear {
+    Operand value;
+    Operand base;
+    int constant;
+  };
+
+  static constexpr int kMaxRounds = 16; // Rewrites per instruction
+
+  Function &func;
+  std::unordered_map<std::string, Operand> movs; // SSA value -> MOV source
+  std::unordered_map<std::string, Linear> sums, products; // By name
+  std::unordered_map<std::string, std::vector<std::string>> dependents;
+  int simplified = 0, divisions = 0, removed = 0;
+
+  static std::string keyOf(const Operand &v) {
+    return v.value + "." + std::to_string(v.version);
+  }
+
+  // In SSA a version has a single definition, so one defined by a MOV of a
+  // constant is that constant wherever it is used.
+  void collectConstants() {
+    std::unordered_set<std::string> defined;
+    for (const auto &bb : func.blocks)
+      for (const auto &inst : bb->instructions) {
+        if (!hasResult(inst.op) || inst.result.type != Operand::VARIABLE ||
+            inst.result.version == 0)
+          continue;
+        std::string key = keyOf(inst.result);
+        if (!defined.insert(key).second)
+          movs.erase(key); // Not SSA after all
+        else if (inst.op == OpCode::MOV)
+          movs[key] = inst.operands[0];
+      }
+  }
+
+  // Only constants are propagated: forwarding a copied variable could
+  // read it after a later version has replaced it in the engine's register.
+  Operand lookThrough(const Operand &op) const {
+    Operand v = op;
+    for (int hops = 0; hops < 8; ++hops) {
+      if (v.type != Operand::VARIABLE || v.version == 0)
+        break;
+      auto it = movs.find(keyOf(v));
+      if (it == movs.end())
+        break;
+      if (it->second.type == Operand::CONSTANT)
+        return it->second;
+      v = it->second;
+    }
+    return op;
+  }
+
+  const Linear *linear(const std::unordered_map<std::string, Linear> &facts,
+                       const Operand &v) const {
+    if (v.type != Operand::VARIABLE)
+      return nullptr;
+    auto it = facts.find(v.value);
+    return it != facts.end() && sameValue(it->second.value, v) ? &it->second
+                                                              : nullptr;
+  }
+
+  static void becomeMov(Instruction &inst, Operand value) {
+    inst.op = OpCode::MOV;
+    inst.operands = {std::move(value)};
+  }
+
+  // Applies one rewrite to 'inst'; false once none applies.
+  bool simplify(Instruction &inst) {
+    if (!isArithmetic(inst.op))
+      return false;
+    if (inst.op == OpCode::SELECT) {
+      // SELECT C, a, b and SELECT c, a, a pick a known operand.
+      auto cond = constant(inst.operands[0]);
+      if (cond || sameValue(inst.operands[1], inst.operands[2])) {
+        becomeMov(inst, inst.operands[cond && *cond == 0 ? 2 : 1]);
+        return true;
+      }
+      return false;
+    }
+    Operand &x = inst.operands[0], &y = inst.operands[1];
+    auto cx = constant(x), cy = constant(y);
+    if (cx && cy) {
+      auto value = fold(inst.op, *cx, *cy);
+      if (!value)
+        return false;
+      becomeMov(inst, Operand::makeConst(*value));
+      return true;
+    }
+    bool same = sameValue(x, y) && x.type == Operand::VARIABLE;
+
+    switch (inst.op) {
+    case OpCode::ADD:
+    case OpCode::MUL:
+    case OpCode::EQ:
+    case OpCode::NEQ:
+    case OpCode::MULH:
+      if (cx) {
+        std::swap(x, y);
+        return true;
+      }
+      break;
+    case OpCode::LT:
+    case OpCode::GT:
+      if (cx) {
+        inst.op = inst.op == OpCode::LT ? OpCode::GT : OpCode::LT;
+        std::swap(x, y);
+        return true;
+      }
+      break;
+    default:
+      break;
+    }
+
+    switch (inst.op) {
+    case OpCode::ADD:
+      if (cy && *cy == 0) {
+        becomeMov(inst, x);
+        return true;
+      }
+      if (const Linear *sum = cy ? linear(sums, x) : nullptr) {
+        y = Operand::makeConst(wrap(int64_t(sum->constant) + *cy));
+        x = sum->base;
+        return true;
+      }
+      return false;
+    case OpCode::SUB:
+      if (same) {
+        becomeMov(inst, Operand::makeConst(0));
+        return true;
+      }
+      if (cy && *cy != INT_MIN) {
+        inst.op = OpCode::ADD;
+        y = Operand::makeConst(-*cy);
+        return true;
+      }
+      return false;
+    case OpCode::MUL:
+      if (cy && *cy == 0) {
+        becomeMov(inst, Operand::makeConst(0));
+        return true;
+      }
+      if (cy && *cy == 1) {
+        becomeMov(inst, x);
+        return true;
+      }
+      if (cy && *cy == -1) {
+        inst.op = OpCode::SUB;
+        inst.operands = {Operand::makeConst(0), x};
+        return true;
+      }
+      if (const Linear *product = cy ? linear(products, x) : nullptr) {
+        y = Operand::makeConst(wrap(int64_t(product->constant) * *cy));
+        x = product->base;
+        return true;
+      }
+      if (auto k = cy ? log2Of(*cy) : std::nullopt) {
+        inst.op = OpCode::SHL;
+        y = Operand::makeConst(*k);
+        return true;
+      }
+      return false;
+    case OpCode::SHL:
+    case OpCode::SHR:
+      if (!cy)
+        return false;
+      if ((*cy & 31) == 0) {
+        becomeMov(inst, x);
+        return true;
+      }
+      if (*cy != (*cy & 31)) {
+        y = Operand::makeConst(*cy & 31);
+        return true;
+      }
+      if (inst.op == OpCode::SHL && linear(products, x)) {
+        // Back to a MUL, which folds the chain and turns into SHL again.
+        inst.op = OpCode::MUL;
+        y = Operand::makeConst(wrap(int64_t(1) << *cy));
+        return true;
+      }
+      return false;
+    case OpCode::DIV:
+      if ((cx && *cx == 0) || (cy && *cy == 0)) {
+        becomeMov(inst, Operand::makeConst(0));
+        return true;
+      }
+      if (cy && *cy == 1) {
+        becomeMov(inst, x);
+        return true;
+      }
+      if (cy && *cy == -1) {
+        inst.op = OpCode::SUB;
+        inst.operands = {Operand::makeConst(0), x};
+        return true;
+      }
+      return false;
+    case OpCode::MULH:
+      if (cy && *cy == 0) {
+        becomeMov(inst, Operand::makeConst(0));
+        return true;
+      }
+      return false;
+    case OpCode::LT:
+    case OpCode::GT:
+    case OpCode::NEQ:
+    case OpCode::EQ:
+      if (same) {
+        becomeMov(inst, Operand::makeConst(inst.op == OpCode::EQ));
+        return true;
+      }
+      return false;
+    default:
+      return false;
+    }
+  }
+
+  // DIV r, x, d (|d| >= 2) becomes
+  //   MULH hi, x, multiplier
+  //   ADD/SUB hi', hi, x   (when the multiplier's sign needs correcting)
+  //   SHR q, hi', shift    (when shift > 0)
+  //   SHR sign, q, 31      (-1 for a negative quotient)
+  //   SUB r, q, sign       (rounds toward zero)
+  void expandDivision(std::list<Instruction> &insts,
+                      std::list<Instruction>::iterator it) {
+    auto d = constant(it->operands[1]);
+    if (!d || it->operands[0].type != Operand::VARIABLE)
+      return;
+    DivisionMagic magic = signedDivisionMagic(*d);
+    std::string prefix = "%div" + std::to_string(divisions++);
+    int version = it->result.version > 0 ? 1 : 0;
+    Operand x = it->operands[0];
+    auto emit = [&](OpCode op, const char *suffix, Operand a, Operand b) {
+      Operand dst = Operand::makeVar(prefix + suffix);
+      dst.version = version;
+      Instruction inst(op, dst, std::move(a), std::move(b));
+      inst.line = it->line;
+      insts.insert(it, inst);
+      return dst;
+    };
+    Operand q = emit(OpCode::MULH, "_hi", x,
+                     Operand::makeConst(magic.multiplier));
+    if (*d > 0 && magic.multiplier < 0)
+      q = emit(OpCode::ADD, "_add", q, x);
+    else if (*d < 0 && magic.multiplier > 0)
+      q = emit(OpCode::SUB, "_sub", q, x);
+    if (magic.shift > 0)
+      q = emit(OpCode::SHR, "_shr", q, Operand::makeConst(magic.shift));
+    Operand sign = emit(OpCode::SHR, "_sign", q, Operand::makeConst(31));
+    it->op = OpCode::SUB;
+    it->operands = {q, sign};
+  }
+
+  // Keeps sums/products in step with a definition of inst.result.
+  void record(const Instruction &inst) {
+    if (!hasResult(inst.op) || inst.result.type != Operand::VARIABLE)
+      return;
+    const std::string &name = inst.result.value;
+    sums.erase(name);
+    products.erase(name);
+    auto deps = dependents.find(name);
+    if (deps != dependents.end()) {
+      for (const auto &d : deps->second) {
+        auto s = sums.find(d);
+        if (s != sums.end() && s->second.base.value == name)
+          sums.erase(s);
+        auto p = products.find(d);
+        if (p != products.end() && p->second.base.value == name)
+          products.erase(p);
+      }
+      dependents.erase(deps);
+    }
+
+    if (inst.operands.size() != 2)
+      return;
+    const Operand &base = inst.operands[0];
+    auto c = constant(inst.operands[1]);
+    if (!c || base.type != Operand::VARIABLE || base.value == name)
+      return;
+    if (inst.op == OpCode::ADD)
+      sums[name] = {inst.result, base, *c};
+    else if (inst.op == OpCode::MUL)
+      products[name] = {inst.result, base, *c};
+    else if (inst.op == OpCode::SHL)
+      products[name] = {inst.result, base, wrap(int64_t(1) << *c)};
+    else
+      return;
+    dependents[base.value].push_back(name);
+  }
+
+  void removeDead() {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      std::unordered_set<std::string> used;
+      for (const auto &bb : func.blocks)
+        for (const auto &inst : bb->instructions)
+          for (const auto &op : inst.operands)
+            if (op.type == Operand::VARIABLE)
+              used.insert(op.value);
+      for (auto &bb : func.blocks)
+        bb->instructions.remove_if([&](const Instruction &inst) {
+          bool dead = isRemovable(inst.op) &&
+                      inst.result.type == Operand::VARIABLE &&
+                      !used.count(inst.result.value);
+          if (dead) {
+            ++removed;
+            changed = true;
+          }
+          return dead;
+        });
+    }
+  }
+};
+
+} // namespace
+
+void InstCombinePass::run(Function &func) const { Combiner(func).run(); }
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,513 @@
+#include "optimix/ir/LoopFusion.h"
+#include "optimix/ir/Dominators.h"
+#include "optimix/ir/LoopInfo.h"
+#include "optimix/support/Diagnostics.h"
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+// Safe to run before the first loop instead of after it.
+bool isSpeculatable(OpCode op) {
+  switch (op) {
+  case OpCode::ADD:
+  case OpCode::SUB:
+  case OpCode::MUL:
+  case OpCode::MOV:
+  case OpCode::LT:
+  case OpCode::GT:
+  case OpCode::EQ:
+  case OpCode::NEQ:
+  case OpCode::SHL:
+  case OpCode::SHR:
+  case OpCode::MULH:
+  case OpCode::SELECT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool sameValue(const Operand &a, const Operand &b) {
+  return a.type == Operand::VARIABLE && b.type == Operand::VARIABLE &&
+         a.value == b.value && a.version == b.version;
+}
+
+std::string keyOf(const Operand &v) {
+  return v.value + "." + std::to_string(v.version);
+}
+
+// A loop of the form
+//   header: PHIs; test = LT iv, bound; JMP_IF body, test; JMP exit
+//   body:   ...; JMP header
+// where iv starts at 'first' and is 'next' = iv + 1 on the back edge.
+struct SimpleLoop {
+  BasicBlock *preheader, *header, *body, *exit;
+  Operand iv, first, next, bound, test;
+};
+
+struct Access {
+  std::string array;
+  std::optional<int64_t> offset; // From the IV
+  bool write;
+};
+
+// What fusing needs to know about one loop.
+struct Summary {
+  bool fusible = true;
+  bool effects = false; // A PRINT or an access that may fail its check
+  std::set<std::string> defs, uses;
+  std::vector<Access> accesses;
+};
+
+class Fuser {
+public:
+  explicit Fuser(Function &func) : func(func) {}
+
+  void run() {
+    if (func.blocks.empty())
+      return;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      DominatorTree domTree(func);
+      LoopInfo loops(domTree);
+      index(domTree);
+      for (const auto &loop : loops.loops()) {
+        auto first = match(*loop);
+        if (!first || first->exit->succs.size() != 1)
+          continue;
+        Loop *next = loops.loopFor(first->exit->succs[0]);
+        if (!next || next->header != first->exit->succs[0] ||
+            next->parent != loop->parent)
+          continue;
+        auto second = match(*next);
+        if (second && second->preheader == first->exit &&
+            legal(domTree, *first, *second)) {
+          fuse(*first, *second);
+          changed = true;
+          break;
+        }
+      }
+    }
+    OPTIMIX_LOG(DEBUG, "loop-fusion: " + func.name + ": " +
+                           std::to_string(fused) + " loops fused");
+  }
+
+private:
+  Function &func;
+  std::unordered_map<std::string, BasicBlock *> blocks;
+  std::unordered_map<std::string, const Instruction *> defs; // By key
+  std::map<std::string,
+           std::vector<std::pair<const BasicBlock *, const Instruction *>>>
+      allocas;
+  int fused = 0;
+
+  void index(const DominatorTree &domTree) {
+    blocks.clear();
+    defs.clear();
+    allocas.clear();
+    for (auto &bb : func.blocks) {
+      blocks[bb->label] = bb.get();
+      if (!domTree.isReachable(bb.get()))
+        continue;
+      for (const auto &inst : bb->instructions) {
+        if (hasResult(inst.op) && inst.result.type == Operand::VARIABLE)
+          defs[keyOf(inst.result)] = &inst;
+        if (inst.op == OpCode::ALLOCA)
+          allocas[inst.operands[0].value].push_back({bb.get(), &inst});
+      }
+    }
+  }
+
+  const Instruction *defOf(const Operand &v) const {
+    if (v.type != Operand::VARIABLE)
+      return nullptr;
+    auto it = defs.find(keyOf(v));
+    return it == defs.end() ? nullptr : it->second;
+  }
+
+  std::optional<int64_t> constantOf(const Operand &v, int depth = 0) const {
+    if (v.type == Operand::CONSTANT)
+      return std::stoll(v.value);
+    const Instruction *d = defOf(v);
+    if (!d || d->op != OpCode::MOV || depth > 16)
+      return std::nullopt;
+    return constantOf(d->operands[0], depth + 1);
+  }
+
+  bool sameOrEqual(const Operand &a, const Operand &b) const {
+    if (sameValue(a, b))
+      return true;
+    auto x = constantOf(a), y = constantOf(b);
+    return x && y && *x == *y;
+  }
+
+  // v = iv + offset through MOV and ADD/SUB of constants.
+  std::optional<int64_t> offsetFrom(const Operand &v, const Operand &iv,
+                                    int depth = 0) const {
+    if (sameValue(v, iv))
+      return 0;
+    const Instruction *d = defOf(v);
+    if (!d || depth > 16)
+      return std::nullopt;
+    if (d->op == OpCode::MOV)
+      return offsetFrom(d->operands[0], iv, depth + 1);
+    if (d->op != OpCode::ADD && d->op != OpCode::SUB)
+      return std::nullopt;
+    const Operand &a = d->operands[0], &b = d->operands[1];
+    std::optional<int64_t> o;
+    int64_t c;
+    if (b.type == Operand::CONSTANT) {
+      o = offsetFrom(a, iv, depth + 1);
+      c = std::stoll(b.value);
+      if (d->op == OpCode::SUB)
+        c = -c;
+    } else if (a.type == Operand::CONSTANT && d->op == OpCode::ADD) {
+      o = offsetFrom(b, iv, depth + 1);
+      c = std::stoll(a.value);
+    } else {
+      return std::nullopt;
+    }
+    if (!o)
+      return std::nullopt;
+    return *o + c;
+  }
+
+  std::optional<SimpleLoop> match(const Loop &loop) const {
+    if (!loop.subLoops.empty() || loop.blocks.size() != 2 ||
+        loop.latches.size() != 1)
+      return std::nullopt;
+    SimpleLoop l;
+    l.header = loop.header;
+    l.body = loop.latches[0];
+    l.preheader = loop.preheader();
+    if (!l.preheader || l.body == l.header || l.body->preds.size() != 1)
+      return std::nullopt;
+    for (const auto &inst : l.preheader->instructions)
+      if (inst.op == OpCode::JMP_IF)
+        return std::nullopt;
+
+    auto &insts = l.header->instructions;
+    auto cmp = std::find_if(
+        insts.begin(), insts.end(),
+        [](const Instruction &inst) { return inst.op != OpCode::PHI; });
+    if (std::distance(cmp, insts.end()) != 3)
+      return std::nullopt;
+    const Instruction &branch = *std::next(cmp), &leave = *std::next(cmp, 2);
+    if (cmp->op != OpCode::LT || branch.op != OpCode::JMP_IF ||
+        leave.op != OpCode::JMP ||
+        branch.operands[0].value != l.body->label ||
+        !sameValue(branch.operands[1], cmp->result))
+      return std::nullopt;
+    auto exit = blocks.find(leave.operands[0].value);
+    if (exit == blocks.end() || loop.contains(exit->second))
+      return std::nullopt;
+    l.exit = exit->second;
+
+    const auto &body = l.body->instructions;
+    for (auto it = body.begin(); it != body.end(); ++it)
+      if (isTerminator(it->op) || it->op == OpCode::JMP_IF) {
+        if (std::next(it) != body.end() || it->op != OpCode::JMP ||
+            it->operands[0].value != l.header->label)
+          return std::nullopt;
+      }
+    if (body.empty() || body.back().op != OpCode::JMP)
+      return std::nullopt;
+
+    l.iv = cmp->operands[0];
+    l.bound = cmp->operands[1];
+    l.test = cmp->result;
+    const Instruction *phi = defOf(l.iv);
+    if (!phi || phi->op != OpCode::PHI || phi->operands.size() != 4 ||
+        std::find_if(insts.begin(), cmp, [&](const Instruction &inst) {
+          return &inst == phi;
+        }) == cmp)
+      return std::nullopt;
+    bool haveFirst = false, stepsByOne = false;
+    for (size_t i = 0; i + 1 < phi->operands.size(); i += 2) {
+      const std::string &from = phi->operands[i + 1].value;
+      if (from == l.preheader->label) {
+        l.first = phi->operands[i];
+        haveFirst = true;
+      } else if (from == l.body->label) {
+        l.next = phi->operands[i];
+        stepsByOne = offsetFrom(l.next, l.iv) == 1;
+      }
+    }
+    if (!haveFirst || !stepsByOne)
+      return std::nullopt;
+    // The bound must not change while the loop runs.
+    if (l.bound.type == Operand::VARIABLE)
+      for (const BasicBlock *bb : loop.blocks)
+        for (const auto &inst : bb->instructions)
+          if (hasResult(inst.op) && sameValue(inst.result, l.bound))
+            return std::nullopt;
+    return l;
+  }
+
+  // Whether array[iv + offset] is valid on every iteration: the only
+  // ALLOCA of the array ran before the loop with the loop's bound or a
+  // constant size that covers it.
+  bool inBounds(const DominatorTree &domTree, const SimpleLoop &l,
+                const Access &access) const {
+    auto first = constantOf(l.first);
+    auto info = allocas.find(access.array);
+    if (!access.offset || !first || *first + *access.offset < 0 ||
+        info == allocas.end() || info->second.size() != 1 ||
+        !domTree.dominates(info->second[0].first, l.header))
+      return false;
+    const Operand &size = info->second[0].second->operands[1];
+    if (sameValue(size, l.bound))
+      return *access.offset <= 0;
+    auto n = constantOf(l.bound), s = constantOf(size);
+    return n && s && *n + *access.offset <= *s;
+  }
+
+  Summary summarize(const DominatorTree &domTree, const SimpleLoop &l) const {
+    Summary s;
+    for (const BasicBlock *bb : {l.header, l.body})
+      for (const auto &inst : bb->instructions) {
+        if (hasResult(inst.op) && inst.result.type == Operand::VARIABLE)
+          s.defs.insert(inst.result.value);
+        for (size_t i = 0; i < inst.operands.size(); ++i)
+          if (inst.operands[i].type == Operand::VARIABLE &&
+              !isArrayOperand(inst.op, i))
+            s.uses.insert(inst.operands[i].value);
+        switch (inst.op) {
+        case OpCode::LOAD:
+        case OpCode::STORE:
+        case OpCode::LOAD_UNCHECKED:
+        case OpCode::STORE_UNCHECKED: {
+          Access access{inst.operands[0].value,
+                        offsetFrom(inst.operands[1], l.iv),
+                        inst.op == OpCode::STORE ||
+                            inst.op == OpCode::STORE_UNCHECKED};
+          if ((inst.op == OpCode::LOAD || inst.op == OpCode::STORE) &&
+              !inBounds(domTree, l, access))
+            s.effects = true;
+          s.accesses.push_back(std::move(access));
+          break;
+        }
+        case OpCode::PRINT:
+          s.effects = true;
+          break;
+        case OpCode::DIV: // Yields 0 for a zero divisor
+        case OpCode::PHI:
+        case OpCode::JMP:
+        case OpCode::JMP_IF:
+          break;
+        default:
+          s.fusible = s.fusible && isSpeculatable(inst.op);
+        }
+      }
+    return s;
+  }
+
+  bool legal(const DominatorTree &domTree, const SimpleLoop &a,
+             const SimpleLoop &b) const {
+    if (a.exit->preds.size() != 1 || !sameOrEqual(a.first, b.first) ||
+        !sameOrEqual(a.bound, b.bound))
+      return false;
+    Summary sa = summarize(domTree, a), sb = summarize(domTree, b);
+    if (!sa.fusible || !sb.fusible || (sa.effects && sb.effects))
+      return false;
+    // Scalars: one register per name, so neither loop may see the other's.
+    for (const auto &name : sa.defs)
+      if (sb.defs.count(name) || sb.uses.count(name))
+        return false;
+    for (const auto &name : sb.defs)
+      if (sa.uses.count(name))
+        return false;
+    // The code between the loops moves in front of the first.
+    for (const auto &inst : a.exit->instructions) {
+      if (isTerminator(inst.op))
+        break;
+      if (!isSpeculatable(inst.op) || inst.result.type != Operand::VARIABLE ||
+          sa.defs.count(inst.result.value) || sa.uses.count(inst.result.value))
+        return false;
+      for (const auto &op : inst.operands)
+        if (op.type == Operand::VARIABLE && sa.defs.count(op.value))
+          return false;
+    }
+    // Arrays: B may only touch elements A is done with.
+    for (const Access &x : sa.accesses)
+      for (const Access &y : sb.accesses)
+        if (x.array == y.array && (x.write || y.write) &&
+            (!x.offset || !y.offset || *y.offset > *x.offset))
+          return false;
+    // B's test goes away with its header.
+    for (const auto &bb : func.blocks)
+      for (const auto &inst : bb->instructions)
+        if (bb.get() != b.header &&
+            std::any_of(inst.operands.begin(), inst.operands.end(),
+                        [&](const Operand &op) {
+                          return sameValue(op, b.test);
+                        }))
+          return false;
+    return true;
+  }
+
+  using InstList = std::list<Instruction>;
+
+  static bool reads(const Instruction &inst, const std::string &name) {
+    for (size_t i = 0; i < inst.operands.size(); ++i)
+      if (inst.operands[i].type == Operand::VARIABLE &&
+          !isArrayOperand(inst.op, i) && inst.operands[i].value == name)
+        return true;
+    return false;
+  }
+
+  static bool defines(const Instruction &inst, const std::string &name) {
+    return hasResult(inst.op) && inst.result.type == Operand::VARIABLE &&
+           inst.result.value == name;
+  }
+
+  // The instructions of 'insts' that compute 'next' from 'iv', in order;
+  // empty if some of them are elsewhere.
+  static std::vector<InstList::iterator>
+  stepChain(InstList &insts, const Operand &iv, const Operand &next) {
+    std::vector<InstList::iterator> chain;
+    Operand v = next;
+    while (!sameValue(v, iv)) {
+      auto it = std::find_if(
+          insts.begin(), insts.end(), [&](const Instruction &inst) {
+            return hasResult(inst.op) && sameValue(inst.result, v);
+          });
+      if (it == insts.end())
+        return {};
+      chain.insert(chain.begin(), it);
+      const Operand &lhs = it->operands[0];
+      v = lhs.type == Operand::CONSTANT ? it->operands[1] : lhs;
+    }
+    return chain;
+  }
+
+  // Whether the IV update can move to the end of the body: nothing after
+  // it uses what it defines or redefines what it reads.
+  static bool canSink(InstList &insts,
+                      const std::vector<InstList::iterator> &chain) {
+    std::set<const Instruction *> moved;
+    for (auto it : chain)
+      moved.insert(&*it);
+    for (auto x : chain)
+      for (auto y = std::next(x); y != insts.end(); ++y) {
+        if (moved.count(&*y) || isTerminator(y->op))
+          continue;
+        const std::string &name = x->result.value;
+        if (reads(*y, name) || defines(*y, name) ||
+            (hasResult(y->op) && reads(*x, y->result.value)))
+          return false;
+      }
+    return true;
+  }
+
+  // With A's IV updated last, B's IV equals it throughout the body, so B's
+  // code reads A's instead and B's own goes if nothing after the loop
+  // needs its final value. The range analysis then knows B's indices too.
+  void shareInductionVariable(const SimpleLoop &a, const SimpleLoop &b,
+                              InstList::iterator from, InstList::iterator to,
+                              const std::vector<InstList::iterator> &bChain) {
+    std::set<const Instruction *> chain;
+    for (auto it : bChain)
+      chain.insert(&*it);
+    for (auto it = from; it != to; ++it)
+      if (!chain.count(&*it))
+        for (size_t i = 0; i < it->operands.size(); ++i)
+          if (!isArrayOperand(it->op, i) && sameValue(it->operands[i], b.iv))
+            it->operands[i] = a.iv;
+
+    auto &head = a.header->instructions;
+    auto phi = std::find_if(
+        head.begin(), head.end(), [&](const Instruction &inst) {
+          return inst.op == OpCode::PHI && sameValue(inst.result, b.iv);
+        });
+    chain.insert(&*phi);
+    for (const auto &bb : func.blocks) {
+      if (bb.get() == b.header) // About to go
+        continue;
+      for (const auto &inst : bb->instructions)
+        if (!chain.count(&inst))
+          for (const Instruction *x : chain)
+            if (reads(inst, x->result.value))
+              return;
+    }
+    head.erase(phi);
+    for (auto it : bChain)
+      a.body->instructions.erase(it);
+  }
+
+  void fuse(const SimpleLoop &a, const SimpleLoop &b) {
+    auto &pre = a.preheader->instructions;
+    auto at = pre.end();
+    if (!pre.empty() && isTerminator(pre.back().op))
+      at = std::prev(at);
+    auto &between = a.exit->instructions;
+    pre.splice(at, between, between.begin(),
+               std::find_if(between.begin(), between.end(),
+                            [](const Instruction &inst) {
+                              return isTerminator(inst.op);
+                            }));
+
+    // B's PHIs join A's, entered from A's preheader and body.
+    auto &head = a.header->instructions;
+    auto firstOther = std::find_if(
+        head.begin(), head.end(),
+        [](const Instruction &inst) { return inst.op != OpCode::PHI; });
+    auto &bHead = b.header->instructions;
+    while (!bHead.empty() && bHead.front().op == OpCode::PHI) {
+      auto &ops = bHead.front().operands;
+      for (size_t i = 1; i < ops.size(); i += 2) {
+        if (ops[i].value == a.exit->label)
+          ops[i].value = a.preheader->label;
+        else if (ops[i].value == b.body->label)
+          ops[i].value = a.body->label;
+      }
+      head.splice(firstOther, bHead, bHead.begin());
+    }
+
+    auto &body = a.body->instructions, &bBody = b.body->instructions;
+    bBody.pop_back(); // JMP to B's header
+    auto aChain = stepChain(body, a.iv, a.next);
+    auto bChain = stepChain(bBody, b.iv, b.next);
+    auto bFirst = bBody.begin();
+    bool shareIV = !aChain.empty() && !bChain.empty() && canSink(body, aChain);
+    body.splice(std::prev(body.end()), bBody);
+    if (shareIV) {
+      for (auto it : aChain)
+        body.splice(std::prev(body.end()), body, it);
+      shareInductionVariable(a, b, bFirst, aChain.front(), bChain);
+    }
+    head.back().operands[0].value = b.exit->label;
+
+    for (auto &bb : func.blocks)
+      for (auto &inst : bb->instructions) {
+        if (inst.op != OpCode::PHI)
+          break;
+        for (size_t i = 1; i < inst.operands.size(); i += 2)
+          if (inst.operands[i].value == b.header->label)
+            inst.operands[i].value = a.header->label;
+      }
+    func.blocks.remove_if([&](const std::unique_ptr<BasicBlock> &bb) {
+      return bb.get() == a.exit || bb.get() == b.header || bb.get() == b.body;
+    });
+    ++fused;
+  }
+};
+
+} // namespace
+
+void LoopFusionPass::run(Function &func) const { Fuser(func).run(); }
+
+} // namespace ir
+} // namespace optimix
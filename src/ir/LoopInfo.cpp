@@ -0,0 +1,72 @@
+#include "optimix/ir/LoopInfo.h"
+#include <algorithm>
+
+namespace optimix {
+namespace ir {
+
+BasicBlock *Loop::preheader() const {
+  BasicBlock *outside = nullptr;
+  for (BasicBlock *pred : header->preds) {
+    if (contains(pred))
+      continue;
+    if (outside)
+      return nullptr;
+    outside = pred;
+  }
+  if (!outside || outside->succs.size() != 1)
+    return nullptr;
+  return outside;
+}
+
+LoopInfo::LoopInfo(const DominatorTree &domTree) {
+  // Headers in reverse postorder put enclosing loops before nested ones.
+  for (BasicBlock *header : domTree.reversePostOrder()) {
+    std::vector<BasicBlock *> latches;
+    for (BasicBlock *pred : header->preds)
+      if (domTree.dominates(header, pred))
+        latches.push_back(pred);
+    if (latches.empty())
+      continue;
+
+    auto loop = std::make_unique<Loop>();
+    loop->header = header;
+    loop->latches = latches;
+    loop->blocks.insert(header);
+    std::vector<BasicBlock *> work(latches.begin(), latches.end());
+    while (!work.empty()) {
+      BasicBlock *bb = work.back();
+      work.pop_back();
+      if (!loop->blocks.insert(bb).second)
+        continue;
+      for (BasicBlock *pred : bb->preds)
+        if (domTree.isReachable(pred))
+          work.push_back(pred);
+    }
+    all.push_back(std::move(loop));
+  }
+
+  // The parent is the smallest earlier loop that contains the header.
+  for (size_t i = 0; i < all.size(); ++i) {
+    Loop *best = nullptr;
+    for (size_t j = 0; j < i; ++j) {
+      if (all[j]->contains(all[i]->header) &&
+          (!best || all[j]->blocks.size() < best->blocks.size()))
+        best = all[j].get();
+    }
+    all[i]->parent = best;
+    if (best)
+      best->subLoops.push_back(all[i].get());
+  }
+}
+
+Loop *LoopInfo::loopFor(const BasicBlock *bb) const {
+  Loop *best = nullptr;
+  for (const auto &loop : all)
+    if (loop->contains(bb) &&
+        (!best || loop->blocks.size() < best->blocks.size()))
+      best = loop.get();
+  return best;
+}
+
+} // namespace ir
+} // namespace optimix
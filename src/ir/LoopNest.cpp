@@ -0,0 +1,566 @@
+#include "optimix/ir/LoopNest.h"
+#include "optimix/ir/Dominators.h"
+#include "optimix/ir/LoopInfo.h"
+#include "optimix/ir/LoopUtils.h"
+#include "optimix/ir/Polynomial.h"
+#include "optimix/support/Diagnostics.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+// Iterations of the inner loop per strip when tiling.
+const int64_t kTileSize = 32;
+// Strides (in elements) from which an access is assumed to leave the
+// cache line it was on.
+const int64_t kLargeStride = 16;
+
+bool isLarge(const Poly &stride) {
+  auto c = constantValue(stride);
+  return !c || std::llabs(*c) >= kLargeStride;
+}
+
+// An array index: outer * i + inner * j + rest.
+struct Affine {
+  Poly outer, inner, rest;
+
+  bool invariant() const { return outer.empty() && inner.empty(); }
+  bool operator==(const Affine &o) const {
+    return outer == o.outer && inner == o.inner && rest == o.rest;
+  }
+};
+
+struct Access {
+  std::string array;
+  std::optional<Affine> index;
+  bool write;
+};
+
+using InstIter = std::list<Instruction>::iterator;
+
+// A perfect nest of two loops as IRBuilder emits it:
+//   outerHeader: LT c1, i, n; JMP_IF outerBody, c1; JMP exit
+//   outerBody:   MOV j, j0; JMP innerHeader
+//   innerHeader: LT c2, j, m; JMP_IF body, c2; JMP innerExit
+//   body:        ...; ADD t, j, 1; MOV j, t; JMP innerHeader
+//   innerExit:   ADD u, i, 1; MOV i, u; JMP outerHeader
+struct Nest {
+  BasicBlock *preheader, *outerHeader, *outerBody, *innerHeader, *body,
+      *innerExit, *exit;
+  std::string outer, inner;           // i and j
+  Operand outerBound, innerBound;     // n and m
+  Operand innerFirst;                 // j0
+  std::optional<Operand> outerFirst;  // Constant i set in the preheader
+  InstIter innerStep, outerStep;      // The ADDs of the increments
+
+  std::vector<BasicBlock *> blocks() const {
+    return {outerHeader, outerBody, innerHeader, body, innerExit};
+  }
+};
+
+// What the nest may contain besides its loop control.
+bool isAllowed(OpCode op) {
+  switch (op) {
+  case OpCode::ADD:
+  case OpCode::SUB:
+  case OpCode::MUL:
+  case OpCode::DIV:
+  case OpCode::MOV:
+  case OpCode::LT:
+  case OpCode::GT:
+  case OpCode::EQ:
+  case OpCode::NEQ:
+  case OpCode::SHL:
+  case OpCode::SHR:
+  case OpCode::MULH:
+  case OpCode::SELECT:
+  case OpCode::LOAD:
+  case OpCode::STORE:
+  case OpCode::LOAD_UNCHECKED:
+  case OpCode::STORE_UNCHECKED:
+  case OpCode::JMP:
+  case OpCode::JMP_IF:
+    return true;
+  default:
+    return false;
+  }
+}
+
+class NestOptimizer {
+public:
+  explicit NestOptimizer(Function &func) : func(func) {}
+
+  void run() {
+    if (func.blocks.empty())
+      return;
+    std::set<std::string> seen; // Headers of nests already considered
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      DominatorTree domTree(func);
+      LoopInfo loops(domTree);
+      defSites = ScalarDefs(func);
+      for (const auto &loop : loops.loops()) {
+        if (!seen.insert(loop->header->label).second)
+          continue;
+        auto nest = match(*loop);
+        if (nest && optimize(domTree, *nest)) {
+          changed = true;
+          break;
+        }
+      }
+    }
+    OPTIMIX_LOG(DEBUG, "loop-nest: " + func.name + ": " +
+                           std::to_string(interchanged) + " interchanged, " +
+                           std::to_string(tiled) + " tiled");
+  }
+
+private:
+  Function &func;
+  ScalarDefs defSites;
+  int interchanged = 0, tiled = 0;
+
+  // ADD t, iv, 1; MOV iv, t; JMP target at the end of 'bb'.
+  static std::optional<InstIter> matchStep(BasicBlock *bb,
+                                           const std::string &iv,
+                                           const std::string &target) {
+    auto &insts = bb->instructions;
+    if (insts.size() < 3)
+      return std::nullopt;
+    auto jump = std::prev(insts.end());
+    auto mov = std::prev(jump), add = std::prev(mov);
+    bool unit = add->op == OpCode::ADD &&
+                ((isVar(add->operands[0], iv) &&
+                  add->operands[1].type == Operand::CONSTANT &&
+                  add->operands[1].value == "1") ||
+                 (isVar(add->operands[1], iv) &&
+                  add->operands[0].type == Operand::CONSTANT &&
+                  add->operands[0].value == "1"));
+    if (jump->op != OpCode::JMP || jump->operands[0].value != target ||
+        mov->op != OpCode::MOV || !isVar(mov->result, iv) || !unit ||
+        !isVar(mov->operands[0], add->result.value))
+      return std::nullopt;
+    return add;
+  }
+
+  std::optional<Nest> match(const Loop &loop) {
+    if (loop.subLoops.size() != 1 || loop.blocks.size() != 5 ||
+        loop.latches.size() != 1)
+      return std::nullopt;
+    const Loop &innerLoop = *loop.subLoops[0];
+    if (!innerLoop.subLoops.empty() || innerLoop.blocks.size() != 2 ||
+        innerLoop.latches.size() != 1)
+      return std::nullopt;
+    Nest n;
+    n.preheader = loop.preheader();
+    n.outerHeader = loop.header;
+    n.innerHeader = innerLoop.header;
+    n.body = innerLoop.latches[0];
+    n.innerExit = loop.latches[0];
+    if (!n.preheader || n.body == n.innerHeader)
+      return std::nullopt;
+    std::unordered_map<std::string, BasicBlock *> byLabel;
+    for (auto &bb : func.blocks)
+      byLabel[bb->label] = bb.get();
+    std::string in, out, innerIn, innerOut;
+    if (!matchHeader(n.outerHeader, n.outer, n.outerBound, in, out) ||
+        !matchHeader(n.innerHeader, n.inner, n.innerBound, innerIn,
+                     innerOut) ||
+        n.outer == n.inner || innerIn != n.body->label ||
+        innerOut != n.innerExit->label || !byLabel.count(in) ||
+        !byLabel.count(out))
+      return std::nullopt;
+    n.outerBody = byLabel[in];
+    n.exit = byLabel[out];
+    if (!loop.contains(n.outerBody) || innerLoop.contains(n.outerBody) ||
+        loop.contains(n.exit))
+      return std::nullopt;
+
+    // outerBody: MOV j, j0; JMP innerHeader
+    auto &init = n.outerBody->instructions;
+    if (init.size() != 2 || init.front().op != OpCode::MOV ||
+        !isVar(init.front().result, n.inner) ||
+        init.back().op != OpCode::JMP ||
+        init.back().operands[0].value != n.innerHeader->label)
+      return std::nullopt;
+    n.innerFirst = init.front().operands[0];
+
+    auto innerStep = matchStep(n.body, n.inner, n.innerHeader->label);
+    auto outerStep = matchStep(n.innerExit, n.outer, n.outerHeader->label);
+    if (!innerStep || !outerStep || n.innerExit->instructions.size() != 3)
+      return std::nullopt;
+    n.innerStep = *innerStep;
+    n.outerStep = *outerStep;
+
+    // Bounds and j0 must not change inside the nest, the body may only
+    // step j at its end, and it may not assign i.
+    std::set<std::string> assigned;
+    for (BasicBlock *bb : n.blocks())
+      for (const auto &inst : bb->instructions)
+        if (definesScalar(inst))
+          assigned.insert(inst.result.value);
+    for (const Operand *op : {&n.outerBound, &n.innerBound, &n.innerFirst})
+      if (op->type == Operand::VARIABLE && assigned.count(op->value))
+        return std::nullopt;
+    for (auto it = n.body->instructions.begin(); it != n.innerStep; ++it)
+      if (definesScalar(*it) &&
+          (it->result.value == n.outer || it->result.value == n.inner))
+        return std::nullopt;
+
+    // A start for i that is known, for the dependence test.
+    for (const auto &inst : n.preheader->instructions)
+      if (definesScalar(inst) && inst.result.value == n.outer)
+        n.outerFirst = inst.op == OpCode::MOV &&
+                               inst.operands[0].type == Operand::CONSTANT
+                           ? std::optional<Operand>(inst.operands[0])
+                           : std::nullopt;
+    return n;
+  }
+
+  // The value of a name the nest does not assign, as a constant or symbol.
+  Poly resolve(const Nest &n, const DominatorTree &domTree,
+               const Operand &v) const {
+    auto value = defSites.fixedValue(domTree, v, n.outerHeader,
+                                     &n.outerHeader->instructions.front());
+    return value ? *value : symbol(v.value);
+  }
+
+  // The index 'v' read at 'at' in the body, or nothing if it is not a
+  // polynomial in i, j and names the nest does not assign.
+  std::optional<Affine> affineOf(const Nest &n, const DominatorTree &domTree,
+                                 const std::set<std::string> &assigned,
+                                 const Operand &v, InstIter at,
+                                 int depth = 0) const {
+    if (depth > 32)
+      return std::nullopt;
+    Affine a;
+    if (v.type == Operand::CONSTANT) {
+      a.rest = constant(std::stoll(v.value));
+      return a;
+    }
+    auto def = at;
+    bool found = false;
+    while (!found && def != n.body->instructions.begin()) {
+      --def;
+      found = definesScalar(*def) && def->result.value == v.value;
+    }
+    if (!found) {
+      if (v.value == n.outer)
+        a.outer = constant(1);
+      else if (v.value == n.inner)
+        a.inner = constant(1);
+      else if (assigned.count(v.value))
+        return std::nullopt; // Carried over from another iteration
+      else
+        a.rest = resolve(n, domTree, v);
+      return a;
+    }
+    auto operand = [&](size_t i) {
+      return affineOf(n, domTree, assigned, def->operands[i], def, depth + 1);
+    };
+    if (def->op == OpCode::MOV)
+      return operand(0);
+    if (def->op != OpCode::ADD && def->op != OpCode::SUB &&
+        def->op != OpCode::MUL)
+      return std::nullopt;
+    auto x = operand(0), y = operand(1);
+    if (!x || !y)
+      return std::nullopt;
+    if (def->op != OpCode::MUL) {
+      int64_t sign = def->op == OpCode::ADD ? 1 : -1;
+      addTo(x->outer, y->outer, sign);
+      addTo(x->inner, y->inner, sign);
+      addTo(x->rest, y->rest, sign);
+      return x;
+    }
+    if (!x->invariant())
+      std::swap(x, y);
+    if (!x->invariant())
+      return std::nullopt;
+    auto outer = multiply(y->outer, x->rest);
+    auto inner = multiply(y->inner, x->rest), rest = multiply(y->rest, x->rest);
+    if (!outer || !inner || !rest)
+      return std::nullopt;
+    return Affine{*outer, *inner, *rest};
+  }
+
+  // x = x + e (or x - e, e + x) at the end of the chain MOV x, t in the
+  // body, where the nest reads x nowhere else.
+  static bool isSum(const Nest &n, const std::string &x,
+                    const std::map<std::string, int> &defs,
+                    const std::map<std::string, int> &reads) {
+    if (defs.at(x) != 1 || !reads.count(x) || reads.at(x) != 1)
+      return false;
+    auto &insts = n.body->instructions;
+    auto mov = std::find_if(insts.begin(), insts.end(), [&](const auto &i) {
+      return definesScalar(i) && i.result.value == x;
+    });
+    if (mov == insts.end() || mov->op != OpCode::MOV ||
+        mov->operands[0].type != Operand::VARIABLE)
+      return false;
+    const std::string &t = mov->operands[0].value;
+    for (auto it = mov; it != insts.begin();) {
+      --it;
+      if (!definesScalar(*it) || it->result.value != t)
+        continue;
+      bool sum = (it->op == OpCode::ADD && (isVar(it->operands[0], x) ||
+                                            isVar(it->operands[1], x))) ||
+                 (it->op == OpCode::SUB && isVar(it->operands[0], x));
+      return sum && defs.at(t) == 1 && reads.at(t) == 1;
+    }
+    return false;
+  }
+
+  // Whether the scalars of the nest allow its iterations to be reordered.
+  static bool scalarsAllowReordering(const Nest &n) {
+    std::map<std::string, int> defs, reads;
+    std::set<std::string> exposed; // Read before being assigned in a block
+    for (BasicBlock *bb : n.blocks()) {
+      std::set<std::string> local;
+      for (const auto &inst : bb->instructions) {
+        if (!isAllowed(inst.op))
+          return false;
+        forEachRead(inst, [&](const std::string &r) {
+          ++reads[r];
+          if (!local.count(r))
+            exposed.insert(r);
+        });
+        if (definesScalar(inst)) {
+          ++defs[inst.result.value];
+          local.insert(inst.result.value);
+        }
+      }
+    }
+    for (const auto &[name, count] : defs) {
+      if (name == n.outer || name == n.inner || isSum(n, name, defs, reads))
+        continue;
+      if (exposed.count(name) || liveAt(n.exit, name))
+        return false;
+    }
+    return !liveAt(n.exit, n.outer) && !liveAt(n.exit, n.inner);
+  }
+
+  // Whether stride 'own' of the loop 'iv' (starting at 'first', running
+  // while below 'bound') is too small for the iterations of that loop to
+  // make up for one step of 'other': |own| * (iterations - 1) < |other|.
+  bool outweighs(const Nest &n, const DominatorTree &domTree,
+                 const Poly &own, const Poly &other,
+                 const std::optional<Operand> &first,
+                 const Operand &bound) const {
+    auto step = constantValue(own);
+    if (!step || !first || first->type != Operand::CONSTANT)
+      return false;
+    int64_t start = std::stoll(first->value);
+    Poly limit = resolve(n, domTree, bound);
+    auto b = constantValue(limit), o = constantValue(other);
+    if (b && o)
+      return (*b - start - 1) * std::llabs(*step) < std::llabs(*o);
+    // Symbolic: 'other' is c * b for the bound b and c >= 1. Then there
+    // are at most b iterations, and none at all unless b > 0.
+    if (b || std::llabs(*step) != 1 || start < 0 || other.size() != 1 ||
+        limit.size() != 1)
+      return false;
+    const auto &[monomial, c] = *other.begin();
+    return monomial == limit.begin()->first && c >= 1;
+  }
+
+  // Whether no two iterations, one with the larger i and the other with the
+  // larger j, touch the same element through 'index'.
+  bool independent(const Nest &n, const DominatorTree &domTree,
+                   const Affine &index) const {
+    const Poly &so = index.outer, &si = index.inner;
+    auto co = constantValue(so), ci = constantValue(si);
+    if (so.empty() || si.empty()) // Collisions only between equal i (or j)
+      return (co && *co != 0) || (ci && *ci != 0);
+    if (co && ci && (*co < 0) != (*ci < 0))
+      return true;
+    return outweighs(n, domTree, so, si, n.outerFirst, n.outerBound) ||
+           outweighs(n, domTree, si, so, n.innerFirst, n.innerBound);
+  }
+
+  bool optimize(const DominatorTree &domTree, const Nest &n) {
+    if (!scalarsAllowReordering(n))
+      return false;
+    std::set<std::string> assigned;
+    for (BasicBlock *bb : n.blocks())
+      for (const auto &inst : bb->instructions)
+        if (definesScalar(inst))
+          assigned.insert(inst.result.value);
+    std::vector<Access> accesses;
+    auto &insts = n.body->instructions;
+    for (auto it = insts.begin(); it != insts.end(); ++it) {
+      bool load = it->op == OpCode::LOAD || it->op == OpCode::LOAD_UNCHECKED;
+      bool store =
+          it->op == OpCode::STORE || it->op == OpCode::STORE_UNCHECKED;
+      if (load || store)
+        accesses.push_back(
+            {it->operands[0].value,
+             affineOf(n, domTree, assigned, it->operands[1], it), store});
+    }
+
+    int outerLarge = 0, innerLarge = 0;
+    bool tileable = false;
+    for (const Access &a : accesses) {
+      if (!a.index)
+        continue;
+      outerLarge += isLarge(a.index->outer);
+      innerLarge += isLarge(a.index->inner);
+      tileable |= isLarge(a.index->inner) && !isLarge(a.index->outer);
+    }
+    bool interchange = outerLarge < innerLarge;
+    // Strips need a start that is known not to be negative (so that the
+    // strip bound cannot overflow) and more than one strip.
+    int64_t start = n.innerFirst.type == Operand::CONSTANT
+                        ? std::stoll(n.innerFirst.value)
+                        : -1;
+    auto extent = constantValue(resolve(n, domTree, n.innerBound));
+    bool tile = !interchange && tileable && start >= 0 &&
+                (!extent || *extent - start > kTileSize);
+    if (!interchange && !tile)
+      return false;
+
+    for (const Access &a : accesses) {
+      if (!a.write)
+        continue;
+      for (const Access &b : accesses)
+        if (b.array == a.array &&
+            (!a.index || !b.index || !(*a.index == *b.index)))
+          return false;
+      if (!independent(n, domTree, *a.index))
+        return false;
+    }
+    if (interchange)
+      swapLoops(n);
+    else
+      stripMine(n);
+    return true;
+  }
+
+  static Instruction mov(const std::string &dst, const Operand &src,
+                         int line) {
+    Instruction inst(OpCode::MOV, Operand::makeVar(dst), src);
+    inst.line = line;
+    return inst;
+  }
+
+  // Inserts 'code' before the jump that ends the preheader.
+  static void appendToPreheader(const Nest &n, std::list<Instruction> code) {
+    auto &insts = n.preheader->instructions;
+    auto at = insts.end();
+    if (!insts.empty() && isTerminator(insts.back().op))
+      at = std::prev(at);
+    insts.splice(at, code);
+  }
+
+  // j now runs in outerHeader/innerExit and i in innerHeader/body; i
+  // restarts from the value it had on entry.
+  void swapLoops(const Nest &n) {
+    int line = n.outerHeader->instructions.front().line;
+    std::string first = "%" + n.outerHeader->label + "_first";
+    appendToPreheader(n, {mov(first, Operand::makeVar(n.outer), line),
+                          mov(n.inner, n.innerFirst, line)});
+    auto &outerTest = n.outerHeader->instructions.front();
+    auto &innerTest = n.innerHeader->instructions.front();
+    std::swap(outerTest.operands, innerTest.operands);
+    n.outerBody->instructions.front() =
+        mov(n.outer, Operand::makeVar(first),
+            n.outerBody->instructions.front().line);
+    auto renameStep = [](InstIter add, const std::string &from,
+                         const std::string &to) {
+      for (auto &op : add->operands)
+        if (isVar(op, from))
+          op.value = to;
+      std::next(add)->result.value = to;
+    };
+    renameStep(n.innerStep, n.inner, n.outer);
+    renameStep(n.outerStep, n.outer, n.inner);
+    ++interchanged;
+  }
+
+  // for (s = j0; s < m; s += kTileSize)
+  //   for (i = i0; i < n; ++i)
+  //     for (j = s; j < min(s + kTileSize, m); ++j) body
+  void stripMine(const Nest &n) {
+    int line = n.innerHeader->instructions.front().line;
+    const std::string &label = n.outerHeader->label;
+    std::string first = "%" + label + "_first", strip = "%" + label + "_strip",
+                more = "%" + label + "_more", last = "%" + label + "_last",
+                full = "%" + label + "_full", low = "%" + label + "_low",
+                end = "%" + label + "_end";
+    auto var = [](const std::string &name) { return Operand::makeVar(name); };
+    auto inst = [&](OpCode op, const std::string &dst, Operand a, Operand b) {
+      Instruction i(op, var(dst), a, b);
+      i.line = line;
+      return i;
+    };
+    auto jump = [&](const std::string &target) {
+      Instruction i =
+          Instruction::createBranch(OpCode::JMP, Operand::makeLabel(target));
+      i.line = line;
+      return i;
+    };
+
+    // header: while (strip < m)
+    auto header = std::make_unique<BasicBlock>(label + "_tile");
+    header->addInst(inst(OpCode::LT, more, var(strip), n.innerBound));
+    Instruction branch = Instruction::createCondBranch(
+        OpCode::JMP_IF, Operand::makeLabel(label + "_tile_body"), var(more));
+    branch.line = line;
+    header->addInst(branch);
+    header->addInst(jump(n.exit->label));
+    // body: end = min(strip + kTileSize, m) without overflow, as
+    // (strip < m - kTileSize ? strip : m - kTileSize) + kTileSize
+    auto body = std::make_unique<BasicBlock>(label + "_tile_body");
+    Operand size = Operand::makeConst(int(kTileSize));
+    body->addInst(inst(OpCode::SUB, last, n.innerBound, size));
+    body->addInst(inst(OpCode::LT, full, var(strip), var(last)));
+    Instruction select = inst(OpCode::SELECT, low, var(full), var(strip));
+    select.operands.push_back(var(last));
+    body->addInst(select);
+    body->addInst(inst(OpCode::ADD, end, var(low), size));
+    body->addInst(mov(n.outer, var(first), line));
+    body->addInst(jump(label));
+    // latch: strip = end
+    auto latch = std::make_unique<BasicBlock>(label + "_tile_next");
+    latch->addInst(mov(strip, var(end), line));
+    latch->addInst(jump(header->label));
+
+    for (auto &i : n.preheader->instructions)
+      if ((i.op == OpCode::JMP || i.op == OpCode::JMP_IF) &&
+          i.operands[0].value == label)
+        i.operands[0].value = header->label;
+    appendToPreheader(n, {mov(first, var(n.outer), line),
+                          mov(strip, n.innerFirst, line)});
+    n.outerHeader->instructions.back().operands[0].value = latch->label;
+    n.outerBody->instructions.front().operands[0] = var(strip);
+    n.innerHeader->instructions.front().operands[1] = var(end);
+
+    auto position = [&](const BasicBlock *bb) {
+      return std::find_if(
+          func.blocks.begin(), func.blocks.end(),
+          [&](const std::unique_ptr<BasicBlock> &b) { return b.get() == bb; });
+    };
+    auto at = position(n.outerHeader);
+    func.blocks.insert(at, std::move(header));
+    func.blocks.insert(at, std::move(body));
+    func.blocks.insert(std::next(position(n.innerExit)), std::move(latch));
+    ++tiled;
+  }
+};
+
+} // namespace
+
+void LoopNestPass::run(Function &func) const { NestOptimizer(func).run(); }
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,92 @@
+#include "optimix/ir/LoopUtils.h"
+#include <set>
+
+namespace optimix {
+namespace ir {
+
+bool definesScalar(const Instruction &inst) {
+  return hasResult(inst.op) && inst.result.type == Operand::VARIABLE;
+}
+
+bool isVar(const Operand &op, const std::string &name) {
+  return op.type == Operand::VARIABLE && op.value == name;
+}
+
+bool matchHeader(const BasicBlock *header, std::string &iv, Operand &bound,
+                 std::string &in, std::string &out) {
+  auto &insts = header->instructions;
+  if (insts.size() != 3)
+    return false;
+  auto it = insts.begin();
+  const Instruction &test = *it++, &branch = *it++, &jump = *it;
+  if (test.op != OpCode::LT || test.operands[0].type != Operand::VARIABLE ||
+      branch.op != OpCode::JMP_IF ||
+      !isVar(branch.operands[1], test.result.value) ||
+      jump.op != OpCode::JMP)
+    return false;
+  iv = test.operands[0].value;
+  bound = test.operands[1];
+  in = branch.operands[0].value;
+  out = jump.operands[0].value;
+  return true;
+}
+
+bool liveAt(const BasicBlock *from, const std::string &name) {
+  std::set<const BasicBlock *> visited;
+  std::vector<const BasicBlock *> work{from};
+  while (!work.empty()) {
+    const BasicBlock *bb = work.back();
+    work.pop_back();
+    if (!visited.insert(bb).second)
+      continue;
+    bool killed = false;
+    for (const auto &inst : bb->instructions) {
+      bool read = false;
+      forEachRead(inst, [&](const std::string &r) { read |= r == name; });
+      if (read)
+        return true;
+      if (definesScalar(inst) && inst.result.value == name) {
+        killed = true;
+        break;
+      }
+    }
+    if (!killed)
+      work.insert(work.end(), bb->succs.begin(), bb->succs.end());
+  }
+  return false;
+}
+
+ScalarDefs::ScalarDefs(const Function &func) {
+  for (const auto &bb : func.blocks)
+    for (const auto &inst : bb->instructions)
+      if (definesScalar(inst))
+        sites[inst.result.value].push_back({bb.get(), &inst});
+}
+
+const std::vector<ScalarDefs::Site> &
+ScalarDefs::of(const std::string &name) const {
+  static const std::vector<Site> none;
+  auto it = sites.find(name);
+  return it == sites.end() ? none : it->second;
+}
+
+std::optional<Poly> ScalarDefs::fixedValue(const DominatorTree &domTree,
+                                           const Operand &v,
+                                           const BasicBlock *atBlock,
+                                           const Instruction *at,
+                                           int depth) const {
+  if (v.type == Operand::CONSTANT)
+    return constant(std::stoll(v.value));
+  auto it = sites.find(v.value);
+  if (it == sites.end())
+    return symbol(v.value);
+  if (it->second.size() != 1 || depth > 16)
+    return std::nullopt;
+  auto [bb, inst] = it->second[0];
+  if (inst->op != OpCode::MOV || !domTree.dominates(bb, inst, atBlock, at))
+    return std::nullopt;
+  return fixedValue(domTree, inst->operands[0], bb, inst, depth + 1);
+}
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,79 @@
+#include "optimix/ir/Memoize.h"
+#include "optimix/support/Diagnostics.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+// Entries per memo table: enough for the distinct arguments of a typical
+// recursion, while a table of a few ints per entry stays small.
+const int kMemoEntries = 4096;
+
+} // namespace
+
+void MemoizePass::run(Module &module) const {
+  // Who calls whom, and which functions do more than compute a result.
+  std::map<std::string, std::set<std::string>> callees;
+  std::set<std::string> impure;
+  for (const auto &func : module.functions)
+    for (const auto &bb : func->blocks)
+      for (const auto &inst : bb->instructions) {
+        if (inst.op == OpCode::PRINT)
+          impure.insert(func->name);
+        if (inst.op != OpCode::CALL)
+          continue;
+        const std::string &callee = inst.operands[0].value;
+        callees[func->name].insert(callee);
+        if (!module.getFunction(callee))
+          impure.insert(func->name);
+      }
+
+  // Calling an impure function makes the caller impure too.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto &func : module.functions) {
+      if (impure.count(func->name))
+        continue;
+      for (const auto &callee : callees[func->name])
+        if (impure.count(callee)) {
+          impure.insert(func->name);
+          changed = true;
+          break;
+        }
+    }
+  }
+
+  int memoized = 0;
+  for (const auto &func : module.functions) {
+    if (impure.count(func->name) || func->blocks.empty())
+      continue;
+    // Recursive: the function is reachable from its own callees.
+    std::set<std::string> reached;
+    std::vector<std::string> work(callees[func->name].begin(),
+                                  callees[func->name].end());
+    while (!work.empty() && !reached.count(func->name)) {
+      std::string next = work.back();
+      work.pop_back();
+      if (reached.insert(next).second)
+        work.insert(work.end(), callees[next].begin(), callees[next].end());
+    }
+    auto &entry = func->blocks.front()->instructions;
+    if (!reached.count(func->name) ||
+        (!entry.empty() && entry.front().op == OpCode::MEMO))
+      continue;
+    entry.push_front(Instruction(OpCode::MEMO, {Operand::CONSTANT, ""},
+                                 Operand::makeConst(kMemoEntries)));
+    ++memoized;
+  }
+  OPTIMIX_LOG(DEBUG, "memoize: " + std::to_string(memoized) +
+                         " functions memoized");
+}
+
+} // namespace ir
+} // namespace optimix
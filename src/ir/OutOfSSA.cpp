@@ -0,0 +1,342 @@
+#include "optimix/ir/OutOfSSA.h"
+#include "optimix/ir/Dominators.h"
+#include "optimix/ir/SSA.h"
+#include "optimix/support/Diagnostics.h"
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+// Holds a value while a cycle of copies is broken.
+const char *const kSwapTemp = "%swap";
+
+struct Copy {
+  std::string dst;
+  Operand src;
+};
+
+bool definesScalar(const Instruction &inst) {
+  return hasResult(inst.op) && inst.result.type == Operand::VARIABLE;
+}
+
+template <typename Fn> void forEachRead(Instruction &inst, Fn fn) {
+  for (size_t i = 0; i < inst.operands.size(); ++i) {
+    Operand &op = inst.operands[i];
+    if (op.type == Operand::VARIABLE && !isArrayOperand(inst.op, i))
+      fn(op);
+  }
+}
+
+// Orders parallel copies (distinct destinations) so that none overwrites a
+// source that a later one still reads. When only cycles remain, one
+// destination is saved in kSwapTemp and read from there instead.
+std::vector<Copy> sequentialize(std::vector<Copy> pending) {
+  auto isRead = [&](const std::string &name) {
+    return std::any_of(pending.begin(), pending.end(), [&](const Copy &c) {
+      return c.src.type == Operand::VARIABLE && c.src.value == name;
+    });
+  };
+  std::vector<Copy> out;
+  while (!pending.empty()) {
+    auto ready = std::find_if(pending.begin(), pending.end(),
+                              [&](const Copy &c) { return !isRead(c.dst); });
+    if (ready != pending.end()) {
+      out.push_back(*ready);
+      pending.erase(ready);
+      continue;
+    }
+    std::string saved = pending.front().dst;
+    out.push_back({kSwapTemp, Operand::makeVar(saved)});
+    for (auto &c : pending)
+      if (c.src.type == Operand::VARIABLE && c.src.value == saved)
+        c.src = Operand::makeVar(kSwapTemp);
+  }
+  return out;
+}
+
+class Destructor {
+public:
+  explicit Destructor(Function &func) : func(func) {}
+
+  void run() {
+    if (func.blocks.empty())
+      return;
+    lowerPhis();
+    discardSSA(func);
+    while (coalesceOne())
+      ++coalesced;
+    removeEmptySplits();
+    OPTIMIX_LOG(DEBUG, "out-of-ssa: " + func.name + ": " +
+                           std::to_string(copies) + " copies, " +
+                           std::to_string(splits) + " edges split, " +
+                           std::to_string(coalesced) + " coalesced");
+  }
+
+private:
+  using BlockList = std::list<std::unique_ptr<BasicBlock>>;
+
+  // A block inserted on the edge pred -> target.
+  struct Split {
+    BasicBlock *block;
+    BasicBlock *pred;
+    std::string target;
+  };
+
+  Function &func;
+  std::vector<Split> splitEdges;
+  std::unordered_map<const BasicBlock *, std::set<std::string>> liveIn,
+      liveOut;
+  int copies = 0, splits = 0, coalesced = 0;
+
+  BlockList::iterator position(const BasicBlock *bb) {
+    return std::find_if(
+        func.blocks.begin(), func.blocks.end(),
+        [&](const std::unique_ptr<BasicBlock> &b) { return b.get() == bb; });
+  }
+
+  static Instruction jumpTo(const std::string &label, int line) {
+    Instruction jump =
+        Instruction::createBranch(OpCode::JMP, Operand::makeLabel(label));
+    jump.line = line;
+    return jump;
+  }
+
+  static bool hasConditionalJump(const BasicBlock &bb) {
+    return std::any_of(
+        bb.instructions.begin(), bb.instructions.end(),
+        [](const Instruction &inst) { return inst.op == OpCode::JMP_IF; });
+  }
+
+  // Makes 'pos' end in a terminator, so a block can be inserted after it.
+  // A block that ran off the end of the function jumps to a new empty
+  // block there instead.
+  void endExplicitly(BlockList::iterator pos) {
+    auto &insts = (*pos)->instructions;
+    if (!insts.empty() && isTerminator(insts.back().op))
+      return;
+    int line = insts.empty() ? 0 : insts.back().line;
+    auto next = std::next(pos);
+    if (next == func.blocks.end())
+      next = func.blocks.insert(
+          next, std::make_unique<BasicBlock>((*pos)->label + "_exit"));
+    insts.push_back(jumpTo((*next)->label, line));
+  }
+
+  // Moves 'copies' onto the edge pred -> bb.
+  void place(BasicBlock *pred, BasicBlock *bb, std::list<Instruction> code) {
+    auto &predInsts = pred->instructions;
+    if (pred->succs.size() == 1 && !hasConditionalJump(*pred)) {
+      auto at = predInsts.end();
+      if (!predInsts.empty() && isTerminator(predInsts.back().op))
+        at = std::prev(at);
+      predInsts.splice(at, code);
+      return;
+    }
+    auto &insts = bb->instructions;
+    if (bb->preds.size() == 1) {
+      auto at = std::find_if(insts.begin(), insts.end(),
+                             [](const Instruction &inst) {
+                               return inst.op != OpCode::PHI;
+                             });
+      insts.splice(at, code);
+      return;
+    }
+    // A critical edge: the copies get a block of their own after pred.
+    auto predPos = position(pred);
+    endExplicitly(predPos);
+    std::string label = bb->label + "_from_" + pred->label;
+    for (auto &inst : predInsts)
+      if ((inst.op == OpCode::JMP || inst.op == OpCode::JMP_IF) &&
+          inst.operands[0].value == bb->label)
+        inst.operands[0].value = label;
+    auto split = std::make_unique<BasicBlock>(label);
+    int line = code.empty() ? 0 : code.back().line;
+    split->instructions.splice(split->instructions.end(), code);
+    auto next = std::next(predPos);
+    if (next == func.blocks.end() || next->get() != bb)
+      split->instructions.push_back(jumpTo(bb->label, line));
+    splitEdges.push_back({split.get(), pred, bb->label});
+    func.blocks.insert(next, std::move(split));
+    ++splits;
+  }
+
+  // Edges whose copies were all coalesced away no longer need a block.
+  void removeEmptySplits() {
+    for (const Split &s : splitEdges) {
+      auto &insts = s.block->instructions;
+      if (insts.size() > 1 ||
+          (insts.size() == 1 && insts.front().op != OpCode::JMP))
+        continue;
+      for (auto &inst : s.pred->instructions)
+        if ((inst.op == OpCode::JMP || inst.op == OpCode::JMP_IF) &&
+            inst.operands[0].value == s.block->label)
+          inst.operands[0].value = s.target;
+      func.blocks.erase(position(s.block));
+      --splits;
+    }
+  }
+
+  void lowerPhis() {
+    computeCFG(func);
+    std::vector<BasicBlock *> joins;
+    for (auto &bb : func.blocks)
+      if (!bb->instructions.empty() &&
+          bb->instructions.front().op == OpCode::PHI)
+        joins.push_back(bb.get());
+    for (BasicBlock *bb : joins) {
+      auto preds = bb->preds; // Splitting edits the CFG
+      for (BasicBlock *pred : preds) {
+        std::vector<Copy> parallel;
+        int line = 0;
+        for (const auto &inst : bb->instructions) {
+          if (inst.op != OpCode::PHI)
+            break;
+          const Operand *value = inst.incoming(pred->label);
+          if (!value || (value->type == Operand::VARIABLE &&
+                         value->value == inst.result.value))
+            continue; // Undefined, or the variable's own register
+          Operand src = *value;
+          src.version = 0;
+          parallel.push_back({inst.result.value, src});
+          line = inst.line;
+        }
+        if (parallel.empty())
+          continue;
+        std::list<Instruction> code;
+        for (const Copy &c : sequentialize(std::move(parallel))) {
+          Instruction mov(OpCode::MOV, Operand::makeVar(c.dst), c.src);
+          mov.line = line;
+          code.push_back(std::move(mov));
+          ++copies;
+        }
+        place(pred, bb, std::move(code));
+      }
+    }
+  }
+
+  void computeLiveness() {
+    computeCFG(func);
+    std::unordered_map<const BasicBlock *, std::set<std::string>> uses, defs;
+    for (auto &bb : func.blocks) {
+      auto &use = uses[bb.get()], &def = defs[bb.get()];
+      for (auto &inst : bb->instructions) {
+        forEachRead(inst, [&](Operand &op) {
+          if (!def.count(op.value))
+            use.insert(op.value);
+        });
+        if (definesScalar(inst))
+          def.insert(inst.result.value);
+      }
+    }
+    liveIn.clear();
+    liveOut.clear();
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto it = func.blocks.rbegin(); it != func.blocks.rend(); ++it) {
+        const BasicBlock *bb = it->get();
+        std::set<std::string> out;
+        for (const BasicBlock *s : bb->succs)
+          out.insert(liveIn[s].begin(), liveIn[s].end());
+        std::set<std::string> in = uses[bb];
+        for (const auto &name : out)
+          if (!defs[bb].count(name))
+            in.insert(name);
+        if (in != liveIn[bb] || out != liveOut[bb]) {
+          liveIn[bb] = std::move(in);
+          liveOut[bb] = std::move(out);
+          changed = true;
+        }
+      }
+    }
+  }
+
+  static bool isCopyBetween(const Instruction &inst, const std::string &a,
+                            const std::string &b) {
+    if (inst.op != OpCode::MOV || inst.operands[0].type != Operand::VARIABLE)
+      return false;
+    const std::string &dst = inst.result.value, &src = inst.operands[0].value;
+    return (dst == a && src == b) || (dst == b && src == a);
+  }
+
+  // Whether a and b are live at the same time with (possibly) different
+  // values: one is defined, other than by a copy of the other, while the
+  // other is live.
+  bool interfere(const std::string &a, const std::string &b) {
+    for (auto &bb : func.blocks) {
+      std::set<std::string> live = liveOut[bb.get()];
+      auto &insts = bb->instructions;
+      for (auto it = insts.rbegin(); it != insts.rend(); ++it) {
+        if (definesScalar(*it)) {
+          const std::string &d = it->result.value;
+          if (!isCopyBetween(*it, a, b) &&
+              ((d == a && live.count(b)) || (d == b && live.count(a))))
+            return true;
+          live.erase(d);
+        }
+        forEachRead(*it, [&](Operand &op) { live.insert(op.value); });
+      }
+    }
+    return false;
+  }
+
+  // Removes one copy MOV x, y by renaming one side to the other. The side
+  // with a single definition (usually a temporary) goes; names live on
+  // entry stay, since the caller's values are looked up by them.
+  bool coalesceOne() {
+    computeLiveness();
+    const auto &entry = liveIn[func.blocks.front().get()];
+    std::unordered_map<std::string, int> defs;
+    for (auto &bb : func.blocks)
+      for (auto &inst : bb->instructions)
+        if (definesScalar(inst))
+          ++defs[inst.result.value];
+    for (auto &bb : func.blocks)
+      for (auto &inst : bb->instructions) {
+        if (inst.op != OpCode::MOV ||
+            inst.operands[0].type != Operand::VARIABLE)
+          continue;
+        std::string x = inst.result.value, y = inst.operands[0].value;
+        if (x == y || (entry.count(x) && entry.count(y)) || interfere(x, y))
+          continue;
+        bool keepY = entry.count(y) || (defs[y] > 1 && defs[x] == 1);
+        if (keepY)
+          rename(x, y);
+        else
+          rename(y, x);
+        return true;
+      }
+    return false;
+  }
+
+  void rename(const std::string &from, const std::string &to) {
+    for (auto &bb : func.blocks) {
+      auto &insts = bb->instructions;
+      for (auto it = insts.begin(); it != insts.end();) {
+        if (definesScalar(*it) && it->result.value == from)
+          it->result.value = to;
+        forEachRead(*it, [&](Operand &op) {
+          if (op.value == from)
+            op.value = to;
+        });
+        bool selfCopy = it->op == OpCode::MOV &&
+                        it->operands[0].type == Operand::VARIABLE &&
+                        it->operands[0].value == it->result.value;
+        it = selfCopy ? insts.erase(it) : std::next(it);
+      }
+    }
+  }
+};
+
+} // namespace
+
+void OutOfSSAPass::run(Function &func) const { Destructor(func).run(); }
+
+} // namespace ir
+} // namespace optimix
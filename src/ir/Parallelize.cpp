@@ -0,0 +1,583 @@
+#include "optimix/ir/Parallelize.h"
+#include "optimix/ir/Dominators.h"
+#include "optimix/ir/LoopInfo.h"
+#include "optimix/ir/LoopUtils.h"
+#include "optimix/ir/Polynomial.h"
+#include "optimix/support/Diagnostics.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <set>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+using InstIter = std::list<Instruction>::const_iterator;
+
+// An inner loop that counts j from 'first' by one while j < bound.
+struct Counter {
+  const Loop *loop;
+  Operand first, bound;
+};
+
+// An array index: outer * i + inner * counter + rest.
+struct Affine {
+  Poly outer;
+  std::string counter; // Empty when 'inner' is
+  Poly inner, rest;
+
+  bool invariant() const { return outer.empty() && inner.empty(); }
+  bool operator==(const Affine &o) const {
+    return outer == o.outer && counter == o.counter && inner == o.inner &&
+           rest == o.rest;
+  }
+};
+
+// A loop the pass parallelizes.
+struct Candidate {
+  const Loop *loop;
+  BasicBlock *preheader; // Null when the loop needs a new one
+  BasicBlock *exit;
+  std::string iv;
+  Operand bound;
+  std::vector<std::string> sums;
+};
+
+bool isOne(const Operand &op) {
+  return op.type == Operand::CONSTANT && op.value == "1";
+}
+
+// What a parallel loop may contain.
+bool isAllowed(OpCode op) {
+  switch (op) {
+  case OpCode::ADD:
+  case OpCode::SUB:
+  case OpCode::MUL:
+  case OpCode::DIV:
+  case OpCode::MOV:
+  case OpCode::LT:
+  case OpCode::GT:
+  case OpCode::EQ:
+  case OpCode::NEQ:
+  case OpCode::SHL:
+  case OpCode::SHR:
+  case OpCode::MULH:
+  case OpCode::SELECT:
+  case OpCode::LOAD:
+  case OpCode::STORE:
+  case OpCode::LOAD_UNCHECKED:
+  case OpCode::STORE_UNCHECKED:
+  case OpCode::INBOUNDS:
+  case OpCode::JMP:
+  case OpCode::JMP_IF:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// s + e, e + s or s - e, for an e other than s.
+bool isSumOf(const Instruction &inst, const std::string &s) {
+  const auto &ops = inst.operands;
+  if (inst.op == OpCode::ADD)
+    return isVar(ops[0], s) != isVar(ops[1], s);
+  if (inst.op == OpCode::SUB)
+    return isVar(ops[0], s) && !isVar(ops[1], s);
+  return false;
+}
+
+class LoopParallelizer {
+public:
+  explicit LoopParallelizer(Function &func) : func(func) {}
+
+  void run() {
+    if (func.blocks.empty())
+      return;
+    for (const auto &bb : func.blocks)
+      for (const auto &inst : bb->instructions)
+        if (inst.op == OpCode::PHI || inst.op == OpCode::PARFOR)
+          return; // Still in SSA form, or done already
+    DominatorTree domTree(func);
+    LoopInfo loops(domTree);
+    defSites = ScalarDefs(func);
+
+    std::vector<Candidate> chosen;
+    std::set<const BasicBlock *> covered;
+    for (const auto &loop : loops.loops()) {
+      if (covered.count(loop->header))
+        continue;
+      if (auto c = match(domTree, loops, *loop)) {
+        chosen.push_back(*c);
+        covered.insert(loop->blocks.begin(), loop->blocks.end());
+      }
+    }
+    for (const Candidate &c : chosen)
+      mark(c);
+    OPTIMIX_LOG(DEBUG, "parallelize: " + func.name + ": " +
+                           std::to_string(chosen.size()) + " loops");
+  }
+
+private:
+  Function &func;
+  ScalarDefs defSites;
+  std::map<std::string, Counter> counters; // Of the loop being matched
+
+  // Whether the only assignment to 'iv' in 'bb' is iv = iv + 1, directly
+  // or through a temp t = iv + 1 that nothing else reads.
+  static bool stepsByOne(const BasicBlock *bb, const std::string &iv,
+                         const std::map<std::string, int> &reads) {
+    auto &insts = bb->instructions;
+    auto def = std::find_if(insts.begin(), insts.end(), [&](const auto &i) {
+      return definesScalar(i) && i.result.value == iv;
+    });
+    if (def == insts.end())
+      return false;
+    auto isIncrement = [&](const Instruction &inst) {
+      return inst.op == OpCode::ADD &&
+             ((isVar(inst.operands[0], iv) && isOne(inst.operands[1])) ||
+              (isOne(inst.operands[0]) && isVar(inst.operands[1], iv)));
+    };
+    if (isIncrement(*def))
+      return true;
+    if (def->op != OpCode::MOV || def->operands[0].type != Operand::VARIABLE)
+      return false;
+    const std::string &t = def->operands[0].value;
+    for (auto it = def; it != insts.begin();) {
+      --it;
+      if (definesScalar(*it) && it->result.value == t)
+        return isIncrement(*it) && reads.at(t) == 1;
+    }
+    return false;
+  }
+
+  // The value of a name the loop does not assign, as a constant or symbol.
+  Poly resolve(const Candidate &c, const DominatorTree &domTree,
+               const Operand &v) const {
+    const BasicBlock *header = c.loop->header;
+    auto value =
+        defSites.fixedValue(domTree, v, header, &header->instructions.front());
+    return value ? *value : symbol(v.value);
+  }
+
+  // The counters of the loops nested in 'loop': j = first outside the
+  // inner loop, j = j + 1 in its latch, and no other assignment to j.
+  void findCounters(const LoopInfo &loops, const Loop &loop,
+                    const std::map<std::string, int> &defs,
+                    const std::map<std::string, int> &reads) {
+    counters.clear();
+    for (const auto &inner : loops.loops()) {
+      if (inner.get() == &loop || !loop.contains(inner->header) ||
+          inner->latches.size() != 1)
+        continue;
+      std::string j, in, out;
+      Operand bound;
+      if (!matchHeader(inner->header, j, bound, in, out) ||
+          !defs.count(j) || defs.at(j) != 2 ||
+          !stepsByOne(inner->latches[0], j, reads) ||
+          (bound.type == Operand::VARIABLE && defs.count(bound.value)))
+        continue;
+      for (const auto &[bb, inst] : defSites.of(j))
+        if (loop.contains(bb) && !inner->contains(bb) &&
+            inst->op == OpCode::MOV &&
+            inst->operands[0].type == Operand::CONSTANT)
+          counters[j] = {inner.get(), inst->operands[0], bound};
+    }
+  }
+
+  // The index 'v' read at 'at' in 'bb', or nothing if it is not affine in
+  // i and one counter, with a rest the loop does not assign.
+  std::optional<Affine> affineOf(const Candidate &c,
+                                 const DominatorTree &domTree,
+                                 const std::map<std::string, int> &defs,
+                                 const BasicBlock *bb, InstIter at,
+                                 const Operand &v, int depth = 0) const {
+    if (depth > 32)
+      return std::nullopt;
+    Affine a;
+    if (v.type == Operand::CONSTANT) {
+      a.rest = constant(std::stoll(v.value));
+      return a;
+    }
+    auto def = at;
+    bool found = false;
+    while (!found && def != bb->instructions.begin()) {
+      --def;
+      found = definesScalar(*def) && def->result.value == v.value;
+    }
+    if (!found) {
+      // Inside its loop, past the test, a counter is in [first, bound).
+      auto counter = counters.find(v.value);
+      if (v.value == c.iv) {
+        a.outer = constant(1);
+      } else if (counter != counters.end() &&
+                 counter->second.loop->contains(bb) &&
+                 counter->second.loop->header != bb) {
+        a.counter = v.value;
+        a.inner = constant(1);
+      } else if (defs.count(v.value)) {
+        return std::nullopt;
+      } else {
+        a.rest = resolve(c, domTree, v);
+      }
+      return a;
+    }
+    auto operand = [&](size_t i) {
+      return affineOf(c, domTree, defs, bb, def, def->operands[i], depth + 1);
+    };
+    if (def->op == OpCode::MOV)
+      return operand(0);
+    auto x = operand(0);
+    if (!x)
+      return std::nullopt;
+    std::optional<Affine> y;
+    if (def->op == OpCode::SHL) {
+      // x << k for a constant k, as instcombine writes x * 2^k
+      const Operand &k = def->operands[1];
+      int64_t shift = k.type == Operand::CONSTANT ? std::stoll(k.value) : -1;
+      if (shift < 0 || shift > 30)
+        return std::nullopt;
+      y = Affine{};
+      y->rest = constant(int64_t(1) << shift);
+    } else if (def->op == OpCode::ADD || def->op == OpCode::SUB ||
+               def->op == OpCode::MUL) {
+      y = operand(1);
+    }
+    if (!y)
+      return std::nullopt;
+    if (def->op == OpCode::ADD || def->op == OpCode::SUB) {
+      if (x->counter.empty())
+        x->counter = y->counter;
+      else if (!y->counter.empty() && y->counter != x->counter)
+        return std::nullopt;
+      int64_t sign = def->op == OpCode::ADD ? 1 : -1;
+      addTo(x->outer, y->outer, sign);
+      addTo(x->inner, y->inner, sign);
+      addTo(x->rest, y->rest, sign);
+      if (x->inner.empty())
+        x->counter.clear();
+      return x;
+    }
+    if (!x->invariant())
+      std::swap(x, y);
+    if (!x->invariant())
+      return std::nullopt;
+    auto outer = multiply(y->outer, x->rest);
+    auto inner = multiply(y->inner, x->rest), rest = multiply(y->rest, x->rest);
+    if (!outer || !inner || !rest)
+      return std::nullopt;
+    Affine product{*outer, y->counter, *inner, *rest};
+    if (product.inner.empty())
+      product.counter.clear();
+    return product;
+  }
+
+  // Whether no two iterations touch the same element through 'index':
+  // outer * (i1 - i2) can only equal inner * (j2 - j1) for i1 == i2.
+  bool independent(const Candidate &c, const DominatorTree &domTree,
+                   const Affine &index) const {
+    auto a = constantValue(index.outer);
+    if (index.outer.empty())
+      return false; // Every iteration touches the same elements
+    if (index.inner.empty())
+      return a && *a != 0;
+    auto b = constantValue(index.inner);
+    const Counter &j = counters.at(index.counter);
+    if (!b || j.first.type != Operand::CONSTANT)
+      return false;
+    int64_t first = std::stoll(j.first.value);
+    Poly limit = resolve(c, domTree, j.bound);
+    auto bound = constantValue(limit);
+    if (a && bound)
+      return std::llabs(*b) * std::max<int64_t>(*bound - first - 1, 0) <
+             std::llabs(*a);
+    // Symbolic: outer is k * m for the bound m and k >= 1, and j moves by
+    // one from 0 on, so it stays below m.
+    if (a || bound || std::llabs(*b) != 1 || first < 0 || limit.size() != 1 ||
+        index.outer.size() != 1)
+      return false;
+    const auto &[monomial, k] = *index.outer.begin();
+    return monomial == limit.begin()->first && k >= 1;
+  }
+
+  // The names the loop only updates as sums. 'temps' gets the t of each
+  // s = c ? t : s with t = s + e.
+  static std::vector<std::string>
+  findSums(const std::vector<BasicBlock *> &blocks, const std::string &iv,
+           const std::map<std::string, int> &defs,
+           const std::map<std::string, int> &reads,
+           std::set<std::string> &temps) {
+    std::map<std::string, int> covered; // Reads of s inside its updates
+    std::set<std::string> other;        // Assigned by something else
+    std::map<std::string, std::string> tempOf;
+    for (BasicBlock *bb : blocks) {
+      auto &insts = bb->instructions;
+      for (auto it = insts.begin(); it != insts.end(); ++it) {
+        if (!definesScalar(*it))
+          continue;
+        const std::string &s = it->result.value;
+        if (isSumOf(*it, s)) {
+          ++covered[s];
+          continue;
+        }
+        // SELECT s, c, t, s (or c, s, t) after t = s + e
+        const auto &ops = it->operands;
+        std::string t;
+        if (it->op == OpCode::SELECT && !isVar(ops[0], s) &&
+            isVar(ops[1], s) != isVar(ops[2], s)) {
+          const Operand &sum = isVar(ops[1], s) ? ops[2] : ops[1];
+          if (sum.type == Operand::VARIABLE)
+            t = sum.value;
+        }
+        bool matched = false;
+        for (auto d = it; !t.empty() && d != insts.begin();) {
+          --d;
+          if (!definesScalar(*d) || (d->result.value != t &&
+                                     d->result.value != s))
+            continue;
+          matched = d->result.value == t && isSumOf(*d, s) &&
+                    defs.at(t) == 1 && reads.at(t) == 1;
+          break;
+        }
+        if (matched) {
+          covered[s] += 2;
+          tempOf[t] = s;
+        } else {
+          other.insert(s);
+        }
+      }
+    }
+    std::vector<std::string> sums;
+    for (const auto &[s, count] : covered)
+      if (s != iv && !other.count(s) && reads.count(s) &&
+          reads.at(s) == count)
+        sums.push_back(s);
+    for (const auto &[t, s] : tempOf)
+      if (std::find(sums.begin(), sums.end(), s) != sums.end())
+        temps.insert(t);
+    return sums;
+  }
+
+  // Whether every name in 'tracked' is assigned in each iteration before
+  // the iteration reads it. 'always' gets the names every iteration
+  // assigns before it reaches the latch.
+  static bool assignedBeforeRead(const DominatorTree &domTree,
+                                 const Loop &loop,
+                                 const std::set<std::string> &tracked,
+                                 std::set<std::string> &always) {
+    std::vector<BasicBlock *> order;
+    for (BasicBlock *bb : domTree.reversePostOrder())
+      if (loop.contains(bb))
+        order.push_back(bb);
+    // Names assigned on every path from the header to a block's end; a
+    // block not visited yet stands for all names.
+    std::map<const BasicBlock *, std::set<std::string>> out;
+    auto entryState = [&](const BasicBlock *bb) {
+      std::optional<std::set<std::string>> in;
+      if (bb != loop.header) {
+        for (const BasicBlock *pred : bb->preds) {
+          auto it = out.find(pred);
+          if (!loop.contains(pred) || it == out.end())
+            continue;
+          if (!in) {
+            in = it->second;
+            continue;
+          }
+          std::set<std::string> both;
+          std::set_intersection(in->begin(), in->end(), it->second.begin(),
+                                it->second.end(),
+                                std::inserter(both, both.end()));
+          in = std::move(both);
+        }
+      }
+      return in ? *in : std::set<std::string>();
+    };
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (BasicBlock *bb : order) {
+        auto names = entryState(bb);
+        for (const auto &inst : bb->instructions)
+          if (definesScalar(inst))
+            names.insert(inst.result.value);
+        auto it = out.find(bb);
+        if (it == out.end() || it->second != names) {
+          out[bb] = std::move(names);
+          changed = true;
+        }
+      }
+    }
+    for (BasicBlock *bb : order) {
+      auto names = entryState(bb);
+      for (const auto &inst : bb->instructions) {
+        bool early = false;
+        forEachRead(inst, [&](const std::string &r) {
+          early |= tracked.count(r) && !names.count(r);
+        });
+        if (early)
+          return false;
+        if (definesScalar(inst))
+          names.insert(inst.result.value);
+      }
+    }
+    always = out[loop.latches[0]];
+    return true;
+  }
+
+  std::optional<Candidate> match(const DominatorTree &domTree,
+                                 const LoopInfo &loops, const Loop &loop) {
+    Candidate c;
+    c.loop = &loop;
+    BasicBlock *header = loop.header;
+    std::string in, out;
+    if (loop.latches.size() != 1 ||
+        !matchHeader(header, c.iv, c.bound, in, out))
+      return std::nullopt;
+    c.exit = nullptr;
+    for (BasicBlock *succ : header->succs)
+      if (succ->label == out && !loop.contains(succ))
+        c.exit = succ;
+    if (!c.exit)
+      return std::nullopt;
+
+    // The loop is left only from its header. A new preheader goes right
+    // before the header, so nothing in the loop may fall through into it.
+    c.preheader = loop.preheader();
+    std::vector<BasicBlock *> blocks;
+    BasicBlock *previous = nullptr;
+    for (auto &bb : func.blocks) {
+      if (bb.get() == header && previous && loop.contains(previous) &&
+          (previous->instructions.empty() ||
+           !isTerminator(previous->instructions.back().op)))
+        return std::nullopt;
+      previous = bb.get();
+      if (!loop.contains(bb.get()))
+        continue;
+      blocks.push_back(bb.get());
+      for (BasicBlock *succ : bb->succs)
+        if (!loop.contains(succ) && bb.get() != header)
+          return std::nullopt;
+    }
+
+    std::map<std::string, int> defs, reads;
+    for (BasicBlock *bb : blocks)
+      for (const auto &inst : bb->instructions) {
+        if (!isAllowed(inst.op))
+          return std::nullopt;
+        forEachRead(inst, [&](const std::string &r) { ++reads[r]; });
+        if (definesScalar(inst))
+          ++defs[inst.result.value];
+      }
+    const Operand &bound = c.bound;
+    if (!defs.count(c.iv) || defs.at(c.iv) != 1 ||
+        !stepsByOne(loop.latches[0], c.iv, reads) ||
+        (bound.type == Operand::VARIABLE && defs.count(bound.value)))
+      return std::nullopt;
+
+    // Scalars: private to an iteration, or sums.
+    std::set<std::string> temps;
+    c.sums = findSums(blocks, c.iv, defs, reads, temps);
+    std::set<std::string> tracked, always;
+    for (const auto &[name, count] : defs)
+      if (name != c.iv &&
+          std::find(c.sums.begin(), c.sums.end(), name) == c.sums.end())
+        tracked.insert(name);
+    if (!assignedBeforeRead(domTree, loop, tracked, always))
+      return std::nullopt;
+    for (const std::string &name : tracked)
+      if ((temps.count(name) || !always.count(name)) &&
+          liveAt(c.exit, name))
+        return std::nullopt;
+
+    // Arrays: each element the loop writes belongs to one iteration.
+    findCounters(loops, loop, defs, reads);
+    std::map<std::string, std::vector<std::optional<Affine>>> indices;
+    std::set<std::string> written;
+    for (BasicBlock *bb : blocks) {
+      auto &insts = bb->instructions;
+      for (auto it = insts.begin(); it != insts.end(); ++it) {
+        bool load = it->op == OpCode::LOAD || it->op == OpCode::LOAD_UNCHECKED;
+        bool store =
+            it->op == OpCode::STORE || it->op == OpCode::STORE_UNCHECKED;
+        if (!load && !store)
+          continue;
+        const std::string &array = it->operands[0].value;
+        indices[array].push_back(
+            affineOf(c, domTree, defs, bb, it, it->operands[1]));
+        if (store)
+          written.insert(array);
+      }
+    }
+    for (const std::string &array : written) {
+      const auto &list = indices[array];
+      for (const auto &index : list)
+        if (!index || !(*index == *list.front()))
+          return std::nullopt;
+      if (!independent(c, domTree, *list.front()))
+        return std::nullopt;
+    }
+    return c;
+  }
+
+  // MOV %header_end, n; PARFOR header, i, %header_end, s... on the way
+  // into the loop, which now runs while i < %header_end: at the end of its
+  // preheader, or in a new block header_par if it has none.
+  void mark(const Candidate &c) {
+    BasicBlock *header = c.loop->header;
+    const std::string &label = header->label;
+    std::string end = "%" + label + "_end";
+    int line = header->instructions.front().line;
+    Instruction mov(OpCode::MOV, Operand::makeVar(end), c.bound);
+    Instruction parfor =
+        Instruction::createBranch(OpCode::PARFOR, Operand::makeLabel(label));
+    parfor.operands.push_back(Operand::makeVar(c.iv));
+    parfor.operands.push_back(Operand::makeVar(end));
+    for (const std::string &s : c.sums)
+      parfor.operands.push_back(Operand::makeVar(s));
+    mov.line = parfor.line = line;
+    header->instructions.front().operands[1] = Operand::makeVar(end);
+
+    if (c.preheader) {
+      auto &insts = c.preheader->instructions;
+      auto at = insts.end();
+      if (!insts.empty() && isTerminator(insts.back().op))
+        at = std::prev(at);
+      insts.insert(at, {mov, parfor});
+      return;
+    }
+    auto par = std::make_unique<BasicBlock>(label + "_par");
+    par->addInst(mov);
+    par->addInst(parfor);
+    Instruction jump =
+        Instruction::createBranch(OpCode::JMP, Operand::makeLabel(label));
+    jump.line = line;
+    par->addInst(jump);
+    for (auto &bb : func.blocks) {
+      if (c.loop->contains(bb.get()))
+        continue;
+      for (auto &inst : bb->instructions)
+        if ((inst.op == OpCode::JMP || inst.op == OpCode::JMP_IF) &&
+            inst.operands[0].value == label)
+          inst.operands[0].value = par->label;
+    }
+    auto position =
+        std::find_if(func.blocks.begin(), func.blocks.end(),
+                     [&](const std::unique_ptr<BasicBlock> &b) {
+                       return b.get() == header;
+                     });
+    func.blocks.insert(position, std::move(par));
+  }
+};
+
+} // namespace
+
+void ParallelizePass::run(Function &func) const {
+  LoopParallelizer(func).run();
+}
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,69 @@
+#include "optimix/ir/PassManager.h"
+#include "optimix/support/ThreadPool.h"
+#include "optimix/support/TimeReport.h"
+
+namespace optimix {
+namespace ir {
+
+void PassManager::addPass(std::unique_ptr<FunctionPass> pass) {
+  pipeline.push_back({std::move(pass), nullptr});
+}
+
+void PassManager::addPass(std::unique_ptr<ModulePass> pass) {
+  pipeline.push_back({nullptr, std::move(pass)});
+}
+
+void PassManager::run(Module &module, ThreadPool *pool) const {
+  size_t i = 0;
+  while (i < pipeline.size()) {
+    if (pipeline[i].modulePass) {
+      TimeReport::Region region(timeReport, pipeline[i].modulePass->name(),
+                                TimeReport::Kind::Pass);
+      pipeline[i].modulePass->run(module);
+      ++i;
+      continue;
+    }
+    size_t end = i;
+    while (end < pipeline.size() && pipeline[end].functionPass)
+      ++end;
+    runStage(module, i, end, pool);
+    i = end;
+  }
+}
+
+std::string PassManager::pipelineText() const {
+  std::string text;
+  for (const auto &entry : pipeline) {
+    if (!text.empty())
+      text += ",";
+    text += entry.functionPass ? entry.functionPass->name()
+                               : entry.modulePass->name();
+  }
+  return text;
+}
+
+void PassManager::runStage(Module &module, size_t begin, size_t end,
+                           ThreadPool *pool) const {
+  auto runAll = [this, begin, end](Function &func) {
+    for (size_t p = begin; p < end; ++p) {
+      TimeReport::Region region(timeReport, pipeline[p].functionPass->name(),
+                                TimeReport::Kind::Pass);
+      pipeline[p].functionPass->run(func);
+    }
+  };
+
+  if (!pool || module.functions.size() < 2) {
+    for (auto &func : module.functions)
+      runAll(*func);
+    return;
+  }
+
+  for (auto &func : module.functions) {
+    Function *f = func.get();
+    pool->submit([runAll, f] { runAll(*f); });
+  }
+  pool->wait();
+}
+
+} // namespace ir
+} // namespace optimix
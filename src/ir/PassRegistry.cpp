@@ -0,0 +1,77 @@
+#include "optimix/ir/PassRegistry.h"
+#include "optimix/ir/BoundsCheck.h"
+#include "optimix/ir/IfConversion.h"
+#include "optimix/ir/InstCombine.h"
+#include "optimix/ir/LoopFusion.h"
+#include "optimix/ir/LoopNest.h"
+#include "optimix/ir/OutOfSSA.h"
+#include "optimix/ir/Parallelize.h"
+#include "optimix/ir/SSA.h"
+#include "optimix/ir/ScalarReplacement.h"
+#include "optimix/ir/SimplifyCFG.h"
+#include <functional>
+#include <stdexcept>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+struct Registration {
+  const char *name;
+  std::function<std::unique_ptr<FunctionPass>()> create;
+};
+
+const std::vector<Registration> &registry() {
+  static const std::vector<Registration> passes = {
+      {"loop-nest", [] { return std::make_unique<LoopNestPass>(); }},
+      {"ssa", [] { return std::make_unique<SSAPass>(); }},
+      {"sroa", [] { return std::make_unique<ScalarReplacementPass>(); }},
+      {"loop-fusion", [] { return std::make_unique<LoopFusionPass>(); }},
+      {"bce", [] { return std::make_unique<BoundsCheckEliminationPass>(); }},
+      {"instcombine", [] { return std::make_unique<InstCombinePass>(); }},
+      {"ifconvert", [] { return std::make_unique<IfConversionPass>(); }},
+      {"simplifycfg", [] { return std::make_unique<SimplifyCFGPass>(); }},
+      {"out-of-ssa", [] { return std::make_unique<OutOfSSAPass>(); }},
+      {"parallelize", [] { return std::make_unique<ParallelizePass>(); }},
+  };
+  return passes;
+}
+
+} // namespace
+
+std::unique_ptr<FunctionPass> createPass(const std::string &name) {
+  for (const auto &r : registry())
+    if (name == r.name)
+      return r.create();
+  return nullptr;
+}
+
+std::vector<std::string> registeredPasses() {
+  std::vector<std::string> names;
+  for (const auto &r : registry())
+    names.push_back(r.name);
+  return names;
+}
+
+PassManager parsePipeline(const std::string &text) {
+  PassManager pm;
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t comma = text.find(',', start);
+    if (comma == std::string::npos)
+      comma = text.size();
+    std::string name = text.substr(start, comma - start);
+    start = comma + 1;
+    if (name.empty())
+      continue;
+    auto pass = createPass(name);
+    if (!pass)
+      throw std::runtime_error("unknown pass '" + name + "'");
+    pm.addPass(std::move(pass));
+  }
+  return pm;
+}
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,53 @@
+#include "optimix/ir/Polynomial.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+// Bound on coefficients, so that products cannot overflow.
+const int64_t kMaxCoefficient = int64_t(1) << 31;
+
+} // namespace
+
+Poly constant(int64_t c) {
+  Poly p;
+  if (c != 0)
+    p[{}] = c;
+  return p;
+}
+
+Poly symbol(const std::string &name) { return {{{name}, 1}}; }
+
+void addTo(Poly &p, const Poly &q, int64_t sign) {
+  for (const auto &[m, c] : q)
+    if ((p[m] += sign * c) == 0)
+      p.erase(m);
+}
+
+std::optional<Poly> multiply(const Poly &p, const Poly &q) {
+  Poly r;
+  for (const auto &[m1, c1] : p)
+    for (const auto &[m2, c2] : q) {
+      if (std::llabs(c1) > kMaxCoefficient || std::llabs(c2) > kMaxCoefficient)
+        return std::nullopt;
+      std::vector<std::string> m = m1;
+      m.insert(m.end(), m2.begin(), m2.end());
+      std::sort(m.begin(), m.end());
+      addTo(r, {{m, c1 * c2}}, 1);
+    }
+  return r;
+}
+
+std::optional<int64_t> constantValue(const Poly &p) {
+  if (p.empty())
+    return 0;
+  if (p.size() == 1 && p.begin()->first.empty())
+    return p.begin()->second;
+  return std::nullopt;
+}
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,270 @@
+#include "optimix/ir/Profile.h"
+#include <algorithm>
+#include <cstdio>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace optimix {
+namespace ir {
+
+const BlockCount *FunctionProfile::getBlock(const std::string &label) const {
+  for (const auto &b : blocks)
+    if (b.label == label)
+      return &b;
+  return nullptr;
+}
+
+uint64_t FunctionProfile::edgeCount(const std::string &from,
+                                    const std::string &to) const {
+  for (const auto &e : edges)
+    if (e.from == from && e.to == to)
+      return e.count;
+  return 0;
+}
+
+const FunctionProfile *Profile::getFunction(const std::string &name) const {
+  for (const auto &f : functions)
+    if (f.name == name)
+      return &f;
+  return nullptr;
+}
+
+void Profile::merge(const FunctionProfile &fp) {
+  FunctionProfile *into = nullptr;
+  for (auto &f : functions)
+    if (f.name == fp.name)
+      into = &f;
+  if (!into) {
+    functions.push_back(fp);
+    return;
+  }
+
+  for (const auto &b : fp.blocks) {
+    auto it = std::find_if(
+        into->blocks.begin(), into->blocks.end(),
+        [&](const BlockCount &x) { return x.label == b.label; });
+    if (it == into->blocks.end()) {
+      into->blocks.push_back(b);
+    } else {
+      it->count += b.count;
+      it->instructions += b.instructions;
+    }
+  }
+  for (const auto &e : fp.edges) {
+    auto it = std::find_if(into->edges.begin(), into->edges.end(),
+                           [&](const EdgeCount &x) {
+                             return x.from == e.from && x.to == e.to;
+                           });
+    if (it == into->edges.end())
+      into->edges.push_back(e);
+    else
+      it->count += e.count;
+  }
+  for (const auto &br : fp.branches) {
+    auto it = std::find_if(into->branches.begin(), into->branches.end(),
+                           [&](const BranchCount &x) {
+                             return x.block == br.block &&
+                                    x.target == br.target;
+                           });
+    if (it == into->branches.end()) {
+      into->branches.push_back(br);
+    } else {
+      it->taken += br.taken;
+      it->notTaken += br.notTaken;
+    }
+  }
+  for (const auto &l : fp.lines)
+    into->lines[l.first] += l.second;
+}
+
+void Profile::write(std::ostream &os) const {
+  os << "optimix-profile 1\n";
+  for (const auto &op : opcodes)
+    os << "opcode " << op.first << " " << op.second << "\n";
+  for (const auto &f : functions) {
+    os << "function " << f.name << "\n";
+    for (const auto &b : f.blocks)
+      os << "block " << b.label << " " << b.count << " " << b.instructions
+         << " " << b.line << "\n";
+    for (const auto &e : f.edges)
+      os << "edge " << e.from << " " << e.to << " " << e.count << "\n";
+    for (const auto &br : f.branches)
+      os << "branch " << br.block << " " << br.target << " " << br.taken << " "
+         << br.notTaken << " " << br.line << "\n";
+    for (const auto &l : f.lines)
+      os << "line " << l.first << " " << l.second << "\n";
+    os << "end\n";
+  }
+}
+
+Profile Profile::read(std::istream &is) {
+  Profile profile;
+  FunctionProfile *func = nullptr;
+  std::string text;
+  int lineNo = 0;
+  auto fail = [&lineNo](const std::string &message) {
+    throw std::runtime_error("profile line " + std::to_string(lineNo) + ": " +
+                             message);
+  };
+
+  while (std::getline(is, text)) {
+    ++lineNo;
+    std::istringstream in(text);
+    std::string kind;
+    if (!(in >> kind))
+      continue;
+
+    if (lineNo == 1) {
+      int version = 0;
+      if (kind != "optimix-profile" || !(in >> version))
+        fail("not an optimix profile");
+      if (version != 1)
+        fail("unsupported profile version " + std::to_string(version));
+      continue;
+    }
+
+    bool ok = true;
+    if (kind == "opcode") {
+      std::string name;
+      uint64_t count;
+      ok = static_cast<bool>(in >> name >> count);
+      if (ok)
+        profile.opcodes[name] += count;
+    } else if (kind == "function") {
+      FunctionProfile fp;
+      ok = static_cast<bool>(in >> fp.name);
+      profile.functions.push_back(fp);
+      func = &profile.functions.back();
+    } else if (kind == "end") {
+      func = nullptr;
+    } else if (!func) {
+      fail("'" + kind + "' outside of a function");
+    } else if (kind == "block") {
+      BlockCount b;
+      ok = static_cast<bool>(in >> b.label >> b.count >> b.instructions >>
+                             b.line);
+      func->blocks.push_back(b);
+    } else if (kind == "edge") {
+      EdgeCount e;
+      ok = static_cast<bool>(in >> e.from >> e.to >> e.count);
+      func->edges.push_back(e);
+    } else if (kind == "branch") {
+      BranchCount br;
+      ok = static_cast<bool>(in >> br.block >> br.target >> br.taken >>
+                             br.notTaken >> br.line);
+      func->branches.push_back(br);
+    } else if (kind == "line") {
+      int line;
+      uint64_t count;
+      ok = static_cast<bool>(in >> line >> count);
+      if (ok)
+        func->lines[line] += count;
+    } else {
+      fail("unknown record '" + kind + "'");
+    }
+    if (!ok)
+      fail("malformed '" + kind + "' record");
+  }
+  if (lineNo == 0)
+    throw std::runtime_error("profile is empty");
+  return profile;
+}
+
+void Profile::printReport(std::ostream &os, const std::string *source,
+                          size_t top) const {
+  std::vector<std::string> sourceLines;
+  if (source) {
+    std::istringstream in(*source);
+    std::string l;
+    while (std::getline(in, l))
+      sourceLines.push_back(l);
+  }
+  auto sourceText = [&sourceLines](int line) -> std::string {
+    if (line <= 0 || line > static_cast<int>(sourceLines.size()))
+      return "";
+    std::string text = sourceLines[line - 1];
+    size_t start = text.find_first_not_of(" \t");
+    return start == std::string::npos ? "" : text.substr(start);
+  };
+  auto percent = [](uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+  };
+
+  uint64_t total = 0;
+  for (const auto &op : opcodes)
+    total += op.second;
+  os << "=== Profile: " << total << " instructions executed ===\n";
+  char buf[200];
+
+  struct HotBlock {
+    const FunctionProfile *func;
+    const BlockCount *block;
+  };
+  std::vector<HotBlock> hot;
+  for (const auto &f : functions)
+    for (const auto &b : f.blocks)
+      if (b.count > 0)
+        hot.push_back({&f, &b});
+  std::stable_sort(hot.begin(), hot.end(),
+                   [](const HotBlock &a, const HotBlock &b) {
+                     return a.block->instructions > b.block->instructions;
+                   });
+  os << "Hot blocks:\n       entries   %insts  line  block\n";
+  for (size_t i = 0; i < hot.size() && i < top; ++i) {
+    const BlockCount &b = *hot[i].block;
+    std::snprintf(buf, sizeof(buf), "  %12llu  %6.2f%%  %4d  %s:%s\n",
+                  static_cast<unsigned long long>(b.count),
+                  percent(b.instructions, total), b.line,
+                  hot[i].func->name.c_str(), b.label.c_str());
+    os << buf;
+  }
+
+  std::vector<std::pair<int, uint64_t>> lines;
+  for (const auto &f : functions)
+    for (const auto &l : f.lines)
+      lines.push_back(l);
+  auto bySecond = [](const auto &a, const auto &b) {
+    return a.second > b.second;
+  };
+  std::stable_sort(lines.begin(), lines.end(), bySecond);
+  if (!lines.empty()) {
+    os << "Hot source lines:\n  line     instructions   %insts\n";
+    for (size_t i = 0; i < lines.size() && i < top; ++i) {
+      std::snprintf(buf, sizeof(buf), "  %4d  %15llu  %6.2f%%  ",
+                    lines[i].first,
+                    static_cast<unsigned long long>(lines[i].second),
+                    percent(lines[i].second, total));
+      os << buf << sourceText(lines[i].first) << "\n";
+    }
+  }
+
+  bool anyBranch = false;
+  for (const auto &f : functions) {
+    for (const auto &br : f.branches) {
+      if (!anyBranch)
+        os << "Branches:\n         taken    not taken  %taken  line  branch\n";
+      anyBranch = true;
+      std::snprintf(buf, sizeof(buf), "  %12llu %12llu  %6.2f%%  %4d  ",
+                    static_cast<unsigned long long>(br.taken),
+                    static_cast<unsigned long long>(br.notTaken),
+                    percent(br.taken, br.taken + br.notTaken), br.line);
+      os << buf << f.name << ":" << br.block << " -> " << br.target << "\n";
+    }
+  }
+
+  os << "Opcodes:\n";
+  std::vector<std::pair<std::string, uint64_t>> ops(opcodes.begin(),
+                                                    opcodes.end());
+  std::stable_sort(ops.begin(), ops.end(), bySecond);
+  for (const auto &op : ops) {
+    std::snprintf(buf, sizeof(buf), "  %-8s %15llu  %6.2f%%\n",
+                  op.first.c_str(), static_cast<unsigned long long>(op.second),
+                  percent(op.second, total));
+    os << buf;
+  }
+}
+
+} // namespace ir
+} // namespace optimix
@@ -0,0 +1,314 @@
+#include "optimix/ir/ProfileGuided.h"
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+int firstLine(const BasicBlock &bb) {
+  for (const auto &inst : bb.instructions)
+    if (inst.line)
+      return inst.line;
+  return 0;
+}
+
+// The function's profile, or nothing when it has none or it was recorded
+// for different code: a profiled block no longer exists or starts on another
+// source line. Blocks that passes derived from a block of this function
+// ("loop_L3_unchecked" from "loop_L3") count as that block. Blocks added by
+// earlier profile-guided passes have no counts of their own.
+std::optional<FunctionProfile> matchingProfile(const Profile &profile,
+                                               const Function &func) {
+  const FunctionProfile *recorded = profile.getFunction(func.name);
+  if (!recorded)
+    return std::nullopt;
+  std::unordered_map<std::string, int> lines;
+  for (const auto &bb : func.blocks)
+    lines[bb->label] = firstLine(*bb);
+  auto base = [&](std::string label) {
+    while (!lines.count(label)) {
+      size_t cut = label.rfind('_');
+      if (cut == std::string::npos || cut == 0)
+        return std::string();
+      label.erase(cut);
+    }
+    return label;
+  };
+
+  FunctionProfile fp;
+  fp.name = recorded->name;
+  fp.lines = recorded->lines;
+  for (const auto &b : recorded->blocks) {
+    std::string label = base(b.label);
+    if (label.empty())
+      return std::nullopt;
+    if (b.label == label && b.line && lines[label] && b.line != lines[label])
+      return std::nullopt;
+    auto it = std::find_if(
+        fp.blocks.begin(), fp.blocks.end(),
+        [&](const BlockCount &c) { return c.label == label; });
+    if (it == fp.blocks.end()) {
+      fp.blocks.push_back({label, 0, 0, lines[label]});
+      it = std::prev(fp.blocks.end());
+    }
+    it->count += b.count;
+    it->instructions += b.instructions;
+  }
+  for (const auto &e : recorded->edges) {
+    std::string from = base(e.from), to = base(e.to);
+    auto it = std::find_if(fp.edges.begin(), fp.edges.end(),
+                           [&](const EdgeCount &c) {
+                             return c.from == from && c.to == to;
+                           });
+    if (it == fp.edges.end())
+      fp.edges.push_back({from, to, e.count});
+    else
+      it->count += e.count;
+  }
+  for (const auto &br : recorded->branches) {
+    std::string block = base(br.block), target = base(br.target);
+    auto it = std::find_if(fp.branches.begin(), fp.branches.end(),
+                           [&](const BranchCount &c) {
+                             return c.block == block && c.target == target;
+                           });
+    if (it == fp.branches.end()) {
+      fp.branches.push_back({block, target, br.taken, br.notTaken, br.line});
+    } else {
+      it->taken += br.taken;
+      it->notTaken += br.notTaken;
+    }
+  }
+  return fp;
+}
+
+uint64_t blockCount(const FunctionProfile &fp, const std::string &label) {
+  const BlockCount *b = fp.getBlock(label);
+  return b ? b->count : 0;
+}
+
+bool isControl(OpCode op) {
+  return op == OpCode::JMP || op == OpCode::JMP_IF || op == OpCode::RET ||
+         op == OpCode::PHI;
+}
+
+bool endsWithTerminator(const BasicBlock &bb) {
+  return !bb.instructions.empty() &&
+         (bb.instructions.back().op == OpCode::JMP ||
+          bb.instructions.back().op == OpCode::RET);
+}
+
+// Number of jumps in 'func' that target each label.
+std::unordered_map<std::string, int> jumpsInto(const Function &func) {
+  std::unordered_map<std::string, int> uses;
+  for (const auto &bb : func.blocks)
+    for (const auto &inst : bb->instructions)
+      if (inst.op == OpCode::JMP || inst.op == OpCode::JMP_IF)
+        ++uses[inst.operands[0].value];
+  return uses;
+}
+
+} // namespace
+
+void LoopUnrollPass::run(Function &func) const {
+  auto fp = matchingProfile(profile, func);
+  if (!fp)
+    return;
+  uint64_t total = 0;
+  for (const auto &f : profile.functions)
+    for (const auto &b : f.blocks)
+      total += b.instructions;
+  if (total == 0)
+    return;
+
+  std::unordered_map<std::string, BasicBlock *> byLabel;
+  std::vector<BasicBlock *> original;
+  for (const auto &bb : func.blocks) {
+    byLabel[bb->label] = bb.get();
+    original.push_back(bb.get());
+  }
+  auto uses = jumpsInto(func);
+
+  for (BasicBlock *header : original) {
+    // Header: condition code, then "JMP_IF body, c" and "JMP exit".
+    auto &hi = header->instructions;
+    if (hi.size() < 2 || hi.back().op != OpCode::JMP ||
+        std::prev(hi.end(), 2)->op != OpCode::JMP_IF)
+      continue;
+    const Instruction &branch = *std::prev(hi.end(), 2);
+    const Instruction &exit = hi.back();
+    if (std::any_of(hi.begin(), std::prev(hi.end(), 2),
+                    [](const Instruction &i) { return isControl(i.op); }))
+      continue;
+
+    // Body: a single block, entered only from the header, that runs
+    // straight through and jumps back.
+    auto found = byLabel.find(branch.operands[0].value);
+    if (found == byLabel.end() || found->second == header ||
+        found->second == func.blocks.front().get())
+      continue;
+    BasicBlock *body = found->second;
+    auto &bi = body->instructions;
+    if (bi.empty() || bi.back().op != OpCode::JMP ||
+        bi.back().operands[0].value != header->label ||
+        uses[body->label] != 1)
+      continue;
+    if (std::any_of(bi.begin(), std::prev(bi.end()),
+                    [](const Instruction &i) { return isControl(i.op); }))
+      continue;
+
+    // Profitability from the profile: hot, and iterates often enough.
+    const BranchCount *counts = nullptr;
+    for (const auto &br : fp->branches)
+      if (br.block == header->label && br.target == body->label)
+        counts = &br;
+    if (!counts || counts->taken == 0)
+      continue;
+    const BlockCount *headerCounts = fp->getBlock(header->label);
+    const BlockCount *bodyCounts = fp->getBlock(body->label);
+    if (!headerCounts || !bodyCounts)
+      continue;
+    if (headerCounts->instructions + bodyCounts->instructions <
+        options.hotFraction * total)
+      continue;
+    uint64_t trip = counts->taken / std::max<uint64_t>(1, counts->notTaken);
+    if (trip < options.minTripCount)
+      continue;
+
+    size_t iterationSize = (hi.size() - 2) + bi.size() + 2;
+    unsigned factor = 1;
+    while (factor * 2 <= options.maxUnrollFactor && factor * 2 <= trip &&
+           iterationSize * factor * 2 <= options.maxUnrolledSize)
+      factor *= 2;
+    if (factor < 2)
+      continue;
+
+    // body:   S; cond; JMP_IF body_u1, c; JMP exit
+    // body_u1: S; cond; JMP_IF body_u2, c; JMP exit
+    // ...
+    // body_uN: S; JMP header
+    std::vector<Instruction> straight(bi.begin(), std::prev(bi.end()));
+    std::vector<Instruction> cond(hi.begin(), std::prev(hi.end(), 2));
+    Instruction backEdge = bi.back();
+
+    auto pos = std::find_if(func.blocks.begin(), func.blocks.end(),
+                            [body](const std::unique_ptr<BasicBlock> &b) {
+                              return b.get() == body;
+                            });
+    BasicBlock *copy = body;
+    copy->instructions.pop_back();
+    for (unsigned k = 1; k < factor; ++k) {
+      std::string label = body->label + "_u" + std::to_string(k);
+      for (const auto &inst : cond)
+        copy->addInst(inst);
+      Instruction next = branch;
+      next.operands[0] = Operand::makeLabel(label);
+      copy->addInst(next);
+      copy->addInst(exit);
+
+      pos = func.blocks.insert(std::next(pos),
+                               std::make_unique<BasicBlock>(label));
+      copy = pos->get();
+      for (const auto &inst : straight)
+        copy->addInst(inst);
+    }
+    copy->addInst(backEdge);
+  }
+}
+
+void BlockLayoutPass::run(Function &func) const {
+  auto fp = matchingProfile(profile, func);
+  if (!fp || func.blocks.size() < 3)
+    return;
+
+  // Make every fallthrough explicit so blocks can move freely. A last block
+  // that falls off the end of the function stays last.
+  std::vector<BasicBlock *> blocks;
+  for (const auto &bb : func.blocks)
+    blocks.push_back(bb.get());
+  for (size_t i = 0; i + 1 < blocks.size(); ++i)
+    if (!endsWithTerminator(*blocks[i]))
+      blocks[i]->addInst(Instruction::createBranch(
+          OpCode::JMP, Operand::makeLabel(blocks[i + 1]->label)));
+  BasicBlock *pinned = endsWithTerminator(*blocks.back()) ? nullptr
+                                                          : blocks.back();
+
+  std::unordered_map<std::string, BasicBlock *> byLabel;
+  for (BasicBlock *bb : blocks)
+    byLabel[bb->label] = bb;
+  std::set<BasicBlock *> placed;
+  if (pinned)
+    placed.insert(pinned);
+
+  // Greedy chains: follow the hottest edge out of the block just placed;
+  // when it leads nowhere new, restart from the hottest remaining block.
+  std::vector<BasicBlock *> order;
+  BasicBlock *cur = blocks.front();
+  while (cur) {
+    order.push_back(cur);
+    placed.insert(cur);
+
+    BasicBlock *next = nullptr;
+    uint64_t best = 0;
+    for (const auto &e : fp->edges) {
+      if (e.from != cur->label || e.count <= best)
+        continue;
+      auto it = byLabel.find(e.to);
+      if (it != byLabel.end() && !placed.count(it->second)) {
+        next = it->second;
+        best = e.count;
+      }
+    }
+    if (!next) {
+      // Blocks without counts of their own (e.g. unrolled copies) stay
+      // behind the block they were created after.
+      auto self = std::find(blocks.begin(), blocks.end(), cur);
+      if (self + 1 != blocks.end() && !placed.count(self[1]) &&
+          !fp->getBlock(self[1]->label))
+        next = self[1];
+    }
+    if (!next) {
+      // Executed blocks by heat, then never-executed ones in source order.
+      for (BasicBlock *bb : blocks) {
+        if (placed.count(bb))
+          continue;
+        uint64_t count = blockCount(*fp, bb->label);
+        if (!next || count > best) {
+          next = bb;
+          best = count;
+        }
+      }
+    }
+    cur = next;
+  }
+  if (pinned)
+    order.push_back(pinned);
+
+  // Jumps to the block that now follows become fallthroughs.
+  for (size_t i = 0; i + 1 < order.size(); ++i) {
+    auto &insts = order[i]->instructions;
+    if (!insts.empty() && insts.back().op == OpCode::JMP &&
+        insts.back().operands[0].value == order[i + 1]->label)
+      insts.pop_back();
+  }
+
+  std::unordered_map<BasicBlock *, size_t> rank;
+  for (size_t i = 0; i < order.size(); ++i)
+    rank[order[i]] = i;
+  std::vector<std::unique_ptr<BasicBlock>> sorted(order.size());
+  for (auto &bb : func.blocks) {
+    size_t r = rank[bb.get()];
+    sorted[r] = std::move(bb);
+  }
+  func.blocks.clear();
+  for (auto &bb : sorted)
+    func.blocks.push_back(std::move(bb));
+}
+
+} // namespace ir
+} // namespace optimix
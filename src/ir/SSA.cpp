@@ -1,108 +1,155 @@
 #include "optimix/ir/SSA.h"
-#include <iostream>
+#include "optimix/ir/Dominators.h"
+#include "optimix/support/Diagnostics.h"
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace optimix {
 namespace ir {
 
-void SSAPass::run(Function &func) {
-  std::cout << "Running SSA Pass on " << func.name << "...\n";
-  // 1. Compute CFG Predecessors (already done dynamically?)
-  for (auto &bb : func.blocks) {
-    bb->preds.clear();
-    bb->succs.clear();
-  }
-  // Rebuild CFG edges naive (O(N^2) but fine for mini compiler)
-  for (auto &bb : func.blocks) {
-    for (auto &inst : bb->instructions) {
-      if (inst.op == OpCode::JMP || inst.op == OpCode::JMP_IF) {
-        // Find target
-        std::string targetLabel = inst.operands[0].value;
-        for (auto &potentialSucc : func.blocks) {
-          if (potentialSucc->label == targetLabel) {
-            bb->succs.push_back(potentialSucc.get());
-            potentialSucc->preds.push_back(bb.get());
-          }
-        }
-      }
-    }
-  }
-
-  // 2. Insert Phi Nodes (Simplified: Insert Phi for all vars at all merge
-  // points) In a real compiler we use Dominance Frontiers.
-  std::set<std::string> globals;
-  // Find vars defined in multiple blocks...
-  // For this demo, we'll assume 'a', 'b', 'i', 'temp' need Phis at loop headers
+namespace {
 
-  for (auto &bb : func.blocks) {
-    if (bb->preds.size() > 1) {
-      // Merge point (e.g., loop header)
-      // Insert dummy Phi for likely variables
-      // Heuristic: if it's a loop header, insert Phis for live-ins
-      // This is a placeholder for the complex algorithm
-      // For the demo output, we will simulate the effect of Phi insertion
-
-      // std::cout << "Detected Merge Point: " << bb->label << "\n";
-    }
-  }
-
-  // 3. Rename Variables (The most visual part of SSA)
-  // We will traverse and version the variables
-
-  // Reset counters
-  counter.clear();
-  stack.clear();
-  visited.clear();
-
-  if (!func.blocks.empty()) {
-    renameVariables(func, func.blocks.front().get());
+// Operands that read a scalar variable.
+template <typename Fn> void forEachUse(Instruction &inst, Fn fn) {
+  for (size_t i = 0; i < inst.operands.size(); ++i) {
+    Operand &op = inst.operands[i];
+    if (op.type == Operand::VARIABLE && !isArrayOperand(inst.op, i))
+      fn(op);
   }
 }
 
-std::string SSAPass::newName(std::string name) {
-  int i = counter[name];
-  stack[name].push_back(i);
-  counter[name] += 1;
-  return name + "_" + std::to_string(i);
+bool definesVariable(const Instruction &inst) {
+  return hasResult(inst.op) && inst.result.type == Operand::VARIABLE;
 }
 
-void SSAPass::renameVariables(Function &func, BasicBlock *bb) {
-  // 1. Rename Phi node LHS (not implemented fully in this basic pass)
+} // namespace
 
-  // 2. Rename instructions
-  for (auto &inst : bb->instructions) {
-    // Rename uses (RHS)
-    for (auto &op : inst.operands) {
-      if (op.type == Operand::VARIABLE) {
-        if (!stack[op.value].empty()) {
-          op.version = stack[op.value].back(); // Use current version
-        }
+void discardSSA(Function &func) {
+  for (auto &bb : func.blocks) {
+    auto &insts = bb->instructions;
+    for (auto it = insts.begin(); it != insts.end();) {
+      if (it->op == OpCode::PHI) {
+        it = insts.erase(it);
+        continue;
       }
+      it->result.version = 0;
+      for (auto &op : it->operands)
+        op.version = 0;
+      ++it;
     }
+  }
+}
 
-    // Rename defs (LHS)
-    if (inst.op == OpCode::MOV || inst.op == OpCode::ADD ||
-        inst.op == OpCode::LT) {
-      // If it writes to a variable
-      if (inst.result.type == Operand::VARIABLE) {
-        int i = counter[inst.result.value]++;
-        inst.result.version = i;
-        stack[inst.result.value].push_back(i);
+void SSAPass::run(Function &func) const {
+  discardSSA(func);
+  DominatorTree domTree(func);
+  const auto &order = domTree.reversePostOrder();
+
+  // Variables read before being written in some block are the only ones
+  // that can need a PHI.
+  std::set<std::string> liveIn;
+  std::map<std::string, std::vector<BasicBlock *>> defBlocks;
+  for (BasicBlock *bb : order) {
+    std::set<std::string> defined;
+    for (auto &inst : bb->instructions) {
+      forEachUse(inst, [&](Operand &op) {
+        if (!defined.count(op.value))
+          liveIn.insert(op.value);
+      });
+      if (definesVariable(inst)) {
+        defined.insert(inst.result.value);
+        auto &blocks = defBlocks[inst.result.value];
+        if (blocks.empty() || blocks.back() != bb)
+          blocks.push_back(bb);
       }
     }
   }
 
-  // 3. Rename Phi node RHS in successors
-
-  // 4. Recurse to children
-  // Simplified: Use a visited set to traverse CFG (approximating DomTree
-  // traversal) The visited set is now a member of SSAPass and cleared in run()
-
-  visited.insert(bb);
+  // PHIs on the iterated dominance frontier of each variable's definitions.
+  // Operands start as (var, pred) pairs and get their versions during
+  // renaming.
+  int phis = 0;
+  for (const auto &var : liveIn) {
+    auto defs = defBlocks.find(var);
+    if (defs == defBlocks.end())
+      continue;
+    std::set<BasicBlock *> placed;
+    std::vector<BasicBlock *> work = defs->second;
+    while (!work.empty()) {
+      BasicBlock *bb = work.back();
+      work.pop_back();
+      for (BasicBlock *join : domTree.frontier(bb)) {
+        if (!placed.insert(join).second)
+          continue;
+        Instruction phi(OpCode::PHI, Operand::makeVar(var));
+        for (BasicBlock *pred : join->preds) {
+          phi.operands.push_back(Operand::makeVar(var));
+          phi.operands.push_back(Operand::makeLabel(pred->label));
+        }
+        if (!join->instructions.empty())
+          phi.line = join->instructions.front().line;
+        join->instructions.push_front(phi);
+        ++phis;
+        work.push_back(join);
+      }
+    }
+  }
+  OPTIMIX_LOG(DEBUG, "ssa: " + func.name + ": " + std::to_string(phis) +
+                         " phis");
+
+  // Rename along the dominator tree: each definition pushes a new version,
+  // uses take the innermost one, and leaving a block pops what it pushed.
+  std::unordered_map<std::string, int> counter;
+  std::unordered_map<std::string, std::vector<int>> stack;
+  auto current = [&stack](const std::string &var) {
+    auto it = stack.find(var);
+    return it == stack.end() || it->second.empty() ? 0 : it->second.back();
+  };
+
+  struct Visit {
+    BasicBlock *bb;
+    bool leaving;
+  };
+  std::vector<Visit> work = {{order.empty() ? nullptr : order.front(), false}};
+  std::unordered_map<BasicBlock *, std::vector<std::string>> pushed;
+  while (!order.empty() && !work.empty()) {
+    Visit visit = work.back();
+    work.pop_back();
+    BasicBlock *bb = visit.bb;
+    if (visit.leaving) {
+      for (const auto &var : pushed[bb])
+        stack[var].pop_back();
+      pushed.erase(bb);
+      continue;
+    }
 
-  for (auto *succ : bb->succs) {
-    if (visited.find(succ) == visited.end()) {
-      renameVariables(func, succ);
+    auto &defs = pushed[bb];
+    for (auto &inst : bb->instructions) {
+      if (inst.op != OpCode::PHI)
+        forEachUse(inst, [&](Operand &op) { op.version = current(op.value); });
+      if (definesVariable(inst)) {
+        int version = ++counter[inst.result.value];
+        inst.result.version = version;
+        stack[inst.result.value].push_back(version);
+        defs.push_back(inst.result.value);
+      }
+    }
+    for (BasicBlock *succ : bb->succs) {
+      for (auto &inst : succ->instructions) {
+        if (inst.op != OpCode::PHI)
+          break;
+        for (size_t i = 0; i + 1 < inst.operands.size(); i += 2)
+          if (inst.operands[i + 1].value == bb->label)
+            inst.operands[i].version = current(inst.operands[i].value);
+      }
     }
+
+    work.push_back({bb, true});
+    const auto &kids = domTree.children(bb);
+    for (auto it = kids.rbegin(); it != kids.rend(); ++it)
+      work.push_back({*it, false});
   }
 }
 
@@ -0,0 +1,247 @@
+#include "optimix/ir/ScalarReplacement.h"
+#include "optimix/ir/Dominators.h"
+#include "optimix/ir/SSA.h"
+#include "optimix/support/Diagnostics.h"
+#include <list>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+struct Candidate {
+  int size = -1;
+  bool promotable = true;
+  std::vector<std::pair<const BasicBlock *, const Instruction *>> allocas;
+  int work = 0; // ALLOCAs and accesses
+};
+
+bool isAccess(OpCode op) {
+  return op == OpCode::LOAD || op == OpCode::LOAD_UNCHECKED ||
+         op == OpCode::STORE || op == OpCode::STORE_UNCHECKED;
+}
+
+Operand element(const std::string &array, int index) {
+  return Operand::makeVar("%" + array + "[" + std::to_string(index) + "]");
+}
+
+// The array an element variable belongs to, empty for other operands.
+std::string arrayOf(const Operand &op) {
+  const std::string &name = op.value;
+  if (op.type != Operand::VARIABLE || name.size() < 4 || name[0] != '%' ||
+      name.back() != ']')
+    return "";
+  return name.substr(1, name.rfind('[') - 1);
+}
+
+std::string versioned(const Operand &op) {
+  return op.value + "." + std::to_string(op.version);
+}
+
+bool definesElement(const Instruction &inst) {
+  return (inst.op == OpCode::MOV || inst.op == OpCode::PHI) &&
+         !arrayOf(inst.result).empty();
+}
+
+// Removes the element MOVs and PHIs whose values nothing reads: the zeroing
+// of elements that are written before they are read, and stores that are
+// never loaded. Needs SSA form.
+void removeDeadElements(Function &func) {
+  std::unordered_map<std::string, const Instruction *> defs;
+  std::vector<std::string> work;
+  for (const auto &bb : func.blocks)
+    for (const auto &inst : bb->instructions) {
+      if (definesElement(inst)) {
+        defs[versioned(inst.result)] = &inst;
+        continue;
+      }
+      for (const auto &op : inst.operands)
+        if (!arrayOf(op).empty())
+          work.push_back(versioned(op));
+    }
+  std::unordered_set<std::string> live;
+  while (!work.empty()) {
+    std::string value = work.back();
+    work.pop_back();
+    if (!live.insert(value).second)
+      continue;
+    auto it = defs.find(value);
+    if (it == defs.end())
+      continue;
+    for (const auto &op : it->second->operands)
+      if (!arrayOf(op).empty())
+        work.push_back(versioned(op));
+  }
+  for (auto &bb : func.blocks)
+    bb->instructions.remove_if([&](const Instruction &inst) {
+      return definesElement(inst) && !live.count(versioned(inst.result));
+    });
+}
+
+using Snapshot = std::vector<std::pair<std::string, std::list<Instruction>>>;
+
+// Promotes the arrays that qualify, other than 'excluded', and returns those
+// whose elements take more instructions than the ALLOCAs and accesses they
+// replaced. Before changing anything, saves the function to 'saved'.
+std::set<std::string> promote(Function &func,
+                              const std::set<std::string> &excluded,
+                              Snapshot &saved) {
+  DominatorTree domTree(func);
+
+  std::unordered_map<std::string, const Instruction *> defs;
+  for (const auto &bb : func.blocks)
+    for (const auto &inst : bb->instructions)
+      if (hasResult(inst.op) && inst.result.version > 0)
+        defs[versioned(inst.result)] = &inst;
+  // The constant an operand holds, looking through MOVs.
+  auto constantOf = [&](Operand op) -> std::optional<int> {
+    for (int hops = 0; hops < 8; ++hops) {
+      if (op.type == Operand::CONSTANT)
+        return std::stoi(op.value);
+      if (op.type != Operand::VARIABLE || op.version == 0)
+        return std::nullopt;
+      auto it = defs.find(versioned(op));
+      if (it == defs.end() || it->second->op != OpCode::MOV)
+        return std::nullopt;
+      op = it->second->operands[0];
+    }
+    return std::nullopt;
+  };
+
+  std::map<std::string, Candidate> arrays;
+  for (const auto &bb : func.blocks)
+    for (const auto &inst : bb->instructions) {
+      if (inst.op != OpCode::ALLOCA)
+        continue;
+      Candidate &c = arrays[inst.operands[0].value];
+      auto size = constantOf(inst.operands[1]);
+      if (!size || *size < 0 ||
+          *size > ScalarReplacementPass::kMaxElements ||
+          (c.size >= 0 && c.size != *size) ||
+          excluded.count(inst.operands[0].value))
+        c.promotable = false;
+      else
+        c.size = *size;
+      c.allocas.push_back({bb.get(), &inst});
+      ++c.work;
+    }
+
+  // Every access needs a constant index in range, and an ALLOCA before it
+  // (otherwise it faults, or reads an array handed in from outside).
+  std::unordered_map<const Instruction *, int> indices;
+  for (const auto &bb : func.blocks) {
+    bool reachable = domTree.isReachable(bb.get());
+    for (const auto &inst : bb->instructions) {
+      if (inst.operands.empty() || !isArrayOperand(inst.op, 0))
+        continue;
+      Candidate &c = arrays[inst.operands[0].value];
+      if (inst.op == OpCode::ALLOCA)
+        continue;
+      ++c.work;
+      int index = -1;
+      if (isAccess(inst.op))
+        index = constantOf(inst.operands[1]).value_or(-1);
+      bool allocated = !reachable;
+      for (const auto &a : c.allocas)
+        allocated = allocated ||
+                    domTree.dominates(a.first, a.second, bb.get(), &inst);
+      if (index < 0 || index >= c.size || !allocated)
+        c.promotable = false;
+      else
+        indices[&inst] = index;
+    }
+  }
+
+  int promoted = 0;
+  for (const auto &c : arrays)
+    promoted += c.second.promotable;
+  OPTIMIX_LOG(DEBUG, "sroa: " + func.name + ": " + std::to_string(promoted) +
+                         " arrays promoted");
+  if (!promoted)
+    return {};
+
+  saved.clear();
+  for (const auto &bb : func.blocks)
+    saved.push_back({bb->label, bb->instructions});
+  for (auto &bb : func.blocks) {
+    auto &insts = bb->instructions;
+    for (auto it = insts.begin(); it != insts.end();) {
+      if (it->operands.empty() || !isArrayOperand(it->op, 0) ||
+          !arrays[it->operands[0].value].promotable) {
+        ++it;
+        continue;
+      }
+      const std::string array = it->operands[0].value;
+      int line = it->line;
+      if (it->op == OpCode::ALLOCA) {
+        // Arrays start out zeroed.
+        for (int i = 0; i < arrays[array].size; ++i) {
+          Instruction zero(OpCode::MOV, element(array, i),
+                           Operand::makeConst(0));
+          zero.line = line;
+          insts.insert(it, zero);
+        }
+        it = insts.erase(it);
+        continue;
+      }
+      Operand slot = element(array, indices[&*it]);
+      if (it->op == OpCode::LOAD || it->op == OpCode::LOAD_UNCHECKED)
+        *it = Instruction(OpCode::MOV, it->result, slot);
+      else
+        *it = Instruction(OpCode::MOV, slot, it->operands[2]);
+      it->line = line;
+      ++it;
+    }
+  }
+  SSAPass().run(func);
+  removeDeadElements(func);
+
+  // What is left of each array: the MOVs into its elements, and whatever
+  // reads them other than a MOV (a LOAD turned MOV is folded into its use
+  // later on).
+  std::map<std::string, int> work;
+  for (const auto &bb : func.blocks)
+    for (const auto &inst : bb->instructions) {
+      if (inst.op == OpCode::PHI)
+        continue;
+      if (hasResult(inst.op) && !arrayOf(inst.result).empty()) {
+        ++work[arrayOf(inst.result)];
+        continue;
+      }
+      if (inst.op == OpCode::MOV)
+        continue;
+      for (const auto &op : inst.operands)
+        if (!arrayOf(op).empty())
+          ++work[arrayOf(op)];
+    }
+  std::set<std::string> costly;
+  for (const auto &c : arrays)
+    if (c.second.promotable && work[c.first] > c.second.work)
+      costly.insert(c.first);
+  return costly;
+}
+
+} // namespace
+
+void ScalarReplacementPass::run(Function &func) const {
+  if (func.blocks.empty())
+    return;
+  Snapshot saved;
+  std::set<std::string> costly = promote(func, {}, saved);
+  if (costly.empty())
+    return;
+  // Start over from the saved function without those arrays.
+  func.blocks.clear();
+  for (auto &block : saved)
+    func.createBlock(block.first)->instructions = std::move(block.second);
+  promote(func, costly, saved);
+}
+
+} // namespace ir
+} // namespace optimix
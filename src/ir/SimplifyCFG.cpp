@@ -0,0 +1,531 @@
+#include "optimix/ir/SimplifyCFG.h"
+#include "optimix/ir/Dominators.h"
+#include "optimix/ir/LoopInfo.h"
+#include "optimix/support/Diagnostics.h"
+#include <algorithm>
+#include <optional>
+#include <set>
+#include <unordered_map>
+
+namespace optimix {
+namespace ir {
+
+namespace {
+
+// Threading can in principle bounce an edge between two blocks; everything
+// else shrinks the CFG, so this is only a safety net.
+constexpr int kMaxRounds = 64;
+
+bool endsWithTerminator(const BasicBlock &bb) {
+  return !bb.instructions.empty() && isTerminator(bb.instructions.back().op);
+}
+
+bool isJump(OpCode op) { return op == OpCode::JMP || op == OpCode::JMP_IF; }
+
+bool hasPhis(const BasicBlock &bb) {
+  return !bb.instructions.empty() &&
+         bb.instructions.front().op == OpCode::PHI;
+}
+
+bool sameValue(const Operand &a, const Operand &b) {
+  return a.type == b.type && a.value == b.value && a.version == b.version;
+}
+
+std::string keyOf(const Operand &v) {
+  return v.value + "." + std::to_string(v.version);
+}
+
+void removeIncoming(Instruction &phi, const std::string &label) {
+  auto &ops = phi.operands;
+  for (size_t i = 0; i + 1 < ops.size();) {
+    if (ops[i + 1].value == label)
+      ops.erase(ops.begin() + i, ops.begin() + i + 2);
+    else
+      i += 2;
+  }
+}
+
+void removeIncoming(BasicBlock &bb, const std::string &label) {
+  for (auto &inst : bb.instructions) {
+    if (inst.op != OpCode::PHI)
+      break;
+    removeIncoming(inst, label);
+  }
+}
+
+void renameIncoming(BasicBlock &bb, const std::string &from,
+                    const std::string &to) {
+  for (auto &inst : bb.instructions) {
+    if (inst.op != OpCode::PHI)
+      break;
+    for (size_t i = 1; i < inst.operands.size(); i += 2)
+      if (inst.operands[i].value == from)
+        inst.operands[i].value = to;
+  }
+}
+
+void retarget(BasicBlock &bb, const std::string &from, const std::string &to) {
+  for (auto &inst : bb.instructions)
+    if (isJump(inst.op) && inst.operands[0].value == from)
+      inst.operands[0].value = to;
+}
+
+bool jumpsTo(const BasicBlock &bb, const std::string &label) {
+  for (const auto &inst : bb.instructions)
+    if (isJump(inst.op) && inst.operands[0].value == label)
+      return true;
+  return false;
+}
+
+class Simplifier {
+public:
+  explicit Simplifier(Function &func) : func(func) {}
+
+  void run(bool reorder) {
+    if (func.blocks.empty())
+      return;
+    normalize();
+    bool changed = true;
+    for (int round = 0; changed && round < kMaxRounds; ++round) {
+      index();
+      changed = foldBranches();
+      changed = removeUnreachable() || changed;
+      changed = forwardJumps() || changed;
+      changed = removeUnreachable() || changed;
+      changed = threadJumps() || changed;
+      changed = removeUnreachable() || changed;
+      while (mergeBlocks())
+        changed = true;
+    }
+    if (reorder)
+      layout();
+    dropFallthroughJumps();
+    OPTIMIX_LOG(DEBUG, "simplifycfg: " + func.name + ": " +
+                           std::to_string(folded) + " branches folded, " +
+                           std::to_string(forwarded) + " jumps forwarded, " +
+                           std::to_string(threaded) + " threaded, " +
+                           std::to_string(merged) + " merged, " +
+                           std::to_string(removed) + " removed");
+  }
+
+private:
+  Function &func;
+  std::unordered_map<std::string, BasicBlock *> byLabel;
+  std::unordered_map<std::string, Operand> movs; // SSA value -> MOV source
+  int folded = 0, forwarded = 0, threaded = 0, merged = 0, removed = 0;
+
+  void index() {
+    byLabel.clear();
+    movs.clear();
+    std::set<std::string> defined;
+    for (auto &bb : func.blocks) {
+      byLabel[bb->label] = bb.get();
+      for (const auto &inst : bb->instructions) {
+        if (!hasResult(inst.op) || inst.result.type != Operand::VARIABLE ||
+            inst.result.version == 0)
+          continue;
+        std::string key = keyOf(inst.result);
+        if (!defined.insert(key).second)
+          movs.erase(key);
+        else if (inst.op == OpCode::MOV)
+          movs[key] = inst.operands[0];
+      }
+    }
+  }
+
+  BasicBlock *block(const std::string &label) const {
+    auto it = byLabel.find(label);
+    return it == byLabel.end() ? nullptr : it->second;
+  }
+
+  std::optional<int> constantOf(Operand op) const {
+    for (int hops = 0; hops < 8; ++hops) {
+      if (op.type == Operand::CONSTANT)
+        return std::stoi(op.value);
+      if (op.type != Operand::VARIABLE || op.version == 0)
+        return std::nullopt;
+      auto it = movs.find(keyOf(op));
+      if (it == movs.end())
+        return std::nullopt;
+      op = it->second;
+    }
+    return std::nullopt;
+  }
+
+  std::vector<BasicBlock *> successors(const BasicBlock &bb) const {
+    std::vector<BasicBlock *> out;
+    for (const auto &inst : bb.instructions) {
+      if (!isJump(inst.op))
+        continue;
+      BasicBlock *target = block(inst.operands[0].value);
+      if (target && std::find(out.begin(), out.end(), target) == out.end())
+        out.push_back(target);
+    }
+    return out;
+  }
+
+  std::vector<BasicBlock *> predecessors(const BasicBlock &bb) const {
+    std::vector<BasicBlock *> out;
+    for (const auto &p : func.blocks)
+      if (jumpsTo(*p, bb.label))
+        out.push_back(p.get());
+    return out;
+  }
+
+  // Cuts what follows a terminator and spells out every fallthrough except
+  // the last block's, which leaves the function.
+  void normalize() {
+    for (auto it = func.blocks.begin(); it != func.blocks.end(); ++it) {
+      auto &insts = (*it)->instructions;
+      auto term = std::find_if(insts.begin(), insts.end(),
+                               [](const Instruction &inst) {
+                                 return isTerminator(inst.op);
+                               });
+      if (term != insts.end()) {
+        insts.erase(std::next(term), insts.end());
+      } else if (std::next(it) != func.blocks.end()) {
+        Instruction jump = Instruction::createBranch(
+            OpCode::JMP, Operand::makeLabel((*std::next(it))->label));
+        jump.line = insts.empty() ? 0 : insts.back().line;
+        insts.push_back(jump);
+      }
+    }
+  }
+
+  bool foldBranches() {
+    bool changed = false;
+    for (auto &bb : func.blocks) {
+      auto &insts = bb->instructions;
+      auto before = successors(*bb);
+      bool edited = false;
+      for (auto it = insts.begin(); it != insts.end();) {
+        if (it->op != OpCode::JMP_IF) {
+          ++it;
+          continue;
+        }
+        auto next = std::next(it);
+        bool sameTarget = next != insts.end() && next->op == OpCode::JMP &&
+                          next->operands[0].value == it->operands[0].value;
+        auto cond = constantOf(it->operands[1]);
+        if (sameTarget || (cond && *cond)) {
+          Instruction jump =
+              Instruction::createBranch(OpCode::JMP, it->operands[0]);
+          jump.line = it->line;
+          *it = jump;
+          insts.erase(next, insts.end());
+          edited = true;
+          break;
+        }
+        if (cond) {
+          it = insts.erase(it);
+          edited = true;
+          continue;
+        }
+        ++it;
+      }
+      if (!edited)
+        continue;
+      ++folded;
+      changed = true;
+      auto after = successors(*bb);
+      for (BasicBlock *s : before)
+        if (std::find(after.begin(), after.end(), s) == after.end())
+          removeIncoming(*s, bb->label);
+    }
+    return changed;
+  }
+
+  bool removeUnreachable() {
+    std::set<BasicBlock *> seen = {func.blocks.front().get()};
+    std::vector<BasicBlock *> work = {func.blocks.front().get()};
+    while (!work.empty()) {
+      BasicBlock *bb = work.back();
+      work.pop_back();
+      for (BasicBlock *s : successors(*bb))
+        if (seen.insert(s).second)
+          work.push_back(s);
+    }
+    if (seen.size() == func.blocks.size())
+      return false;
+    for (auto &bb : func.blocks)
+      if (!seen.count(bb.get()))
+        for (BasicBlock *s : successors(*bb))
+          removeIncoming(*s, bb->label);
+    removed += func.blocks.size() - seen.size();
+    func.blocks.remove_if([&](const std::unique_ptr<BasicBlock> &bb) {
+      return !seen.count(bb.get());
+    });
+    index();
+    return true;
+  }
+
+  // Predecessors of a block that only jumps on go straight to its target.
+  // Where the target has PHIs, its entries for the block are repeated for
+  // each predecessor, which needs every predecessor to be new to it.
+  bool forwardJumps() {
+    bool changed = false;
+    for (auto it = std::next(func.blocks.begin()); it != func.blocks.end();
+         ++it) {
+      BasicBlock &bb = **it;
+      if (bb.instructions.size() != 1 ||
+          bb.instructions.front().op != OpCode::JMP)
+        continue;
+      BasicBlock *target = block(bb.instructions.front().operands[0].value);
+      auto preds = predecessors(bb);
+      if (!target || target == &bb || preds.empty())
+        continue;
+      bool phis = hasPhis(*target);
+      if (phis && std::any_of(preds.begin(), preds.end(), [&](BasicBlock *p) {
+            return jumpsTo(*p, target->label);
+          }))
+        continue;
+      for (BasicBlock *p : preds)
+        retarget(*p, bb.label, target->label);
+      for (auto &phi : target->instructions) {
+        if (phi.op != OpCode::PHI)
+          break;
+        const Operand *value = phi.incoming(bb.label);
+        if (!value)
+          continue;
+        Operand v = *value;
+        removeIncoming(phi, bb.label);
+        for (BasicBlock *p : preds) {
+          phi.operands.push_back(v);
+          phi.operands.push_back(Operand::makeLabel(p->label));
+        }
+      }
+      ++forwarded;
+      changed = true;
+    }
+    return changed;
+  }
+
+  // Whether every use of the PHIs of 'bb' is its own branch or an entry
+  // for 'bb' in a successor's PHI, which threading can rewrite.
+  bool phisUsedOnlyLocally(const BasicBlock &bb) const {
+    std::set<std::string> results;
+    for (const auto &inst : bb.instructions) {
+      if (inst.op != OpCode::PHI)
+        break;
+      results.insert(keyOf(inst.result));
+    }
+    for (const auto &other : func.blocks)
+      for (const auto &inst : other->instructions) {
+        if (other.get() == &bb && inst.op == OpCode::JMP_IF)
+          continue;
+        for (size_t i = 0; i < inst.operands.size(); ++i) {
+          const Operand &op = inst.operands[i];
+          if (op.type != Operand::VARIABLE || !results.count(keyOf(op)))
+            continue;
+          bool phiEntry = inst.op == OpCode::PHI && i % 2 == 0 &&
+                          inst.operands[i + 1].value == bb.label;
+          if (!phiEntry || other.get() == &bb)
+            return false;
+        }
+      }
+    return true;
+  }
+
+  // A block that is PHIs plus "JMP_IF l, c; JMP m" with c one of its PHIs:
+  // a predecessor for which c is a constant can jump to l or m directly.
+  bool threadJumps() {
+    bool changed = false;
+    for (auto &owner : func.blocks) {
+      BasicBlock &bb = *owner;
+      auto &insts = bb.instructions;
+      auto branch = std::find_if(insts.begin(), insts.end(),
+                                 [](const Instruction &inst) {
+                                   return inst.op != OpCode::PHI;
+                                 });
+      if (branch == insts.begin() || branch == insts.end() ||
+          branch->op != OpCode::JMP_IF || std::next(branch) == insts.end() ||
+          std::next(branch)->op != OpCode::JMP ||
+          std::next(branch, 2) != insts.end())
+        continue;
+      const Operand &cond = branch->operands[1];
+      const Instruction *condPhi = nullptr;
+      for (auto it = insts.begin(); it != branch; ++it)
+        if (sameValue(it->result, cond))
+          condPhi = &*it;
+      if (!condPhi || !phisUsedOnlyLocally(bb))
+        continue;
+      std::string taken = branch->operands[0].value;
+      std::string notTaken = std::next(branch)->operands[0].value;
+
+      for (BasicBlock *pred : predecessors(bb)) {
+        if (pred == &bb)
+          continue;
+        const Operand *value = condPhi->incoming(pred->label);
+        auto known = value ? constantOf(*value) : std::nullopt;
+        if (!known)
+          continue;
+        BasicBlock *target = block(*known ? taken : notTaken);
+        if (!target || target == &bb ||
+            (hasPhis(*target) && jumpsTo(*pred, target->label)))
+          continue;
+        // The target's entries for 'bb' become entries for 'pred', with
+        // the PHIs of 'bb' resolved to what 'pred' passes in.
+        for (auto &phi : target->instructions) {
+          if (phi.op != OpCode::PHI)
+            break;
+          const Operand *v = phi.incoming(bb.label);
+          if (!v)
+            continue;
+          Operand passed = *v;
+          for (auto it = insts.begin(); it != branch; ++it)
+            if (sameValue(it->result, passed)) {
+              const Operand *in = it->incoming(pred->label);
+              if (in)
+                passed = *in;
+            }
+          phi.operands.push_back(passed);
+          phi.operands.push_back(Operand::makeLabel(pred->label));
+        }
+        retarget(*pred, bb.label, target->label);
+        removeIncoming(bb, pred->label);
+        ++threaded;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Merges one block into its only predecessor; false if there is none.
+  bool mergeBlocks() {
+    for (auto it = func.blocks.begin(); it != func.blocks.end(); ++it) {
+      BasicBlock &bb = **it;
+      auto &insts = bb.instructions;
+      if (insts.empty() || insts.back().op != OpCode::JMP ||
+          std::count_if(insts.begin(), insts.end(), [](const Instruction &i) {
+            return isJump(i.op);
+          }) != 1)
+        continue;
+      BasicBlock *succ = block(insts.back().operands[0].value);
+      if (!succ || succ == &bb || succ == func.blocks.front().get())
+        continue;
+      auto preds = predecessors(*succ);
+      if (preds.size() != 1)
+        continue;
+      // A block that falls off the end of the function must stay last.
+      auto next = std::next(it);
+      if (!endsWithTerminator(*succ) &&
+          (next == func.blocks.end() || next->get() != succ))
+        continue;
+
+      insts.pop_back();
+      for (auto &inst : succ->instructions) {
+        if (inst.op != OpCode::PHI) {
+          insts.push_back(inst);
+          continue;
+        }
+        const Operand *value = inst.incoming(bb.label);
+        if (!value)
+          continue;
+        if (value->type == Operand::VARIABLE &&
+            value->value == inst.result.value) {
+          // Another version of the same variable: the engine gives both
+          // one register, so renaming the uses is exact.
+          rename(inst.result, *value);
+        } else {
+          Instruction mov(OpCode::MOV, inst.result, *value);
+          mov.line = inst.line;
+          insts.push_back(mov);
+        }
+      }
+      for (BasicBlock *s : successors(*succ))
+        renameIncoming(*s, succ->label, bb.label);
+      func.blocks.erase(std::find_if(
+          func.blocks.begin(), func.blocks.end(),
+          [&](const std::unique_ptr<BasicBlock> &b) {
+            return b.get() == succ;
+          }));
+      index();
+      ++merged;
+      return true;
+    }
+    return false;
+  }
+
+  void rename(const Operand &from, const Operand &to) {
+    for (auto &bb : func.blocks)
+      for (auto &inst : bb->instructions)
+        for (auto &op : inst.operands)
+          if (sameValue(op, from))
+            op = to;
+  }
+
+  // Greedy chains from the entry: each block is followed by its likely
+  // successor if that is still free, else by the first free block in the
+  // current order. A successor in the block's own loop is likely (loop
+  // branches are mostly taken); otherwise the JMP target is.
+  void layout() {
+    if (func.blocks.size() < 3)
+      return;
+    DominatorTree domTree(func);
+    LoopInfo loops(domTree);
+    std::vector<BasicBlock *> blocks;
+    for (const auto &bb : func.blocks)
+      blocks.push_back(bb.get());
+    BasicBlock *pinned = endsWithTerminator(*blocks.back()) ? nullptr
+                                                            : blocks.back();
+    std::set<BasicBlock *> placed;
+    if (pinned)
+      placed.insert(pinned);
+
+    std::vector<BasicBlock *> order;
+    BasicBlock *cur = blocks.front();
+    while (cur) {
+      order.push_back(cur);
+      placed.insert(cur);
+      auto succs = successors(*cur);
+      std::reverse(succs.begin(), succs.end()); // JMP target first
+      Loop *loop = loops.loopFor(cur);
+      std::stable_partition(succs.begin(), succs.end(), [&](BasicBlock *s) {
+        return loop && loop->contains(s);
+      });
+      cur = nullptr;
+      for (BasicBlock *s : succs)
+        if (!placed.count(s)) {
+          cur = s;
+          break;
+        }
+      if (!cur)
+        for (BasicBlock *bb : blocks)
+          if (!placed.count(bb)) {
+            cur = bb;
+            break;
+          }
+    }
+    if (pinned)
+      order.push_back(pinned);
+
+    std::unordered_map<BasicBlock *, size_t> rank;
+    for (size_t i = 0; i < order.size(); ++i)
+      rank[order[i]] = i;
+    std::vector<std::unique_ptr<BasicBlock>> sorted(order.size());
+    for (auto &bb : func.blocks)
+      sorted[rank[bb.get()]] = std::move(bb);
+    func.blocks.clear();
+    for (auto &bb : sorted)
+      func.blocks.push_back(std::move(bb));
+  }
+
+  void dropFallthroughJumps() {
+    for (auto it = func.blocks.begin(); std::next(it) != func.blocks.end();
+         ++it) {
+      auto &insts = (*it)->instructions;
+      if (!insts.empty() && insts.back().op == OpCode::JMP &&
+          insts.back().operands[0].value == (*std::next(it))->label)
+        insts.pop_back();
+    }
+  }
+};
+
+} // namespace
+
+void SimplifyCFGPass::run(Function &func) const {
+  Simplifier(func).run(reorder);
+}
+
+} // namespace ir
+} // namespace optimix
@@ -1,91 +1,671 @@
 #include "optimix/codegen/IRInterpreter.h"
+#include "optimix/codegen/Interpreter.h"
 #include "optimix/common.h"
+#include "optimix/driver/CompilationCache.h"
+#include "optimix/driver/Pipeline.h"
+#include "optimix/ir/BinaryIR.h"
+#include "optimix/ir/Evaluate.h"
 #include "optimix/ir/IRBuilder.h"
-#include "optimix/ir/SSA.h"
+#include "optimix/ir/IRParser.h"
+#include "optimix/ir/PassRegistry.h"
+#include "optimix/ir/Profile.h"
 #include "optimix/lexer/Lexer.h"
 #include "optimix/parser/Parser.h"
+#include "optimix/support/AllocationHooks.h"
+#include "optimix/support/ThreadPool.h"
+#include "optimix/support/TimeReport.h"
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
 void printUsage() {
-  std::cout << "Usage: optimix [command] [options]\n"
-            << "Commands:\n"
-            << "  compile <file>  Compile source file\n"
-            << "Options:\n"
-            << "  --help          Show this help message\n"
-            << "  --version       Show version info\n";
+  std::cout
+      << "Usage: optimix [command] [options]\n"
+      << "Commands:\n"
+      << "  compile <file>          Compile source file and execute it\n"
+      << "  compile --batch <files> Compile many files in parallel\n"
+      << "  run <file>              Interpret source file, compiling hot "
+         "loops\n"
+      << "  run <file.oxb>          Execute precompiled binary IR\n"
+      << "  opt <file.oxir|.oxb>    Run individual passes on stored IR\n"
+      << "Options:\n"
+      << "  --help                  Show this help message\n"
+      << "  --version               Show version info\n"
+      << "  -v, --verbose           Report progress (default: only problems)\n"
+      << "compile options:\n"
+      << "  -o <out.oxb|out.oxir>   Write optimized IR instead of executing\n"
+      << "  --cache-dir <dir>       Reuse results for unchanged sources\n"
+      << "                          (default: $OPTIMIX_CACHE_DIR)\n"
+      << "  --cache-size <MB>       Cache size bound (default 256)\n"
+      << "  --no-cache              Ignore $OPTIMIX_CACHE_DIR\n"
+      << "  --dump-ast              Print the syntax tree\n"
+      << "  --dump-ir               Print the IR before and after\n"
+      << "                          optimization\n"
+      << "  --profile-use=<file>    Unroll and lay out code using a profile\n"
+      << "                          from `run --profile`\n"
+      << "  --time-report           Print time, CPU, allocations and peak RSS\n"
+      << "                          per phase and pass (also for run)\n"
+      << "  --time-trace <file>     Also write a Chrome trace-event JSON\n"
+      << "  -j <n>                  Threads for parallel loops (default: all\n"
+      << "                          cores, 1 = run them sequentially)\n"
+      << "  --eval-steps <n>        Steps compile-time evaluation may take\n"
+      << "                          in all (default 1000000, 0 = none)\n"
+      << "compile --batch options:\n"
+      << "  -j <n>                  Worker threads (default: all cores)\n"
+      << "  -o <dir>                Write <dir>/<file>.oxir instead of "
+         "stdout\n"
+      << "  --manifest <list>       Read input paths from a file\n"
+      << "run options:\n"
+      << "  --tier-threshold <n>    Loop iterations before tier-up "
+         "(default 1000, 0 = never)\n"
+      << "  --profile[=<file>]      Count block, branch and opcode\n"
+      << "                          executions, report hot spots and write\n"
+      << "                          the profile (default optimix.prof)\n"
+      << "  -j <n>                  Threads for parallel loops in .oxb files\n"
+      << "opt options:\n"
+      << "  -passes=<a,b,...>       Passes to run, in order\n"
+      << "  -o <out.oxir|out.oxb>   Write the result instead of printing it\n"
+      << "  --repeat <n>            Run the pipeline n times for timing\n"
+      << "  --time                  Report the time spent in each pass\n";
 }
 
-int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    printUsage();
-    return 0;
+// Reads a whole file into 'content'. Returns false (after reporting) on error.
+bool readFile(const std::string &filename, std::string &content) {
+  try {
+    content = optimix::driver::readFile(filename);
+    return true;
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return false;
   }
+}
 
-  std::string command = argv[1];
-  if (command == "--help") {
-    printUsage();
-    return 0;
-  } else if (command == "--version") {
-    std::cout << "Optimix Compiler v1.0.0\n";
-    return 0;
-  } else if (command == "compile") {
-    if (argc < 3) {
-      std::cerr << "Error: No input file specified.\n";
+// Worker threads a -j option may ask for.
+const uint64_t kMaxThreads = 1024;
+// Largest --cache-size whose size in bytes still fits.
+const uint64_t kMaxCacheMB = std::numeric_limits<uint64_t>::max() >> 20;
+
+// Reads the value of a numeric option into 'value'. Returns false (after
+// reporting) unless 'text' is a decimal number from 0 to 'max'.
+template <typename T>
+bool parseCount(const std::string &option, const std::string &text, T &value,
+                uint64_t max = std::numeric_limits<T>::max()) {
+  bool ok = !text.empty() && text.size() <= 19;
+  for (char c : text)
+    ok = ok && c >= '0' && c <= '9';
+  uint64_t parsed = ok ? std::stoull(text) : 0;
+  if (!ok || parsed > max) {
+    std::cerr << "Error: Invalid value '" << text << "' for " << option
+              << "\n";
+    return false;
+  }
+  value = static_cast<T>(parsed);
+  return true;
+}
+
+// compile --batch [-j N] [-o dir] [--manifest list] files...
+int compileBatch(int argc, char *argv[]) {
+  std::vector<std::string> files;
+  optimix::driver::BatchOptions options;
+  bool useEnvCache = true;
+  try {
+    for (int i = 3; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (arg == "-j" && i + 1 < argc) {
+        if (!parseCount(arg, argv[++i], options.jobs, kMaxThreads))
+          return 1;
+      } else if (arg == "-o" && i + 1 < argc) {
+        options.outputDir = argv[++i];
+      } else if (arg == "--cache-dir" && i + 1 < argc) {
+        options.cacheDir = argv[++i];
+      } else if (arg == "--cache-size" && i + 1 < argc) {
+        if (!parseCount(arg, argv[++i], options.cacheMaxBytes,
+                        kMaxCacheMB))
+          return 1;
+        options.cacheMaxBytes <<= 20;
+      } else if (arg == "--no-cache") {
+        options.cacheDir.clear();
+        useEnvCache = false;
+      } else if (arg == "--manifest" && i + 1 < argc) {
+        auto listed = optimix::driver::readManifest(argv[++i]);
+        files.insert(files.end(), listed.begin(), listed.end());
+      } else {
+        files.push_back(arg);
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  if (files.empty()) {
+    std::cerr << "Error: No input files specified.\n";
+    return 1;
+  }
+  if (options.cacheDir.empty() && useEnvCache) {
+    if (const char *dir = std::getenv("OPTIMIX_CACHE_DIR"))
+      options.cacheDir = dir;
+  }
+
+  auto entries = optimix::driver::compileBatch(files, options);
+
+  int failed = 0;
+  int cached = 0;
+  for (const auto &entry : entries) {
+    cached += entry.fromCache;
+    if (!entry.error.empty()) {
+      std::cerr << entry.file << ": error: " << entry.error << "\n";
+      ++failed;
+    } else if (options.outputDir.empty()) {
+      std::cout << "; " << entry.file << "\n" << entry.output;
+    }
+  }
+  std::string summary = "Compiled " + std::to_string(entries.size() - failed) +
+                        "/" + std::to_string(entries.size()) + " files";
+  if (!options.cacheDir.empty())
+    summary += " (" + std::to_string(cached) + " from cache)";
+  if (failed)
+    OPTIMIX_LOG(WARNING, summary);
+  else
+    OPTIMIX_LOG(INFO, summary);
+  return failed ? 1 : 0;
+}
+
+bool writeFile(const std::string &filename, const std::string &content) {
+  std::ofstream out(filename, std::ios::binary);
+  out << content;
+  if (!out) {
+    std::cerr << "Error: Could not write file " << filename << "\n";
+    return false;
+  }
+  return true;
+}
+
+// 'threads' is the pool size for parallel loops (0 = all cores, 1 = none).
+int executeMain(const optimix::ir::Module &module,
+                optimix::ir::Profile *profile = nullptr,
+                unsigned threads = 0) {
+  const optimix::ir::Function *entry = module.getFunction("main");
+  if (!entry)
+    throw std::runtime_error("no 'main' function");
+
+  bool parallel = false;
+  for (const auto &func : module.functions)
+    for (const auto &bb : func->blocks)
+      for (const auto &inst : bb->instructions)
+        parallel |= inst.op == optimix::ir::OpCode::PARFOR;
+  std::unique_ptr<optimix::ThreadPool> pool;
+  if (parallel && !profile && threads != 1)
+    pool = std::make_unique<optimix::ThreadPool>(threads);
+
+  optimix::IRInterpreter irInterpreter;
+  irInterpreter.setProfile(profile);
+  irInterpreter.setThreadPool(pool.get());
+  irInterpreter.setModule(&module);
+  int result = irInterpreter.execute(*entry);
+  std::cout << "Program returned: " << result << "\n";
+  return result;
+}
+
+// Prints the --time-report table to stderr and writes the --time-trace file.
+void emitTimeReport(const optimix::TimeReport *report,
+                    const std::string &tracePath) {
+  if (!report)
+    return;
+  if (!tracePath.empty()) {
+    std::ofstream trace(tracePath);
+    if (trace)
+      report->writeTrace(trace);
+    else
+      std::cerr << "Error: Could not write " << tracePath << "\n";
+  }
+  report->print(std::cerr);
+}
+
+// compile <file> [-o out.oxb|out.oxir] [--cache-dir dir] [--cache-size MB]
+//                [--no-cache] [--profile-use=prof] [--dump-ast] [--dump-ir]
+//                [--time-report] [--time-trace trace.json] [-j n]
+//                [--eval-steps n]
+int compileFile(int argc, char *argv[]) {
+  std::string filename, output, cacheDir, tracePath, profilePath;
+  uint64_t cacheMaxBytes = 256ull << 20;
+  uint64_t evalSteps = optimix::ir::PartialEvaluationPass::kDefaultStepLimit;
+  unsigned threads = 0;
+  bool useEnvCache = true, timeReport = false;
+  bool dumpAst = false, dumpIr = false;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "--cache-dir" && i + 1 < argc) {
+      cacheDir = argv[++i];
+    } else if (arg == "--cache-size" && i + 1 < argc) {
+      if (!parseCount(arg, argv[++i], cacheMaxBytes, kMaxCacheMB))
+        return 1;
+      cacheMaxBytes <<= 20;
+    } else if (arg == "--no-cache") {
+      cacheDir.clear();
+      useEnvCache = false;
+    } else if (arg == "--time-report") {
+      timeReport = true;
+    } else if (arg == "--time-trace" && i + 1 < argc) {
+      tracePath = argv[++i];
+      timeReport = true;
+    } else if (arg.rfind("--profile-use=", 0) == 0) {
+      profilePath = arg.substr(14);
+    } else if (arg == "--dump-ast") {
+      dumpAst = true;
+    } else if (arg == "--dump-ir") {
+      dumpIr = true;
+    } else if (arg == "-j" && i + 1 < argc) {
+      if (!parseCount(arg, argv[++i], threads, kMaxThreads))
+        return 1;
+    } else if (arg == "--eval-steps" && i + 1 < argc) {
+      if (!parseCount(arg, argv[++i], evalSteps))
+        return 1;
+    } else if (filename.empty()) {
+      filename = arg;
+    } else {
+      std::cerr << "Error: Unexpected argument " << arg << "\n";
       return 1;
     }
-    std::string filename = argv[2];
-    std::cout << "Compiling " << filename << "...\n";
+  }
+  if (filename.empty()) {
+    std::cerr << "Error: No input file specified.\n";
+    return 1;
+  }
+  if (cacheDir.empty() && useEnvCache) {
+    if (const char *dir = std::getenv("OPTIMIX_CACHE_DIR"))
+      cacheDir = dir;
+  }
+  OPTIMIX_LOG(INFO, "Compiling " + filename);
 
-    // Read file
-    std::FILE *fp = std::fopen(filename.c_str(), "rb");
-    if (!fp) {
-      std::cerr << "Error: Could not open file " << filename << "\n";
+  std::unique_ptr<optimix::TimeReport> report;
+  if (timeReport)
+    report = std::make_unique<optimix::TimeReport>();
+  using Region = optimix::TimeReport::Region;
+
+  std::string content;
+  {
+    Region region(report.get(), "read source");
+    if (!readFile(filename, content))
       return 1;
+  }
+
+  int status = 0;
+  try {
+    // The profile changes the generated code, so it is part of the cache
+    // key as well.
+    std::string profileText;
+    std::unique_ptr<optimix::ir::Profile> profile;
+    if (!profilePath.empty()) {
+      Region region(report.get(), "read profile");
+      profileText = optimix::driver::readFile(profilePath);
+      std::istringstream in(profileText);
+      profile = std::make_unique<optimix::ir::Profile>(
+          optimix::ir::Profile::read(in));
     }
-    std::fseek(fp, 0, SEEK_END);
-    size_t size = std::ftell(fp);
-    std::string content(size, '\0');
-    std::rewind(fp);
-    if (std::fread(&content[0], 1, size, fp) != size) {
-      std::cerr << "Error: Could not read entire file " << filename << "\n";
-      std::fclose(fp);
+    auto pipeline =
+        optimix::driver::defaultPipeline(profile.get(), evalSteps);
+    pipeline.setTimeReport(report.get());
+
+    std::unique_ptr<optimix::driver::CompilationCache> cache;
+    std::string key;
+    std::unique_ptr<optimix::ir::Module> module;
+    if (!cacheDir.empty()) {
+      Region region(report.get(), "cache lookup");
+      cache = std::make_unique<optimix::driver::CompilationCache>(
+          cacheDir, cacheMaxBytes);
+      key = optimix::driver::CompilationCache::makeKey(
+          content, "compile-oxb" +
+                       std::to_string(optimix::ir::kBinaryIRVersion) + ";" +
+                       pipeline.pipelineText() + ";" +
+                       std::to_string(evalSteps) + ";" + profileText);
+      if (auto hit = cache->lookup(key)) {
+        // A damaged entry is a miss; compiling again overwrites it.
+        try {
+          module = optimix::ir::readBinary(hit->data(), hit->size(), true);
+        } catch (const std::exception &e) {
+          OPTIMIX_LOG(WARNING, std::string("Ignoring cache entry: ") +
+                                   e.what());
+        }
+      }
+    }
+
+    if (module) {
+      OPTIMIX_LOG(INFO, "Loaded optimized IR from cache");
+    } else {
+      std::unique_ptr<optimix::ProgramAST> ast;
+      {
+        // The lexer is pulled by the parser, so the two are timed together.
+        Region region(report.get(), "lex+parse");
+        optimix::Lexer lexer(content);
+        optimix::Parser parser(lexer);
+        ast = parser.parseProgram();
+      }
+      if (dumpAst) {
+        std::cout << "AST:\n";
+        ast->print(std::cout, 0);
+      }
+
+      {
+        Region region(report.get(), "IR generation");
+        optimix::IRBuilder builder;
+        module = builder.generate(*ast);
+      }
+
+      if (dumpIr) {
+        std::cout << "Raw IR:\n";
+        module->print();
+      }
+
+      {
+        Region region(report.get(), "optimize");
+        // Functions are optimized concurrently once there is more than one.
+        std::unique_ptr<optimix::ThreadPool> pool;
+        if (module->functions.size() > 1)
+          pool = std::make_unique<optimix::ThreadPool>();
+        pipeline.run(*module, pool.get());
+      }
+
+      if (cache) {
+        Region region(report.get(), "cache store");
+        cache->store(key, optimix::ir::writeBinary(*module));
+      }
+    }
+
+    if (dumpIr) {
+      std::cout << "Optimized IR:\n";
+      module->print();
+    }
+
+    if (!output.empty()) {
+      Region region(report.get(), "write output");
+      // .oxb is the binary format, anything else gets the text IR.
+      std::string bytes;
+      if (output.size() > 4 && output.substr(output.size() - 4) == ".oxb") {
+        bytes = optimix::ir::writeBinary(*module);
+      } else {
+        std::ostringstream text;
+        module->print(text);
+        bytes = text.str();
+      }
+      if (writeFile(output, bytes))
+        OPTIMIX_LOG(INFO, "Wrote " + output);
+      else
+        status = 1;
+    } else {
+      optimix::flushDiagnostics(); // Progress first, then program output
+      Region region(report.get(), "execute");
+      executeMain(*module, nullptr, threads);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Compilation failed: " << e.what() << "\n";
+    status = 1;
+  }
+  emitTimeReport(report.get(), tracePath);
+  return status;
+}
+
+// opt <file.oxir|file.oxb> -passes=a,b [-o out] [--repeat n] [--time]
+// Runs the named passes, in order, on stored IR. Each pass runs over every
+// function before the next one starts so its time can be reported alone.
+int optFile(int argc, char *argv[]) {
+  std::string filename, output, passes;
+  int repeat = 1;
+  bool time = false;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("-passes=", 0) == 0) {
+      passes = arg.substr(8);
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      if (!parseCount(arg, argv[++i], repeat))
+        return 1;
+    } else if (arg == "--time") {
+      time = true;
+    } else if (filename.empty()) {
+      filename = arg;
+    } else {
+      std::cerr << "Error: Unexpected argument " << arg << "\n";
       return 1;
     }
-    std::fclose(fp);
+  }
+  if (filename.empty()) {
+    std::cerr << "Error: No input file specified.\n";
+    return 1;
+  }
 
-    try {
-      optimix::Lexer lexer(content);
-      optimix::Parser parser(lexer);
-      auto ast = parser.parseTopLevel();
-      std::cout << "Parsing successful!\n";
-      ast->print(0);
+  auto isBinary = [](const std::string &f) {
+    return f.size() > 4 && f.substr(f.size() - 4) == ".oxb";
+  };
 
-      ast->print(0);
+  try {
+    std::vector<std::string> names;
+    std::vector<std::unique_ptr<optimix::ir::FunctionPass>> pipeline;
+    size_t start = 0;
+    while (start < passes.size()) {
+      size_t comma = passes.find(',', start);
+      if (comma == std::string::npos)
+        comma = passes.size();
+      if (comma > start) {
+        names.push_back(passes.substr(start, comma - start));
+        pipeline.push_back(optimix::ir::createPass(names.back()));
+        if (!pipeline.back())
+          throw std::runtime_error("unknown pass '" + names.back() + "'");
+      }
+      start = comma + 1;
+    }
 
-      std::cout << "\nGenerating IR...\n";
-      optimix::IRBuilder builder;
-      auto ir = builder.generate(*ast);
+    std::unique_ptr<optimix::ir::Module> module;
+    if (isBinary(filename)) {
+      module = optimix::ir::loadBinaryFile(filename);
+    } else {
+      std::string content;
+      if (!readFile(filename, content))
+        return 1;
+      module = optimix::ir::parseIR(content);
+    }
 
-      std::cout << "Raw IR:\n";
-      ir->print();
+    // Later repetitions run on fresh copies of the input so every round
+    // does the same work.
+    std::string original;
+    if (repeat > 1)
+      original = optimix::ir::writeBinary(*module);
 
-      optimix::ir::SSAPass ssa;
-      ssa.run(*ir);
+    std::vector<double> seconds(pipeline.size(), 0.0);
+    for (int round = 0; round < repeat; ++round) {
+      if (round > 0)
+        module = optimix::ir::readBinary(original.data(), original.size());
+      for (size_t p = 0; p < pipeline.size(); ++p) {
+        auto begin = std::chrono::steady_clock::now();
+        for (auto &fn : module->functions)
+          pipeline[p]->run(*fn);
+        seconds[p] += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - begin)
+                          .count();
+      }
+    }
 
-      std::cout << "\nSSA IR:\n";
-      ir->print();
+    if (time) {
+      std::cerr << "Pass timing (" << repeat << " run"
+                << (repeat == 1 ? "" : "s") << ", mean per run):\n";
+      for (size_t p = 0; p < pipeline.size(); ++p)
+        std::cerr << "  " << names[p] << ": "
+                  << seconds[p] / repeat * 1e3 << " ms\n";
+    }
 
-      std::cout << "\nExecuting (Optimized IR)...\n";
-      optimix::IRInterpreter irInterpreter;
-      int result = irInterpreter.execute(*ir);
-      std::cout << "Program returned: " << result << "\n";
+    if (output.empty()) {
+      module->print();
+      return 0;
+    }
+    std::string bytes;
+    if (isBinary(output)) {
+      bytes = optimix::ir::writeBinary(*module);
+    } else {
+      std::ostringstream text;
+      module->print(text);
+      bytes = text.str();
+    }
+    return writeFile(output, bytes) ? 0 : 1;
+  } catch (const std::exception &e) {
+    std::cerr << "opt failed: " << e.what() << "\n";
+    return 1;
+  }
+}
 
-    } catch (const std::exception &e) {
-      std::cerr << "Compilation failed: " << e.what() << "\n";
+// run <file|file.oxb> [--tier-threshold n] [--profile[=out.prof]]
+//                      [--time-report] [--time-trace trace.json] [-j n]
+int runFile(int argc, char *argv[]) {
+  std::string filename, tracePath, profilePath;
+  int tierThreshold = 1000;
+  unsigned threads = 0;
+  bool timeReport = false;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--tier-threshold" && i + 1 < argc) {
+      if (!parseCount(arg, argv[++i], tierThreshold))
+        return 1;
+    } else if (arg == "--profile") {
+      profilePath = "optimix.prof";
+    } else if (arg.rfind("--profile=", 0) == 0) {
+      profilePath = arg.substr(10);
+    } else if (arg == "--time-report") {
+      timeReport = true;
+    } else if (arg == "--time-trace" && i + 1 < argc) {
+      tracePath = argv[++i];
+      timeReport = true;
+    } else if (arg == "-j" && i + 1 < argc) {
+      if (!parseCount(arg, argv[++i], threads, kMaxThreads))
+        return 1;
+    } else if (filename.empty()) {
+      filename = arg;
+    } else {
+      std::cerr << "Error: Unexpected argument " << arg << "\n";
       return 1;
     }
+  }
+  if (filename.empty()) {
+    std::cerr << "Error: No input file specified.\n";
+    return 1;
+  }
+
+  std::unique_ptr<optimix::TimeReport> report;
+  if (timeReport)
+    report = std::make_unique<optimix::TimeReport>();
+  using Region = optimix::TimeReport::Region;
+
+  int status = 0;
+  try {
+    bool binary =
+        filename.size() > 4 && filename.substr(filename.size() - 4) == ".oxb";
+    if (!profilePath.empty()) {
+      // Counters live in the IR engine, so profiled runs compile the whole
+      // program up front instead of starting in the AST interpreter.
+      std::string content;
+      std::unique_ptr<optimix::ir::Module> module;
+      if (binary) {
+        Region region(report.get(), "load binary IR");
+        module = optimix::ir::loadBinaryFile(filename);
+      } else {
+        Region region(report.get(), "compile");
+        content = optimix::driver::readFile(filename);
+        module = optimix::driver::compileSource(content).module;
+      }
+
+      optimix::ir::Profile profile;
+      {
+        Region region(report.get(), "execute (profiled)");
+        executeMain(*module, &profile);
+      }
+      std::ofstream out(profilePath);
+      if (!out)
+        throw std::runtime_error("Could not write " + profilePath);
+      profile.write(out);
+      profile.printReport(std::cerr, binary ? nullptr : &content);
+      OPTIMIX_LOG(INFO, "Profile written to " + profilePath);
+    } else if (binary) {
+      // Precompiled IR runs directly on the IR engine.
+      std::unique_ptr<optimix::ir::Module> module;
+      {
+        Region region(report.get(), "load binary IR");
+        module = optimix::ir::loadBinaryFile(filename);
+      }
+      Region region(report.get(), "execute");
+      executeMain(*module, nullptr, threads);
+    } else {
+      std::string content;
+      {
+        Region region(report.get(), "read source");
+        content = optimix::driver::readFile(filename);
+      }
+
+      std::unique_ptr<optimix::ProgramAST> program;
+      {
+        Region region(report.get(), "lex+parse");
+        optimix::Lexer lexer(content);
+        optimix::Parser parser(lexer);
+        program = parser.parseProgram();
+      }
+      const optimix::FunctionAST *ast = program->getFunction("main");
+      if (!ast)
+        throw std::runtime_error("no 'main' function");
+
+      // Start in the AST interpreter (no IR construction cost for short
+      // scripts); loops that get hot are promoted to the IR engine.
+      Region region(report.get(), "execute");
+      optimix::Interpreter interpreter;
+      interpreter.setTierUpThreshold(tierThreshold);
+      interpreter.setProgram(program.get());
+      int result = interpreter.execute(*ast);
+      std::cout << "Program returned: " << result << "\n";
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Execution failed: " << e.what() << "\n";
+    status = 1;
+  }
+  emitTimeReport(report.get(), tracePath);
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  // --verbose is accepted anywhere on the command line and is taken out
+  // before the commands parse their own options.
+  int kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--verbose" || arg == "-v")
+      optimix::setLogLevel(optimix::LogLevel::INFO);
+    else
+      argv[kept++] = argv[i];
+  }
+  argc = kept;
+
+  if (argc < 2) {
+    printUsage();
+    return 0;
+  }
+
+  std::string command = argv[1];
+  if (command == "--help") {
+    printUsage();
+    return 0;
+  } else if (command == "--version") {
+    std::cout << "Optimix Compiler v" OPTIMIX_VERSION "\n";
+    return 0;
+  } else if (command == "compile") {
+    if (argc >= 3 && std::string(argv[2]) == "--batch")
+      return compileBatch(argc, argv);
+    return compileFile(argc, argv);
+  } else if (command == "opt") {
+    return optFile(argc, argv);
+  } else if (command == "run") {
+    return runFile(argc, argv);
   } else {
     std::cerr << "Unknown command: " << command << "\n";
     return 1;
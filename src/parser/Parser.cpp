@@ -23,19 +23,33 @@ std::unique_ptr<Expr> Parser::parsePrimary() {
     std::string name = currentToken.text;
     eat(TokenType::IDENTIFIER);
 
-    // Array Access: x = arr[i] + 1;
+    // Array Access: x = arr[i] + 1; or x = m[i][j];
     if (currentToken.type == TokenType::LBRACKET) {
-      eat(TokenType::LBRACKET);
-      auto index = parseExpression();
-      eat(TokenType::RBRACKET);
-      return std::make_unique<ArrayAccessExpr>(name, std::move(index));
+      auto indices = parseSubscripts(name, false);
+      return std::make_unique<ArrayAccessExpr>(name, std::move(indices));
     }
 
+    // Call: fib(n - 1)
+    if (currentToken.type == TokenType::LPAREN)
+      return parseCall(name);
+
     return std::make_unique<VariableExpr>(name);
   }
   throw std::runtime_error("Unknown token in expression");
 }
 
+std::unique_ptr<CallExpr> Parser::parseCall(const std::string &callee) {
+  eat(TokenType::LPAREN);
+  std::vector<std::unique_ptr<Expr>> args;
+  while (currentToken.type != TokenType::RPAREN) {
+    if (!args.empty())
+      eat(TokenType::COMMA);
+    args.push_back(parseExpression());
+  }
+  eat(TokenType::RPAREN);
+  return std::make_unique<CallExpr>(callee, std::move(args));
+}
+
 std::unique_ptr<Expr> Parser::parseMultiplicative() {
   auto left = parsePrimary();
   while (currentToken.type == TokenType::STAR ||
@@ -76,6 +90,28 @@ std::unique_ptr<Expr> Parser::parseRelational() {
 
 std::unique_ptr<Expr> Parser::parseExpression() { return parseRelational(); }
 
+std::vector<std::unique_ptr<Expr>>
+Parser::parseSubscripts(const std::string &array, bool declaration) {
+  std::vector<std::unique_ptr<Expr>> subscripts;
+  while (currentToken.type == TokenType::LBRACKET) {
+    eat(TokenType::LBRACKET);
+    subscripts.push_back(parseExpression());
+    eat(TokenType::RBRACKET);
+  }
+  // Every use must match the declarations before it; an array used before
+  // any declaration must be one-dimensional.
+  auto known = arrayRanks.find(array);
+  size_t rank = known != arrayRanks.end() ? known->second : 1;
+  if (declaration && known == arrayRanks.end())
+    arrayRanks[array] = subscripts.size();
+  else if (subscripts.size() != rank)
+    throw std::runtime_error("Array " + array + " has " +
+                             std::to_string(rank) + " dimension" +
+                             (rank == 1 ? "" : "s") + ", not " +
+                             std::to_string(subscripts.size()));
+  return subscripts;
+}
+
 std::unique_ptr<Stmt> Parser::parseStatement() {
   if (currentToken.type == TokenType::KW_RETURN) {
     eat(TokenType::KW_RETURN);
@@ -89,15 +125,11 @@ std::unique_ptr<Stmt> Parser::parseStatement() {
     std::string name = currentToken.text;
     eat(TokenType::IDENTIFIER);
 
-    // Array Declaration: int arr[10];
+    // Array Declaration: int arr[10]; or int arr[n * 2]; or int m[4][n];
     if (currentToken.type == TokenType::LBRACKET) {
-      eat(TokenType::LBRACKET);
-      int size =
-          std::stoi(currentToken.text); // Simplified: Assume constant size
-      eat(TokenType::NUMBER);
-      eat(TokenType::RBRACKET);
+      auto dims = parseSubscripts(name, true);
       eat(TokenType::SEMICOLON);
-      return std::make_unique<ArrayDecl>(name, size);
+      return std::make_unique<ArrayDecl>(name, std::move(dims));
     }
 
     eat(TokenType::ASSIGN);
@@ -115,19 +147,39 @@ std::unique_ptr<Stmt> Parser::parseStatement() {
     return std::make_unique<WhileStmt>(std::move(cond), std::move(body));
   }
 
+  if (currentToken.type == TokenType::KW_IF) {
+    eat(TokenType::KW_IF);
+    eat(TokenType::LPAREN);
+    auto cond = parseExpression();
+    eat(TokenType::RPAREN);
+    auto then = parseBlock();
+    std::vector<std::unique_ptr<Stmt>> otherwise;
+    if (currentToken.type == TokenType::KW_ELSE) {
+      eat(TokenType::KW_ELSE);
+      if (currentToken.type == TokenType::KW_IF) {
+        // else if: the nested if is the whole else branch
+        int line = currentToken.line;
+        otherwise.push_back(parseStatement());
+        otherwise.back()->line = line;
+      } else {
+        otherwise = parseBlock();
+      }
+    }
+    return std::make_unique<IfStmt>(std::move(cond), std::move(then),
+                                    std::move(otherwise));
+  }
+
   if (currentToken.type == TokenType::IDENTIFIER) {
     std::string name = currentToken.text;
     eat(TokenType::IDENTIFIER);
 
-    // Array Assignment: arr[i] = 5;
+    // Array Assignment: arr[i] = 5; or m[i][j] = 5;
     if (currentToken.type == TokenType::LBRACKET) {
-      eat(TokenType::LBRACKET);
-      auto index = parseExpression();
-      eat(TokenType::RBRACKET);
+      auto indices = parseSubscripts(name, false);
       eat(TokenType::ASSIGN);
       auto val = parseExpression();
       eat(TokenType::SEMICOLON);
-      return std::make_unique<ArrayAssignment>(name, std::move(index),
+      return std::make_unique<ArrayAssignment>(name, std::move(indices),
                                                std::move(val));
     }
 
@@ -137,6 +189,13 @@ std::unique_ptr<Stmt> Parser::parseStatement() {
       eat(TokenType::SEMICOLON);
       return std::make_unique<Assignment>(name, std::move(val));
     }
+
+    // Call Statement: log(x);
+    if (currentToken.type == TokenType::LPAREN) {
+      auto call = parseCall(name);
+      eat(TokenType::SEMICOLON);
+      return std::make_unique<CallStmt>(std::move(call));
+    }
   }
 
   if (currentToken.type == TokenType::KW_PRINT) {
@@ -157,24 +216,43 @@ std::vector<std::unique_ptr<Stmt>> Parser::parseBlock() {
   std::vector<std::unique_ptr<Stmt>> stmts;
   while (currentToken.type != TokenType::RBRACE &&
          currentToken.type != TokenType::END_OF_FILE) {
+    int line = currentToken.line;
     stmts.push_back(parseStatement());
+    stmts.back()->line = line;
   }
   eat(TokenType::RBRACE);
   return stmts;
 }
 
 std::unique_ptr<FunctionAST> Parser::parseTopLevel() {
-  // int main() { ... }
-  eat(TokenType::KW_INT); // Return type
+  // int main(int a, int b) { ... }
+  if (currentToken.type == TokenType::KW_VOID)
+    eat(TokenType::KW_VOID);
+  else
+    eat(TokenType::KW_INT); // Return type
   std::string name = currentToken.text;
   eat(TokenType::IDENTIFIER);
   eat(TokenType::LPAREN);
-  // Args...
+  arrayRanks.clear();
+  std::vector<std::string> args;
+  while (currentToken.type != TokenType::RPAREN) {
+    if (!args.empty())
+      eat(TokenType::COMMA);
+    eat(TokenType::KW_INT);
+    args.push_back(currentToken.text);
+    eat(TokenType::IDENTIFIER);
+  }
   eat(TokenType::RPAREN);
 
   auto body = parseBlock();
-  return std::make_unique<FunctionAST>(name, std::vector<std::string>{},
-                                       std::move(body));
+  return std::make_unique<FunctionAST>(name, std::move(args), std::move(body));
+}
+
+std::unique_ptr<ProgramAST> Parser::parseProgram() {
+  auto program = std::make_unique<ProgramAST>();
+  while (currentToken.type != TokenType::END_OF_FILE)
+    program->functions.push_back(parseTopLevel());
+  return program;
 }
 
 } // namespace optimix
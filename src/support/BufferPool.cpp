@@ -0,0 +1,50 @@
+#include "optimix/support/BufferPool.h"
+
+namespace optimix {
+
+namespace {
+
+// Smallest class whose buffers hold 'size' elements.
+size_t classFor(size_t size) {
+  size_t cls = 0;
+  while ((BufferPool::kMinCapacity << cls) < size)
+    ++cls;
+  return cls;
+}
+
+} // namespace
+
+BufferPool &BufferPool::local() {
+  thread_local BufferPool pool;
+  return pool;
+}
+
+std::vector<int> BufferPool::acquire(size_t size) {
+  size_t cls = classFor(size);
+  std::vector<int> buffer;
+  if (cls < kNumClasses && !free[cls].empty()) {
+    buffer = std::move(free[cls].back());
+    free[cls].pop_back();
+    ++reuseCount;
+  } else if (cls < kNumClasses) {
+    buffer.reserve(kMinCapacity << cls);
+  }
+  buffer.assign(size, 0);
+  return buffer;
+}
+
+void BufferPool::release(std::vector<int> &&buffer) {
+  size_t capacity = buffer.capacity();
+  if (capacity < kMinCapacity)
+    return;
+  // The largest class the buffer can serve.
+  size_t cls = classFor(capacity);
+  if ((kMinCapacity << cls) > capacity)
+    --cls;
+  if (cls >= kNumClasses || free[cls].size() >= kMaxPerClass)
+    return;
+  buffer.clear();
+  free[cls].push_back(std::move(buffer));
+}
+
+} // namespace optimix
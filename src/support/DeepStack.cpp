@@ -0,0 +1,100 @@
+#include "optimix/support/DeepStack.h"
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <intrin.h>
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+namespace optimix {
+
+namespace {
+
+// Besides the bytes asked for, a new thread gets this much for its start-up
+// frames, thread-local storage and guard page.
+const size_t kOverhead = 256 * 1024;
+
+// Lowest address of the stack run() promised on this thread, 0 on threads
+// it did not start. Stacks grow down on every platform we build for.
+thread_local uintptr_t stackEnd = 0;
+
+// Where the caller's frame is. Not the address of a local, which
+// AddressSanitizer may move to the heap.
+#ifdef _MSC_VER
+#define OPTIMIX_FRAME_ADDRESS() _AddressOfReturnAddress()
+#else
+#define OPTIMIX_FRAME_ADDRESS() __builtin_frame_address(0)
+#endif
+
+size_t remaining() {
+  auto here = reinterpret_cast<uintptr_t>(OPTIMIX_FRAME_ADDRESS());
+  return here > stackEnd ? here - stackEnd : 0;
+}
+
+struct Task {
+  size_t bytes;
+  const std::function<void()> *fn;
+  std::exception_ptr error;
+};
+
+void runTask(Task &task) {
+  stackEnd = reinterpret_cast<uintptr_t>(OPTIMIX_FRAME_ADDRESS()) - task.bytes;
+  try {
+    (*task.fn)();
+  } catch (...) {
+    task.error = std::current_exception();
+  }
+}
+
+#ifdef _WIN32
+DWORD WINAPI threadMain(LPVOID task) {
+  runTask(*static_cast<Task *>(task));
+  return 0;
+}
+#else
+void *threadMain(void *task) {
+  runTask(*static_cast<Task *>(task));
+  return nullptr;
+}
+#endif
+
+} // namespace
+
+void DeepStack::run(size_t bytes, const std::function<void()> &fn) {
+  if (stackEnd && remaining() >= bytes) {
+    fn();
+    return;
+  }
+  Task task{bytes, &fn, nullptr};
+  // Whole multiples of 64 KB are a valid stack size everywhere.
+  size_t size = (bytes + kOverhead + 0xFFFF) & ~size_t(0xFFFF);
+#ifdef _WIN32
+  HANDLE thread = CreateThread(nullptr, size, threadMain, &task,
+                               STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+  if (!thread)
+    throw std::runtime_error("Cannot start a thread for the interpreter");
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_t thread;
+  bool started = pthread_attr_setstacksize(&attr, size) == 0 &&
+                 pthread_create(&thread, &attr, threadMain, &task) == 0;
+  pthread_attr_destroy(&attr);
+  if (!started)
+    throw std::runtime_error("Cannot start a thread for the interpreter");
+  pthread_join(thread, nullptr);
+#endif
+  if (task.error)
+    std::rethrow_exception(task.error);
+}
+
+bool DeepStack::exhausted() { return stackEnd && remaining() < kReserve; }
+
+} // namespace optimix
@@ -0,0 +1,99 @@
+#include "optimix/support/Diagnostics.h"
+#include <iostream>
+
+namespace optimix {
+
+namespace detail {
+std::atomic<int> runtimeLogLevel{static_cast<int>(LogLevel::WARNING)};
+} // namespace detail
+
+namespace {
+
+// Flushed on exit by its destructor.
+StreamSink &stderrSink() {
+  static StreamSink sink(std::cerr);
+  return sink;
+}
+
+std::atomic<DiagnosticSink *> currentSink{nullptr};
+
+DiagnosticSink &sink() {
+  DiagnosticSink *s = currentSink.load(std::memory_order_acquire);
+  return s ? *s : stderrSink();
+}
+
+// Buffered messages are written once this much has accumulated.
+constexpr size_t kFlushThreshold = 4096;
+
+} // namespace
+
+const char *logLevelName(LogLevel level) {
+  switch (level) {
+  case LogLevel::ERROR:
+    return "ERROR";
+  case LogLevel::WARNING:
+    return "WARN";
+  case LogLevel::INFO:
+    return "INFO";
+  case LogLevel::DEBUG:
+    return "DEBUG";
+  }
+  return "?";
+}
+
+void StreamSink::emit(LogLevel level, const std::string &message) {
+  std::lock_guard<std::mutex> guard(lock);
+  buffer += '[';
+  buffer += logLevelName(level);
+  buffer += "] ";
+  buffer += message;
+  buffer += '\n';
+  if (level <= LogLevel::WARNING || buffer.size() >= kFlushThreshold) {
+    os.write(buffer.data(), buffer.size());
+    os.flush();
+    buffer.clear();
+  }
+}
+
+void StreamSink::flush() {
+  std::lock_guard<std::mutex> guard(lock);
+  if (buffer.empty())
+    return;
+  os.write(buffer.data(), buffer.size());
+  os.flush();
+  buffer.clear();
+}
+
+void CollectingSink::emit(LogLevel level, const std::string &message) {
+  std::lock_guard<std::mutex> guard(lock);
+  collected.push_back({level, message});
+}
+
+std::vector<CollectingSink::Message> CollectingSink::messages() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return collected;
+}
+
+void setLogLevel(LogLevel level) {
+  detail::runtimeLogLevel.store(static_cast<int>(level),
+                                std::memory_order_relaxed);
+}
+
+LogLevel logLevel() {
+  return static_cast<LogLevel>(
+      detail::runtimeLogLevel.load(std::memory_order_relaxed));
+}
+
+DiagnosticSink *setDiagnosticSink(DiagnosticSink *s) {
+  sink().flush();
+  return currentSink.exchange(s, std::memory_order_acq_rel);
+}
+
+void flushDiagnostics() { sink().flush(); }
+
+void log(LogLevel level, const std::string &message) {
+  if (logEnabled(level))
+    sink().emit(level, message);
+}
+
+} // namespace optimix
@@ -0,0 +1,81 @@
+#include "optimix/support/MappedFile.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace optimix {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path) {
+  file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    file = nullptr;
+    throw std::runtime_error("Could not open file " + path);
+  }
+  LARGE_INTEGER size;
+  GetFileSizeEx(file, &size);
+  length = static_cast<size_t>(size.QuadPart);
+  if (length == 0)
+    return; // Empty files cannot be mapped
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping)
+    base = static_cast<const char *>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!base) {
+    if (mapping)
+      CloseHandle(mapping);
+    CloseHandle(file);
+    throw std::runtime_error("Could not map file " + path);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (base)
+    UnmapViewOfFile(base);
+  if (mapping)
+    CloseHandle(mapping);
+  if (file)
+    CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Could not open file " + path);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("Could not stat file " + path);
+  }
+  length = static_cast<size_t>(st.st_size);
+  if (length > 0) {
+    void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Could not map file " + path);
+    }
+    base = static_cast<const char *>(p);
+  }
+  close(fd); // The mapping stays valid
+}
+
+MappedFile::~MappedFile() {
+  if (base)
+    munmap(const_cast<char *>(base), length);
+}
+
+#endif
+
+} // namespace optimix
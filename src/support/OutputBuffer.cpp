@@ -0,0 +1,34 @@
+#include "optimix/support/OutputBuffer.h"
+#include <charconv>
+
+namespace optimix {
+
+OutputBuffer::OutputBuffer(std::ostream &os, size_t capacity)
+    : os(os), capacity(capacity) {
+  buffer.reserve(capacity);
+}
+
+void OutputBuffer::writeLine(int value) {
+  char digits[16];
+  auto end = std::to_chars(digits, digits + sizeof(digits) - 1, value).ptr;
+  *end++ = '\n';
+  buffer.append(digits, end);
+  if (buffer.size() >= capacity)
+    flush();
+}
+
+void OutputBuffer::write(const std::string &text) {
+  buffer += text;
+  if (buffer.size() >= capacity)
+    flush();
+}
+
+void OutputBuffer::flush() {
+  if (buffer.empty())
+    return;
+  os.write(buffer.data(), buffer.size());
+  os.flush();
+  buffer.clear();
+}
+
+} // namespace optimix
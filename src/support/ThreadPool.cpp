@@ -0,0 +1,115 @@
+#include "optimix/support/ThreadPool.h"
+
+namespace optimix {
+
+namespace {
+// Pool and queue index of the worker running on this thread, if any.
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local unsigned currentWorker = 0;
+} // namespace
+
+ThreadPool::ThreadPool(unsigned threads) {
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  if (threads == 0)
+    threads = 1;
+
+  for (unsigned i = 0; i < threads; ++i)
+    queues.push_back(std::make_unique<Queue>());
+  for (unsigned i = 0; i < threads; ++i)
+    workers.emplace_back([this, i] { workerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(stateLock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &t : workers)
+    t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  unsigned target = currentPool == this
+                        ? currentWorker
+                        : nextQueue.fetch_add(1) % queues.size();
+  {
+    // Count the task before it becomes visible: otherwise another worker
+    // could take and finish it first, and its completion would be charged
+    // against a task that is still running, letting wait() return early.
+    std::lock_guard<std::mutex> state(stateLock);
+    std::lock_guard<std::mutex> guard(queues[target]->lock);
+    queues[target]->tasks.push_back(std::move(task));
+    ++queued;
+    ++pending;
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> guard(stateLock);
+  idle.wait(guard, [this] { return pending == 0; });
+  if (firstError) {
+    auto error = firstError;
+    firstError = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+bool ThreadPool::tryTake(unsigned self, std::function<void()> &task) {
+  // Own work first (LIFO keeps it cache-warm), then steal the oldest task
+  // from the other workers.
+  for (size_t n = 0; n < queues.size(); ++n) {
+    Queue &q = *queues[(self + n) % queues.size()];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tasks.empty())
+      continue;
+    if (n == 0) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    } else {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::workerLoop(unsigned self) {
+  currentPool = this;
+  currentWorker = self;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(stateLock);
+      wake.wait(guard, [this] { return queued > 0 || stopping; });
+      if (queued == 0 && stopping)
+        return;
+    }
+
+    std::function<void()> task;
+    if (!tryTake(self, task))
+      continue; // Another worker got there first
+    {
+      std::lock_guard<std::mutex> guard(stateLock);
+      --queued;
+    }
+
+    std::exception_ptr error;
+    try {
+      task();
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> guard(stateLock);
+    if (error && !firstError)
+      firstError = error;
+    if (--pending == 0)
+      idle.notify_all();
+  }
+}
+
+} // namespace optimix
@@ -0,0 +1,250 @@
+#include "optimix/support/TimeReport.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+namespace {
+
+// Counting only starts once a TimeReport exists, so ordinary runs do not pay
+// for a shared atomic on every allocation.
+std::atomic<bool> countAllocations{false};
+std::atomic<uint64_t> processAllocations{0};
+thread_local uint64_t threadAllocations = 0;
+
+} // namespace
+
+namespace optimix {
+
+namespace {
+
+double processCpuSeconds() {
+#ifdef _WIN32
+  FILETIME created, exited, kernel, user;
+  GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+  auto ticks = [](FILETIME t) {
+    return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+  };
+  return (ticks(kernel) + ticks(user)) * 1e-7;
+#else
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+double threadCpuSeconds() {
+#ifdef _WIN32
+  FILETIME created, exited, kernel, user;
+  GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user);
+  auto ticks = [](FILETIME t) {
+    return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime;
+  };
+  return (ticks(kernel) + ticks(user)) * 1e-7;
+#else
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+// Small stable ids for trace events (tid 0 is the first thread to record).
+unsigned threadIndex() {
+  static std::atomic<unsigned> next{0};
+  thread_local unsigned index = next.fetch_add(1);
+  return index;
+}
+
+} // namespace
+
+void TimeReport::noteAllocation() {
+  if (countAllocations.load(std::memory_order_relaxed)) {
+    processAllocations.fetch_add(1, std::memory_order_relaxed);
+    ++threadAllocations;
+  }
+}
+
+namespace detail {
+
+void *countedAlloc(std::size_t size) {
+  TimeReport::noteAllocation();
+  return std::malloc(size ? size : 1);
+}
+
+void countedFree(void *p) noexcept { std::free(p); }
+
+} // namespace detail
+
+uint64_t TimeReport::allocationCount() {
+  return processAllocations.load(std::memory_order_relaxed);
+}
+
+uint64_t TimeReport::threadAllocationCount() { return threadAllocations; }
+
+long TimeReport::peakRssKB() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024; // Bytes on macOS
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+TimeReport::TimeReport() : origin(std::chrono::steady_clock::now()) {
+  countAllocations.store(true, std::memory_order_relaxed);
+}
+
+TimeReport::Region::Region(TimeReport *r, std::string n, Kind k)
+    : report(r), name(std::move(n)), kind(k) {
+  if (!report)
+    return;
+  bool phase = kind == Kind::Phase;
+  cpuStart = phase ? processCpuSeconds() : threadCpuSeconds();
+  allocStart = phase ? allocationCount() : threadAllocationCount();
+  wallStart = std::chrono::steady_clock::now();
+}
+
+TimeReport::Region::~Region() {
+  if (!report)
+    return;
+  auto wallEnd = std::chrono::steady_clock::now();
+  bool phase = kind == Kind::Phase;
+  Event e;
+  e.name = std::move(name);
+  e.kind = kind;
+  e.start = std::chrono::duration<double>(wallStart - report->origin).count();
+  e.wall = std::chrono::duration<double>(wallEnd - wallStart).count();
+  e.cpu = (phase ? processCpuSeconds() : threadCpuSeconds()) - cpuStart;
+  e.allocations =
+      (phase ? allocationCount() : threadAllocationCount()) - allocStart;
+  e.peakRss = peakRssKB();
+  e.thread = threadIndex();
+  report->record(std::move(e));
+}
+
+void TimeReport::record(Event event) {
+  std::lock_guard<std::mutex> guard(lock);
+  events.push_back(std::move(event));
+}
+
+void TimeReport::print(std::ostream &os) const {
+  struct Row {
+    std::string name;
+    Kind kind;
+    int calls = 0;
+    double wall = 0, cpu = 0;
+    uint64_t allocations = 0;
+    long peakRss = 0;
+  };
+
+  std::vector<Row> rows;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (const auto &e : events) {
+      Row *row = nullptr;
+      for (auto &r : rows)
+        if (r.name == e.name && r.kind == e.kind)
+          row = &r;
+      if (!row) {
+        rows.push_back({e.name, e.kind});
+        row = &rows.back();
+      }
+      ++row->calls;
+      row->wall += e.wall;
+      row->cpu += e.cpu;
+      row->allocations += e.allocations;
+      row->peakRss = std::max(row->peakRss, e.peakRss);
+    }
+  }
+
+  auto line = [&os](const char *name, int calls, double wall, double cpu,
+                    uint64_t allocations, long peakRss) {
+    char count[16] = "";
+    if (calls > 0)
+      std::snprintf(count, sizeof(count), "%d", calls);
+    char buf[160];
+    std::snprintf(buf, sizeof(buf), "  %10.3f %10.3f %10llu %10ld %6s  %s\n",
+                  wall * 1e3, cpu * 1e3,
+                  static_cast<unsigned long long>(allocations), peakRss, count,
+                  name);
+    os << buf;
+  };
+
+  os << "===-------------------------------------------------------===\n"
+     << "                    Optimix time report\n"
+     << "===-------------------------------------------------------===\n";
+  for (Kind kind : {Kind::Phase, Kind::Pass}) {
+    bool any = false;
+    double wall = 0, cpu = 0;
+    uint64_t allocations = 0;
+    long peakRss = 0;
+    for (const auto &r : rows) {
+      if (r.kind != kind)
+        continue;
+      if (!any) {
+        os << (kind == Kind::Phase ? "Phases" : "\nPasses (summed over "
+                                                "functions, per thread)")
+           << ":\n   Wall (ms)   CPU (ms)     Allocs   RSS (KB)  Calls  "
+              "Name\n";
+        any = true;
+      }
+      line(r.name.c_str(), r.calls, r.wall, r.cpu, r.allocations, r.peakRss);
+      wall += r.wall;
+      cpu += r.cpu;
+      allocations += r.allocations;
+      peakRss = std::max(peakRss, r.peakRss);
+    }
+    if (any && kind == Kind::Phase)
+      line("Total", 0, wall, cpu, allocations, peakRss);
+  }
+}
+
+void TimeReport::writeTrace(std::ostream &os) const {
+  auto escape = [](const std::string &s) {
+    std::string out;
+    for (char c : s) {
+      if (c == '"' || c == '\\')
+        out += '\\';
+      out += c;
+    }
+    return out;
+  };
+
+  std::lock_guard<std::mutex> guard(lock);
+  os << "{\"traceEvents\": [\n";
+  for (size_t i = 0; i < events.size(); ++i) {
+    const Event &e = events[i];
+    char buf[256];
+    std::snprintf(buf, sizeof(buf),
+                  "\"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+                  "\"dur\": %.3f, \"args\": {\"cpu_ms\": %.3f, "
+                  "\"allocations\": %llu, \"peak_rss_kb\": %ld}",
+                  e.thread, e.start * 1e6, e.wall * 1e6, e.cpu * 1e3,
+                  static_cast<unsigned long long>(e.allocations), e.peakRss);
+    os << "  {\"name\": \"" << escape(e.name) << "\", \"cat\": \""
+       << (e.kind == Kind::Phase ? "phase" : "pass") << "\", " << buf << "}"
+       << (i + 1 < events.size() ? ",\n" : "\n");
+  }
+  os << "], \"displayTimeUnit\": \"ms\"}\n";
+}
+
+} // namespace optimix
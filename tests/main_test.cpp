@@ -1,10 +1,42 @@
 #include <iostream>
 
+#include "test_interpreter.h"
+#include "test_ir.h"
 #include "test_lexer.h"
+#include "test_support.h"
 
 int main() {
   std::cout << "Running tests...\n";
   test_basic_tokens();
+  test_tier_up();
+  test_profile();
+  test_dynamic_arrays();
+  test_multidim_arrays();
+  test_superinstructions();
+  test_if_else();
+  test_function_calls();
+  test_thread_pool();
+  test_compilation_cache();
+  test_batch_output_paths();
+  test_time_report();
+  test_diagnostics();
+  test_buffer_pool();
+  test_parallel_pass_manager();
+  test_binary_ir_round_trip();
+  test_text_ir_round_trip();
+  test_profile_guided();
+  test_bounds_check();
+  test_array_arena();
+  test_scalar_replacement();
+  test_instcombine();
+  test_simplify_cfg();
+  test_if_conversion();
+  test_out_of_ssa();
+  test_loop_fusion();
+  test_loop_nest();
+  test_parallelize();
+  test_memoize();
+  test_partial_evaluation();
   std::cout << "All tests passed!\n";
   return 0;
 }
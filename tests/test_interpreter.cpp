@@ -0,0 +1,435 @@
+#include "optimix/codegen/IRInterpreter.h"
+#include "optimix/codegen/Interpreter.h"
+#include "optimix/driver/Pipeline.h"
+#include "optimix/ir/IRParser.h"
+#include "optimix/lexer/Lexer.h"
+#include "optimix/parser/Parser.h"
+#include "optimix/support/DeepStack.h"
+#include <cassert>
+#include <functional>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Runs main of 'source' in the AST interpreter and returns "<prints>|<result>".
+std::string runTiered(const std::string &source, int threshold,
+                      int *tierUps = nullptr) {
+  optimix::Lexer lexer(source);
+  optimix::Parser parser(lexer);
+  auto program = parser.parseProgram();
+
+  std::ostringstream out;
+  auto *old = std::cout.rdbuf(out.rdbuf());
+  optimix::Interpreter interpreter;
+  interpreter.setTierUpThreshold(threshold);
+  interpreter.setProgram(program.get());
+  int result = interpreter.execute(*program->getFunction("main"));
+  std::cout.rdbuf(old);
+
+  if (tierUps)
+    *tierUps = interpreter.tierUpCount();
+  return out.str() + "|" + std::to_string(result);
+}
+
+} // namespace
+
+void test_tier_up() {
+  // Nested loops sharing an array, plus a return from inside a hot loop.
+  std::string source = "int main() {"
+                       "  int arr[4]; int total = 0; int i = 0;"
+                       "  while (i < 20) {"
+                       "    int j = 0;"
+                       "    while (j < 4) {"
+                       "      arr[j] = arr[j] + i * j;"
+                       "      total = total + arr[j];"
+                       "      j = j + 1;"
+                       "    }"
+                       "    i = i + 1;"
+                       "  }"
+                       "  print(total);"
+                       "  int k = 0;"
+                       "  while (k < 100) {"
+                       "    k = k + 1;"
+                       "    while (k > 40) { return k + total; }"
+                       "  }"
+                       "  return 0;"
+                       "}";
+
+  int tierUps = 0;
+  std::string reference = runTiered(source, 0, &tierUps);
+  assert(tierUps == 0);
+  assert(reference == "7980\n|8021");
+
+  for (int threshold : {1, 2, 3, 10}) {
+    assert(runTiered(source, threshold, &tierUps) == reference);
+    assert(tierUps > 0);
+  }
+
+  std::cout << "test_tier_up passed!\n";
+}
+
+void test_profile() {
+  std::string source = "int main() {\n"
+                       "  int i = 0;\n"
+                       "  int s = 0;\n"
+                       "  while (i < 10) {\n"
+                       "    s = s + i;\n"
+                       "    i = i + 1;\n"
+                       "  }\n"
+                       "  return s;\n"
+                       "}\n";
+  auto compiled = optimix::driver::compileSource(source);
+  optimix::ir::Profile profile;
+  optimix::IRInterpreter interpreter;
+  interpreter.setProfile(&profile);
+  for (int run = 0; run < 2; ++run)
+    assert(interpreter.execute(*compiled.module->getFunction("main")) == 45);
+
+  // Two runs accumulate into one function profile.
+  assert(profile.functions.size() == 1);
+  const auto &fp = profile.functions[0];
+  assert(fp.getBlock("loop_L0")->count == 22);
+  assert(fp.getBlock("loop_L0")->line == 4);
+  assert(fp.getBlock("loop_body_L1")->count == 20);
+  assert(fp.edgeCount("loop_body_L1", "loop_L0") == 20);
+  assert(fp.edgeCount("loop_L0", "loop_exit_L2") == 2);
+  assert(fp.branches.size() == 1);
+  assert(fp.branches[0].taken == 20 && fp.branches[0].notTaken == 2);
+  assert(fp.lines.at(5) == 20); // ADD (MOV coalesced), 10 iterations, 2 runs
+  assert(profile.opcodes.at("RET") == 2);
+
+  std::stringstream file;
+  profile.write(file);
+  auto loaded = optimix::ir::Profile::read(file);
+  std::stringstream again;
+  loaded.write(again);
+  assert(again.str() == file.str());
+
+  std::stringstream report;
+  profile.printReport(report, &source);
+  assert(report.str().find("s = s + i;") != std::string::npos);
+
+  for (const char *bad : {"", "not a profile\n",
+                          "optimix-profile 1\nblock x 1 2 3\n",
+                          "optimix-profile 1\nfunction f\nedge a b\n"}) {
+    std::istringstream in(bad);
+    bool rejected = false;
+    try {
+      optimix::ir::Profile::read(in);
+    } catch (const std::runtime_error &) {
+      rejected = true;
+    }
+    assert(rejected);
+  }
+
+  std::cout << "test_profile passed!\n";
+}
+
+void test_dynamic_arrays() {
+  // Sizes computed at run time, redeclared on every iteration with a size
+  // that grows; every tier must agree.
+  std::string source = "int main() {"
+                       "  int n = 5; int total = 0; int r = 0;"
+                       "  while (r < 30) {"
+                       "    int temp[n + r / 10];"
+                       "    int i = 0;"
+                       "    while (i < n + r / 10) {"
+                       "      temp[i] = temp[i] + i * r;"
+                       "      i = i + 1;"
+                       "    }"
+                       "    total = total + temp[n + r / 10 - 1];"
+                       "    r = r + 1;"
+                       "  }"
+                       "  return total;"
+                       "}";
+  std::string reference = runTiered(source, 0);
+  assert(reference == "|2375");
+  for (int threshold : {1, 3})
+    assert(runTiered(source, threshold) == reference);
+  auto compiled = optimix::driver::compileSource(source);
+  assert(optimix::IRInterpreter().execute(
+             *compiled.module->getFunction("main")) == 2375);
+
+  optimix::Lexer lexer("int main() { int n = 2; int a[n - 3]; return 0; }");
+  optimix::Parser parser(lexer);
+  auto ast = parser.parseTopLevel();
+  bool negative = false;
+  try {
+    optimix::Interpreter().execute(*ast);
+  } catch (const std::runtime_error &e) {
+    negative = std::string(e.what()) == "Negative array size";
+  }
+  assert(negative);
+
+  std::cout << "test_dynamic_arrays passed!\n";
+}
+
+void test_multidim_arrays() {
+  // Row-major layout: m[i][j] and the flat element i * 4 + j are the same
+  // cell, and a 3-D array with a run-time extent agrees in every tier.
+  std::string source = "int main() {"
+                       "  int n = 3; int m[n][4]; int i = 0;"
+                       "  while (i < n) {"
+                       "    int j = 0;"
+                       "    while (j < 4) { m[i][j] = i * 10 + j; j = j + 1; }"
+                       "    i = i + 1;"
+                       "  }"
+                       "  print(m[2][3]);"
+                       "  int c[2][n][2]; c[1][2][1] = 7; c[0][1][0] = 5;"
+                       "  print(c[1][2][1] + c[0][1][0] + c[0][0][1]);"
+                       "  return m[0][5];"
+                       "}";
+  std::string reference = runTiered(source, 0);
+  assert(reference == "23\n12\n|11");
+  assert(runTiered(source, 1) == reference);
+  auto compiled = optimix::driver::compileSource(source);
+  std::ostringstream out;
+  auto *old = std::cout.rdbuf(out.rdbuf());
+  int result =
+      optimix::IRInterpreter().execute(*compiled.module->getFunction("main"));
+  std::cout.rdbuf(old);
+  assert(out.str() + "|" + std::to_string(result) == reference);
+
+  auto fails = [](const std::string &source, const std::string &message) {
+    try {
+      optimix::Lexer lexer(source);
+      optimix::Parser parser(lexer);
+      auto ast = parser.parseTopLevel();
+      optimix::Interpreter().execute(*ast);
+    } catch (const std::runtime_error &e) {
+      return std::string(e.what()) == message;
+    }
+    return false;
+  };
+  assert(fails("int main() { int m[2][2]; return m[1]; }",
+               "Array m has 2 dimensions, not 1"));
+  // -2 * -2 would be a valid size; each extent is checked on its own.
+  assert(fails("int main() { int n = 0 - 2; int m[n][n]; return 0; }",
+               "Negative array size"));
+
+  std::cout << "test_multidim_arrays passed!\n";
+}
+
+void test_superinstructions() {
+  // Loops with every fused sequence: compare-and-branch, increments, a
+  // load feeding an add, and constant-offset loads and stores.
+  std::string source = "int main() {\n"
+                       "  int a[64]; int i = 0;\n"
+                       "  while (i < 63) { a[i + 1] = a[i] + i; i = i + 1; }\n"
+                       "  int s = 0; int j = 1;\n"
+                       "  while (j < 64) { s = s + a[j] - a[j - 1]; "
+                       "j = j + 1; }\n"
+                       "  int k = 10;\n"
+                       "  while (k > 0) { print(s + k); k = k - 3; }\n"
+                       "  return s;\n"
+                       "}\n";
+  auto compiled = optimix::driver::compileSource(source);
+  const auto &main = *compiled.module->getFunction("main");
+  auto run = [&](optimix::ir::Profile *profile, uint64_t &executed) {
+    std::ostringstream out;
+    optimix::OutputBuffer buffer(out);
+    optimix::IRInterpreter interpreter;
+    interpreter.setOutput(&buffer);
+    interpreter.setProfile(profile); // Profiling runs unfused code
+    int result = interpreter.execute(main);
+    buffer.flush();
+    executed = interpreter.executedCount();
+    return out.str() + "|" + std::to_string(result);
+  };
+  optimix::ir::Profile profile;
+  uint64_t plain = 0, fused = 0;
+  std::string expected = run(&profile, plain);
+  assert(expected == "1963\n1960\n1957\n1954\n|1953");
+  assert(run(nullptr, fused) == expected);
+  // A quarter fewer dispatches (copies are already coalesced away).
+  assert(fused * 4 < plain * 3);
+
+  // The temp of an offset access may be the index itself.
+  auto module = optimix::ir::parseIR("Function main:\n"
+                                     "entry:\n"
+                                     "  ALLOCA a, 4\n"
+                                     "  MOV i, 1\n"
+                                     "  STORE a, 2, 7\n"
+                                     "  ADD i, i, 1\n"
+                                     "  LOAD_UNCHECKED x, a, i\n"
+                                     "  ADD i, i, 1\n"
+                                     "  STORE_UNCHECKED a, i, i\n"
+                                     "  LOAD y, a, 3\n"
+                                     "  MUL z, x, y\n"
+                                     "  ADD z, z, i\n"
+                                     "  RET z\n");
+  assert(optimix::IRInterpreter().execute(*module->getFunction("main")) ==
+         24);
+
+  std::cout << "test_superinstructions passed!\n";
+}
+
+void test_if_else() {
+  // Diamonds and triangles that if-conversion turns into SELECTs, an
+  // else-if chain with a PRINT that it must leave alone, and a return
+  // from inside an if; every tier must agree.
+  std::string source = "int main() {\n"
+                       "  int i = 0; int evens = 0; int odds = 0;\n"
+                       "  int big = 0; int hi = 0;\n"
+                       "  while (i < 20) {\n"
+                       "    if (i / 2 * 2 == i) { evens = evens + i; }\n"
+                       "    else { odds = odds + 1; }\n"
+                       "    if (i > 15) { big = big + 1; }\n"
+                       "    if (i < 5) {\n"
+                       "      hi = hi + 1;\n"
+                       "    } else if (i == 12) {\n"
+                       "      print(i);\n"
+                       "    } else {\n"
+                       "      hi = hi - 1;\n"
+                       "    }\n"
+                       "    i = i + 1;\n"
+                       "  }\n"
+                       "  print(hi);\n"
+                       "  if (big > 3) { return evens * 100 + odds; }\n"
+                       "  return 0;\n"
+                       "}\n";
+  std::string reference = runTiered(source, 0);
+  assert(reference == "12\n-9\n|9010");
+  for (int threshold : {1, 3})
+    assert(runTiered(source, threshold) == reference);
+
+  auto compiled = optimix::driver::compileSource(source);
+  std::ostringstream ir;
+  compiled.module->print(ir);
+  assert(ir.str().find("SELECT") != std::string::npos);
+  std::ostringstream out;
+  optimix::OutputBuffer buffer(out);
+  optimix::IRInterpreter interpreter;
+  interpreter.setOutput(&buffer);
+  int result = interpreter.execute(*compiled.module->getFunction("main"));
+  buffer.flush();
+  assert(out.str() + "|" + std::to_string(result) == reference);
+
+  std::cout << "test_if_else passed!\n";
+}
+
+void test_function_calls() {
+  // Recursion, mutual recursion, a void function that prints, a recursive
+  // function whose array must survive its inner calls, calls with arrays of
+  // their own in array indices and stored values, and calls from a loop hot
+  // enough to be finished by the IR engine; every tier must agree.
+  std::string source = "int fib(int n) {\n"
+                       "  if (n < 2) { return n; }\n"
+                       "  return fib(n - 1) + fib(n - 2);\n"
+                       "}\n"
+                       "int isEven(int n) {\n"
+                       "  if (n == 0) { return 1; }\n"
+                       "  return isOdd(n - 1);\n"
+                       "}\n"
+                       "int isOdd(int n) {\n"
+                       "  if (n == 0) { return 0; }\n"
+                       "  return isEven(n - 1);\n"
+                       "}\n"
+                       "int total(int n) {\n"
+                       "  int a[n + 1]; int i = 0;\n"
+                       "  while (i < n + 1) { a[i] = i * 2; i = i + 1; }\n"
+                       "  int rest = 0;\n"
+                       "  if (n > 0) { rest = total(n - 1); }\n"
+                       "  return a[n] + rest;\n"
+                       "}\n"
+                       "void report(int x, int y) { print(x * 1000 + y); }\n"
+                       "int fill(int n) {\n"
+                       "  int b[n + 1]; b[n] = n;\n"
+                       "  return b[n];\n"
+                       "}\n"
+                       "int main() {\n"
+                       "  int i = 0; int s = 0;\n"
+                       "  while (i < 30) { s = s + fib(i / 3); i = i + 1; }\n"
+                       "  report(s, isEven(7));\n"
+                       "  int c[3]; c[0] = 1; c[fill(2)] = fill(1) + 5;\n"
+                       "  print(c[fill(2)] * 10 + c[fill(0)]);\n"
+                       "  print(total(40));\n"
+                       "  return fib(18);\n"
+                       "}\n";
+  std::string reference = runTiered(source, 0);
+  assert(reference == "264000\n61\n1640\n|2584");
+  for (int threshold : {1, 3})
+    assert(runTiered(source, threshold) == reference);
+
+  auto compiled = optimix::driver::compileSource(source);
+  std::ostringstream out;
+  optimix::OutputBuffer buffer(out);
+  optimix::IRInterpreter interpreter;
+  interpreter.setOutput(&buffer);
+  interpreter.setModule(compiled.module.get());
+  int result = interpreter.execute(*compiled.module->getFunction("main"));
+  buffer.flush();
+  assert(out.str() + "|" + std::to_string(result) == reference);
+
+  // Runaway recursion fails in both tiers instead of crashing.
+  std::string endless = "int down(int n) { return down(n + 1); }\n"
+                        "int main() { return down(0); }\n";
+  optimix::Lexer lexer(endless);
+  optimix::Parser parser(lexer);
+  auto program = parser.parseProgram();
+  optimix::Interpreter tree;
+  tree.setProgram(program.get());
+  bool failed = false;
+  try {
+    tree.execute(*program->getFunction("main"));
+  } catch (const std::runtime_error &) {
+    failed = true;
+  }
+  assert(failed);
+  auto deep = optimix::driver::compileSource(endless);
+  optimix::IRInterpreter engine;
+  engine.setModule(deep.module.get());
+  optimix::ExecState state;
+  failed = false;
+  try {
+    engine.execute(*deep.module->getFunction("main"), state);
+  } catch (const std::runtime_error &) {
+    failed = true;
+  }
+  assert(failed);
+
+  // Both tiers make exactly their limit of nested calls and fail one past
+  // it, on a stack of their own: the caller here has 256 KB.
+  auto nested = [](int calls) {
+    return "int down(int n) {\n"
+           "  if (n == 0) { return 0; }\n"
+           "  return down(n - 1) + 1;\n"
+           "}\n"
+           "int main() { return down(" +
+           std::to_string(calls - 1) + "); }\n";
+  };
+  auto runTree = [](const std::string &source) {
+    optimix::Lexer lexer(source);
+    optimix::Parser parser(lexer);
+    auto program = parser.parseProgram();
+    optimix::Interpreter tree;
+    tree.setProgram(program.get());
+    return tree.execute(*program->getFunction("main"));
+  };
+  auto runEngine = [](const std::string &source) {
+    auto compiled = optimix::driver::compileSource(source);
+    optimix::IRInterpreter engine;
+    engine.setModule(compiled.module.get());
+    optimix::ExecState state;
+    return engine.execute(*compiled.module->getFunction("main"), state);
+  };
+  auto overflows = [](const std::function<void()> &run) {
+    try {
+      run();
+    } catch (const std::runtime_error &e) {
+      return std::string(e.what()) == "Call stack overflow";
+    }
+    return false;
+  };
+  optimix::DeepStack::run(256 * 1024, [&] {
+    const int treeLimit = optimix::Interpreter::kMaxCallDepth;
+    assert(runTree(nested(treeLimit)) == treeLimit - 1);
+    assert(overflows([&] { runTree(nested(treeLimit + 1)); }));
+    const int engineLimit = optimix::IRInterpreter::kMaxCallDepth;
+    assert(runEngine(nested(engineLimit)) == engineLimit - 1);
+    assert(overflows([&] { runEngine(nested(engineLimit + 1)); }));
+  });
+
+  std::cout << "test_function_calls passed!\n";
+}
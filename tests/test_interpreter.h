@@ -0,0 +1,9 @@
+#pragma once
+
+void test_tier_up();
+void test_profile();
+void test_dynamic_arrays();
+void test_multidim_arrays();
+void test_superinstructions();
+void test_if_else();
+void test_function_calls();
@@ -0,0 +1,1139 @@
+#include "optimix/codegen/IRInterpreter.h"
+#include "optimix/driver/Pipeline.h"
+#include "optimix/ir/BinaryIR.h"
+#include "optimix/ir/IRBuilder.h"
+#include "optimix/ir/IRParser.h"
+#include "optimix/ir/InstCombine.h"
+#include "optimix/ir/PassManager.h"
+#include "optimix/ir/PassRegistry.h"
+#include "optimix/ir/ProfileGuided.h"
+#include "optimix/lexer/Lexer.h"
+#include "optimix/parser/Parser.h"
+#include "optimix/support/ThreadPool.h"
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+std::string manyFunctions(int count) {
+  std::string source;
+  for (int f = 0; f < count; ++f) {
+    std::string n = std::to_string(f);
+    source += "int f" + n + "(int x) { int i = 0; int s = " + n +
+              "; while (i < 10) { s = s + i * " + n +
+              "; i = i + 1; } return s; }\n";
+  }
+  source += "int main() { return 0; }\n";
+  return source;
+}
+
+std::string printed(const optimix::ir::Module &module) {
+  std::ostringstream os;
+  module.print(os);
+  return os.str();
+}
+
+// Appends a marker to the entry block of every function it sees.
+class MarkPass : public optimix::ir::FunctionPass {
+public:
+  const char *name() const override { return "mark"; }
+  void run(optimix::ir::Function &func) const override {
+    optimix::ir::Instruction inst(optimix::ir::OpCode::PRINT,
+                                  {optimix::ir::Operand::CONSTANT, ""});
+    inst.operands = {optimix::ir::Operand::makeConst(7)};
+    func.blocks.front()->addInst(inst);
+  }
+};
+
+// Checks that the preceding stage has finished on every function.
+class BarrierCheck : public optimix::ir::ModulePass {
+public:
+  std::atomic<int> *seen;
+  explicit BarrierCheck(std::atomic<int> *s) : seen(s) {}
+  const char *name() const override { return "barrier-check"; }
+  void run(optimix::ir::Module &module) const override {
+    for (const auto &f : module.functions) {
+      const auto &last = f->blocks.front()->instructions.back();
+      assert(last.op == optimix::ir::OpCode::PRINT);
+      ++*seen;
+    }
+  }
+};
+
+} // namespace
+
+void test_parallel_pass_manager() {
+  std::string source = manyFunctions(64);
+  auto sequential = optimix::driver::compileSource(source);
+  optimix::ThreadPool pool(4);
+  auto parallel = optimix::driver::compileSource(source, &pool);
+  assert(parallel.module->functions.size() == 65);
+  assert(printed(*sequential.module) == printed(*parallel.module));
+
+  std::atomic<int> seen{0};
+  optimix::ir::PassManager pm;
+  pm.addPass(std::make_unique<MarkPass>());
+  pm.addPass(std::make_unique<BarrierCheck>(&seen));
+  pm.run(*parallel.module, &pool);
+  assert(seen == 65);
+
+  std::cout << "test_parallel_pass_manager passed!\n";
+}
+
+void test_binary_ir_round_trip() {
+  // Parameters, calls and a memoized function survive as well.
+  std::string source = manyFunctions(3) + "int g() { int a[4]; a[1] = 0 - 7; "
+                                          "print(a[1]); return f1(a[1]); }\n"
+                                          "int h(int n) { if (n > 0) { "
+                                          "return h(n - 1); } return n; }\n";
+  auto compiled = optimix::driver::compileSource(source);
+  std::string bytes = optimix::ir::writeBinary(*compiled.module);
+
+  auto loaded = optimix::ir::readBinary(bytes.data(), bytes.size());
+  assert(printed(*loaded) == printed(*compiled.module));
+  // SSA versions survive, not just the printed names.
+  assert(optimix::ir::writeBinary(*loaded) == bytes);
+
+  // Truncation and corruption are rejected, not executed.
+  for (size_t cut : {size_t(0), size_t(10), bytes.size() / 2,
+                     bytes.size() - 1}) {
+    bool rejected = false;
+    try {
+      optimix::ir::readBinary(bytes.data(), cut);
+    } catch (const std::runtime_error &) {
+      rejected = true;
+    }
+    assert(rejected);
+  }
+  std::string wrongVersion = bytes;
+  wrongVersion[4] = 99;
+  bool rejected = false;
+  try {
+    optimix::ir::readBinary(wrongVersion.data(), wrongVersion.size());
+  } catch (const std::runtime_error &) {
+    rejected = true;
+  }
+  assert(rejected);
+
+  // A huge count or index in any field is rejected, not allocated.
+  for (size_t at = 0; at + 4 <= bytes.size(); at += 4) {
+    std::string corrupt = bytes;
+    uint32_t huge = 0x7FFFFFF0;
+    std::memcpy(&corrupt[at], &huge, sizeof(huge));
+    try {
+      optimix::ir::readBinary(corrupt.data(), corrupt.size());
+    } catch (const std::runtime_error &) {
+    }
+  }
+
+  // Loaded IR is not trusted to keep its accesses in bounds: the store
+  // is checked and faults instead of writing past the array.
+  auto outside = optimix::ir::parseIR("Function main:\n"
+                                      "entry:\n"
+                                      "  ALLOCA arr, 4\n"
+                                      "  STORE_UNCHECKED arr, 100000000, 7\n"
+                                      "  RET 0\n");
+  auto store = [](const optimix::ir::Module &module) {
+    return std::next(module.functions[0]->blocks.front()->instructions.begin())
+        ->op;
+  };
+  assert(store(*outside) == optimix::ir::OpCode::STORE);
+  assert(optimix::IRInterpreter().execute(*outside->functions[0]) == -1);
+  std::next(outside->functions[0]->blocks.front()->instructions.begin())->op =
+      optimix::ir::OpCode::STORE_UNCHECKED;
+  std::string oxb = optimix::ir::writeBinary(*outside);
+  assert(store(*optimix::ir::readBinary(oxb.data(), oxb.size())) ==
+         optimix::ir::OpCode::STORE);
+  assert(store(*optimix::ir::readBinary(oxb.data(), oxb.size(), true)) ==
+         optimix::ir::OpCode::STORE_UNCHECKED);
+
+  std::cout << "test_binary_ir_round_trip passed!\n";
+}
+
+void test_text_ir_round_trip() {
+  std::string source = manyFunctions(2) + "int g() { int a[4]; a[1] = 3; "
+                                          "print(a[1]); return f1(a[1]); }\n"
+                                          "int h(int n) { if (n > 0) { "
+                                          "return h(n - 1); } return n; }\n";
+  auto compiled = optimix::driver::compileSource(source);
+  std::string text = printed(*compiled.module);
+
+  auto parsed = optimix::ir::parseIR(text);
+  assert(printed(*parsed) == text);
+  // Versions are parsed back, not kept as part of the name. Source lines are
+  // not part of the text form.
+  for (auto &f : compiled.module->functions)
+    for (auto &bb : f->blocks)
+      for (auto &inst : bb->instructions)
+        inst.line = 0;
+  assert(optimix::ir::writeBinary(*parsed) ==
+         optimix::ir::writeBinary(*compiled.module));
+
+  // Comments and blank lines are ignored; a pipeline runs on parsed IR.
+  auto small = optimix::ir::parseIR("; hand-written\n"
+                                    "Function main:\n"
+                                    "entry:\n"
+                                    "  MOV x, 1   ; x = 1\n"
+                                    "\n"
+                                    "  MOV x, 2\n"
+                                    "  ADD t0, x, 2\n"
+                                    "  RET t0\n");
+  optimix::ir::parsePipeline("ssa").run(*small);
+  assert(printed(*small).find("ADD t0.1, x.2, 2") != std::string::npos);
+
+  auto rejects = [](const std::string &ir) {
+    try {
+      optimix::ir::parseIR(ir);
+    } catch (const std::runtime_error &) {
+      return true;
+    }
+    return false;
+  };
+  assert(rejects("  MOV x, 1\n"));                        // No function
+  assert(rejects("Function f:\nentry:\n  FROB x, 1\n")); // Unknown opcode
+  assert(rejects("Function f:\nentry:\n  ADD x, 1\n"));  // Missing operand
+
+  bool unknownPass = false;
+  try {
+    optimix::ir::parsePipeline("ssa,nosuchpass");
+  } catch (const std::runtime_error &) {
+    unknownPass = true;
+  }
+  assert(unknownPass);
+
+  std::cout << "test_text_ir_round_trip passed!\n";
+}
+
+namespace {
+
+// Runs main with stdout captured; returns "<prints>|<result>".
+std::string runMain(const optimix::ir::Module &module,
+                    optimix::ir::Profile *profile = nullptr,
+                    optimix::ThreadPool *pool = nullptr) {
+  std::ostringstream out;
+  auto *old = std::cout.rdbuf(out.rdbuf());
+  optimix::IRInterpreter interpreter;
+  interpreter.setProfile(profile);
+  interpreter.setThreadPool(pool);
+  interpreter.setModule(&module);
+  int result = interpreter.execute(*module.getFunction("main"));
+  std::cout.rdbuf(old);
+  return out.str() + "|" + std::to_string(result);
+}
+
+} // namespace
+
+void test_profile_guided() {
+  std::string source = "int main() {\n"
+                       "  int a[64]; int i = 0; int s = 0;\n"
+                       "  while (i < 64) { a[i] = i * 3; i = i + 1; }\n"
+                       "  int j = 0;\n"
+                       "  while (j < 63) { s = s + a[j] - a[j + 1]; "
+                       "j = j + 1; }\n"
+                       "  int k = 0;\n"
+                       "  while (k < 3) { print(s + k); k = k + 1; }\n"
+                       "  return s;\n"
+                       "}\n";
+  auto plain = optimix::driver::compileSource(source);
+  optimix::ir::Profile profile;
+  std::string expected = runMain(*plain.module, &profile);
+  assert(expected == "-189\n-188\n-187\n|-189");
+
+  // Hot loops with long trips are unrolled; the 3-trip loop is not.
+  auto ast = optimix::driver::compileSource(source).ast;
+  auto module = optimix::IRBuilder().generate(*ast);
+  optimix::driver::defaultPipeline(&profile).run(*module);
+  std::string text = printed(*module);
+  assert(text.find("loop_body_L1_u1:") != std::string::npos);
+  assert(text.find("loop_body_L4_u1:") != std::string::npos);
+  assert(text.find("loop_body_L7_u1:") == std::string::npos);
+  assert(runMain(*module) == expected);
+
+  // Layout puts each hot loop body right after its header.
+  const optimix::ir::Function &fn = *module->getFunction("main");
+  std::string previous;
+  for (const auto &bb : fn.blocks) {
+    if (bb->label == "loop_body_L4")
+      assert(previous == "loop_L3");
+    previous = bb->label;
+  }
+
+  // A profile recorded for other code is ignored.
+  auto other = optimix::driver::compileSource(
+      "int main() { int x = 0; while (x < 100) { x = x + 1; } return x; }");
+  optimix::ir::Profile stale;
+  runMain(*other.module, &stale);
+  auto unchanged = optimix::IRBuilder().generate(*ast);
+  auto reference = optimix::IRBuilder().generate(*ast);
+  optimix::driver::defaultPipeline(&stale).run(*unchanged);
+  optimix::driver::defaultPipeline().run(*reference);
+  assert(printed(*unchanged) == printed(*reference));
+
+  std::cout << "test_profile_guided passed!\n";
+}
+
+void test_bounds_check() {
+  // Constant trip counts: every access is proven and the checks go away.
+  auto proven = optimix::driver::compileSource(
+      "int main() {\n"
+      "  int a[16]; int i = 0; int s = 0;\n"
+      "  while (i < 16) { a[i] = i; i = i + 1; }\n"
+      "  int j = 1;\n"
+      "  while (j < 16) { s = s + a[j] * a[j - 1]; j = j + 1; }\n"
+      "  return s;\n"
+      "}\n");
+  std::string text = printed(*proven.module);
+  assert(text.find("STORE_UNCHECKED a") != std::string::npos);
+  assert(text.find("LOAD_UNCHECKED") != std::string::npos);
+  assert(text.find("LOAD t") == std::string::npos);
+  assert(text.find("INBOUNDS") == std::string::npos);
+  assert(runMain(*proven.module) == "|1120");
+
+  // A bound only known at run time: the loop is versioned on one INBOUNDS
+  // test, and either copy gives the same answer as before.
+  auto versioned = [](int n) {
+    return "int main() {\n"
+           "  int a[32]; a[0] = " +
+           std::to_string(n) +
+           ";\n"
+           "  int n = a[0]; int i = 0; int s = 0;\n"
+           "  while (i < n) { a[i + 1] = i; s = s + a[i]; i = i + 1; }\n"
+           "  return s;\n"
+           "}\n";
+  };
+  auto fast = optimix::driver::compileSource(versioned(20));
+  text = printed(*fast.module);
+  assert(text.find("INBOUNDS") != std::string::npos);
+  assert(text.find("loop_body_L1_unchecked:") != std::string::npos);
+  assert(runMain(*fast.module) == "|191");
+
+  // Out of range, the checked copy runs and still reports the error.
+  auto slow = optimix::driver::compileSource(versioned(40));
+  std::ostringstream errors;
+  auto *old = std::cerr.rdbuf(errors.rdbuf());
+  int result =
+      optimix::IRInterpreter().execute(*slow.module->getFunction("main"));
+  std::cerr.rdbuf(old);
+  assert(result == -1);
+  assert(errors.str() == "Runtime Error: Index out of bounds.\n");
+
+  // The loop never runs, so its branch gives i the empty range [2, 0];
+  // dividing by it must not divide by zero at compile time.
+  auto unreachable = optimix::driver::compileSource(
+      "int main() {\n"
+      "  int a[10]; int n = 1; int i = 2;\n"
+      "  while (i < n) { a[7 / i] = 1; i = i + 1; }\n"
+      "  return 0;\n"
+      "}\n");
+  assert(runMain(*unreachable.module) == "|0");
+
+  std::cout << "test_bounds_check passed!\n";
+}
+
+void test_array_arena() {
+  // 'b' sits after 'a' in the frame; growing 'a' past its region moves it
+  // instead of overwriting 'b'.
+  auto module = optimix::ir::parseIR("Function main:\n"
+                                     "entry:\n"
+                                     "  MOV n, 2\n"
+                                     "  ALLOCA a, n\n"
+                                     "  ALLOCA b, 3\n"
+                                     "  STORE_UNCHECKED b, 0, 5\n"
+                                     "  MOV n, 8\n"
+                                     "  ALLOCA a, n\n"
+                                     "  STORE_UNCHECKED a, 7, 4\n"
+                                     "  LOAD x, b, 0\n"
+                                     "  LOAD y, a, 7\n"
+                                     "  MUL z, x, y\n"
+                                     "  RET z\n");
+  assert(runMain(*module) == "|20");
+
+  // Arrays handed over by the AST interpreter come back with their
+  // contents and sizes.
+  optimix::ExecState state;
+  state.arrays["b"] = {1, 2, 3};
+  auto osr = optimix::ir::parseIR("Function osr:\n"
+                                  "entry:\n"
+                                  "  ALLOCA a, 2\n"
+                                  "  LOAD_UNCHECKED t, b, 2\n"
+                                  "  STORE_UNCHECKED a, 1, t\n"
+                                  "  STORE b, 0, 9\n");
+  optimix::IRInterpreter().execute(*osr->getFunction("osr"), state);
+  assert((state.arrays["a"] == std::vector<int>{0, 3}));
+  assert((state.arrays["b"] == std::vector<int>{9, 2, 3}));
+
+  std::cout << "test_array_arena passed!\n";
+}
+
+void test_scalar_replacement() {
+  // Constant indices only: the array turns into variables, including
+  // through a MOV of the index and across the loop.
+  auto promoted = optimix::driver::compileSource(
+      "int main() {\n"
+      "  int arr[4]; int k = 2; arr[0] = 3; arr[1] = arr[0] + 4;\n"
+      "  int i = 0; int s = 0;\n"
+      "  while (i < 10) { arr[k] = arr[k] + i; s = s + arr[1]; i = i + 1; }\n"
+      "  print(arr[2]);\n"
+      "  return s + arr[3];\n"
+      "}\n");
+  std::string text = printed(*promoted.module);
+  assert(text.find("ALLOCA") == std::string::npos);
+  assert(text.find("LOAD") == std::string::npos);
+  assert(text.find("STORE") == std::string::npos);
+  assert(text.find("ADD %arr[2], %arr[2], i\n") != std::string::npos);
+  assert(runMain(*promoted.module) == "45\n|70");
+  auto reparsed = optimix::ir::parseIR(text);
+  assert(printed(*reparsed) == text);
+
+  // A variable index, or a constant one past the end, keeps the array.
+  auto kept = optimix::driver::compileSource(
+      "int main() {\n"
+      "  int a[4]; int b[2]; int i = 0;\n"
+      "  while (i < 4) { a[i] = i; i = i + 1; }\n"
+      "  b[0] = 1;\n"
+      "  return a[3] + b[2];\n"
+      "}\n");
+  text = printed(*kept.module);
+  assert(text.find("ALLOCA a, 4") != std::string::npos);
+  assert(text.find("ALLOCA b, 2") != std::string::npos);
+
+  // Elements written before they are read, and unused arrays, are not
+  // zeroed at all.
+  auto unread = optimix::driver::compileSource(
+      "int main() {\n"
+      "  int i = 0; int s = 0;\n"
+      "  while (i < 3000) {\n"
+      "    int t[16]; int b[8]; t[0] = i; s = s + t[0] / 1000; i = i + 1;\n"
+      "  }\n"
+      "  return s;\n"
+      "}\n");
+  text = printed(*unread.module);
+  assert(text.find("ALLOCA") == std::string::npos);
+  assert(text.find("%t[") == std::string::npos);
+  assert(text.find("%b[") == std::string::npos);
+  assert(runMain(*unread.module) == "|3000");
+
+  std::cout << "test_scalar_replacement passed!\n";
+}
+
+void test_instcombine() {
+  auto module = optimix::ir::parseIR("Function main:\n"
+                                     "entry:\n"
+                                     "  MOV k.1, 8\n"
+                                     "  ADD a.1, 0, x\n"
+                                     "  MUL b.1, a.1, 1\n"
+                                     "  ADD c.1, b.1, 3\n"
+                                     "  SUB d.1, c.1, 1\n"
+                                     "  ADD e.1, d.1, 4\n"
+                                     "  MUL f.1, e.1, k.1\n"
+                                     "  MUL g.1, f.1, 4\n"
+                                     "  SUB h.1, g.1, g.1\n"
+                                     "  LT l.1, 5, x\n"
+                                     "  DIV m.1, x, 1\n"
+                                     "  DIV n.1, x, k.1\n"
+                                     "  ADD o.1, x, 1\n"
+                                     "  MOV x.1, 0\n"
+                                     "  ADD p.1, o.1, 1\n"
+                                     "  PRINT p.1\n"
+                                     "  PRINT n.1\n"
+                                     "  PRINT m.1\n"
+                                     "  PRINT l.1\n"
+                                     "  PRINT h.1\n"
+                                     "  RET g.1\n");
+  optimix::ir::createPass("instcombine")->run(*module->getFunction("main"));
+  std::string text = printed(*module);
+  auto has = [&](const char *line) {
+    return text.find(std::string("  ") + line + "\n") != std::string::npos;
+  };
+  assert(has("MOV a.1, x") && has("MOV b.1, a.1")); // 0 + x, a * 1
+  assert(has("SHL g.1, e.1, 5"));                   // (e * k) * 4, k = 8
+  assert(has("ADD e.1, b.1, 6"));                   // ((b + 3) - 1) + 4
+  assert(has("MOV h.1, 0") && has("MOV m.1, x"));   // g - g, x / 1
+  assert(has("GT l.1, x, 5"));
+  assert(has("MULH %div0_hi.1, x, -2147483647"));  // x / k
+  assert(has("SUB n.1, %div0_shr.1, %div0_sign.1"));
+  // x was redefined in between, so o + 1 cannot become x + 2.
+  assert(has("ADD p.1, o.1, 1"));
+  // Dead intermediate steps are gone.
+  assert(text.find("c.1") == std::string::npos);
+  assert(text.find("f.1") == std::string::npos);
+
+  // Division by a constant matches DIV for every divisor kind, with and
+  // without the engine fusing the sequence back into one instruction.
+  auto magic = optimix::ir::signedDivisionMagic(7);
+  assert(magic.multiplier == -1840700269 && magic.shift == 2);
+  magic = optimix::ir::signedDivisionMagic(3);
+  assert(magic.multiplier == 1431655766 && magic.shift == 0);
+  const int divisors[] = {2,   3,  5,   6,    7,    10,      16,     125,
+                          641, -2, -3, -7, -16, 1000, INT_MAX, INT_MIN};
+  const int dividends[] = {0,  1,       -1,      6,          -6,         7,
+                           -7, 999999,  -999999, 2147483646, INT_MAX,
+                           INT_MIN,     -2147483647};
+  for (int d : divisors) {
+    auto div = optimix::ir::parseIR("Function f:\nentry:\n  DIV q, x, " +
+                                    std::to_string(d) + "\n  RET q\n");
+    auto &f = *div->getFunction("f");
+    optimix::ir::createPass("instcombine")->run(f);
+    assert(printed(*div).find("DIV") == std::string::npos);
+    for (int x : dividends) {
+      for (bool profiled : {false, true}) {
+        optimix::ExecState state;
+        state.variables["x"] = x;
+        optimix::ir::Profile profile;
+        optimix::IRInterpreter engine;
+        engine.setProfile(profiled ? &profile : nullptr);
+        assert(engine.execute(f, state) == x / d);
+        if (!profiled)
+          assert(engine.executedCount() == 2); // Fused, then RET
+      }
+    }
+  }
+
+  std::cout << "test_instcombine passed!\n";
+}
+
+void test_simplify_cfg() {
+  auto simplified = [](const std::string &ir) {
+    auto module = optimix::ir::parseIR(ir);
+    for (auto &f : module->functions)
+      optimix::ir::createPass("simplifycfg")->run(*f);
+    return module;
+  };
+  auto run = [](const optimix::ir::Module &module, int n) {
+    optimix::ExecState state;
+    state.variables["n"] = n;
+    std::ostringstream out;
+    optimix::OutputBuffer buffer(out);
+    optimix::IRInterpreter engine;
+    engine.setOutput(&buffer);
+    int result = engine.execute(*module.functions.front(), state);
+    buffer.flush();
+    return out.str() + "|" + std::to_string(result);
+  };
+
+  // A constant branch: the other side goes away and the rest merges into
+  // the entry, its single-entry PHI becoming a MOV.
+  std::string folded = "Function main:\n"
+                       "entry:\n"
+                       "  MOV c.1, 0\n"
+                       "  JMP_IF dead, c.1\n"
+                       "  JMP a\n"
+                       "dead:\n"
+                       "  PRINT 99\n"
+                       "  JMP a\n"
+                       "a:\n"
+                       "  PHI v.1, 1, entry, 2, dead\n"
+                       "  PRINT v.1\n"
+                       "  RET v.1\n";
+  auto module = simplified(folded);
+  assert(printed(*module) == "Function main:\n"
+                             "entry:\n"
+                             "  MOV c.1, 0\n"
+                             "  MOV v.1, 1\n"
+                             "  PRINT v.1\n"
+                             "  RET v.1\n");
+  assert(run(*module, 0) == "1\n|1");
+
+  // Jump-only blocks are bypassed, and the branch on a PHI that is
+  // constant per predecessor is threaded; 'join' disappears and 'no' is
+  // merged into 'join2'.
+  std::string threaded = "Function main:\n"
+                         "entry:\n"
+                         "  JMP_IF one, n\n"
+                         "  JMP zero\n"
+                         "one:\n"
+                         "  JMP join\n"
+                         "zero:\n"
+                         "  JMP join2\n"
+                         "join2:\n"
+                         "  JMP join\n"
+                         "join:\n"
+                         "  PHI f.1, 1, one, 0, join2\n"
+                         "  JMP_IF yes, f.1\n"
+                         "  JMP no\n"
+                         "yes:\n"
+                         "  PRINT 1\n"
+                         "  RET 1\n"
+                         "no:\n"
+                         "  PRINT 0\n"
+                         "  RET 0\n";
+  module = simplified(threaded);
+  assert(printed(*module) == "Function main:\n"
+                             "entry:\n"
+                             "  JMP_IF yes, n\n"
+                             "join2:\n"
+                             "  PRINT 0\n"
+                             "  RET 0\n"
+                             "yes:\n"
+                             "  PRINT 1\n"
+                             "  RET 1\n");
+  auto original = optimix::ir::parseIR(threaded);
+  for (int n : {0, 1})
+    assert(run(*module, n) == run(*original, n));
+
+  // A PHI joining versions of one variable is renamed away on merging.
+  module = simplified("Function main:\n"
+                      "entry:\n"
+                      "  MOV x.1, 3\n"
+                      "  JMP b\n"
+                      "b:\n"
+                      "  PHI x.2, x.1, entry\n"
+                      "  ADD y.1, x.2, 1\n"
+                      "  RET y.1\n");
+  assert(printed(*module) == "Function main:\n"
+                             "entry:\n"
+                             "  MOV x.1, 3\n"
+                             "  ADD y.1, x.1, 1\n"
+                             "  RET y.1\n");
+
+  // Loops keep their shape and results through the whole pipeline.
+  auto compiled = optimix::driver::compileSource(
+      "int main() {\n"
+      "  int i = 0; int s = 0;\n"
+      "  while (i < 4) { int j = 0; while (j < i) { s = s + j; j = j + 1; }"
+      " i = i + 1; }\n"
+      "  return s;\n"
+      "}\n");
+  assert(runMain(*compiled.module) == "|4");
+  std::string text = printed(*compiled.module);
+  assert(text.find("JMP loop_L0\n") != std::string::npos); // Back edge
+  assert(text.find("JMP loop_L3\n") != std::string::npos);
+
+  std::cout << "test_simplify_cfg passed!\n";
+}
+
+void test_if_conversion() {
+  auto converted = [](const std::string &ir) {
+    auto module = optimix::ir::parseIR(ir);
+    for (auto &f : module->functions)
+      optimix::ir::createPass("ifconvert")->run(*f);
+    return module;
+  };
+  auto run = [](const optimix::ir::Module &module, int n) {
+    optimix::ExecState state;
+    state.variables["n"] = n;
+    std::ostringstream out;
+    optimix::OutputBuffer buffer(out);
+    optimix::IRInterpreter engine;
+    engine.setOutput(&buffer);
+    int result = engine.execute(*module.functions.front(), state);
+    buffer.flush();
+    return out.str() + "|" + std::to_string(result);
+  };
+
+  // A diamond: both arms run in the entry, the copies at their ends are
+  // forwarded, and the sum sits right before the SELECT that reads it.
+  std::string diamond = "Function main:\n"
+                        "entry:\n"
+                        "  GT c.1, n, 0\n"
+                        "  JMP_IF then, c.1\n"
+                        "  JMP else\n"
+                        "then:\n"
+                        "  ADD t.1, n, 5\n"
+                        "  MOV x.1, t.1\n"
+                        "  JMP join\n"
+                        "else:\n"
+                        "  MOV x.2, 7\n"
+                        "  JMP join\n"
+                        "join:\n"
+                        "  PHI x.3, x.1, then, x.2, else\n"
+                        "  PRINT x.3\n"
+                        "  RET x.3\n";
+  auto module = converted(diamond);
+  assert(printed(*module) == "Function main:\n"
+                             "entry:\n"
+                             "  GT c.1, n, 0\n"
+                             "  ADD %if0_t.1, n, 5\n"
+                             "  SELECT x.3, c.1, %if0_t.1, 7\n"
+                             "  PRINT x.3\n"
+                             "  RET x.3\n");
+  auto original = optimix::ir::parseIR(diamond);
+  for (int n : {-4, 0, 3})
+    assert(run(*module, n) == run(*original, n));
+
+  // A triangle inside a loop: the arm redefines x, so it is renamed and
+  // the old x.2 still reaches the SELECT.
+  std::string triangle = "Function main:\n"
+                         "entry:\n"
+                         "  MOV x.1, 0\n"
+                         "  MOV i.1, 0\n"
+                         "loop:\n"
+                         "  PHI x.2, x.1, entry, x.4, join\n"
+                         "  PHI i.2, i.1, entry, i.3, join\n"
+                         "  LT c.1, i.2, n\n"
+                         "  JMP_IF body, c.1\n"
+                         "  RET x.2\n"
+                         "body:\n"
+                         "  GT odd.1, i.2, 2\n"
+                         "  JMP_IF add, odd.1\n"
+                         "  JMP join\n"
+                         "add:\n"
+                         "  ADD x.3, x.2, i.2\n"
+                         "  JMP join\n"
+                         "join:\n"
+                         "  PHI x.4, x.3, add, x.2, body\n"
+                         "  ADD i.3, i.2, 1\n"
+                         "  JMP loop\n";
+  module = converted(triangle);
+  std::string text = printed(*module);
+  assert(text.find("  ADD %if0_x.3, x.2, i.2\n"
+                   "  SELECT x.4, odd.1, %if0_x.3, x.2\n"
+                   "  ADD i.3, i.2, 1\n"
+                   "  JMP loop\n") != std::string::npos);
+  assert(text.find("join") == std::string::npos);
+  original = optimix::ir::parseIR(triangle);
+  for (int n : {0, 3, 10})
+    assert(run(*module, n) == run(*original, n));
+
+  // Left alone: an arm with a side effect, and PHIs that swap two values
+  // (the first SELECT would overwrite what the second reads).
+  for (std::string blocked : {"  PRINT n\n", ""}) {
+    std::string swap = "Function main:\n"
+                       "entry:\n"
+                       "  MOV a.1, 1\n"
+                       "  MOV b.1, 2\n"
+                       "  JMP_IF then, n\n"
+                       "  JMP join\n"
+                       "then:\n" +
+                       blocked +
+                       "  JMP join\n"
+                       "join:\n"
+                       "  PHI a.2, b.1, then, a.1, entry\n"
+                       "  PHI b.2, a.1, then, b.1, entry\n"
+                       "  SUB d.1, a.2, b.2\n"
+                       "  RET d.1\n";
+    module = converted(swap);
+    assert(printed(*module) == printed(*optimix::ir::parseIR(swap)));
+    assert(run(*module, 0) == "|-1");
+  }
+
+  std::cout << "test_if_conversion passed!\n";
+}
+
+void test_out_of_ssa() {
+  auto lowered = [](const std::string &ir) {
+    auto module = optimix::ir::parseIR(ir);
+    for (auto &f : module->functions)
+      optimix::ir::createPass("out-of-ssa")->run(*f);
+    return module;
+  };
+  auto run = [](const optimix::ir::Module &module, int n) {
+    optimix::ExecState state;
+    state.variables["n"] = n;
+    return optimix::IRInterpreter().execute(*module.functions.front(), state);
+  };
+
+  // A rotated loop swapping a and b: the back edge is critical, so its
+  // copies get their own block, and the swap goes through a temporary.
+  // Copies between versions of i vanish, and r's ADD is coalesced.
+  std::string swap = "Function main:\n"
+                     "entry:\n"
+                     "  MOV a.1, 1\n"
+                     "  MOV b.1, 2\n"
+                     "  MOV i.1, 0\n"
+                     "loop:\n"
+                     "  PHI a.2, a.1, entry, b.2, loop\n"
+                     "  PHI b.2, b.1, entry, a.2, loop\n"
+                     "  PHI i.2, i.1, entry, i.3, loop\n"
+                     "  ADD i.3, i.2, 1\n"
+                     "  LT c.1, i.3, n\n"
+                     "  JMP_IF loop, c.1\n"
+                     "  MUL r.1, a.2, 10\n"
+                     "  ADD r.2, r.1, b.2\n"
+                     "  RET r.2\n";
+  auto module = lowered(swap);
+  assert(printed(*module) == "Function main:\n"
+                             "entry:\n"
+                             "  MOV a, 1\n"
+                             "  MOV b, 2\n"
+                             "  MOV i, 0\n"
+                             "loop:\n"
+                             "  ADD i, i, 1\n"
+                             "  LT c, i, n\n"
+                             "  JMP_IF loop_from_loop, c\n"
+                             "  MUL r, a, 10\n"
+                             "  ADD r, r, b\n"
+                             "  RET r\n"
+                             "loop_from_loop:\n"
+                             "  MOV %swap, a\n"
+                             "  MOV a, b\n"
+                             "  MOV b, %swap\n"
+                             "  JMP loop\n");
+  auto original = optimix::ir::parseIR(swap);
+  for (int n : {0, 2, 3, 8})
+    assert(run(*module, n) == run(*original, n));
+
+  // Both incoming values coalesce into the PHI's variable, so the edge
+  // from entry needs no block after all.
+  module = lowered("Function main:\n"
+                   "entry:\n"
+                   "  ADD x.1, n, 5\n"
+                   "  JMP_IF join, n\n"
+                   "other:\n"
+                   "  MUL y.1, n, 7\n"
+                   "join:\n"
+                   "  PHI z.1, x.1, entry, y.1, other\n"
+                   "  RET z.1\n");
+  assert(printed(*module) == "Function main:\n"
+                             "entry:\n"
+                             "  ADD z, n, 5\n"
+                             "  JMP_IF join, n\n"
+                             "  JMP other\n"
+                             "other:\n"
+                             "  MUL z, n, 7\n"
+                             "join:\n"
+                             "  RET z\n");
+  assert(run(*module, 0) == 0 && run(*module, 2) == 7);
+
+  // The default pipeline ends out of SSA.
+  auto compiled = optimix::driver::compileSource(
+      "int main() {\n"
+      "  int i = 0; int s = 0;\n"
+      "  while (i < 10) { if (i > 4) { s = s + i; } i = i + 1; }\n"
+      "  return s;\n"
+      "}\n");
+  std::string text = printed(*compiled.module);
+  assert(text.find("PHI") == std::string::npos);
+  assert(text.find("ADD i, i, 1\n") != std::string::npos);
+  assert(runMain(*compiled.module) == "|35");
+
+  std::cout << "test_out_of_ssa passed!\n";
+}
+
+void test_loop_fusion() {
+  auto compiled = [](const std::string &body) {
+    return optimix::driver::compileSource("int main() {\n" + body + "}\n");
+  };
+
+  // A chain of three loops becomes one with a single IV; every access
+  // is then proven in bounds. k's final value is still returned.
+  auto module = compiled("  int a[40]; int b[40]; int i = 0;\n"
+                         "  while (i < 40) { a[i] = i * i; i = i + 1; }\n"
+                         "  int j = 0;\n"
+                         "  while (j < 40) { b[j] = a[j] + j; j = j + 1; }\n"
+                         "  int k = 0; int s = 0;\n"
+                         "  while (k < 40) { s = s + b[k]; k = k + 1; }\n"
+                         "  print(s);\n"
+                         "  return k;\n")
+                    .module;
+  std::string text = printed(*module);
+  assert(text.find("loop_L3") == std::string::npos);
+  assert(text.find("loop_L6") == std::string::npos);
+  assert(text.find("LOAD ") == std::string::npos);
+  assert(text.find("STORE ") == std::string::npos);
+  assert(runMain(*module) == "21320\n|40");
+
+  // The second loop reads an element the first writes one iteration
+  // later, so they stay apart.
+  module = compiled("  int a[41]; int i = 0;\n"
+                    "  while (i < 40) { a[i] = i; i = i + 1; }\n"
+                    "  int j = 0; int s = 0;\n"
+                    "  while (j < 40) { s = s + a[j + 1]; j = j + 1; }\n"
+                    "  return s;\n")
+               .module;
+  assert(printed(*module).find("loop_L3") != std::string::npos);
+  assert(runMain(*module) == "|780");
+
+  // Fusing would interleave the two loops' output.
+  module = compiled("  int i = 0;\n"
+                    "  while (i < 3) { print(i); i = i + 1; }\n"
+                    "  int j = 0;\n"
+                    "  while (j < 3) { print(j * 10); j = j + 1; }\n"
+                    "  return 0;\n")
+               .module;
+  assert(printed(*module).find("loop_L3") != std::string::npos);
+  assert(runMain(*module) == "0\n1\n2\n0\n10\n20\n|0");
+
+  std::cout << "test_loop_fusion passed!\n";
+}
+
+void test_loop_nest() {
+  auto optimized = [](const std::string &body) {
+    std::string source = "int main() {\n" + body + "}\n";
+    optimix::IRBuilder builder;
+    optimix::Lexer lexer(source);
+    optimix::Parser parser(lexer);
+    auto module = builder.generate(*parser.parseProgram());
+    optimix::ir::createPass("loop-nest")->run(*module->getFunction("main"));
+    return module;
+  };
+  auto compiled = [](const std::string &body) {
+    return optimix::driver::compileSource("int main() {\n" + body + "}\n")
+        .module;
+  };
+
+  // A column-major walk is interchanged: j now drives the outer header,
+  // and i restarts from the value it had before the nest.
+  std::string walk = "  int n = 40; int m[n][n]; int s = 0; int j = 0;\n"
+                     "  while (j < n) {\n"
+                     "    int i = 0;\n"
+                     "    while (i < n) { m[i][j] = i - j; s = s + m[i][j] * i;"
+                     " i = i + 1; }\n"
+                     "    j = j + 1;\n"
+                     "  }\n"
+                     "  print(s);\n"
+                     "  return m[39][1];\n";
+  std::string text = printed(*optimized(walk));
+  assert(text.find("MOV %loop_L0_first, j") != std::string::npos);
+  assert(text.find("LT t5, i, n") != std::string::npos);
+  assert(runMain(*compiled(walk)) == "213200\n|38");
+
+  // A transpose reads one array along columns whatever the order, so the
+  // inner loop is cut into strips; 70 is not a multiple of their size.
+  std::string transpose = "  int n = 70; int a[n][n]; int b[n][n];\n"
+                          "  a[69][3] = 5; a[1][68] = 9; int i = 0;\n"
+                          "  while (i < n) {\n"
+                          "    int j = 0;\n"
+                          "    while (j < n) { b[i][j] = a[j][i] + i; "
+                          "j = j + 1; }\n"
+                          "    i = i + 1;\n"
+                          "  }\n"
+                          "  return b[3][69] * 100 + b[68][1] + b[69][69];\n";
+  assert(printed(*optimized(transpose)).find("loop_L0_tile") !=
+         std::string::npos);
+  assert(runMain(*compiled(transpose)) == "|946");
+
+  // m[j][40] is m[j + 1][0], so iterations (40, j) and (0, j + 1) update
+  // the same element and must stay in order. Likewise when i is read
+  // after the nest.
+  for (const char *tail : {"  return m[1][0];\n", "  return i;\n"}) {
+    std::string shared = "  int m[81][40]; int i = 0;\n"
+                         "  while (i < 41) {\n"
+                         "    int j = 0;\n"
+                         "    while (j < 80) { m[j][i] = m[j][i] * 2 + i;"
+                         " j = j + 1; }\n"
+                         "    i = i + 1;\n"
+                         "  }\n";
+    std::string text = printed(*optimized(shared + tail));
+    assert(text.find("_first") == std::string::npos);
+  }
+
+  std::cout << "test_loop_nest passed!\n";
+}
+
+void test_parallelize() {
+  auto compiled = [](const std::string &body) {
+    return optimix::driver::compileSource("int main() {\n" + body + "}\n")
+        .module;
+  };
+  auto parallel = [](const optimix::ir::Module &module) {
+    return printed(module).find("PARFOR") != std::string::npos;
+  };
+  // More threads than this machine may have still split the work.
+  optimix::ThreadPool pool(4);
+
+  // Independent stores, a sum, a conditional sum and a difference, and a
+  // nest over the rows of a matrix: every loop runs in chunks, with the
+  // same results as on one thread.
+  std::string independent =
+      "  int n = 30000; int a[n]; int i = 0;\n"
+      "  while (i < n) { a[i] = i * 2 - i / 3; i = i + 1; }\n"
+      "  int s = 0; int big = 0; int d = 5; i = 0;\n"
+      "  while (i < n) {\n"
+      "    int x = a[i]; s = s + x; d = d - i;\n"
+      "    if (x > 40000) { big = big + 1; }\n"
+      "    i = i + 1;\n"
+      "  }\n"
+      "  print(s); print(big); print(d); print(i);\n"
+      "  int m[300][200]; int r = 0;\n"
+      "  while (r < 300) {\n"
+      "    int c = 0;\n"
+      "    while (c < 200) { m[r][c] = r - c; c = c + 1; }\n"
+      "    r = r + 1;\n"
+      "  }\n"
+      "  return m[299][0] + m[0][199] + m[150][20];\n";
+  auto module = compiled(independent);
+  std::string text = printed(*module);
+  assert(text.find("PARFOR loop_L3, i, %loop_L3_end, big, d, s") !=
+         std::string::npos);
+  assert(text.find("PARFOR loop_L8, r, %loop_L8_end\n") != std::string::npos);
+  std::string expected = "749985000\n5999\n-449984995\n30000\n|230";
+  assert(runMain(*module) == expected);
+  assert(runMain(*module, nullptr, &pool) == expected);
+
+  // A fault in any chunk stops the program.
+  auto faulting = compiled("  int a[30000]; int i = 0;\n"
+                           "  while (i < 30001) { a[i] = i * 2; i = i + 1; }\n"
+                           "  return a[5];\n");
+  assert(parallel(*faulting));
+  assert(runMain(*faulting, nullptr, &pool) == "|-1");
+
+  // An iteration that reads what an earlier one wrote, a scalar carried
+  // from one iteration to the next, a sum read inside the loop, and
+  // output all keep the loop sequential.
+  for (const char *loop :
+       {"a[i] = a[i - 1] + i;", "x = x * 3 + i; a[i] = x;",
+        "x = x + i; a[i] = x;", "print(i);"}) {
+    auto module = compiled("  int a[5000]; int x = 1; int i = 1;\n"
+                           "  while (i < 5000) { " +
+                           std::string(loop) +
+                           " i = i + 1; }\n"
+                           "  return a[4999] + x;\n");
+    assert(!parallel(*module));
+  }
+
+  std::cout << "test_parallelize passed!\n";
+}
+
+void test_memoize() {
+  auto memoized = [](const optimix::ir::Module &module,
+                     const std::string &name) {
+    const auto &entry = module.getFunction(name)->blocks.front();
+    return entry->instructions.front().op == optimix::ir::OpCode::MEMO;
+  };
+  // fib and the mutually recursive pair are pure; log prints, noisy calls
+  // it, and square does not recurse.
+  std::string source = "int fib(int n) {\n"
+                       "  if (n < 2) { return n; }\n"
+                       "  return fib(n - 1) + fib(n - 2);\n"
+                       "}\n"
+                       "int ping(int n) {\n"
+                       "  if (n < 1) { return 0; } return pong(n - 1) + 1;\n"
+                       "}\n"
+                       "int pong(int n) {\n"
+                       "  if (n < 1) { return 0; } return ping(n - 1) * 2;\n"
+                       "}\n"
+                       "int log(int n) {\n"
+                       "  print(n); if (n > 0) { log(n - 1); } return n;\n"
+                       "}\n"
+                       "int noisy(int n) {\n"
+                       "  if (n > 0) { return noisy(n - 1) + log(0); }\n"
+                       "  return 0;\n"
+                       "}\n"
+                       "int square(int x) { return x * x; }\n"
+                       "int main() {\n"
+                       "  return fib(25) + ping(9) + noisy(2) + square(3);\n"
+                       "}\n";
+  auto module = optimix::driver::compileSource(source).module;
+  assert(memoized(*module, "fib"));
+  assert(memoized(*module, "ping") && memoized(*module, "pong"));
+  assert(!memoized(*module, "log") && !memoized(*module, "noisy"));
+  assert(!memoized(*module, "square") && !memoized(*module, "main"));
+
+  // Same results; fib(25) goes from about 250000 calls to 26.
+  auto steps = [](const optimix::ir::Module &module, std::string &output) {
+    std::ostringstream out;
+    optimix::OutputBuffer buffer(out);
+    optimix::IRInterpreter interpreter;
+    interpreter.setOutput(&buffer);
+    interpreter.setModule(&module);
+    int result = interpreter.execute(*module.getFunction("main"));
+    buffer.flush();
+    output = out.str() + "|" + std::to_string(result);
+    return interpreter.executedCount();
+  };
+  std::string fast, slow;
+  uint64_t fastSteps = steps(*module, fast);
+  for (auto &func : module->functions) {
+    auto &entry = func->blocks.front()->instructions;
+    if (entry.front().op == optimix::ir::OpCode::MEMO)
+      entry.pop_front();
+  }
+  uint64_t slowSteps = steps(*module, slow);
+  assert(fast == slow && fast == "0\n0\n|75065");
+  assert(fastSteps < 1000 && slowSteps > 1000000);
+
+  std::cout << "test_memoize passed!\n";
+}
+
+void test_partial_evaluation() {
+  auto evaluated = [](const std::string &source, uint64_t steps) {
+    auto ast = optimix::driver::compileSource(source).ast;
+    auto module = optimix::IRBuilder().generate(*ast);
+    optimix::driver::defaultPipeline(nullptr, steps).run(*module);
+    return module;
+  };
+  std::string source = "int fib(int n) {\n"
+                       "  if (n < 2) { return n; }\n"
+                       "  return fib(n - 1) + fib(n - 2);\n"
+                       "}\n"
+                       "int show(int x) { print(x); return x * 2; }\n"
+                       "int bad(int i) { int a[3]; return a[i]; }\n"
+                       "int main() {\n"
+                       "  int t = fib(20) + show(21);\n"
+                       "  int i = 0;\n"
+                       "  while (i < 20000) { i = i + 1; }\n"
+                       "  if (t < 0) { t = bad(5); }\n"
+                       "  return t + i;\n"
+                       "}\n";
+  auto plain = optimix::driver::compileSource(source);
+  std::string expected = runMain(*plain.module);
+  assert(expected == "21\n|26807");
+
+  // Within the limit, main is replaced by what it prints and returns.
+  auto folded = evaluated(source, 100000);
+  const auto &main = *folded->getFunction("main");
+  assert(main.blocks.size() == 1);
+  assert(printed(*folded).find("Function main:\n"
+                               "entry:\n"
+                               "  PRINT 21\n"
+                               "  RET 26807\n") != std::string::npos);
+  assert(runMain(*folded) == expected);
+
+  // Past it, only the calls with constant arguments are; bad(5) faults and
+  // stays a call.
+  auto partial = evaluated(source, 10000);
+  std::string text = printed(*partial);
+  assert(partial->getFunction("main")->blocks.size() > 1);
+  assert(text.find("CALL t0, fib") == std::string::npos);
+  assert(text.find("PRINT 21\n") != std::string::npos);
+  assert(text.find(", bad, 5") != std::string::npos);
+  assert(runMain(*partial) == expected);
+
+  // The engine stops a run at the limit, calls included.
+  std::ostringstream out;
+  optimix::OutputBuffer buffer(out);
+  optimix::IRInterpreter interpreter;
+  interpreter.setOutput(&buffer);
+  interpreter.setModule(partial.get());
+  interpreter.setStepLimit(10000);
+  optimix::ExecState state;
+  bool stopped = false;
+  try {
+    interpreter.execute(*partial->getFunction("main"), state);
+  } catch (const std::runtime_error &e) {
+    stopped = std::string(e.what()) == "Step limit exceeded";
+  }
+  assert(stopped && interpreter.executedCount() == 10001);
+
+  // All runs share the budget: the first calls fold, the ones after it is
+  // used up stay calls.
+  std::string spins = "int spin(int n) {\n"
+                      "  int i = 0;\n"
+                      "  while (i < 1000) { i = i + 1; }\n"
+                      "  return n;\n"
+                      "}\n"
+                      "int main() {\n"
+                      "  int s = 0;\n";
+  for (int k = 0; k < 10; ++k)
+    spins += "  s = s + spin(" + std::to_string(k) + ");\n";
+  spins += "  return s;\n}\n";
+  auto shared = evaluated(spins, 20000);
+  text = printed(*shared);
+  assert(text.find(", spin, 0\n") == std::string::npos);
+  assert(text.find(", spin, 9\n") != std::string::npos);
+  assert(runMain(*shared) == "|45");
+
+  // Calls are evaluated as deep as they run: up to the engine's limit, and
+  // one past it is left to fail at run time.
+  const int limit = optimix::IRInterpreter::kMaxCallDepth;
+  auto deep = [&](int calls) {
+    return evaluated("int down(int n) {\n"
+                     "  if (n == 0) { return 0; }\n"
+                     "  return down(n - 1) + 1;\n"
+                     "}\n"
+                     "int main() { return down(" +
+                         std::to_string(calls - 1) + "); }\n",
+                     1000000);
+  };
+  assert(printed(*deep(limit)).find("RET " + std::to_string(limit - 1)) !=
+         std::string::npos);
+  assert(printed(*deep(limit + 1)).find(", down, " + std::to_string(limit)) !=
+         std::string::npos);
+
+  std::cout << "test_partial_evaluation passed!\n";
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+void test_parallel_pass_manager();
+void test_binary_ir_round_trip();
+void test_text_ir_round_trip();
+void test_profile_guided();
+void test_bounds_check();
+void test_array_arena();
+void test_scalar_replacement();
+void test_instcombine();
+void test_simplify_cfg();
+void test_if_conversion();
+void test_out_of_ssa();
+void test_loop_fusion();
+void test_loop_nest();
+void test_parallelize();
+void test_memoize();
+void test_partial_evaluation();
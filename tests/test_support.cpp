@@ -0,0 +1,280 @@
+#include "optimix/codegen/Interpreter.h"
+#include "optimix/driver/CompilationCache.h"
+#include "optimix/driver/Pipeline.h"
+#include "optimix/ir/IRBuilder.h"
+#include "optimix/lexer/Lexer.h"
+#include "optimix/parser/Parser.h"
+#include "optimix/support/AllocationHooks.h"
+#include "optimix/support/BufferPool.h"
+#include "optimix/support/Diagnostics.h"
+#include "optimix/support/OutputBuffer.h"
+#include "optimix/support/ThreadPool.h"
+#include "optimix/support/TimeReport.h"
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+void test_thread_pool() {
+  optimix::ThreadPool pool(4);
+  assert(pool.size() == 4);
+
+  // Tasks submitted from inside a task land on the worker's own deque and
+  // get stolen by the others.
+  std::atomic<int> sum{0};
+  for (int i = 0; i < 16; ++i) {
+    pool.submit([&pool, &sum, i] {
+      for (int j = 0; j < 100; ++j)
+        pool.submit([&sum, i, j] { sum += i * 100 + j; });
+    });
+  }
+  pool.wait();
+  assert(sum == 1599 * 1600 / 2);
+
+  // The first task exception surfaces from wait(); the pool stays usable.
+  pool.submit([] { throw std::runtime_error("boom"); });
+  bool thrown = false;
+  try {
+    pool.wait();
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+  assert(thrown);
+  pool.submit([&sum] { sum = 0; });
+  pool.wait();
+  assert(sum == 0);
+
+  std::cout << "test_thread_pool passed!\n";
+}
+
+void test_compilation_cache() {
+  namespace fs = std::filesystem;
+  using optimix::driver::CompilationCache;
+  fs::path dir = fs::temp_directory_path() / "optimix_test_cache";
+  fs::remove_all(dir);
+
+  std::string key = CompilationCache::makeKey("int main() {}", "ssa");
+  assert(key.size() == 32);
+  assert(key == CompilationCache::makeKey("int main() {}", "ssa"));
+  assert(key != CompilationCache::makeKey("int main() {}", "ssa,dce"));
+  assert(CompilationCache::makeKey("ab", "c") !=
+         CompilationCache::makeKey("a", "bc"));
+
+  CompilationCache cache(dir.string(), 1000);
+  assert(!cache.lookup(key));
+  cache.store(key, "artifact");
+  assert(cache.lookup(key) == std::string("artifact"));
+
+  // Concurrent writers of the same and different keys.
+  {
+    optimix::ThreadPool pool(4);
+    for (int i = 0; i < 32; ++i)
+      pool.submit([&cache, i] {
+        cache.store(CompilationCache::makeKey(std::to_string(i % 4), ""),
+                    std::string(100, 'a' + i % 4));
+      });
+    pool.wait();
+  }
+  for (int i = 0; i < 4; ++i) {
+    auto hit = cache.lookup(CompilationCache::makeKey(std::to_string(i), ""));
+    assert(!hit || *hit == std::string(100, 'a' + i));
+  }
+
+  // Exceeding the size bound evicts old entries.
+  for (int i = 0; i < 40; ++i)
+    cache.store(CompilationCache::makeKey("big" + std::to_string(i), ""),
+                std::string(100, 'x'));
+  uint64_t total = 0;
+  for (const auto &e : fs::directory_iterator(dir)) {
+    assert(e.path().extension() == ".entry"); // No temporaries left behind
+    total += e.file_size();
+  }
+  assert(total <= 1000);
+
+  // A new cache object measures the directory on its first store.
+  CompilationCache smaller(dir.string(), 500);
+  smaller.store(CompilationCache::makeKey("small", ""), "x");
+  total = 0;
+  for (const auto &e : fs::directory_iterator(dir))
+    total += e.file_size();
+  assert(total <= 500);
+
+  fs::remove_all(dir);
+  std::cout << "test_compilation_cache passed!\n";
+}
+
+void test_batch_output_paths() {
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / "optimix_test_batch";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "src");
+  for (const char *name : {"src/a.optx", "src/a.txt", "up.optx"})
+    std::ofstream(dir / name) << "int main() { return 1; }\n";
+
+  // '..' cannot leave the output directory; a.txt would overwrite a.oxir.
+  optimix::driver::BatchOptions options;
+  options.jobs = 2;
+  options.outputDir = (dir / "out").string();
+  std::string up = (fs::relative(dir / "src") / ".." / "up.optx").string();
+  std::string a = (dir / "src" / "a.optx").string();
+  std::string txt = (dir / "src" / "a.txt").string();
+  auto entries = optimix::driver::compileBatch({up, a, txt}, options);
+  assert(entries[0].error.empty() && entries[1].error.empty());
+  assert(entries[2].file == txt &&
+         entries[2].error.find("also written for " + a) != std::string::npos);
+  int written = 0;
+  for (const auto &e : fs::recursive_directory_iterator(dir))
+    if (e.path().extension() == ".oxir") {
+      assert(e.path().string().rfind(options.outputDir, 0) == 0);
+      ++written;
+    }
+  assert(written == 2);
+
+  fs::remove_all(dir);
+  std::cout << "test_batch_output_paths passed!\n";
+}
+
+// Allocations are counted because this file includes AllocationHooks.h.
+void test_time_report() {
+  optimix::TimeReport report;
+  {
+    optimix::TimeReport::Region region(&report, "allocate");
+    for (int i = 0; i < 100; ++i)
+      std::make_unique<int>(i);
+  }
+  { optimix::TimeReport::Region disabled(nullptr, "ignored"); }
+
+  // Passes are recorded on whichever thread runs them.
+  std::string source;
+  for (int f = 0; f < 4; ++f)
+    source += "int f" + std::to_string(f) + "() { return " +
+              std::to_string(f) + "; }\n";
+  optimix::Lexer lexer(source);
+  optimix::Parser parser(lexer);
+  auto module = optimix::IRBuilder().generate(*parser.parseProgram());
+  auto pipeline = optimix::driver::defaultPipeline();
+  pipeline.setTimeReport(&report);
+  optimix::ThreadPool pool(2);
+  pipeline.run(*module, &pool);
+
+  std::ostringstream table;
+  report.print(table);
+  std::string text = table.str();
+  assert(text.find("allocate") != std::string::npos);
+  assert(text.find("ignored") == std::string::npos);
+  // Four functions through one pass: a single row with four calls.
+  assert(text.find("4  ssa") != std::string::npos);
+
+  std::istringstream rows(text);
+  std::string row;
+  while (std::getline(rows, row)) {
+    if (row.find("allocate") == std::string::npos)
+      continue;
+    double wall, cpu;
+    unsigned long long allocations;
+    std::istringstream(row) >> wall >> cpu >> allocations;
+    assert(allocations >= 100);
+  }
+
+  std::ostringstream trace;
+  report.writeTrace(trace);
+  assert(trace.str().find("\"traceEvents\"") == 1);
+  assert(trace.str().find("\"name\": \"ssa\", \"cat\": \"pass\"") !=
+         std::string::npos);
+
+  std::cout << "test_time_report passed!\n";
+}
+
+void test_diagnostics() {
+  // Quiet by default: below WARNING nothing reaches the sink, and
+  // OPTIMIX_LOG does not even build the message.
+  optimix::CollectingSink collected;
+  optimix::DiagnosticSink *previous = optimix::setDiagnosticSink(&collected);
+  assert(optimix::logLevel() == optimix::LogLevel::WARNING);
+  int built = 0;
+  auto message = [&built](const char *text) {
+    ++built;
+    return std::string(text);
+  };
+  OPTIMIX_LOG(INFO, message("progress"));
+  OPTIMIX_LOG(WARNING, message("problem"));
+  assert(built == 1);
+  optimix::setLogLevel(optimix::LogLevel::INFO);
+  OPTIMIX_LOG(INFO, message("progress"));
+  optimix::setLogLevel(optimix::LogLevel::WARNING);
+  auto messages = collected.messages();
+  assert(messages.size() == 2);
+  assert(messages[0].level == optimix::LogLevel::WARNING);
+  assert(messages[1].text == "progress");
+  optimix::setDiagnosticSink(previous);
+
+  // The stream sink holds routine messages back until a flush, but passes
+  // problems through at once.
+  std::ostringstream stream;
+  {
+    optimix::StreamSink sink(stream);
+    sink.emit(optimix::LogLevel::INFO, "a");
+    assert(stream.str().empty());
+    sink.emit(optimix::LogLevel::ERROR, "b");
+    assert(stream.str() == "[INFO] a\n[ERROR] b\n");
+    sink.emit(optimix::LogLevel::DEBUG, "c");
+  }
+  assert(stream.str() == "[INFO] a\n[ERROR] b\n[DEBUG] c\n");
+
+  std::ostringstream text;
+  {
+    optimix::OutputBuffer out(text, 8);
+    out.writeLine(INT_MIN);
+    assert(text.str() == std::to_string(INT_MIN) + "\n"); // Filled up
+    out.writeLine(0);
+    out.write("x\n");
+    assert(text.str() == std::to_string(INT_MIN) + "\n");
+  }
+  assert(text.str() == std::to_string(INT_MIN) + "\n0\nx\n");
+
+  // Output stays in order when a loop moves to the IR engine mid-run.
+  optimix::Lexer lexer("int main() { int i = 0; print(7); "
+                       "while (i < 5) { print(i); i = i + 1; } "
+                       "print(8); return i; }");
+  optimix::Parser parser(lexer);
+  auto program = parser.parseProgram();
+  std::ostringstream printed;
+  optimix::OutputBuffer out(printed);
+  optimix::Interpreter interpreter;
+  interpreter.setTierUpThreshold(2);
+  interpreter.setOutput(&out);
+  assert(interpreter.execute(*program->getFunction("main")) == 5);
+  assert(interpreter.tierUpCount() == 1);
+  out.flush();
+  assert(printed.str() == "7\n0\n1\n2\n3\n4\n8\n");
+
+  std::cout << "test_diagnostics passed!\n";
+}
+
+void test_buffer_pool() {
+  optimix::BufferPool pool;
+  auto a = pool.acquire(100);
+  assert(a.size() == 100 && a.capacity() == 128);
+  a[5] = 7;
+  const int *data = a.data();
+  pool.release(std::move(a));
+
+  // Anything up to the class size gets the same buffer back, zeroed.
+  auto b = pool.acquire(120);
+  assert(b.data() == data && b.size() == 120 && b[5] == 0);
+  assert(pool.reused() == 1);
+  auto c = pool.acquire(100);
+  assert(c.data() != data && pool.reused() == 1);
+
+  // Small buffers are not pooled.
+  pool.release(std::vector<int>(3));
+  pool.acquire(3);
+  assert(pool.reused() == 1);
+
+  std::cout << "test_buffer_pool passed!\n";
+}
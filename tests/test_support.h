@@ -0,0 +1,8 @@
+#pragma once
+
+void test_thread_pool();
+void test_compilation_cache();
+void test_batch_output_paths();
+void test_time_report();
+void test_diagnostics();
+void test_buffer_pool();